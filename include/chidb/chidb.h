@@ -32,6 +32,7 @@ typedef struct chidb chidb;
 #define CHIDB_EMISMATCH (6)
 #define CHIDB_EIO (7)
 #define CHIDB_EMISUSE (8)
+#define CHIDB_EBUSY (12)
 
 #define CHIDB_ROW (100)
 #define CHIDB_DONE (101)
@@ -163,6 +164,32 @@ const char *chidb_column_name(chidb_stmt* stmt, int col);
 int chidb_column_int(chidb_stmt *stmt, int col);
 
 
+/* Returns the value of a column of integer type, with all its 64 bits
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - col: Column (columns are numbered from 0)
+ *
+ * Return
+ * - Integer value
+ */
+int64_t chidb_column_int64(chidb_stmt *stmt, int col);
+
+
+/* Returns the value of a column of floating point type (SQL_REAL)
+ *
+ * Integer columns are converted to floating point.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - col: Column (columns are numbered from 0)
+ *
+ * Return
+ * - Floating point value
+ */
+double chidb_column_double(chidb_stmt *stmt, int col);
+
+
 /* Returns the value of a column of string type
  *
  * Parameters
@@ -178,7 +205,82 @@ int chidb_column_int(chidb_stmt *stmt, int col);
 const char *chidb_column_text(chidb_stmt *stmt, int col);
 
 
+/* Returns whether a database is in autocommit mode
+ *
+ * A database is in autocommit mode (and every statement is committed
+ * when it finishes) unless a transaction has been started with BEGIN
+ * and has not yet been ended with COMMIT or ROLLBACK.
+ *
+ * Parameters
+ * - db: chidb database
+ *
+ * Return
+ * - Non-zero if the database is in autocommit mode, zero otherwise
+ */
+int chidb_get_autocommit(chidb *db);
+
+
+/* Enables or disables the shared cache
+ *
+ * While the shared cache is enabled, databases opened by chidb_open
+ * share a single pager and buffer pool with every other open database
+ * of this process on the same file, so they can be used concurrently
+ * from different threads (each database by one thread at a time).
+ * Readers never block, but only one database at a time can write:
+ * the others wait up to their busy timeout (see chidb_busy_timeout)
+ * and then fail with CHIDB_EBUSY. Databases that are already open
+ * are not affected. The shared cache is disabled by default.
+ *
+ * Parameters
+ * - enable: Non-zero to enable the shared cache, zero to disable it
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_enable_shared_cache(int enable);
+
+
+/* Sets the busy timeout of a database
+ *
+ * Statements that write to a database wait up to this many milliseconds
+ * for another database sharing the cache to finish its transaction
+ * before failing with CHIDB_EBUSY.
+ *
+ * Parameters
+ * - db: chidb database
+ * - ms: Timeout in milliseconds (0 to fail immediately)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Negative timeout
+ */
+int chidb_busy_timeout(chidb *db, int ms);
+
+
+/* Sets the number of threads that scan a table
+ *
+ * Read-only statements that scan a large table in a single loop (e.g.,
+ * a filtered SELECT, an aggregate, or a GROUP BY) split the table into
+ * key ranges and scan them with up to this many threads at the same
+ * time. The results are the same, and in the same order, as those of
+ * a sequential scan. Statements run inside an explicit transaction are
+ * always scanned sequentially.
+ *
+ * Parameters
+ * - db: chidb database
+ * - n: Number of threads (0 for one per processor, 1 to disable
+ *      parallel scans). The default is 0.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Negative number of threads
+ */
+int chidb_scan_threads(chidb *db, int n);
+
+
 /* Closes a chidb database
+ *
+ * A transaction that is still active is rolled back.
  *
  * Parameters
  * - db: chidb database
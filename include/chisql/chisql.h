@@ -12,12 +12,19 @@
 #define SQL_INTEGER_1BYTE (1)
 #define SQL_INTEGER_2BYTE (2)
 #define SQL_INTEGER_4BYTE (4)
+#define SQL_INTEGER_8BYTE (6)
+#define SQL_REAL (7)
 #define SQL_TEXT (13)
 
 #define STMT_CREATE (0)
 #define STMT_SELECT (1)
 #define STMT_INSERT (2)
 #define STMT_DELETE (3)
+#define STMT_ANALYZE (4)
+#define STMT_BEGIN (5)
+#define STMT_COMMIT (6)
+#define STMT_ROLLBACK (7)
+#define STMT_BLOOM (8)
 
 typedef struct chisql_statement
 {
@@ -29,6 +36,8 @@ typedef struct chisql_statement
         SRA_t    *select;
         Insert_t *insert;
         Delete_t *delete;
+        char     *analyze;  /* Table to analyze (NULL to analyze all tables) */
+        char     *bloom;    /* Table or index to create a Bloom filter for */
     } stmt;
 } chisql_statement_t;
 
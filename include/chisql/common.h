@@ -6,6 +6,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 enum query_type {
    SELECT_Q, CREATE_T_Q, CREATE_I_Q, INSERT_Q, DELETE_Q 
@@ -49,4 +50,20 @@ void indent_print(const char *format,...);
 
 void Query_free(Query_t *query);
 
+/* Memory allocation
+ *
+ * Parse trees are allocated with malloc, and freed with the *_free
+ * functions, unless the calling thread sets an allocator (e.g., the
+ * arena of the statement being prepared). Memory from an allocator is
+ * never freed by chisql_free; it is up to the allocator to release it. */
+typedef void *(*chisql_alloc_t)(void *ctx, size_t size);
+
+void chisql_set_allocator(chisql_alloc_t alloc, void *ctx);
+void chisql_get_allocator(chisql_alloc_t *alloc, void **ctx);
+void *chisql_malloc(size_t size);
+void *chisql_calloc(size_t n, size_t size);
+char *chisql_strdup(const char *s);
+char *chisql_strndup(const char *s, size_t n);
+void chisql_free(void *p);
+
 #endif
@@ -4,7 +4,7 @@
 #include "common.h"
 
 union LitVal {
-   int ival;
+   int64_t ival;
    double dval;
    char cval;
    char *strval;
@@ -16,7 +16,7 @@ typedef struct Literal_t {
    struct Literal_t *next; /* linked list */
 } Literal_t;
 
-Literal_t *litInt(int i);
+Literal_t *litInt(int64_t i);
 Literal_t *litDouble(double d);
 Literal_t *litChar(char c);
 Literal_t *litText(char *str);
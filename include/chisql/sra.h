@@ -83,6 +83,8 @@ typedef struct SRA_Project_s {
    int distinct;
    enum OrderBy asc_desc;
    Expression_t *group_by;
+   int limit;  /* -1 if there is no LIMIT clause */
+   int offset;
 } SRA_Project_t;
 
 typedef struct SRA_Select_s {
@@ -144,9 +146,10 @@ SRA_t *SRAUnion(SRA_t *sra1, SRA_t *sra2);
 SRA_t *SRAExcept(SRA_t *sra1, SRA_t *sra2);
 SRA_t *SRAIntersect(SRA_t *sra1, SRA_t *sra2);
 
-/* the folloing two only work on SRAProject */
+/* the folloing three only work on SRAProject */
 SRA_t *SRA_applyOption(SRA_t *sra, ProjectOption_t *option);
 SRA_t *SRA_makeDistinct(SRA_t *sra);
+SRA_t *SRA_applyLimit(SRA_t *sra, int limit, int offset);
 
 ProjectOption_t *OrderBy_make(Expression_t *expr, enum OrderBy o);
 ProjectOption_t *GroupBy_make(Expression_t *expr);
@@ -0,0 +1,633 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Aggregator (GROUP BY and aggregate functions)
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ *  The aggregator computes COUNT, SUM, AVG, MIN and MAX over groups of
+ *  records. In hash mode, every record is routed to its group through a
+ *  hash table keyed by the (packed) group key, so the input can arrive
+ *  in any order and each record costs O(1) expected time. In streaming
+ *  mode, the input must be ordered on the group key, and only the
+ *  current group is kept in memory.
+ *
+ *  Without a group key (nkeys == 0) all the records belong to a single
+ *  group, which is produced even if there were no records at all (so,
+ *  e.g., COUNT(*) over an empty table yields 0).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chidbInt.h"
+#include "aggregator.h"
+#include "record.h"
+#include "util.h"
+
+
+/* Makes an accumulator hold a copy of a value */
+static int __chidb_Aggregator_hold(AggAccum *acc, uint32_t type, const uint8_t *value)
+{
+    uint32_t len = chidb_DBRecord_typeLen(type);
+
+    if (len > acc->nbytes || acc->bytes == NULL)
+    {
+        uint8_t *bytes = realloc(acc->bytes, len ? len : 1);
+        if (bytes == NULL)
+            return CHIDB_ENOMEM;
+        acc->bytes = bytes;
+    }
+    if (len > 0)
+        memcpy(acc->bytes, value, len);
+    acc->nbytes = len;
+    acc->type = type;
+    acc->set = true;
+
+    return CHIDB_OK;
+}
+
+
+/* Allocates the (zeroed) state of a new group */
+static AggAccum *__chidb_Aggregator_newState(Aggregator *agg)
+{
+    return calloc(agg->nfuncs ? agg->nfuncs : 1, sizeof(AggAccum));
+}
+
+
+/* Frees the values held by a group's state, and zeroes it */
+static void __chidb_Aggregator_resetState(Aggregator *agg, AggAccum *state)
+{
+    for(int i = 0; i < agg->nfuncs; i++)
+        free(state[i].bytes);
+    memset(state, 0, agg->nfuncs * sizeof(AggAccum));
+}
+
+
+/* Feeds a single value into an aggregate function */
+static int __chidb_Aggregator_accumulate(AggAccum *acc, char func, uint32_t type, const uint8_t *value)
+{
+    int cmp;
+
+    switch(func)
+    {
+        case AGG_COUNT_STAR:
+            acc->count++;
+            break;
+
+        case AGG_COUNT:
+            if (type != SQL_NULL)
+                acc->count++;
+            break;
+
+        case AGG_SUM:
+        case AGG_AVG:
+            /* Only integers are added up */
+            if (type != SQL_NULL && type <= SQL_INTEGER_8BYTE)
+            {
+                acc->sum += chidb_DBRecord_rawInt(value, type);
+                acc->count++;
+            }
+            break;
+
+        case AGG_MIN:
+        case AGG_MAX:
+            if (type == SQL_NULL)
+                break;
+            if (acc->set)
+            {
+                cmp = chidb_DBRecord_compareRawValue(type, value, acc->type, acc->bytes);
+                if ((func == AGG_MIN && cmp >= 0) || (func == AGG_MAX && cmp <= 0))
+                    break;
+            }
+            return __chidb_Aggregator_hold(acc, type, value);
+
+        case AGG_VALUE:
+            if (!acc->set)
+                return __chidb_Aggregator_hold(acc, type, value);
+            break;
+
+        default:
+            return CHIDB_EMISUSE;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Builds the packed key of a record (its first nkeys fields) in the
+ * aggregator's key buffer. On return, hpos and dpos point to the first
+ * non-key field of the record. */
+static int __chidb_Aggregator_buildKey(Aggregator *agg, const uint8_t *record,
+                                       uint32_t *hpos, uint32_t *dpos, uint32_t *nkey)
+{
+    uint32_t type, len;
+    const uint8_t *value;
+
+    *nkey = 0;
+    for(int i = 0; i < agg->nkeys; i++)
+    {
+        if (chidb_DBRecord_nextRawField(record, hpos, dpos, &type, &value) != CHIDB_OK)
+        {
+            type = SQL_NULL;
+            value = NULL;
+        }
+        len = chidb_DBRecord_typeLen(type);
+
+        if (*nkey + 4 + 8 + len > agg->keybuf_size)
+        {
+            uint32_t size = (*nkey + 4 + 8 + len) * 2;
+            uint8_t *buf = realloc(agg->keybuf, size);
+            if (buf == NULL)
+                return CHIDB_ENOMEM;
+            agg->keybuf = buf;
+            agg->keybuf_size = size;
+        }
+
+        /* Integers are always widened, so equal values get equal keys */
+        if (type != SQL_NULL && type <= SQL_INTEGER_8BYTE)
+        {
+            put4byte(&agg->keybuf[*nkey], SQL_INTEGER_8BYTE);
+            put8byte(&agg->keybuf[*nkey + 4], (uint64_t) chidb_DBRecord_rawInt(value, type));
+            len = 8;
+        }
+        else
+        {
+            put4byte(&agg->keybuf[*nkey], type);
+            if (len > 0)
+                memcpy(&agg->keybuf[*nkey + 4], value, len);
+        }
+        *nkey += 4 + len;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Produces the output record of a group */
+static int __chidb_Aggregator_emit(Aggregator *agg, AggAccum *state)
+{
+    uint32_t types[AGG_MAX_FUNCS];
+    const uint8_t *values[AGG_MAX_FUNCS];
+    uint8_t ints[AGG_MAX_FUNCS][8];
+    uint32_t hsize = 1, dsize = 0, hpos, dpos;
+    uint8_t *out;
+
+    for(int i = 0; i < agg->nfuncs; i++)
+    {
+        AggAccum *acc = &state[i];
+        int64_t v = 0;
+
+        types[i] = SQL_NULL;
+        values[i] = NULL;
+
+        switch(agg->funcs[i])
+        {
+            case AGG_COUNT_STAR:
+            case AGG_COUNT:
+                types[i] = SQL_INTEGER_4BYTE;
+                v = acc->count;
+                break;
+            case AGG_SUM:
+                if (acc->count > 0)
+                {
+                    types[i] = SQL_INTEGER_4BYTE;
+                    v = acc->sum;
+                }
+                break;
+            case AGG_AVG:
+                if (acc->count > 0)
+                {
+                    types[i] = SQL_INTEGER_4BYTE;
+                    v = acc->sum / acc->count;
+                }
+                break;
+            default:
+                if (acc->set)
+                {
+                    types[i] = acc->type;
+                    values[i] = acc->bytes;
+                }
+                break;
+        }
+
+        if (types[i] == SQL_INTEGER_4BYTE && values[i] == NULL)
+        {
+            if (v >= INT32_MIN && v <= INT32_MAX)
+                put4byte(ints[i], (uint32_t) v);
+            else
+            {
+                types[i] = SQL_INTEGER_8BYTE;
+                put8byte(ints[i], (uint64_t) v);
+            }
+            values[i] = ints[i];
+        }
+
+        hsize += varintLen32(types[i]);
+        dsize += chidb_DBRecord_typeLen(types[i]);
+    }
+
+    out = realloc(agg->out, hsize + dsize);
+    if (out == NULL)
+        return CHIDB_ENOMEM;
+    agg->out = out;
+    agg->nout = hsize + dsize;
+
+    out[0] = hsize;
+    hpos = 1;
+    dpos = hsize;
+    for(int i = 0; i < agg->nfuncs; i++)
+    {
+        uint32_t len = chidb_DBRecord_typeLen(types[i]);
+
+        hpos += putVarint32(&out[hpos], types[i]);
+
+        if (len > 0)
+            memcpy(&out[dpos], values[i], len);
+        dpos += len;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Create a new aggregator
+ *
+ * Parameters
+ * - agg: Out parameter used to return the aggregator
+ * - nkeys: Number of leading record fields that make up the group key
+ * - funcs: Aggregate functions, one character per function (see
+ *          aggregator.h). The i-th function is applied to the i-th
+ *          field after the group key.
+ * - streaming: If true, the input will be ordered on the group key
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Too many functions, or an unknown function
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Aggregator_open(Aggregator **agg, uint8_t nkeys, const char *funcs, bool streaming)
+{
+    size_t nfuncs = funcs == NULL ? 0 : strlen(funcs);
+    int rc;
+
+    if (nfuncs > AGG_MAX_FUNCS || strspn(funcs == NULL ? "" : funcs, "ncsamxv") != nfuncs)
+        return CHIDB_EMISUSE;
+
+    *agg = calloc(1, sizeof(Aggregator));
+    if (*agg == NULL)
+        return CHIDB_ENOMEM;
+
+    (*agg)->nkeys = nkeys;
+    (*agg)->nfuncs = nfuncs;
+    memcpy((*agg)->funcs, funcs, nfuncs);
+    (*agg)->streaming = streaming;
+
+    if (streaming)
+    {
+        (*agg)->state = __chidb_Aggregator_newState(*agg);
+        if ((*agg)->state == NULL)
+        {
+            free(*agg);
+            return CHIDB_ENOMEM;
+        }
+    }
+    else if ((rc = chidb_HashTable_open(&(*agg)->groups)) != CHIDB_OK)
+    {
+        free(*agg);
+        return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Add a record to an aggregator
+ *
+ * In streaming mode, a record with a different group key than the
+ * previous one completes the previous group, which becomes the
+ * aggregator's current output record.
+ *
+ * Parameters
+ * - agg: Aggregator
+ * - record: Packed record (group key followed by function arguments)
+ * - emitted: Out parameter. Set to true if a group was completed.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The aggregator has already been finalized
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Aggregator_step(Aggregator *agg, const uint8_t *record, bool *emitted)
+{
+    uint32_t hpos = 1, dpos = record[0], nkey;
+    AggAccum *state;
+    int rc;
+
+    *emitted = false;
+
+    if (agg->finalized)
+        return CHIDB_EMISUSE;
+
+    if ((rc = __chidb_Aggregator_buildKey(agg, record, &hpos, &dpos, &nkey)) != CHIDB_OK)
+        return rc;
+
+    if (agg->streaming)
+    {
+        if (agg->in_group && (nkey != agg->nkey || memcmp(agg->key, agg->keybuf, nkey)))
+        {
+            if ((rc = __chidb_Aggregator_emit(agg, agg->state)) != CHIDB_OK)
+                return rc;
+            __chidb_Aggregator_resetState(agg, agg->state);
+            agg->in_group = false;
+            *emitted = true;
+        }
+
+        if (!agg->in_group)
+        {
+            uint8_t *key = realloc(agg->key, nkey ? nkey : 1);
+            if (key == NULL)
+                return CHIDB_ENOMEM;
+            memcpy(key, agg->keybuf, nkey);
+            agg->key = key;
+            agg->nkey = nkey;
+            agg->in_group = true;
+        }
+
+        state = agg->state;
+    }
+    else if (chidb_HashTable_find(agg->groups, agg->keybuf, nkey, (void **) &state) != CHIDB_OK)
+    {
+        if ((state = __chidb_Aggregator_newState(agg)) == NULL)
+            return CHIDB_ENOMEM;
+        if ((rc = chidb_HashTable_insert(agg->groups, agg->keybuf, nkey, state)) != CHIDB_OK)
+        {
+            free(state);
+            return rc;
+        }
+    }
+
+    for(int i = 0; i < agg->nfuncs; i++)
+    {
+        uint32_t type;
+        const uint8_t *value;
+
+        if (chidb_DBRecord_nextRawField(record, &hpos, &dpos, &type, &value) != CHIDB_OK)
+        {
+            type = SQL_NULL;
+            value = NULL;
+        }
+
+        if ((rc = __chidb_Aggregator_accumulate(&state[i], agg->funcs[i], type, value)) != CHIDB_OK)
+            return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Merge the groups of another aggregator into an aggregator
+ *
+ * Used by parallel scans, where each worker aggregates part of the
+ * input with an aggregator of its own. Groups that are new to agg are
+ * added after its existing groups, so merging the aggregators of the
+ * parts of the input in order produces the groups in the same order as
+ * aggregating the whole input at once.
+ *
+ * Parameters
+ * - agg: Aggregator
+ * - part: Aggregator with the same group key and functions as agg. It
+ *         is left unchanged.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Either aggregator is finalized or in streaming mode,
+ *                  or they do not have the same functions
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Aggregator_merge(Aggregator *agg, Aggregator *part)
+{
+    HashEntry *e;
+    AggAccum *state, *other;
+    int rc;
+
+    if (agg->finalized || part->finalized || agg->streaming || part->streaming ||
+        agg->nkeys != part->nkeys || agg->nfuncs != part->nfuncs ||
+        memcmp(agg->funcs, part->funcs, agg->nfuncs))
+        return CHIDB_EMISUSE;
+
+    for(uint32_t i = 0; chidb_HashTable_get(part->groups, i, &e) == CHIDB_OK; i++)
+    {
+        other = e->value;
+
+        if (chidb_HashTable_find(agg->groups, e->key, e->nkey, (void **) &state) != CHIDB_OK)
+        {
+            if ((state = __chidb_Aggregator_newState(agg)) == NULL)
+                return CHIDB_ENOMEM;
+            if ((rc = chidb_HashTable_insert(agg->groups, e->key, e->nkey, state)) != CHIDB_OK)
+            {
+                free(state);
+                return rc;
+            }
+        }
+
+        for(int j = 0; j < agg->nfuncs; j++)
+        {
+            switch(agg->funcs[j])
+            {
+                case AGG_COUNT_STAR:
+                case AGG_COUNT:
+                    state[j].count += other[j].count;
+                    break;
+
+                case AGG_SUM:
+                case AGG_AVG:
+                    state[j].sum += other[j].sum;
+                    state[j].count += other[j].count;
+                    break;
+
+                default:
+                    /* MIN, MAX and "value" fold the held value in as
+                     * if it were one more input value */
+                    if (other[j].set &&
+                        (rc = __chidb_Aggregator_accumulate(&state[j], agg->funcs[j],
+                                                            other[j].type, other[j].bytes)) != CHIDB_OK)
+                        return rc;
+                    break;
+            }
+        }
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Finish aggregating, and position the aggregator on the first group
+ *
+ * Parameters
+ * - agg: Aggregator
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: There are no groups
+ * - CHIDB_EMISUSE: The aggregator has already been finalized
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Aggregator_final(Aggregator *agg)
+{
+    HashEntry *e;
+    int rc;
+
+    if (agg->finalized)
+        return CHIDB_EMISUSE;
+    agg->finalized = true;
+
+    if (agg->streaming)
+    {
+        if (!agg->in_group && agg->nkeys > 0)
+            return CHIDB_EEMPTY;
+        agg->in_group = false;
+        return __chidb_Aggregator_emit(agg, agg->state);
+    }
+
+    /* Without a group key, there is always (exactly) one group */
+    if (chidb_HashTable_size(agg->groups) == 0 && agg->nkeys == 0)
+    {
+        AggAccum *state = __chidb_Aggregator_newState(agg);
+        if (state == NULL)
+            return CHIDB_ENOMEM;
+        if ((rc = chidb_HashTable_insert(agg->groups, agg->keybuf, 0, state)) != CHIDB_OK)
+        {
+            free(state);
+            return rc;
+        }
+    }
+
+    if (chidb_HashTable_get(agg->groups, 0, &e) != CHIDB_OK)
+        return CHIDB_EEMPTY;
+
+    agg->pos = 0;
+    return __chidb_Aggregator_emit(agg, e->value);
+}
+
+
+/* Advance the aggregator to the next group
+ *
+ * Parameters
+ * - agg: Aggregator
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_DONE: There are no more groups
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Aggregator_next(Aggregator *agg)
+{
+    HashEntry *e;
+
+    if (agg->streaming || !agg->finalized)
+        return CHIDB_DONE;
+
+    if (chidb_HashTable_get(agg->groups, agg->pos + 1, &e) != CHIDB_OK)
+        return CHIDB_DONE;
+
+    agg->pos++;
+    return __chidb_Aggregator_emit(agg, e->value);
+}
+
+
+/* Get the output record of the current group
+ *
+ * Parameters
+ * - agg: Aggregator
+ * - bytes: Out parameter used to return a pointer to the packed record.
+ *          The record is owned by the aggregator.
+ * - nbytes: Out parameter used to return the size of the record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: No group has been produced yet
+ */
+int chidb_Aggregator_current(Aggregator *agg, uint8_t **bytes, uint32_t *nbytes)
+{
+    if (agg->out == NULL)
+        return CHIDB_EMISUSE;
+
+    *bytes = agg->out;
+    *nbytes = agg->nout;
+
+    return CHIDB_OK;
+}
+
+
+/* Destroy an aggregator
+ *
+ * Parameters
+ * - agg: Aggregator
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Aggregator_close(Aggregator *agg)
+{
+    HashEntry *e;
+
+    if (agg == NULL)
+        return CHIDB_OK;
+
+    if (agg->groups != NULL)
+    {
+        for(uint32_t i = 0; chidb_HashTable_get(agg->groups, i, &e) == CHIDB_OK; i++)
+        {
+            __chidb_Aggregator_resetState(agg, e->value);
+            free(e->value);
+        }
+        chidb_HashTable_close(agg->groups);
+    }
+
+    if (agg->state != NULL)
+    {
+        __chidb_Aggregator_resetState(agg, agg->state);
+        free(agg->state);
+    }
+
+    free(agg->key);
+    free(agg->keybuf);
+    free(agg->out);
+    free(agg);
+
+    return CHIDB_OK;
+}
@@ -0,0 +1,120 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Aggregator (GROUP BY and aggregate functions) -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef AGGREGATOR_H_
+#define AGGREGATOR_H_
+
+#include "chidbInt.h"
+#include "hash.h"
+
+/* Maximum number of aggregate functions (i.e., output columns). This
+ * keeps the header of an output record within a single byte. */
+#define AGG_MAX_FUNCS (63)
+
+/* Aggregate functions, as specified in the AggOpen instruction */
+#define AGG_COUNT_STAR  'n'     /* COUNT(*) */
+#define AGG_COUNT       'c'     /* COUNT(x): number of non-NULL values */
+#define AGG_SUM         's'     /* SUM(x) */
+#define AGG_AVG         'a'     /* AVG(x) (integer average) */
+#define AGG_MIN         'm'     /* MIN(x) */
+#define AGG_MAX         'x'     /* MAX(x) */
+#define AGG_VALUE       'v'     /* Value of x in the first row of the group */
+
+/* Running state of a single aggregate function in a single group */
+typedef struct AggAccum
+{
+    int64_t count;      /* Number of rows (or non-NULL values) */
+    int64_t sum;
+
+    /* Value held by MIN, MAX and "value" (in record format) */
+    bool set;
+    uint32_t type;
+    uint8_t *bytes;
+    uint32_t nbytes;
+} AggAccum;
+
+/* The aggregator takes records whose first nkeys fields are the group
+ * key and whose remaining fields are the arguments of the aggregate
+ * functions (one per function), and produces one record per group
+ * with the result of each function.
+ *
+ * By default, groups are kept in a hash table (keyed by the group key)
+ * and are produced once all the input has been seen. If the input is
+ * known to be ordered on the group key, the aggregator can instead
+ * work in "streaming" mode: only the current group is kept, and it is
+ * produced as soon as a record with a different key arrives.
+ */
+struct Aggregator
+{
+    uint8_t nkeys;
+    uint8_t nfuncs;
+    char funcs[AGG_MAX_FUNCS];
+    bool streaming;
+
+    /* Hash mode: group key -> array of nfuncs AggAccum's */
+    HashTable *groups;
+
+    /* Streaming mode: key and state of the group being accumulated */
+    uint8_t *key;
+    uint32_t nkey;
+    AggAccum *state;
+    bool in_group;
+
+    /* Scratch buffer where the key of each input record is built */
+    uint8_t *keybuf;
+    uint32_t keybuf_size;
+
+    /* Output: the record for the current group */
+    bool finalized;
+    uint32_t pos;
+    uint8_t *out;
+    uint32_t nout;
+};
+typedef struct Aggregator Aggregator;
+
+int chidb_Aggregator_open(Aggregator **agg, uint8_t nkeys, const char *funcs, bool streaming);
+int chidb_Aggregator_step(Aggregator *agg, const uint8_t *record, bool *emitted);
+int chidb_Aggregator_merge(Aggregator *agg, Aggregator *part);
+int chidb_Aggregator_final(Aggregator *agg);
+int chidb_Aggregator_next(Aggregator *agg);
+int chidb_Aggregator_current(Aggregator *agg, uint8_t **bytes, uint32_t *nbytes);
+int chidb_Aggregator_close(Aggregator *agg);
+
+#endif /*AGGREGATOR_H_*/
@@ -46,6 +46,8 @@
 #include "dbm.h"
 #include "btree.h"
 #include "record.h"
+#include "stats.h"
+#include "bloom.h"
 #include "util.h"
 #include "../simclist/simclist.h"
 
@@ -94,9 +96,19 @@ int load_schema(chidb *db, npage_t nroot)
 			chidb_DBRecord_getString(dbr, 4, &sql);
 
 			chisql_statement_t *stmt;
+			chisql_alloc_t alloc;
+			void *ctx;
+
+			/* Schemas outlive the statement that may be being prepared,
+			 * so they are not allocated from its arena */
+			chisql_get_allocator(&alloc, &ctx);
+			chisql_set_allocator(NULL, NULL);
 			chisql_parser(sql, &stmt);
+			chisql_set_allocator(alloc, ctx);
 
 			schema->stmt = stmt;
+			schema->stat = NULL;
+			schema->bloom = 0;
 
 			list_append(&db->schemas, schema);
 
@@ -118,6 +130,16 @@ int load_schema(chidb *db, npage_t nroot)
 	return CHIDB_OK;
 }
 
+/* Whether chidb_open shares pagers (see chidb_enable_shared_cache) */
+static int shared_cache = 0;
+
+int chidb_enable_shared_cache(int enable)
+{
+	shared_cache = enable;
+
+	return CHIDB_OK;
+}
+
 int chidb_open(const char *file, chidb **db)
 {
 	int rc;
@@ -125,8 +147,16 @@ int chidb_open(const char *file, chidb **db)
 	if (*db == NULL)
 		return CHIDB_ENOMEM;
 
-	if (rc = chidb_Btree_open(file, *db, &(*db)->bt))
+	(*db)->busy_timeout = DEFAULT_BUSY_TIMEOUT;
+	(*db)->scan_threads = DEFAULT_SCAN_THREADS;
+
+	if (shared_cache)
+		rc = chidb_Btree_openShared(file, *db, &(*db)->bt);
+	else
+		rc = chidb_Btree_open(file, *db, &(*db)->bt);
+	if (rc)
 		return rc;
+	(*db)->schema_cookie = chidb_Pager_getSchemaCookie((*db)->bt->pager);
 
 	// initialize list of schema structs
 	list_init(&(*db)->schemas);
@@ -134,14 +164,48 @@ int chidb_open(const char *file, chidb **db)
 	if(rc = load_schema(*db, 1))
 		return rc;
 
+	if(rc = chidb_Stats_load(*db))
+		return rc;
+
+	if(rc = chidb_Bloom_load(*db))
+		return rc;
+
 	(*db)->need_refresh = 0;
+	(*db)->autocommit = 1;
 	//print_schema_list((*db)->schemas);
 
 	return CHIDB_OK;
 }
 
+int chidb_busy_timeout(chidb *db, int ms)
+{
+    if (ms < 0)
+        return CHIDB_EMISUSE;
+    db->busy_timeout = ms;
+
+    return CHIDB_OK;
+}
+
+int chidb_scan_threads(chidb *db, int n)
+{
+    if (n < 0)
+        return CHIDB_EMISUSE;
+    db->scan_threads = n;
+
+    return CHIDB_OK;
+}
+
 int chidb_close(chidb *db)
 {
+    /* A transaction that was never committed is rolled back */
+    if (db->bt->shared_writer)
+        chidb_Btree_endSharedWrite(db->bt, true);
+    else if (db->bt->writer)
+    {
+        chidb_Pager_rollback(db->bt->pager);
+        chidb_Btree_endWrite(db->bt);
+    }
+
     chidb_Btree_close(db->bt);
 
     while(!list_empty(&db->schemas))
@@ -151,6 +215,7 @@ int chidb_close(chidb *db)
     	free(next->type);
     	free(next->name);
     	free(next->assoc);
+    	free(next->stat);
     	free(next);
     }
 
@@ -161,12 +226,20 @@ int chidb_close(chidb *db)
     return CHIDB_OK;
 }
 
+/* Allocates parse trees from a statement's arena */
+static void *__chidb_prepare_alloc(void *arena, size_t size)
+{
+    return chidb_Arena_alloc((Arena *) arena, size);
+}
+
 int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
 {
     int rc;
     chisql_statement_t *sql_stmt, *sql_stmt_opt;
 
     *stmt = malloc(sizeof(chidb_stmt));
+    if(*stmt == NULL)
+        return CHIDB_ENOMEM;
 
     rc = chidb_stmt_init(*stmt, db);
 
@@ -176,28 +249,31 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
         return rc;
     }
 
+    /* The parse tree, the optimized plan, and everything the code
+     * generator allocates live as long as the statement, and are freed
+     * all at once by chidb_finalize */
+    chisql_set_allocator(__chidb_prepare_alloc, &(*stmt)->arena);
+
     rc = chisql_parser(sql, &sql_stmt);
 
-    if(rc != CHIDB_OK)
+    if(rc == CHIDB_OK)
+        rc = chidb_stmt_optimize((*stmt)->db, sql_stmt, &sql_stmt_opt);
+
+    if(rc == CHIDB_OK)
     {
-        free(*stmt);
-        return rc;
+        rc = chidb_stmt_codegen(*stmt, sql_stmt_opt);
+        (*stmt)->explain = sql_stmt->explain;
     }
 
-    rc = chidb_stmt_optimize((*stmt)->db, sql_stmt, &sql_stmt_opt);
+    chisql_set_allocator(NULL, NULL);
 
     if(rc != CHIDB_OK)
     {
+        chidb_stmt_free(*stmt);
         free(*stmt);
-        return rc;
+        *stmt = NULL;
     }
 
-    rc = chidb_stmt_codegen(*stmt, sql_stmt_opt);
-
-    free(sql_stmt_opt);
-
-    (*stmt)->explain = sql_stmt->explain;
-
     return rc;
 }
 
@@ -219,7 +295,11 @@ int chidb_step(chidb_stmt *stmt)
 
 int chidb_finalize(chidb_stmt *stmt)
 {
-    return chidb_stmt_free(stmt);
+    int rc = chidb_stmt_free(stmt);
+
+    free(stmt);
+
+    return rc;
 }
 
 int chidb_column_count(chidb_stmt *stmt)
@@ -272,11 +352,14 @@ int chidb_column_type(chidb_stmt *stmt, int col)
 			case REG_NULL:
 				return SQL_NULL;
 				break;
-			case REG_INT32:
-				return SQL_INTEGER_4BYTE;
+			case REG_INTEGER:
+				return DBM_REG_INT32(r) ? SQL_INTEGER_4BYTE : SQL_INTEGER_8BYTE;
+				break;
+			case REG_REAL:
+				return SQL_REAL;
 				break;
 			case REG_STRING:
-				return 2 * strlen(r->value.s) + SQL_TEXT;
+				return 2 * r->len + SQL_TEXT;
 				break;
 			default:
 				return SQL_NOTVALID;
@@ -351,7 +434,7 @@ int chidb_column_int(chidb_stmt *stmt, int col)
 		{
 			chidb_dbm_register_t *r = &stmt->reg[stmt->startRR + col];
 
-			if(r->type != REG_INT32)
+			if(r->type != REG_INTEGER)
 			{
 				/* Undefined behaviour */
 				return 0;
@@ -364,6 +447,46 @@ int chidb_column_int(chidb_stmt *stmt, int col)
 	}
 }
 
+int64_t chidb_column_int64(chidb_stmt *stmt, int col)
+{
+	if(stmt->explain || col < 0 || col >= stmt->nCols)
+		return chidb_column_int(stmt, col);
+	else
+	{
+		chidb_dbm_register_t *r = &stmt->reg[stmt->startRR + col];
+
+		if(r->type != REG_INTEGER)
+		{
+			/* Undefined behaviour */
+			return 0;
+		}
+		else
+		{
+			return r->value.i;
+		}
+	}
+}
+
+double chidb_column_double(chidb_stmt *stmt, int col)
+{
+	if(stmt->explain || col < 0 || col >= stmt->nCols)
+		return chidb_column_int(stmt, col);
+	else
+	{
+		chidb_dbm_register_t *r = &stmt->reg[stmt->startRR + col];
+
+		if(r->type == REG_REAL)
+			return r->value.r;
+		else if(r->type == REG_INTEGER)
+			return (double) r->value.i;
+		else
+		{
+			/* Undefined behaviour */
+			return 0;
+		}
+	}
+}
+
 const char *chidb_column_text(chidb_stmt *stmt, int col)
 {
 	if(stmt->explain)
@@ -406,8 +529,14 @@ const char *chidb_column_text(chidb_stmt *stmt, int col)
 			}
 			else
 			{
-				return r->value.s;
+				/* Strings borrowed from a cursor are not NUL-terminated */
+				return chidb_dbm_reg_text(stmt, r);
 			}
 		}
 	}
 }
+
+int chidb_get_autocommit(chidb *db)
+{
+	return db->autocommit;
+}
@@ -0,0 +1,208 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Arena (bump-pointer) allocator
+ *
+ */
+
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ *  Much of the memory a statement needs (its instructions, the parse
+ *  tree it was compiled from, the records it builds) has the same
+ *  lifetime as the statement itself, or as a single instruction. An
+ *  arena allocates that memory from large chunks, and releases it all
+ *  at once, instead of going through malloc/free for every object.
+ *
+ *  Memory allocated from an arena can't be freed on its own, and it is
+ *  not safe to share an arena between threads.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chidbInt.h"
+#include "arena.h"
+
+
+/* Initializes an empty arena
+ *
+ * An empty arena does not hold any memory; chunks are allocated
+ * the first time they are needed.
+ *
+ * Parameters
+ * - a: Arena
+ *
+ * Return
+ * - Nothing
+ */
+void chidb_Arena_init(Arena *a)
+{
+    a->head = NULL;
+    a->cur = NULL;
+}
+
+
+/* Allocates a chunk that can hold at least size bytes, and appends it
+ * to the arena's chunk list */
+static ArenaChunk *__chidb_Arena_newChunk(Arena *a, size_t size)
+{
+    ArenaChunk *chunk, *last;
+
+    if (size < ARENA_CHUNK_SIZE)
+        size = ARENA_CHUNK_SIZE;
+
+    if ((chunk = malloc(sizeof(ArenaChunk) + size)) == NULL)
+        return NULL;
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->data = (uint8_t *) (chunk + 1);
+
+    if (a->head == NULL)
+        a->head = chunk;
+    else
+    {
+        for (last = a->cur; last->next; last = last->next)
+            ;
+        last->next = chunk;
+    }
+
+    return chunk;
+}
+
+
+/* Allocates memory from an arena
+ *
+ * The memory is aligned like memory returned by malloc (for the types
+ * chidb uses), and stays valid until the arena is reset or freed.
+ *
+ * Parameters
+ * - a: Arena
+ * - size: Number of bytes
+ *
+ * Return
+ * - Pointer to the memory, or NULL if it could not be allocated.
+ */
+void *chidb_Arena_alloc(Arena *a, size_t size)
+{
+    ArenaChunk *chunk = a->cur;
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (size == 0)
+        size = ARENA_ALIGN;
+
+    /* Chunks after the current one are left over from before the
+     * arena was last reset, and are reused before allocating more */
+    while (chunk && chunk->used + size > chunk->size)
+    {
+        chunk = chunk->next;
+        if (chunk)
+            chunk->used = 0;
+    }
+
+    if (chunk == NULL && (chunk = __chidb_Arena_newChunk(a, size)) == NULL)
+        return NULL;
+
+    a->cur = chunk;
+    p = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return p;
+}
+
+
+/* Copies a NUL-terminated string into an arena
+ *
+ * Parameters
+ * - a: Arena
+ * - s: String
+ *
+ * Return
+ * - Pointer to the copy, or NULL if it could not be allocated.
+ */
+char *chidb_Arena_strdup(Arena *a, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = chidb_Arena_alloc(a, len);
+
+    if (copy)
+        memcpy(copy, s, len);
+
+    return copy;
+}
+
+
+/* Makes all the memory allocated from an arena available again
+ *
+ * The arena keeps its chunks, so memory allocated before the reset
+ * must not be used after it.
+ *
+ * Parameters
+ * - a: Arena
+ *
+ * Return
+ * - Nothing
+ */
+void chidb_Arena_reset(Arena *a)
+{
+    a->cur = a->head;
+    if (a->head)
+        a->head->used = 0;
+}
+
+
+/* Frees all the memory held by an arena
+ *
+ * The arena is left empty, and can still be used.
+ *
+ * Parameters
+ * - a: Arena
+ *
+ * Return
+ * - Nothing
+ */
+void chidb_Arena_free(Arena *a)
+{
+    ArenaChunk *chunk, *next;
+
+    for (chunk = a->head; chunk; chunk = next)
+    {
+        next = chunk->next;
+        free(chunk);
+    }
+
+    chidb_Arena_init(a);
+}
@@ -0,0 +1,82 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Arena (bump-pointer) allocator -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include "chidbInt.h"
+
+/* Size of the chunks of memory an arena allocates from (larger requests
+ * get a chunk of their own) */
+#define ARENA_CHUNK_SIZE (16 * 1024)
+
+/* Alignment of the memory returned by an arena */
+#define ARENA_ALIGN (sizeof(void *) > 8 ? sizeof(void *) : 8)
+
+typedef struct ArenaChunk
+{
+    struct ArenaChunk *next;
+    size_t size;
+    size_t used;
+    uint8_t *data;
+} ArenaChunk;
+
+/* An arena hands out memory by bumping a pointer through a list of
+ * chunks, and frees all of it at once.
+ *
+ * Resetting an arena makes all of its memory available again, without
+ * returning the chunks to the system, so an arena that is reset once in
+ * a while (e.g., after every row) stops allocating once it has grown to
+ * the most memory it needs at a time.
+ */
+struct Arena
+{
+    ArenaChunk *head;
+    ArenaChunk *cur;
+};
+typedef struct Arena Arena;
+
+void chidb_Arena_init(Arena *a);
+void *chidb_Arena_alloc(Arena *a, size_t size);
+char *chidb_Arena_strdup(Arena *a, const char *s);
+void chidb_Arena_reset(Arena *a);
+void chidb_Arena_free(Arena *a);
+
+#endif /*ARENA_H_*/
@@ -0,0 +1,623 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Bloom filters of tables and indexes
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ *  CREATE BLOOM FILTER ON name gives a table or index a Bloom filter of
+ *  its keys (the primary keys of a table, the indexed values of an index,
+ *  or the first indexed value of a variable-length index), which tells
+ *  Seek that a key is not in the B-Tree without descending it. The
+ *  filter lives in pages of its own (see bloom.h), is recorded in the
+ *  chidb_bloom table, and is updated by Insert and IdxInsert. Entries
+ *  are never removed, so a filter can only err by saying that a key may
+ *  be there when it isn't.
+ *
+ *  Filters are blocked: all the bits of a key are in one bit page, chosen
+ *  by the upper half of its hash, so a probe reads a single page. Within
+ *  that page, the bits are chosen by double hashing of the lower half.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "bloom.h"
+#include "record.h"
+#include "index.h"
+#include "util.h"
+
+
+/* Function called on every entry visited by __chidb_Bloom_walk */
+typedef int (*bloom_visit_t)(BTreeCell *cell, void *arg);
+
+/* Growable array of the hashes of the entries of a B-Tree */
+typedef struct bloom_hashes
+{
+    uint64_t *hashes;
+    uint32_t n;
+    uint32_t size;
+} bloom_hashes_t;
+
+
+/* Visits the entries of a B-Tree: the leaf cells of a table, and every
+ * cell of an index */
+static int __chidb_Bloom_walk(BTree *bt, npage_t npage, bloom_visit_t visit, void *arg)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        return rc;
+
+    for (ncell_t i = 0; i < btn->n_cells && rc == CHIDB_OK; i++)
+    {
+        chidb_Btree_getCell(btn, i, &cell);
+
+        switch (btn->type)
+        {
+        case PGTYPE_TABLE_INTERNAL:
+            rc = __chidb_Bloom_walk(bt, cell.fields.tableInternal.child_page, visit, arg);
+            break;
+        case PGTYPE_INDEX_INTERNAL:
+        case PGTYPE_VARINDEX_INTERNAL:
+            rc = __chidb_Bloom_walk(bt, btn->type == PGTYPE_INDEX_INTERNAL ?
+                                    cell.fields.indexInternal.child_page : cell.fields.varIndex.child_page,
+                                    visit, arg);
+            if (rc == CHIDB_OK)
+                rc = visit(&cell, arg);
+            break;
+        default:
+            rc = visit(&cell, arg);
+            break;
+        }
+    }
+
+    if (rc == CHIDB_OK && (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL ||
+                           btn->type == PGTYPE_VARINDEX_INTERNAL))
+        rc = __chidb_Bloom_walk(bt, btn->right_page, visit, arg);
+
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+
+/* Reads a page of a filter the way chidb_Btree_getNodeByPage reads
+ * nodes, so that the filter is as of the same snapshot as the B-Tree */
+static int __chidb_Bloom_readPage(BTree *bt, npage_t npage, MemPage **page)
+{
+    if (bt->snapshot == NULL && bt->pager->shared && !bt->writer)
+        return chidb_Pager_readCommittedPage(bt->pager, npage, page);
+
+    return chidb_Pager_readSnapshotPage(bt->pager, bt->snapshot, npage, page);
+}
+
+
+/* 64-bit hash of a byte string (FNV-1a, with the bits of the result
+ * mixed so that both halves can be used) */
+uint64_t chidb_Bloom_hash(const uint8_t *key, uint32_t nkey)
+{
+    uint64_t h = 14695981039346656037ull;
+
+    for (uint32_t i = 0; i < nkey; i++)
+    {
+        h ^= key[i];
+        h *= 1099511628211ull;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+
+    return h;
+}
+
+
+/* Hash of the key of a table or of an index with integer keys */
+uint64_t chidb_Bloom_hashKey(chidb_key_t key)
+{
+    uint8_t buf[8];
+
+    put8byte(buf, key);
+
+    return chidb_Bloom_hash(buf, sizeof(buf));
+}
+
+
+/* Hash of the entry of a B-Tree that a filter holds */
+static int __chidb_Bloom_entryHash(BTreeCell *cell, uint64_t *hash)
+{
+    uint16_t len;
+    int rc;
+
+    if (cell->type != PGTYPE_VARINDEX_INTERNAL && cell->type != PGTYPE_VARINDEX_LEAF)
+    {
+        *hash = chidb_Bloom_hashKey(cell->key);
+        return CHIDB_OK;
+    }
+
+    rc = chidb_Index_keyPrefix(cell->fields.varIndex.key, cell->fields.varIndex.key_size, 1, &len);
+    if (rc != CHIDB_OK && rc != CHIDB_EEMPTY)
+        return rc;
+    *hash = chidb_Bloom_hash(cell->fields.varIndex.key, len);
+
+    return CHIDB_OK;
+}
+
+
+/* Visitor that appends the hash of each entry to a bloom_hashes_t */
+static int __chidb_Bloom_addHash(BTreeCell *cell, void *arg)
+{
+    bloom_hashes_t *hashes = (bloom_hashes_t *) arg;
+
+    if (hashes->n == hashes->size)
+    {
+        uint32_t size = hashes->size ? hashes->size * 2 : 256;
+        uint64_t *h = realloc(hashes->hashes, size * sizeof(uint64_t));
+
+        if (h == NULL)
+            return CHIDB_ENOMEM;
+
+        hashes->hashes = h;
+        hashes->size = size;
+    }
+
+    return __chidb_Bloom_entryHash(cell, &hashes->hashes[hashes->n++]);
+}
+
+
+/* Sets (or, if set is false, tests) the bits of a hash in a bit page
+ * of nbits bits. Returns whether some of those bits were clear. */
+static bool __chidb_Bloom_bits(uint8_t *data, uint32_t nbits, uint8_t nhashes, uint64_t hash, bool set)
+{
+    uint32_t h = (uint32_t) hash;
+    uint32_t delta = (h >> 17) | (h << 15);
+    bool clear = false;
+
+    for (uint8_t i = 0; i < nhashes; i++, h += delta)
+    {
+        uint32_t bit = h % nbits;
+
+        if (!(data[bit >> 3] & (1 << (bit & 7))))
+        {
+            clear = true;
+            if (!set)
+                break;
+            data[bit >> 3] |= 1 << (bit & 7);
+        }
+    }
+
+    return clear;
+}
+
+
+/* Bit page (counting from 0) where the bits of a hash are */
+static inline uint32_t __chidb_Bloom_page(chidb_bloom_t *bloom, uint64_t hash)
+{
+    return (uint32_t) (hash >> 32) % bloom->npages;
+}
+
+
+/* Finds the key of the last row of a table (0 if it is empty) */
+static int __chidb_Bloom_lastKey(BTree *bt, npage_t npage, chidb_key_t *key)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    int rc;
+
+    *key = 0;
+    while (true)
+    {
+        if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+            return rc;
+
+        if (btn->type != PGTYPE_TABLE_INTERNAL)
+            break;
+        npage = btn->right_page;
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+
+    if (btn->n_cells > 0 && (rc = chidb_Btree_getCell(btn, btn->n_cells - 1, &cell)) == CHIDB_OK)
+        *key = cell.key;
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+
+/* Finds the schema entry of a table or index, by name or (if name is
+ * NULL) by root page */
+static chidb_sql_schema_t *__chidb_Bloom_schema(chidb *db, const char *name, npage_t nroot)
+{
+    chidb_sql_schema_t *schema = NULL;
+
+    list_iterator_start(&db->schemas);
+    while (list_iterator_hasnext(&db->schemas))
+    {
+        chidb_sql_schema_t *next = (chidb_sql_schema_t *) list_iterator_next(&db->schemas);
+
+        if (strcmp(next->type, "table") && strcmp(next->type, "index"))
+            continue;
+        if (name ? !strcmp(next->name, name) : next->rpage == nroot)
+        {
+            schema = next;
+            break;
+        }
+    }
+    list_iterator_stop(&db->schemas);
+
+    return schema;
+}
+
+
+/* Finds the root page of the table of filters
+ *
+ * Parameters
+ * - db: Database
+ * - nroot: Out parameter. Root page of the table of filters.
+ * - create: If true, the table is created if it doesn't exist yet
+ *           (without adding it to the in-memory schema).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The table doesn't exist (and create is false)
+ * - Any error returned by the B-Tree module
+ */
+static int __chidb_Bloom_table(chidb *db, npage_t *nroot, bool create)
+{
+    chidb_sql_schema_t *schema = __chidb_Bloom_schema(db, BLOOM_TABLE, 0);
+    chidb_key_t key;
+    DBRecord *dbr;
+    uint8_t *buf;
+    int rc;
+
+    if (schema != NULL)
+    {
+        *nroot = schema->rpage;
+        return CHIDB_OK;
+    }
+    if (!create)
+        return CHIDB_ENOTFOUND;
+
+    if ((rc = __chidb_Bloom_lastKey(db->bt, 1, &key)) != CHIDB_OK)
+        return rc;
+
+    if ((rc = chidb_Btree_newNode(db->bt, nroot, PGTYPE_TABLE_LEAF)) != CHIDB_OK)
+        return rc;
+
+    chidb_DBRecord_create(&dbr, "|s|s|s|i4|s|", "table", BLOOM_TABLE, BLOOM_TABLE, *nroot, BLOOM_TABLE_SQL);
+    chidb_DBRecord_pack(dbr, &buf);
+    rc = chidb_Btree_insertInTable(db->bt, 1, key + 1, buf, dbr->packed_len);
+    free(buf);
+    chidb_DBRecord_destroy(dbr);
+
+    return rc;
+}
+
+
+/* Writes the pages of a new filter: the header page, followed by the
+ * bit pages, whose contents are in bits */
+static int __chidb_Bloom_write(BTree *bt, npage_t npage, uint32_t npages, uint32_t capacity, const uint8_t *bits)
+{
+    Pager *pager = bt->pager;
+    MemPage *page;
+    int rc;
+
+    for (uint32_t i = 0; i <= npages; i++)
+    {
+        if ((rc = chidb_Pager_readPage(pager, npage + i, &page)) != CHIDB_OK)
+            return rc;
+
+        if (i == 0)
+        {
+            memset(page->data, 0, pager->page_size);
+            page->data[BLOOMHDR_PGTYPE_OFFSET] = PGTYPE_BLOOM;
+            page->data[BLOOMHDR_NHASHES_OFFSET] = BLOOM_NHASHES;
+            put4byte(page->data + BLOOMHDR_NPAGES_OFFSET, npages);
+            put4byte(page->data + BLOOMHDR_CAPACITY_OFFSET, capacity);
+        }
+        else
+            memcpy(page->data, bits + (size_t) (i - 1) * pager->page_size, pager->page_size);
+
+        rc = chidb_Pager_writePage(pager, page);
+        chidb_Pager_releaseMemPage(pager, page);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Creates the Bloom filter of a table or index
+ *
+ * The filter is sized for the entries the B-Tree has (see bloom.h),
+ * filled with them, and recorded in the table of filters. The in-memory
+ * schema entry of the B-Tree is updated too, so cursors opened from now
+ * on use the filter.
+ *
+ * Parameters
+ * - db: Database
+ * - name: Name of the table or index
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (or the B-Tree already has a filter)
+ * - CHIDB_EINVALIDSQL: There is no such table or index, or it is one of
+ *                      the tables chidb maintains itself
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any error returned by the B-Tree module or the pager
+ */
+int chidb_Bloom_create(chidb *db, const char *name)
+{
+    chidb_sql_schema_t *schema = __chidb_Bloom_schema(db, name, 0);
+    bloom_hashes_t hashes = { NULL, 0, 0 };
+    chidb_bloom_t bloom;
+    uint16_t page_size = db->bt->pager->page_size;
+    uint32_t capacity, nbits = page_size * 8;
+    uint64_t npages;
+    chidb_key_t key;
+    npage_t nroot, npage;
+    uint8_t *bits = NULL;
+    DBRecord *dbr;
+    uint8_t *buf;
+    int rc;
+
+    /* The statistics and filters tables are written to directly, and
+     * their filters would not be kept up to date */
+    if (schema == NULL || !strncmp(schema->name, "chidb_", 6))
+        return CHIDB_EINVALIDSQL;
+    if (schema->bloom)
+        return CHIDB_OK;
+
+    if ((rc = __chidb_Bloom_table(db, &nroot, true)) != CHIDB_OK)
+        return rc;
+
+    if ((rc = __chidb_Bloom_walk(db->bt, schema->rpage, __chidb_Bloom_addHash, &hashes)) != CHIDB_OK)
+        goto out;
+
+    capacity = hashes.n * 2 > BLOOM_MIN_ENTRIES ? hashes.n * 2 : BLOOM_MIN_ENTRIES;
+    npages = ((uint64_t) capacity * BLOOM_BITS_PER_KEY + nbits - 1) / nbits;
+    if (npages > BLOOM_MAX_PAGES)
+        npages = BLOOM_MAX_PAGES;
+
+    bloom.npages = npages;
+    bloom.nhashes = BLOOM_NHASHES;
+    if ((bits = calloc(npages, page_size)) == NULL)
+    {
+        rc = CHIDB_ENOMEM;
+        goto out;
+    }
+    for (uint32_t i = 0; i < hashes.n; i++)
+        __chidb_Bloom_bits(bits + (size_t) __chidb_Bloom_page(&bloom, hashes.hashes[i]) * page_size,
+                           nbits, bloom.nhashes, hashes.hashes[i], true);
+
+    /* The bit pages must follow the header page. Schema changes hold the
+     * write lock, so nobody else is allocating pages. */
+    for (uint32_t i = 0; i <= npages; i++)
+    {
+        chidb_Pager_allocatePage(db->bt->pager, &npage);
+        if (i == 0)
+            bloom.page = npage;
+        else if (npage != bloom.page + i)
+        {
+            rc = CHIDB_EPAGENO;
+            goto out;
+        }
+    }
+
+    if ((rc = __chidb_Bloom_write(db->bt, bloom.page, bloom.npages, capacity, bits)) != CHIDB_OK)
+        goto out;
+
+    if ((rc = __chidb_Bloom_lastKey(db->bt, nroot, &key)) != CHIDB_OK)
+        goto out;
+
+    chidb_DBRecord_create(&dbr, "|0|s|i4|", schema->name, bloom.page);
+    chidb_DBRecord_pack(dbr, &buf);
+    rc = chidb_Btree_insertInTable(db->bt, nroot, key + 1, buf, dbr->packed_len);
+    free(buf);
+    chidb_DBRecord_destroy(dbr);
+
+    if (rc == CHIDB_OK)
+        schema->bloom = bloom.page;
+
+out:
+    free(bits);
+    free(hashes.hashes);
+
+    return rc;
+}
+
+
+/* Visitor that attaches a row of the table of filters to the schema
+ * entry of the table or index it belongs to */
+static int __chidb_Bloom_loadRow(BTreeCell *cell, void *arg)
+{
+    chidb *db = (chidb *) arg;
+    chidb_sql_schema_t *schema;
+    DBRecord *dbr;
+    char *name;
+    int32_t page;
+
+    chidb_DBRecord_unpack(&dbr, cell->fields.tableLeaf.data);
+    chidb_DBRecord_getString(dbr, 1, &name);
+    chidb_DBRecord_getInt32(dbr, 2, &page);
+
+    /* Rows of dropped (or not yet loaded) B-Trees are ignored */
+    if ((schema = __chidb_Bloom_schema(db, name, 0)) != NULL)
+        schema->bloom = page;
+
+    free(name);
+    chidb_DBRecord_destroy(dbr);
+
+    return CHIDB_OK;
+}
+
+
+/* Attaches the filters of the tables and indexes to their schema entries
+ *
+ * Parameters
+ * - db: Database, with its schema loaded
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - Any error returned by the B-Tree module
+ */
+int chidb_Bloom_load(chidb *db)
+{
+    npage_t nroot;
+
+    if (__chidb_Bloom_table(db, &nroot, false) != CHIDB_OK)
+        return CHIDB_OK;
+
+    return __chidb_Bloom_walk(db->bt, nroot, __chidb_Bloom_loadRow, db);
+}
+
+
+/* Reads the filter of a B-Tree
+ *
+ * Parameters
+ * - db: Database
+ * - bt: B-Tree file the filter is read through (which may be on a snapshot)
+ * - nroot: Root page of the table or index
+ * - bloom: Out parameter. The filter, or one with no pages if the B-Tree
+ *          has no filter (or it isn't visible through bt).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The filter page is not a filter header
+ * - Any error returned by the pager
+ */
+int chidb_Bloom_open(chidb *db, BTree *bt, npage_t nroot, chidb_bloom_t *bloom)
+{
+    chidb_sql_schema_t *schema = __chidb_Bloom_schema(db, NULL, nroot);
+    MemPage *page;
+    int rc;
+
+    bloom->page = 0;
+    bloom->npages = 0;
+    bloom->nhashes = 0;
+
+    if (schema == NULL || !schema->bloom)
+        return CHIDB_OK;
+
+    if ((rc = __chidb_Bloom_readPage(bt, schema->bloom, &page)) != CHIDB_OK)
+        return rc == CHIDB_EPAGENO ? CHIDB_OK : rc;
+
+    if (page->data[BLOOMHDR_PGTYPE_OFFSET] != PGTYPE_BLOOM)
+        rc = CHIDB_ECORRUPT;
+    else
+    {
+        bloom->page = schema->bloom;
+        bloom->npages = get4byte(page->data + BLOOMHDR_NPAGES_OFFSET);
+        bloom->nhashes = page->data[BLOOMHDR_NHASHES_OFFSET];
+    }
+    chidb_Pager_releaseMemPage(bt->pager, page);
+
+    return rc;
+}
+
+
+/* Adds an entry to a filter
+ *
+ * The bit page is latched while it is modified, so writers sharing the
+ * write lock can add entries at the same time.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - bloom: Filter (with no pages, nothing is done)
+ * - hash: Hash of the entry (see chidb_Bloom_hash and chidb_Bloom_hashKey)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - Any error returned by the pager
+ */
+int chidb_Bloom_add(BTree *bt, chidb_bloom_t *bloom, uint64_t hash)
+{
+    npage_t npage;
+    MemPage *page;
+    int rc;
+
+    if (bloom->npages == 0)
+        return CHIDB_OK;
+
+    npage = bloom->page + 1 + __chidb_Bloom_page(bloom, hash);
+    if ((rc = chidb_Pager_latchPage(bt->pager, npage, true)) != CHIDB_OK)
+        return rc;
+
+    if ((rc = chidb_Pager_readPage(bt->pager, npage, &page)) == CHIDB_OK)
+    {
+        if (__chidb_Bloom_bits(page->data, bt->pager->page_size * 8, bloom->nhashes, hash, true))
+            rc = chidb_Pager_writePage(bt->pager, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+    chidb_Pager_unlatchPage(bt->pager, npage, true);
+
+    return rc;
+}
+
+
+/* Checks whether an entry may be in the B-Tree of a filter
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - bloom: Filter
+ * - hash: Hash of the entry
+ *
+ * Return
+ * - false: The entry is certainly not in the B-Tree
+ * - true: The entry may be in the B-Tree (or there is no filter, or it
+ *         couldn't be read)
+ */
+bool chidb_Bloom_mayContain(BTree *bt, chidb_bloom_t *bloom, uint64_t hash)
+{
+    MemPage *page;
+    bool found;
+
+    if (bloom->npages == 0 ||
+        __chidb_Bloom_readPage(bt, bloom->page + 1 + __chidb_Bloom_page(bloom, hash), &page) != CHIDB_OK)
+        return true;
+
+    found = !__chidb_Bloom_bits(page->data, bt->pager->page_size * 8, bloom->nhashes, hash, false);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+
+    return found;
+}
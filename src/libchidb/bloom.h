@@ -0,0 +1,91 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Bloom filters of tables and indexes -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef BLOOM_H_
+#define BLOOM_H_
+
+#include "chidbInt.h"
+#include "btree.h"
+
+/* Table where CREATE BLOOM FILTER records the filter of each table and
+ * index (like the statistics table, it is only ever appended to) */
+#define BLOOM_TABLE "chidb_bloom"
+#define BLOOM_TABLE_SQL "CREATE TABLE chidb_bloom(id INTEGER PRIMARY KEY, name TEXT, page INTEGER)"
+
+/* A filter is a header page followed by its bit pages. The header page
+ * holds the page type, the number of hash functions, the number of bit
+ * pages and the number of entries the filter was sized for; the bit
+ * pages are nothing but bits. */
+#define PGTYPE_BLOOM (0x20)
+
+#define BLOOMHDR_PGTYPE_OFFSET (0)
+#define BLOOMHDR_NHASHES_OFFSET (1)
+#define BLOOMHDR_NPAGES_OFFSET (4)
+#define BLOOMHDR_CAPACITY_OFFSET (8)
+
+/* Filters get BLOOM_BITS_PER_KEY bits and BLOOM_NHASHES hash functions
+ * per entry (a false positive rate of about 1%), for twice the entries
+ * the B-Tree has when the filter is created (and at least
+ * BLOOM_MIN_ENTRIES), so that it can keep growing for a while */
+#define BLOOM_BITS_PER_KEY (10)
+#define BLOOM_NHASHES (7)
+#define BLOOM_MIN_ENTRIES (1024)
+#define BLOOM_MAX_PAGES (8192)
+
+/* The Bloom filter of a B-Tree, as read from its header page. A filter
+ * with no pages stands for a B-Tree that has no filter (and may contain
+ * any key). */
+typedef struct chidb_bloom
+{
+    npage_t page;       /* Header page */
+    uint32_t npages;    /* Number of bit pages, which follow the header page */
+    uint8_t nhashes;    /* Number of bits set by each entry */
+} chidb_bloom_t;
+
+int chidb_Bloom_create(chidb *db, const char *name);
+int chidb_Bloom_load(chidb *db);
+int chidb_Bloom_open(chidb *db, BTree *bt, npage_t nroot, chidb_bloom_t *bloom);
+int chidb_Bloom_add(BTree *bt, chidb_bloom_t *bloom, uint64_t hash);
+bool chidb_Bloom_mayContain(BTree *bt, chidb_bloom_t *bloom, uint64_t hash);
+
+uint64_t chidb_Bloom_hash(const uint8_t *key, uint32_t nkey);
+uint64_t chidb_Bloom_hashKey(chidb_key_t key);
+
+#endif /*BLOOM_H_*/
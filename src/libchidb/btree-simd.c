@@ -0,0 +1,199 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  SIMD key search kernels for B-Tree nodes
+ *
+ */
+
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ *  Searching a table or index node is the innermost loop of every
+ *  point lookup, seek and insert. Nodes read from the buffer pool have
+ *  their keys decoded into an array (see BTreeNodeCache in btree.h),
+ *  which chidb_Btree_keySearch binary searches until a window of at
+ *  most BTREE_SIMD_WINDOW keys is left. The last steps of a binary
+ *  search are the ones the processor mispredicts, so the window is
+ *  scanned instead, 8 keys at a time: with two 4-key registers (AVX2)
+ *  or four 2-key registers (SSE4.2, whose 64-bit comparison SSE2
+ *  lacks). The kernel to use is chosen once, according to the features
+ *  of the processor; there is a scalar kernel for other processors.
+ *
+ *  Keys are unsigned, but the instructions compare signed integers,
+ *  so both sides of a comparison have their sign bit flipped first.
+ */
+
+#include <pthread.h>
+
+#include "btree-simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BTREE_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define BTREE_SIMD_SIGN (0x8000000000000000ULL)
+
+typedef ncell_t (*chidb_Btree_simd_keyRank_t)(const chidb_key_t *keys, ncell_t n, chidb_key_t key, bool after);
+
+static chidb_Btree_simd_keyRank_t __chidb_Btree_simd_keyRankKernel;
+static pthread_once_t __chidb_Btree_simd_once = PTHREAD_ONCE_INIT;
+
+
+/* Scalar kernel (also used for the keys left over by the others) */
+
+static ncell_t __chidb_Btree_simd_keyRankScalar(const chidb_key_t *keys, ncell_t from, ncell_t n,
+                                                chidb_key_t key, bool after)
+{
+    ncell_t i;
+
+    for(i = from; i < n; i++)
+        if (keys[i] > key || (!after && keys[i] == key))
+            break;
+
+    return i;
+}
+
+static ncell_t __chidb_Btree_simd_keyRankC(const chidb_key_t *keys, ncell_t n, chidb_key_t key, bool after)
+{
+    return __chidb_Btree_simd_keyRankScalar(keys, 0, n, key, after);
+}
+
+
+#ifdef BTREE_SIMD_X86
+
+/* SSE4.2 kernel: 8 keys at a time, in 4 registers of 2 */
+
+/* Mask with a bit set for each of the 2 keys that is past key: greater
+ * than it (if after is set) or not smaller */
+__attribute__((target("sse4.2")))
+static inline uint32_t __chidb_Btree_simd_past2(const chidb_key_t *keys, __m128i kv, __m128i sign, bool after)
+{
+    __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) keys), sign);
+    __m128i m = after ? _mm_cmpgt_epi64(v, kv) : _mm_cmpgt_epi64(kv, v);
+
+    return _mm_movemask_pd(_mm_castsi128_pd(m)) ^ (after ? 0 : 0x3);
+}
+
+__attribute__((target("sse4.2")))
+static ncell_t __chidb_Btree_simd_keyRankSSE42(const chidb_key_t *keys, ncell_t n, chidb_key_t key, bool after)
+{
+    __m128i sign = _mm_set1_epi64x((long long) BTREE_SIMD_SIGN);
+    __m128i kv = _mm_xor_si128(_mm_set1_epi64x(key), sign);
+    uint32_t bits;
+    ncell_t i;
+
+    for(i = 0; i + 8 <= n; i += 8)
+    {
+        bits = __chidb_Btree_simd_past2(keys + i, kv, sign, after) |
+               __chidb_Btree_simd_past2(keys + i + 2, kv, sign, after) << 2 |
+               __chidb_Btree_simd_past2(keys + i + 4, kv, sign, after) << 4 |
+               __chidb_Btree_simd_past2(keys + i + 6, kv, sign, after) << 6;
+        if (bits != 0)
+            return i + __builtin_ctz(bits);
+    }
+
+    return __chidb_Btree_simd_keyRankScalar(keys, i, n, key, after);
+}
+
+
+/* AVX2 kernel: 8 keys at a time, in 2 registers of 4 */
+
+__attribute__((target("avx2")))
+static inline uint32_t __chidb_Btree_simd_past4(const chidb_key_t *keys, __m256i kv, __m256i sign, bool after)
+{
+    __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) keys), sign);
+    __m256i m = after ? _mm256_cmpgt_epi64(v, kv) : _mm256_cmpgt_epi64(kv, v);
+
+    return _mm256_movemask_pd(_mm256_castsi256_pd(m)) ^ (after ? 0 : 0xF);
+}
+
+__attribute__((target("avx2")))
+static ncell_t __chidb_Btree_simd_keyRankAVX2(const chidb_key_t *keys, ncell_t n, chidb_key_t key, bool after)
+{
+    __m256i sign = _mm256_set1_epi64x((long long) BTREE_SIMD_SIGN);
+    __m256i kv = _mm256_xor_si256(_mm256_set1_epi64x(key), sign);
+    uint32_t bits;
+    ncell_t i;
+
+    for(i = 0; i + 8 <= n; i += 8)
+    {
+        bits = __chidb_Btree_simd_past4(keys + i, kv, sign, after) |
+               __chidb_Btree_simd_past4(keys + i + 4, kv, sign, after) << 4;
+        if (bits != 0)
+            return i + __builtin_ctz(bits);
+    }
+
+    return __chidb_Btree_simd_keyRankScalar(keys, i, n, key, after);
+}
+
+#endif /* BTREE_SIMD_X86 */
+
+
+/* Choose the kernel for this processor */
+static void __chidb_Btree_simd_init(void)
+{
+    __chidb_Btree_simd_keyRankKernel = __chidb_Btree_simd_keyRankC;
+
+#ifdef BTREE_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        __chidb_Btree_simd_keyRankKernel = __chidb_Btree_simd_keyRankAVX2;
+    else if (__builtin_cpu_supports("sse4.2"))
+        __chidb_Btree_simd_keyRankKernel = __chidb_Btree_simd_keyRankSSE42;
+#endif
+}
+
+
+/* Find where a key belongs in a sorted array of keys
+ *
+ * Returns the position of the first key that is not smaller than key
+ * (or, if after is true, greater than key), which is also the number
+ * of keys before it.
+ *
+ * Parameters
+ * - keys: Keys, in ascending order
+ * - n: Number of keys
+ * - key: Key to search for
+ * - after: Skip the keys that are equal to key
+ *
+ * Return
+ * - The position of the key (n if there is none)
+ */
+ncell_t chidb_Btree_simd_keyRank(const chidb_key_t *keys, ncell_t n, chidb_key_t key, bool after)
+{
+    pthread_once(&__chidb_Btree_simd_once, __chidb_Btree_simd_init);
+
+    return __chidb_Btree_simd_keyRankKernel(keys, n, key, after);
+}
@@ -50,38 +50,19 @@
 #include <chidb/log.h>
 #include "chidbInt.h"
 #include "btree.h"
+#include "btree-simd.h"
 #include "record.h"
 #include "pager.h"
 #include "util.h"
 
 #include <sys/stat.h>
 
-/* Open a B-Tree file
- *
- * This function opens a database file and verifies that the file
- * header is correct. If the file is empty (which will happen
- * if the pager is given a filename for a file that does not exist)
- * then this function will (1) initialize the file header using
- * the default page size and (2) create an empty table leaf node
- * in page 1.
- *
- * Parameters
- * - filename: Database file (might not exist)
- * - db: A chidb struct. Its bt field must be set to the newly
- *       created BTree.
- * - bt: An out parameter. Used to return a pointer to the
- *       newly created BTree.
- *
- * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_ECORRUPTHEADER: Database file contains an invalid header
- * - CHIDB_ENOMEM: Could not allocate memory
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
- */
-int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
+/* Initialize or verify the file header of a newly opened B-Tree file
+ * (see chidb_Btree_open). Must be called with the pager's write lock. */
+static int __chidb_Btree_init(BTree *bt)
 {
   int          st;
-  Pager       *pager;
+  Pager       *pager = bt->pager;
   struct stat  fst;
   npage_t      npage;
   uint8_t      phdr[100];
@@ -91,27 +72,20 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
   uint8_t h0[]  = {0, 0, 0, 0};
   uint8_t h1[]  = {0, 0, 0, 1};
 
-  if ((st = chidb_Pager_open(&pager, filename)) != CHIDB_OK) {
-    return st;
-  }
-
-  *bt = (BTree*)malloc(sizeof(BTree));
-  if (!(*bt)) {
-    return CHIDB_ENOMEM;
-  }
-
-  (*bt)->pager = pager;
-  (*bt)->db    = db;
-  db->bt       = *bt;
-
-  fstat(fileno(pager->f), &fst);
+  fstat(pager->fd, &fst);
 
-  if (!fst.st_size) {
-    // make a new file
+  if (!fst.st_size && !pager->wal_ncommitted) {
+    // make a new file (an empty file whose pages are all still in the
+    // write-ahead log is not new)
     chidb_Pager_setPageSize(pager, DEFAULT_PAGE_SIZE);
     pager->n_pages = 0;
 
-    if (st = chidb_Btree_newNode(*bt, &npage, PGTYPE_TABLE_LEAF)) {
+    if (st = chidb_Btree_newNode(bt, &npage, PGTYPE_TABLE_LEAF)) {
+      return st;
+    }
+
+    // the first page must survive a rollback of the first transaction
+    if (st = chidb_Pager_commit(pager)) {
       return st;
     }
   } else {
@@ -141,6 +115,195 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
 }
 
 
+/* Opens a B-Tree file with a private or shared pager */
+static int __chidb_Btree_open(const char *filename, chidb *db, BTree **bt, bool shared)
+{
+  int    st;
+  Pager *pager;
+
+  st = shared ? chidb_Pager_openShared(&pager, filename)
+              : chidb_Pager_open(&pager, filename);
+  if (st != CHIDB_OK) {
+    return st;
+  }
+
+  *bt = (BTree*)malloc(sizeof(BTree));
+  if (!(*bt)) {
+    return CHIDB_ENOMEM;
+  }
+
+  (*bt)->pager    = pager;
+  (*bt)->db       = db;
+  (*bt)->snapshot = NULL;
+  (*bt)->writer   = false;
+  (*bt)->shared_writer = false;
+  db->bt          = *bt;
+
+  // another connection sharing the pager may be creating the file
+  if (st = chidb_Pager_lockWrite(pager, *bt, DEFAULT_BUSY_TIMEOUT)) {
+    return st;
+  }
+  st = __chidb_Btree_init(*bt);
+  chidb_Pager_unlockWrite(pager, *bt);
+
+  return st;
+}
+
+
+/* Open a B-Tree file
+ *
+ * This function opens a database file and verifies that the file
+ * header is correct. If the file is empty (which will happen
+ * if the pager is given a filename for a file that does not exist)
+ * then this function will (1) initialize the file header using
+ * the default page size and (2) create an empty table leaf node
+ * in page 1.
+ *
+ * Parameters
+ * - filename: Database file (might not exist)
+ * - db: A chidb struct. Its bt field must be set to the newly
+ *       created BTree.
+ * - bt: An out parameter. Used to return a pointer to the
+ *       newly created BTree.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPTHEADER: Database file contains an invalid header
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
+{
+  return __chidb_Btree_open(filename, db, bt, false);
+}
+
+
+/* Open a B-Tree file with a shared pager
+ *
+ * Like chidb_Btree_open, but the pager (and its buffer pool) is shared
+ * with every other connection to the same file that was opened with
+ * this function (see chidb_Pager_openShared). Connections must take
+ * the write lock (chidb_Btree_beginWrite) before modifying the file.
+ *
+ * Parameters
+ * - filename: Database file (might not exist)
+ * - db: A chidb struct. Its bt field must be set to the newly
+ *       created BTree.
+ * - bt: An out parameter. Used to return a pointer to the
+ *       newly created BTree.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPTHEADER: Database file contains an invalid header
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_EBUSY: Another connection kept the file locked
+ */
+int chidb_Btree_openShared(const char *filename, chidb *db, BTree **bt)
+{
+  return __chidb_Btree_open(filename, db, bt, true);
+}
+
+
+/* Take the write lock of a B-Tree file
+ *
+ * Waits up to the database's busy timeout for other connections
+ * sharing the pager to commit or roll back. Until chidb_Btree_endWrite
+ * is called, nodes are read with the uncommitted changes of this
+ * connection.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EBUSY: Another connection kept the file locked
+ */
+int chidb_Btree_beginWrite(BTree *bt)
+{
+  int st;
+
+  if (st = chidb_Pager_lockWrite(bt->pager, bt, bt->db->busy_timeout)) {
+    return st;
+  }
+  bt->writer = true;
+
+  return CHIDB_OK;
+}
+
+
+/* Release the write lock of a B-Tree file
+ *
+ * The changes made since chidb_Btree_beginWrite must have been
+ * committed or rolled back.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Btree_endWrite(BTree *bt)
+{
+  bt->writer = false;
+
+  return chidb_Pager_unlockWrite(bt->pager, bt);
+}
+
+
+/* Join the shared transaction of a B-Tree file
+ *
+ * Like chidb_Btree_beginWrite, but the write lock is shared with other
+ * connections that joined the same transaction, and that insert into
+ * the file at the same time (see chidb_Pager_lockWriteShared). Only
+ * chidb_Btree_insert may modify the file until chidb_Btree_endSharedWrite
+ * is called, since it is the only one that latches the nodes it modifies.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EBUSY: Another connection kept the file locked
+ */
+int chidb_Btree_beginSharedWrite(BTree *bt)
+{
+  int st;
+
+  if (st = chidb_Pager_lockWriteShared(bt->pager, bt->db->busy_timeout)) {
+    return st;
+  }
+  bt->writer = true;
+  bt->shared_writer = true;
+
+  return CHIDB_OK;
+}
+
+
+/* Leave the shared transaction of a B-Tree file
+ *
+ * Waits for the transaction to be committed by the last connection to
+ * leave it, or rolled back if any of them failed.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - failed: Whether this connection failed to make its changes
+ *
+ * Return
+ * - CHIDB_OK: The changes were committed
+ * - CHIDB_EBUSY: The changes were rolled back because a connection failed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_endSharedWrite(BTree *bt, bool failed)
+{
+  bt->writer = false;
+  bt->shared_writer = false;
+
+  return chidb_Pager_unlockWriteShared(bt->pager, failed);
+}
+
+
 /* Close a B-Tree file
  *
  * This function closes a database file, freeing any resource
@@ -162,6 +325,78 @@ int chidb_Btree_close(BTree *bt)
 }
 
 
+// parse the header of a node, which starts at data
+static void __chidb_Btree_readHeader(BTreeNode *btn, uint8_t *data)
+{
+  btn->type = *data;
+  btn->free_offset = get2byte(data + 1);
+  btn->n_cells = get2byte(data + 3);
+  btn->cells_offset = get2byte(data + 5);
+  btn->right_page = ((btn->type == 0x05) || (btn->type == 0x02) || (btn->type == 0x12)) ? get4byte(data+8) : 0;
+}
+
+
+// decode the node in a page read from the buffer pool, and attach the
+// result to its buffer. This is only an optimization: on failure, the
+// page is simply left without a decoded form.
+static void __chidb_Btree_decodeNode(BTree *bt, MemPage *page)
+{
+  BTreeNode btn;
+  BTreeNodeCache *cache;
+  BTreeCell cell;
+  uint8_t *data = page->data + (page->npage == 1 ? 100 : 0);
+  bool internal, fixed;
+  ncell_t i;
+
+  __chidb_Btree_readHeader(&btn, data);
+  switch (btn.type) {
+    case PGTYPE_TABLE_INTERNAL:
+    case PGTYPE_INDEX_INTERNAL:
+      internal = fixed = true;
+      break;
+    case PGTYPE_TABLE_LEAF:
+    case PGTYPE_INDEX_LEAF:
+      internal = false;
+      fixed = true;
+      break;
+    case PGTYPE_VARINDEX_INTERNAL:
+    case PGTYPE_VARINDEX_LEAF:
+      internal = fixed = false;
+      break;
+    default:
+      // not a B-Tree node
+      return;
+  }
+  btn.page = page;
+  btn.celloffset_array = data + (internal || btn.type == PGTYPE_VARINDEX_INTERNAL ? 12 : 8);
+
+  cache = malloc(sizeof(BTreeNodeCache) + (fixed ? btn.n_cells * sizeof(chidb_key_t) : 0) +
+                 (internal ? btn.n_cells * sizeof(npage_t) : 0));
+  if (cache == NULL) {
+    return;
+  }
+  cache->type = btn.type;
+  cache->free_offset = btn.free_offset;
+  cache->n_cells = btn.n_cells;
+  cache->cells_offset = btn.cells_offset;
+  cache->right_page = btn.right_page;
+  cache->keys = fixed ? (chidb_key_t *) (cache + 1) : NULL;
+  cache->children = internal ? (npage_t *) (cache->keys + btn.n_cells) : NULL;
+
+  for (i = 0; fixed && i < btn.n_cells; i++) {
+    chidb_Btree_getCell(&btn, i, &cell);
+    cache->keys[i] = cell.key;
+    if (btn.type == PGTYPE_TABLE_INTERNAL) {
+      cache->children[i] = cell.fields.tableInternal.child_page;
+    } else if (btn.type == PGTYPE_INDEX_INTERNAL) {
+      cache->children[i] = cell.fields.indexInternal.child_page;
+    }
+  }
+
+  chidb_Pager_setAux(bt->pager, page, cache, free);
+}
+
+
 /* Loads a B-Tree node from disk
  *
  * Reads a B-Tree node from a page in the disk. All the information regarding
@@ -171,6 +406,12 @@ int chidb_Btree_close(BTree *bt)
  * allocated for a BTreeNode (do not use free() directly on a BTreeNode variable)
  * Any changes made to a BTreeNode variable will not be effective in the database
  * until chidb_Btree_writeNode is called on that BTreeNode.
+ * If the B-Tree file has a read snapshot, the node is loaded as of that
+ * snapshot. Connections sharing a pager only see the changes of other
+ * connections once they are committed, unless they hold the write lock.
+ * A node read from the pager's buffer pool comes with its decoded form
+ * (see BTreeNodeCache), which is built by the first reader of that
+ * version of the node.
  *
  * Parameters
  * - bt: B-Tree file
@@ -187,23 +428,40 @@ int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **btn)
 {
   int st;
   uint8_t* data;
+  const BTreeNodeCache *cache;
 
   if (!(*btn = (BTreeNode*)malloc(sizeof(BTreeNode)))) {
       return CHIDB_ENOMEM;
   }
 
-  if (st = chidb_Pager_readPage(bt->pager, npage, &(*btn)->page)) {
+  if (bt->snapshot == NULL && bt->pager->shared && !bt->writer) {
+      st = chidb_Pager_readCommittedPage(bt->pager, npage, &(*btn)->page);
+  } else {
+      st = chidb_Pager_readSnapshotPage(bt->pager, bt->snapshot, npage, &(*btn)->page);
+  }
+  if (st) {
       return st;
   }
 
   data = (*btn)->page->data + (npage == 1 ? 100 : 0);
 
-  (*btn)->type = *data;
-  (*btn)->free_offset = get2byte(data + 1);
-  (*btn)->n_cells = get2byte(data + 3);
-  (*btn)->cells_offset = get2byte(data + 5);
-  (*btn)->right_page = (((*btn)->type == 0x05) || ((*btn)->type == 0x02)) ? get4byte(data+8) : 0;
-  (*btn)->celloffset_array = data + ((((*btn)->type == 0x05) || ((*btn)->type == 0x02)) ? 12 : 8);
+  // the first reader of a committed version of the node decodes it
+  // for everyone else
+  if ((*btn)->page->aux == NULL && (*btn)->page->buf != NULL) {
+      __chidb_Btree_decodeNode(bt, (*btn)->page);
+  }
+
+  if ((cache = (*btn)->page->aux) != NULL) {
+      (*btn)->type = cache->type;
+      (*btn)->free_offset = cache->free_offset;
+      (*btn)->n_cells = cache->n_cells;
+      (*btn)->cells_offset = cache->cells_offset;
+      (*btn)->right_page = cache->right_page;
+  } else {
+      __chidb_Btree_readHeader(*btn, data);
+  }
+  (*btn)->celloffset_array = data + ((((*btn)->type == 0x05) || ((*btn)->type == 0x02) || ((*btn)->type == 0x12)) ? 12 : 8);
+  (*btn)->cache = cache;
 
   return CHIDB_OK;
 }
@@ -242,7 +500,8 @@ int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn)
  * - npage: Out parameter. Returns the number of the page that
  *          was allocated.
  * - type: Type of B-Tree node (PGTYPE_TABLE_INTERNAL, PGTYPE_TABLE_LEAF,
- *         PGTYPE_INDEX_INTERNAL, or PGTYPE_INDEX_LEAF)
+ *         PGTYPE_INDEX_INTERNAL, PGTYPE_INDEX_LEAF, PGTYPE_VARINDEX_INTERNAL,
+ *         or PGTYPE_VARINDEX_LEAF)
  *
  * Return
  * - CHIDB_OK: Operation successful
@@ -273,7 +532,8 @@ int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type)
  * - bt: B-Tree file
  * - npage: Database page where the node will be created.
  * - type: Type of B-Tree node (PGTYPE_TABLE_INTERNAL, PGTYPE_TABLE_LEAF,
- *         PGTYPE_INDEX_INTERNAL, or PGTYPE_INDEX_LEAF)
+ *         PGTYPE_INDEX_INTERNAL, PGTYPE_INDEX_LEAF, PGTYPE_VARINDEX_INTERNAL,
+ *         or PGTYPE_VARINDEX_LEAF)
  *
  * Return
  * - CHIDB_OK: Operation successful
@@ -361,7 +621,7 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
 
   // Free offset 
   //We assume from start of Header
-  put2byte(data, ((type == 0x05 || type == 0x02) ? 12 : 8) + ((npage == 1) ? 100 : 0));
+  put2byte(data, ((type == 0x05 || type == 0x02 || type == 0x12) ? 12 : 8) + ((npage == 1) ? 100 : 0));
   data += 2;
 
   // NumCells
@@ -376,7 +636,7 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
   *(data++) = 0;
 
   // Right Page
-  if (type == 0x05 || type == 0x02) {
+  if (type == 0x05 || type == 0x02 || type == 0x12) {
       // Internal Node
       put4byte(data, 0);
       data += 4;
@@ -416,11 +676,13 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
 {
   uint8_t *data = ((btn->page->npage == 1) ? 100 : 0) + btn->page->data;
 
+  // the page no longer has a decoded form once it is written
+  btn->cache = NULL;
   *data = btn->type;
   put2byte(data + 1, btn->free_offset);
   put2byte(data + 3, btn->n_cells);
   put2byte(data + 5, btn->cells_offset);
-  if ((btn->type == 0x05) || (btn->type == 0x02)) {
+  if ((btn->type == 0x05) || (btn->type == 0x02) || (btn->type == 0x12)) {
     put4byte(data + 8, btn->right_page);
   }
 
@@ -430,78 +692,418 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
 }
 
 
-/* Read the contents of a cell
- *
- * Reads the contents of a cell from a BTreeNode and stores them in a BTreeCell.
- * This involves the following:
- *  1. Find out the offset of the requested cell.
- *  2. Read the cell from the in-memory page, and parse its
- *     contents (refer to The chidb File Format document for
- *     the format of cells).
- *
- * Parameters
- * - btn: BTreeNode where cell is contained
- * - ncell: Cell number
- * - cell: BTreeCell where contents must be stored.
- *
- * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_ECELLNO: The provided cell number is invalid
- */
-int chidb_Btree_getCell(BTreeNode* btn, ncell_t ncell, BTreeCell* cell)
+// the cell ncell of a variable-length index node: the length of the
+// prefix it shares with the previous key, the length of the rest of
+// its key, and where the rest starts
+static uint8_t *__chidb_Btree_varIndexCell(BTreeNode *btn, ncell_t ncell, uint32_t *shared, uint32_t *rest)
 {
-  uint8_t* data = btn->page->data + get2byte(btn->celloffset_array + ncell * 2);
+  uint8_t *data = btn->page->data + get2byte(btn->celloffset_array + ncell * 2);
 
-  if (ncell < 0 || ncell > btn->n_cells) {
-    return CHIDB_ECELLNO;
+  if (btn->type == PGTYPE_VARINDEX_INTERNAL) {
+    data += 4;
   }
+  data += getVarint32(data, shared);
+  return data + getVarint32(data, rest);
+}
 
-  switch(btn->type) {
-    case PGTYPE_TABLE_INTERNAL:
-      cell->type = PGTYPE_TABLE_INTERNAL;
-      cell->fields.tableInternal.child_page = get4byte(data);
-      getVarint32(data + 4, &cell->key);
-      break;
-    case PGTYPE_TABLE_LEAF:
-      cell->type = PGTYPE_TABLE_LEAF;
-      getVarint32(data, &cell->fields.tableLeaf.data_size);
-      getVarint32(data + 4, &cell->key);
-      cell->fields.tableLeaf.data = data + TABLELEAFCELL_SIZE_WITHOUTDATA;
-      break;
-    case PGTYPE_INDEX_INTERNAL:
-      cell->type = PGTYPE_INDEX_INTERNAL;
-      cell->key = get4byte(data + 8);
-      cell->fields.indexInternal.keyPk = get4byte(data + 12);
-      cell->fields.indexInternal.child_page = get4byte(data);
-      break;
-    case PGTYPE_INDEX_LEAF:
-      cell->type = PGTYPE_INDEX_LEAF;
-      cell->key = get4byte(data + 4);
-      cell->fields.indexLeaf.keyPk = get4byte(data + 8);
-      break;
-    default:
-      chilog(CRITICAL, "getCell: invalid page type (%d)", btn->type);
-      exit(1);
+// whether the cell ncell of a variable-length index node is not a
+// restart point (i.e., only holds the end of its key)
+static bool __chidb_Btree_varIndexShares(BTreeNode *btn, ncell_t ncell)
+{
+  uint32_t shared, rest;
+
+  __chidb_Btree_varIndexCell(btn, ncell, &shared, &rest);
+  return shared > 0;
+}
+
+// apply the cell ncell to the key of the previous cell, in key and size
+static int __chidb_Btree_varIndexNext(BTreeNode *btn, ncell_t ncell, uint8_t *key, uint16_t *size)
+{
+  uint32_t shared, rest;
+  uint8_t *data = __chidb_Btree_varIndexCell(btn, ncell, &shared, &rest);
+
+  if (shared > *size || shared + rest > VARINDEX_MAXKEY) {
+    return CHIDB_ECORRUPT;
   }
+  memcpy(key + shared, data, rest);
+  *size = shared + rest;
 
   return CHIDB_OK;
 }
 
+// decode the key of the cell ncell of a variable-length index node,
+// starting from the restart point at or before it
+static int __chidb_Btree_varIndexKey(BTreeNode *btn, ncell_t ncell, uint8_t *key, uint16_t *size)
+{
+  ncell_t i;
+  int st;
 
-/* Insert a new cell into a B-Tree node
- *
- * Inserts a new cell into a B-Tree node at a specified dataition ncell.
- * This involves the following:
- *  1. Add the cell at the top of the cell area. This involves "translating"
- *     the BTreeCell into the chidb format (refer to The chidb File Format
- *     document for the format of cells).
- *  2. Modify cells_offset in BTreeNode to reflect the growth in the cell area.
- *  3. Modify the cell offset array so that all values in positions >= ncell
- *     are shifted one position forward in the array. Then, set the value of
- *     position ncell to be the offset of the newly added cell.
+  for (i = ncell; i > 0 && __chidb_Btree_varIndexShares(btn, i); i--);
+
+  for (*size = 0; i <= ncell; i++) {
+    if (st = __chidb_Btree_varIndexNext(btn, i, key, size)) {
+      return st;
+    }
+  }
+
+  return CHIDB_OK;
+}
+
+// fill a cell of a variable-length index node, whose key was decoded
+static int __chidb_Btree_varIndexFill(BTreeNode *btn, ncell_t ncell, uint8_t *key, uint16_t size, BTreeCell *cell)
+{
+  if (size < VARINDEX_PKEY_SIZE) {
+    return CHIDB_ECORRUPT;
+  }
+
+  cell->type = btn->type;
+  cell->fields.varIndex.child_page = (btn->type == PGTYPE_VARINDEX_INTERNAL) ?
+    get4byte(btn->page->data + get2byte(btn->celloffset_array + ncell * 2)) : 0;
+  if (key != cell->fields.varIndex.key) {
+    memcpy(cell->fields.varIndex.key, key, size);
+  }
+  cell->fields.varIndex.key_size = size;
+  cell->fields.varIndex.keyPk = get8byte(key + size - VARINDEX_PKEY_SIZE);
+  // the key is only compared as bytes
+  cell->key = cell->fields.varIndex.keyPk;
+
+  return CHIDB_OK;
+}
+
+// length of the prefix that two keys share
+static uint32_t __chidb_Btree_keyPrefix(const uint8_t *key1, uint16_t size1, const uint8_t *key2, uint16_t size2)
+{
+  uint32_t i;
+
+  for (i = 0; i < size1 && i < size2 && key1[i] == key2[i]; i++);
+
+  return i;
+}
+
+
+/* Compare two keys of a variable-length index
+ *
+ * Keys are compared byte by byte, and a key is equal to every longer key
+ * that starts with it: since the key of an entry is the encoding of its
+ * fields followed by its primary key, the encoding of its first fields
+ * alone finds every entry that has them.
+ *
+ * Parameters
+ * - key1, size1: First key
+ * - key2, size2: Second key
+ *
+ * Return
+ * - Less than, equal to or greater than zero if key1 is smaller than,
+ *   equal to or greater than key2
+ */
+int chidb_Btree_keyCmp(const uint8_t *key1, uint16_t size1, const uint8_t *key2, uint16_t size2)
+{
+  return memcmp(key1, key2, size1 < size2 ? size1 : size2);
+}
+
+
+/* Find where a key belongs in a variable-length index node
+ *
+ * Finds the first cell of the node whose key is not smaller than key
+ * (or, if after is true, greater than key). Restart points hold their
+ * whole key, so they are binary searched for the last one whose key is
+ * smaller; the few cells after it are then decoded one at a time.
+ *
+ * Parameters
+ * - btn: Node of a variable-length index B-Tree
+ * - key, size: Key to search for (see chidb_Btree_keyCmp)
+ * - after: Skip the cells whose key is equal to key
+ * - ncell: Out parameter. Position of the cell (n_cells if there is none)
+ * - cell: Out parameter. If not NULL, the cell at ncell, if there is one
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The node is not a valid variable-length index node
+ */
+int chidb_Btree_varIndexSearch(BTreeNode *btn, const uint8_t *key, uint16_t size, bool after,
+                               ncell_t *ncell, BTreeCell *cell)
+{
+  uint8_t buf[VARINDEX_MAXKEY];
+  uint8_t *data;
+  uint32_t shared, rest;
+  uint16_t len;
+  ncell_t lo, hi, mid, r;
+  int cmp, st;
+
+  // the cell is after the restart point lo, and isn't after any
+  // restart point from hi on
+  lo = 0;
+  hi = btn->n_cells;
+  while (hi - lo > 1) {
+    mid = lo + (hi - lo) / 2;
+    for (r = mid; r > lo && __chidb_Btree_varIndexShares(btn, r); r--);
+    if (r == lo) {
+      for (r = mid + 1; r < hi && __chidb_Btree_varIndexShares(btn, r); r++);
+      if (r == hi) {
+        break;
+      }
+    }
+
+    data = __chidb_Btree_varIndexCell(btn, r, &shared, &rest);
+    cmp = chidb_Btree_keyCmp(data, rest, key, size);
+    if (cmp < 0 || (after && cmp == 0)) {
+      lo = r;
+    } else {
+      hi = r;
+    }
+  }
+
+  for (len = 0; lo < btn->n_cells; lo++) {
+    if (st = __chidb_Btree_varIndexNext(btn, lo, buf, &len)) {
+      return st;
+    }
+    cmp = chidb_Btree_keyCmp(buf, len, key, size);
+    if (cmp > 0 || (!after && cmp == 0)) {
+      break;
+    }
+  }
+
+  *ncell = lo;
+  if (cell != NULL && lo < btn->n_cells) {
+    return __chidb_Btree_varIndexFill(btn, lo, buf, len, cell);
+  }
+
+  return CHIDB_OK;
+}
+
+
+// the key of a cell of a table or index node
+static chidb_key_t __chidb_Btree_cellKey(BTreeNode *btn, ncell_t ncell)
+{
+  BTreeCell cell;
+
+  if (btn->cache != NULL) {
+    return btn->cache->keys[ncell];
+  }
+  chidb_Btree_getCell(btn, ncell, &cell);
+  return cell.key;
+}
+
+
+/* Find where a key belongs in a table or index node
+ *
+ * Finds the first cell of the node whose key is not smaller than key
+ * (or, if after is true, greater than key), with a binary search. If
+ * the node has a decoded form (see BTreeNodeCache), the search only
+ * reads its key array, whose last BTREE_SIMD_WINDOW keys are scanned
+ * with SIMD instructions, and the child page is read from it too;
+ * otherwise the keys are decoded from the page as they are compared.
+ *
+ * Parameters
+ * - btn: Node of a table or index B-Tree (not of a variable-length index)
+ * - key: Key to search for
+ * - after: Skip the cells whose key is equal to key
+ * - ncell: Out parameter. Position of the cell (n_cells if there is none)
+ * - child: Out parameter. If not NULL, the page below ncell in an internal
+ *          node (the right page if ncell is n_cells), and 0 in a leaf
+ * - match: Out parameter. If not NULL, whether the key of the cell at
+ *          ncell is equal to key
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Btree_keySearch(BTreeNode *btn, chidb_key_t key, bool after, ncell_t *ncell, npage_t *child, bool *match)
+{
+  BTreeCell cell;
+  ncell_t lo = 0, hi = btn->n_cells, mid;
+  chidb_key_t k;
+
+  // with a key array, the last keys are scanned (see btree-simd.c)
+  while (hi - lo > (btn->cache != NULL ? BTREE_SIMD_WINDOW : 0)) {
+    mid = lo + (hi - lo) / 2;
+    k = __chidb_Btree_cellKey(btn, mid);
+    if (k < key || (after && k == key)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (btn->cache != NULL) {
+    lo += chidb_Btree_simd_keyRank(btn->cache->keys + lo, hi - lo, key, after);
+  }
+  *ncell = lo;
+
+  if (match != NULL) {
+    *match = lo < btn->n_cells && __chidb_Btree_cellKey(btn, lo) == key;
+  }
+
+  if (child != NULL) {
+    if (btn->type != PGTYPE_TABLE_INTERNAL && btn->type != PGTYPE_INDEX_INTERNAL) {
+      *child = 0;
+    } else if (lo == btn->n_cells) {
+      *child = btn->right_page;
+    } else if (btn->cache != NULL) {
+      *child = btn->cache->children[lo];
+    } else {
+      chidb_Btree_getCell(btn, lo, &cell);
+      *child = (btn->type == PGTYPE_TABLE_INTERNAL) ? cell.fields.tableInternal.child_page :
+               cell.fields.indexInternal.child_page;
+    }
+  }
+
+  return CHIDB_OK;
+}
+
+
+/* Read the contents of a cell
+ *
+ * Reads the contents of a cell from a BTreeNode and stores them in a BTreeCell.
+ * This involves the following:
+ *  1. Find out the offset of the requested cell.
+ *  2. Read the cell from the in-memory page, and parse its
+ *     contents (refer to The chidb File Format document for
+ *     the format of cells).
+ *
+ * Parameters
+ * - btn: BTreeNode where cell is contained
+ * - ncell: Cell number
+ * - cell: BTreeCell where contents must be stored.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECELLNO: The provided cell number is invalid
+ * - CHIDB_ECORRUPT: The key of a variable-length index cell is not valid
+ */
+int chidb_Btree_getCell(BTreeNode* btn, ncell_t ncell, BTreeCell* cell)
+{
+  uint8_t* data = btn->page->data + get2byte(btn->celloffset_array + ncell * 2);
+  int st;
+
+  if (ncell < 0 || ncell > btn->n_cells) {
+    return CHIDB_ECELLNO;
+  }
+
+  switch(btn->type) {
+    case PGTYPE_TABLE_INTERNAL:
+      cell->type = PGTYPE_TABLE_INTERNAL;
+      cell->fields.tableInternal.child_page = get4byte(data);
+      getVarint64(data + 4, &cell->key);
+      break;
+    case PGTYPE_TABLE_LEAF:
+      cell->type = PGTYPE_TABLE_LEAF;
+      data += getVarint32(data, &cell->fields.tableLeaf.data_size);
+      cell->fields.tableLeaf.data = data + getVarint64(data, &cell->key);
+      break;
+    case PGTYPE_INDEX_INTERNAL:
+      cell->type = PGTYPE_INDEX_INTERNAL;
+      cell->key = get4byte(data + 8);
+      cell->fields.indexInternal.keyPk = get4byte(data + 12);
+      cell->fields.indexInternal.child_page = get4byte(data);
+      break;
+    case PGTYPE_INDEX_LEAF:
+      cell->type = PGTYPE_INDEX_LEAF;
+      cell->key = get4byte(data + 4);
+      cell->fields.indexLeaf.keyPk = get4byte(data + 8);
+      break;
+    case PGTYPE_VARINDEX_INTERNAL:
+    case PGTYPE_VARINDEX_LEAF:
+      if ((st = __chidb_Btree_varIndexKey(btn, ncell, cell->fields.varIndex.key,
+                                          &cell->fields.varIndex.key_size)) ||
+          (st = __chidb_Btree_varIndexFill(btn, ncell, cell->fields.varIndex.key,
+                                           cell->fields.varIndex.key_size, cell))) {
+        return st;
+      }
+      break;
+    default:
+      chilog(CRITICAL, "getCell: invalid page type (%d)", btn->type);
+      exit(1);
+  }
+
+  return CHIDB_OK;
+}
+
+
+// add the cell of a variable-length index node to the cell area, with
+// its key compressed against the key of the cell before ncell, and
+// compress the key of the cell at ncell (which will follow it) against
+// it. Keys are sorted, so the latter shares at least as much with the
+// new key as with its previous one, and its cell doesn't grow.
+static int __chidb_Btree_varIndexAdd(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
+{
+  uint8_t prev[VARINDEX_MAXKEY], next[VARINDEX_MAXKEY];
+  uint8_t *key = cell->fields.varIndex.key;
+  uint16_t size = cell->fields.varIndex.key_size;
+  uint16_t psize = 0, nsize;
+  uint32_t shared = 0, nshared, rest;
+  uint8_t *data;
+  ncell_t r, i;
+  int st;
+
+  if (ncell > 0) {
+    if (st = __chidb_Btree_varIndexKey(btn, ncell - 1, prev, &psize)) {
+      return st;
+    }
+
+    // the new cell is a restart point if its run would get too long
+    for (r = ncell - 1; r > 0 && __chidb_Btree_varIndexShares(btn, r); r--);
+    for (i = ncell; i < btn->n_cells && __chidb_Btree_varIndexShares(btn, i); i++);
+    if (i - r < VARINDEX_RESTART_INTERVAL) {
+      shared = __chidb_Btree_keyPrefix(prev, psize, key, size);
+    }
+  }
+
+  if (ncell < btn->n_cells && __chidb_Btree_varIndexShares(btn, ncell)) {
+    nsize = psize;
+    memcpy(next, prev, psize);
+    if (st = __chidb_Btree_varIndexNext(btn, ncell, next, &nsize)) {
+      return st;
+    }
+    nshared = __chidb_Btree_keyPrefix(key, size, next, nsize);
+
+    data = btn->page->data + get2byte(btn->celloffset_array + ncell * 2);
+    if (btn->type == PGTYPE_VARINDEX_INTERNAL) {
+      data += 4;
+    }
+    data += putVarint32(data, nshared);
+    data += putVarint32(data, nsize - nshared);
+    memcpy(data, next + nshared, nsize - nshared);
+  }
+
+  rest = size - shared;
+  btn->cells_offset -= varintLen32(shared) + varintLen32(rest) + rest;
+  if (btn->type == PGTYPE_VARINDEX_INTERNAL) {
+    btn->cells_offset -= 4;
+  }
+
+  data = btn->page->data + btn->cells_offset;
+  if (btn->type == PGTYPE_VARINDEX_INTERNAL) {
+    put4byte(data, cell->fields.varIndex.child_page);
+    data += 4;
+  }
+  data += putVarint32(data, shared);
+  data += putVarint32(data, rest);
+  memcpy(data, key + shared, rest);
+
+  return CHIDB_OK;
+}
+
+
+/* Insert a new cell into a B-Tree node
+ *
+ * Inserts a new cell into a B-Tree node at a specified dataition ncell.
+ * This involves the following:
+ *  1. Add the cell at the top of the cell area. This involves "translating"
+ *     the BTreeCell into the chidb format (refer to The chidb File Format
+ *     document for the format of cells).
+ *  2. Modify cells_offset in BTreeNode to reflect the growth in the cell area.
+ *  3. Modify the cell offset array so that all values in positions >= ncell
+ *     are shifted one position forward in the array. Then, set the value of
+ *     position ncell to be the offset of the newly added cell.
  *
  * This function assumes that there is enough space for this cell in this node.
  *
+ * The data of a table leaf cell whose data pointer is NULL is not copied:
+ * the cell's fill function writes it straight into the page, once its
+ * room in the cell area has been reserved.
+ *
+ * In a variable-length index node, the key of the cell that follows the
+ * new one is compressed again (in place) against the new key.
+ *
  * Parameters
  * - btn: BTreeNode to insert cell in
  * - ncell: Cell number
@@ -515,24 +1117,33 @@ int chidb_Btree_insertCell(BTreeNode* btn, ncell_t ncell, BTreeCell* cell)
 {
   uint8_t* data = btn->page->data;
   uint8_t hexg[] = {0x0B, 0x03, 0x04, 0x04};
+  int slen, klen, st;
 
   if(ncell < 0 || ncell > btn->n_cells) {
     return CHIDB_ECELLNO;
   }
+  btn->cache = NULL;
 
   switch(btn->type) {
     case PGTYPE_TABLE_LEAF:
-      data += btn->cells_offset - cell->fields.tableLeaf.data_size - TABLELEAFCELL_SIZE_WITHOUTDATA;
+      slen = varintLen32(cell->fields.tableLeaf.data_size);
+      klen = varintLen64(cell->key);
+      data += btn->cells_offset - cell->fields.tableLeaf.data_size - slen - klen;
       putVarint32(data, cell->fields.tableLeaf.data_size);
-      putVarint32(data + 4, cell->key);
-      memcpy(data + 8, cell->fields.tableLeaf.data, cell->fields.tableLeaf.data_size);
-      btn->cells_offset -= (cell->fields.tableLeaf.data_size + TABLELEAFCELL_SIZE_WITHOUTDATA);
+      putVarint64(data + slen, cell->key);
+      if (cell->fields.tableLeaf.data == NULL) {
+        cell->fields.tableLeaf.fill(cell->fields.tableLeaf.fill_arg, data + slen + klen);
+      } else {
+        memcpy(data + slen + klen, cell->fields.tableLeaf.data, cell->fields.tableLeaf.data_size);
+      }
+      btn->cells_offset -= (cell->fields.tableLeaf.data_size + slen + klen);
       break;
     case PGTYPE_TABLE_INTERNAL:
-      data += btn->cells_offset - TABLEINTCELL_SIZE;
+      klen = varintLen64(cell->key);
+      data += btn->cells_offset - 4 - klen;
       put4byte(data, cell->fields.tableInternal.child_page);
-      putVarint32(data + 4, cell->key);
-      btn->cells_offset -= TABLEINTCELL_SIZE;
+      putVarint64(data + 4, cell->key);
+      btn->cells_offset -= 4 + klen;
       break;
     case PGTYPE_INDEX_INTERNAL:
       data += btn->cells_offset - INDEXINTCELL_SIZE;
@@ -549,6 +1160,12 @@ int chidb_Btree_insertCell(BTreeNode* btn, ncell_t ncell, BTreeCell* cell)
       put4byte(data + 8, cell->fields.indexLeaf.keyPk);
       btn->cells_offset -= INDEXLEAFCELL_SIZE;
       break;
+    case PGTYPE_VARINDEX_INTERNAL:
+    case PGTYPE_VARINDEX_LEAF:
+      if (st = __chidb_Btree_varIndexAdd(btn, ncell, cell)) {
+        return st;
+      }
+      break;
     default:
       chilog(CRITICAL, "insertCell: invalid page type (%d)", btn->type);
       exit(1);
@@ -584,61 +1201,47 @@ int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data,
 {
   BTreeCell cell;
   BTreeNode *btn;
-
+  ncell_t ncell;
+  npage_t child;
+  bool match;
   int st;
-  int i;
 
   if (st = chidb_Btree_getNodeByPage(bt, nroot, &btn)) {
     return st;
   }
 
-  for (i = 0; i < btn->n_cells; i++) {
-    
-    if (chidb_Btree_getCell(btn, i, &cell)) {
-      return CHIDB_ECELLNO;
-    }
-
-    if ((cell.key == key) && (btn->type == PGTYPE_TABLE_LEAF)) {
-      *size = cell.fields.tableLeaf.data_size;
-      *data = (uint8_t *)malloc(sizeof(uint8_t) * (*size));
-      
-      if (!(*data)) {
-        chidb_Btree_freeMemNode(bt, btn);
-        return CHIDB_ENOMEM;
-      }
-      
-      memcpy(*data, cell.fields.tableLeaf.data, *size);
-
-      if (st = chidb_Btree_freeMemNode(bt, btn)) {
-        return st;
-      }
+  chidb_Btree_keySearch(btn, key, false, &ncell, &child, &match);
 
-      return CHIDB_OK;
+  if (btn->type != PGTYPE_TABLE_LEAF) {
+    if (st = chidb_Btree_freeMemNode(bt, btn)) {
+      return st;
+    }
+    return chidb_Btree_find(bt, child, key, data, size);
+  }
 
-    } else if (key <= cell.key) {
+  if (!match) {
+    if (st = chidb_Btree_freeMemNode(bt, btn)) {
+      return st;
+    }
+    return CHIDB_ENOTFOUND;
+  }
 
-      int type = btn->type;
-      if (st = chidb_Btree_freeMemNode(bt, btn)) {
-        return st;
-      }
+  if (chidb_Btree_getCell(btn, ncell, &cell)) {
+    chidb_Btree_freeMemNode(bt, btn);
+    return CHIDB_ECELLNO;
+  }
 
-      if (type == PGTYPE_TABLE_LEAF) {
-        return CHIDB_ENOTFOUND;
-      }
+  *size = cell.fields.tableLeaf.data_size;
+  *data = (uint8_t *)malloc(sizeof(uint8_t) * (*size));
 
-      return chidb_Btree_find(bt, cell.fields.tableInternal.child_page, key, data, size);
-    }
+  if (!(*data)) {
+    chidb_Btree_freeMemNode(bt, btn);
+    return CHIDB_ENOMEM;
   }
 
-  if (btn->type != PGTYPE_TABLE_LEAF) {
-    i = btn->right_page;
-    if (st = chidb_Btree_freeMemNode(bt, btn)) {
-        return st;
-    }
-    return chidb_Btree_find(bt, i, key, data, size);
-  } 
+  memcpy(*data, cell.fields.tableLeaf.data, *size);
 
-  return CHIDB_ENOTFOUND;
+  return chidb_Btree_freeMemNode(bt, btn);
 }
 
 
@@ -706,96 +1309,252 @@ int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chid
   return chidb_Btree_insert(bt, nroot, &btc);
 }
 
-// where node has room for the cell
+
+/* Insert an entry into a variable-length index B-Tree
+ *
+ * This is a convenience function that wraps around chidb_Btree_insert.
+ * It takes the key of an entry (see index.c), and creates a BTreeCell
+ * that can be passed along to chidb_Btree_insert.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this entry in.
+ * - key: Key of the entry, ending with its primary key
+ * - size: Number of bytes of the key
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_EMISMATCH: The key is too long (or too short)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertInVarIndex(BTree *bt, npage_t nroot, uint8_t *key, uint16_t size)
+{
+  BTreeCell btc;
+
+  if (size < VARINDEX_PKEY_SIZE || size > VARINDEX_MAXKEY) {
+    return CHIDB_EMISMATCH;
+  }
+
+  btc.type = PGTYPE_VARINDEX_LEAF;
+  btc.fields.varIndex.child_page = 0;
+  btc.fields.varIndex.key_size = size;
+  memcpy(btc.fields.varIndex.key, key, size);
+  btc.fields.varIndex.keyPk = get8byte(key + size - VARINDEX_PKEY_SIZE);
+  btc.key = btc.fields.varIndex.keyPk;
+
+  return chidb_Btree_insert(bt, nroot, &btc);
+}
+
+// where node has room for the cell (and its entry in the cell offset array)
 int notEnoughSpace(BTreeNode *btn, BTreeCell *btc)
 {
-  int have = 0;
+  int have = 2;
   int need = btn->cells_offset - btn->free_offset;
 
-  switch(btc->type) {
+  // internal nodes only receive cells from splits, which are internal
+  // cells of their own type whatever the type of the cell being inserted
+  switch((btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL ||
+          btn->type == PGTYPE_VARINDEX_INTERNAL) ? btn->type : btc->type) {
     case PGTYPE_TABLE_LEAF:
-      have = TABLELEAFCELL_SIZE_WITHOUTDATA + btc->fields.tableLeaf.data_size;
+      have += varintLen32(btc->fields.tableLeaf.data_size) + varintLen64(btc->key) +
+              btc->fields.tableLeaf.data_size;
       break;
     case PGTYPE_TABLE_INTERNAL:
-      have = TABLEINTCELL_SIZE;
+      // the key of the cell a split brings up is not known yet
+      have += TABLEINTCELL_MAXSIZE;
       break;
     case PGTYPE_INDEX_LEAF:
-      have = INDEXLEAFCELL_SIZE;
+      have += INDEXLEAFCELL_SIZE;
       break;
     case PGTYPE_INDEX_INTERNAL:
-      have = INDEXINTCELL_SIZE;
+      have += INDEXINTCELL_SIZE;
+      break;
+    case PGTYPE_VARINDEX_LEAF:
+      // a restart point, which is the largest the cell can be
+      have += 1 + varintLen32(btc->fields.varIndex.key_size) + btc->fields.varIndex.key_size;
+      break;
+    case PGTYPE_VARINDEX_INTERNAL:
+      have += VARINDEXINTCELL_MAXSIZE;
       break;
   }
 
   if (need >= have) {
     return 1;
-  } 
+  }
 
   return 0;
 }
 
 
-/* Insert a BTreeCell into a B-Tree
- *
- * The chidb_Btree_insert and chidb_Btree_insertNonFull functions
- * are responsible for inserting new entries into a B-Tree, although
- * chidb_Btree_insertNonFull is the one that actually does the
- * insertion. chidb_Btree_insert, however, first checks if the root
- * has to be split (a splitting operation that is different from
- * splitting any other node). If so, chidb_Btree_split is called
- * before calling chidb_Btree_insertNonFull.
- *
- * Parameters
- * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this cell in.
- * - btc: BTreeCell to insert into B-Tree
- *
- * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
- * - CHIDB_ENOMEM: Could not allocate memory
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
- */
-int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
+// find where the key of a cell belongs in a node: ncell is the position
+// of the first cell whose key is not smaller than it and, in internal
+// nodes, child is the page below that position (the right page past
+// the last cell)
+static int __chidb_Btree_locate(BTreeNode *btn, BTreeCell *btc, ncell_t *ncell, npage_t *child)
 {
-  BTreeNode *rbtn;
-  BTreeNode *cbtn;
-
   BTreeCell tcell;
+  chidb_key_t key = btc->key;
+  bool match;
+  int st;
 
-  int st, i;
-  uint8_t rbtn_type;
-  npage_t npage_lower, npage_cbtn;
+  if (btn->type == PGTYPE_VARINDEX_INTERNAL || btn->type == PGTYPE_VARINDEX_LEAF) {
+    if (st = chidb_Btree_varIndexSearch(btn, btc->fields.varIndex.key, btc->fields.varIndex.key_size,
+                                        false, ncell, &tcell)) {
+      return st;
+    }
+    if (*ncell < btn->n_cells &&
+        tcell.fields.varIndex.key_size == btc->fields.varIndex.key_size &&
+        !chidb_Btree_keyCmp(tcell.fields.varIndex.key, tcell.fields.varIndex.key_size,
+                            btc->fields.varIndex.key, btc->fields.varIndex.key_size)) {
+      return CHIDB_EDUPLICATE;
+    }
+    *child = (btn->type == PGTYPE_VARINDEX_LEAF) ? 0 :
+             (*ncell == btn->n_cells) ? btn->right_page : tcell.fields.varIndex.child_page;
+    return CHIDB_OK;
+  }
 
-  if (st = chidb_Btree_getNodeByPage(bt, nroot, &rbtn)) {
+  chidb_Btree_keySearch(btn, key, false, ncell, child, &match);
+
+  if (match && btn->type != PGTYPE_TABLE_INTERNAL) {
+    return CHIDB_EDUPLICATE;
+  }
+
+  return CHIDB_OK;
+}
+
+
+// empty an in-memory node and turn it into a node of the given type,
+// without writing it: the page keeps its old contents until writeNode
+static void __chidb_Btree_resetNode(BTree *bt, BTreeNode *btn, uint8_t type)
+{
+  uint16_t hdr = (type == PGTYPE_TABLE_INTERNAL || type == PGTYPE_INDEX_INTERNAL ||
+                  type == PGTYPE_VARINDEX_INTERNAL) ?
+                 INTPG_CELLSOFFSET_OFFSET : LEAFPG_CELLSOFFSET_OFFSET;
+  uint16_t off = (btn->page->npage == 1) ? 100 : 0;
+
+  btn->cache = NULL;
+  btn->type = type;
+  btn->free_offset = off + hdr;
+  btn->n_cells = 0;
+  btn->cells_offset = bt->pager->page_size;
+  btn->right_page = 0;
+  btn->celloffset_array = btn->page->data + off + hdr;
+}
+
+
+// optimistic insertion: shared latches are crabbed down to the leaf,
+// which is then latched exclusively while its parent is still held.
+// Only a leaf with room is modified; *full is set otherwise, and the
+// caller has to take the pessimistic path (that may split nodes).
+static int __chidb_Btree_insertLeaf(BTree *bt, npage_t nroot, BTreeCell *btc, bool *full)
+{
+  BTreeNode *btn;
+  npage_t npage, npage_parent, npage_child;
+  ncell_t ncell;
+  bool leaf;
+  int st;
+
+  *full = false;
+  npage_parent = 0;
+  npage = nroot;
+  if (st = chidb_Pager_latchPage(bt->pager, npage, false)) {
     return st;
   }
 
-  if (!notEnoughSpace(rbtn, btc)) {
-    return chidb_Btree_insertNonFull(bt, nroot, btc);
+  while (true) {
+    if (st = chidb_Btree_getNodeByPage(bt, npage, &btn)) {
+      break;
+    }
+    leaf = (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF ||
+            btn->type == PGTYPE_VARINDEX_LEAF);
+    st = leaf ? CHIDB_OK : __chidb_Btree_locate(btn, btc, &ncell, &npage_child);
+    chidb_Btree_freeMemNode(bt, btn);
+    if (st || leaf) {
+      break;
+    }
+
+    // crab: latch the child before letting go of the parent
+    if (st = chidb_Pager_latchPage(bt->pager, npage_child, false)) {
+      break;
+    }
+    if (npage_parent) {
+      chidb_Pager_unlatchPage(bt->pager, npage_parent, false);
+    }
+    npage_parent = npage;
+    npage = npage_child;
   }
 
-  // root doesn't have room, so we need to prepare a new right child 
-  // and populate it with everything in the root
+  if (!st) {
+    // trade the shared latch on the leaf for an exclusive one; the
+    // parent latch keeps the leaf from being split in the meantime
+    chidb_Pager_unlatchPage(bt->pager, npage, false);
+    st = chidb_Pager_latchPage(bt->pager, npage, true);
+  } else {
+    chidb_Pager_unlatchPage(bt->pager, npage, false);
+  }
+  if (npage_parent) {
+    chidb_Pager_unlatchPage(bt->pager, npage_parent, false);
+  }
+  if (st) {
+    return st;
+  }
+
+  if (st = chidb_Btree_getNodeByPage(bt, npage, &btn)) {
+    chidb_Pager_unlatchPage(bt->pager, npage, true);
+    return st;
+  }
+
+  // a root leaf has no parent latch: if it was split meanwhile, the
+  // insert is left to the pessimistic path
+  if ((btn->type != PGTYPE_TABLE_LEAF && btn->type != PGTYPE_INDEX_LEAF &&
+       btn->type != PGTYPE_VARINDEX_LEAF) || !notEnoughSpace(btn, btc)) {
+    *full = true;
+  } else if (!(st = __chidb_Btree_locate(btn, btc, &ncell, &npage_child)) &&
+             !(st = chidb_Btree_insertCell(btn, ncell, btc))) {
+    st = chidb_Btree_writeNode(bt, btn);
+  }
+  chidb_Btree_freeMemNode(bt, btn);
+  chidb_Pager_unlatchPage(bt->pager, npage, true);
+
+  return st;
+}
+
+
+// move every cell of the root into a new child, leaving an empty internal
+// root whose right page is that child, and split the child. The caller
+// holds the exclusive latch on the root.
+static int __chidb_Btree_splitRoot(BTree *bt, npage_t nroot)
+{
+  BTreeNode *rbtn;
+  BTreeNode *cbtn;
+  BTreeCell tcell;
+  npage_t npage_cbtn, npage_lower;
+  int i, st;
+
+  if (st = chidb_Btree_getNodeByPage(bt, nroot, &rbtn)) {
+    return st;
+  }
 
   // prepare new node and initialize (accomplished by newNode...calls initEmptyNode)
   if (st = chidb_Btree_newNode(bt, &npage_cbtn, rbtn->type)) {
-      return st;
+    chidb_Btree_freeMemNode(bt, rbtn);
+    return st;
   }
   // get that new node into the new_child btn
   if (st = chidb_Btree_getNodeByPage(bt, npage_cbtn, &cbtn)) {
-      return st;
+    chidb_Btree_freeMemNode(bt, rbtn);
+    return st;
   }
-  
+
   // now, dump everything from the root into this new child node
   for (i = 0; i < rbtn->n_cells; i++) {
-    // get the cell
-    if (st = chidb_Btree_getCell(rbtn, i, &tcell)) {
-      return st;
-    }
-    // put the cell
-    if (st = chidb_Btree_insertCell(cbtn, i, &tcell)) {
+    if ((st = chidb_Btree_getCell(rbtn, i, &tcell)) ||
+        (st = chidb_Btree_insertCell(cbtn, i, &tcell))) {
+      chidb_Btree_freeMemNode(bt, cbtn);
+      chidb_Btree_freeMemNode(bt, rbtn);
       return st;
     }
   }
@@ -805,71 +1564,118 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
   switch(rbtn->type) {
     case PGTYPE_INDEX_INTERNAL:
     case PGTYPE_TABLE_INTERNAL:
+    case PGTYPE_VARINDEX_INTERNAL:
         cbtn->right_page = rbtn->right_page;
         break;
     default:
         break;
   }
-  
-  // write and close the new child
-  if (st = chidb_Btree_writeNode(bt, cbtn)) {
-      return st;
-  }
-  if (st = chidb_Btree_freeMemNode(bt, cbtn)) {
-      return st;
-  }
-
-  // reinitialize the root as appropriate type (if formerly leaf, make internal)
-  rbtn_type = rbtn->type;
 
-  // CLOSE THE ROOT BEFORE REINITIALIZING!!!
-  if (st = chidb_Btree_writeNode(bt, rbtn)) {
+  // write and close the new child
+  st = chidb_Btree_writeNode(bt, cbtn);
+  chidb_Btree_freeMemNode(bt, cbtn);
+  if (st) {
+    chidb_Btree_freeMemNode(bt, rbtn);
     return st;
   }
-  if (st = chidb_Btree_freeMemNode(bt, rbtn)) {
-      return st;
-  }
 
-  switch(rbtn_type) {
+  // turn the root into an empty internal node (if formerly leaf, make internal)
+  // whose right page is the new child; the tree stays valid for anyone
+  // reading it before the child is split
+  switch(rbtn->type) {
     case PGTYPE_INDEX_LEAF:
     case PGTYPE_INDEX_INTERNAL:
-      if (st = chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_INDEX_INTERNAL)) {
-        return st;
-      }
+      __chidb_Btree_resetNode(bt, rbtn, PGTYPE_INDEX_INTERNAL);
       break;
     case PGTYPE_TABLE_LEAF:
     case PGTYPE_TABLE_INTERNAL:
-      if (st = chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_TABLE_INTERNAL)) {
-        return st;
-      }
+      __chidb_Btree_resetNode(bt, rbtn, PGTYPE_TABLE_INTERNAL);
+      break;
+    case PGTYPE_VARINDEX_LEAF:
+    case PGTYPE_VARINDEX_INTERNAL:
+      __chidb_Btree_resetNode(bt, rbtn, PGTYPE_VARINDEX_INTERNAL);
       break;
     default:
       chilog(CRITICAL, "insert: invalid page type\n");
       exit(1);
   }
+  rbtn->right_page = npage_cbtn;
 
-  // re-open the root
-  if (st = chidb_Btree_getNodeByPage(bt, nroot, &rbtn)) {
+  // write and close the root
+  st = chidb_Btree_writeNode(bt, rbtn);
+  chidb_Btree_freeMemNode(bt, rbtn);
+  if (st) {
     return st;
   }
 
-  // set the root's right_page to the npage_cbtn
-  rbtn->right_page = npage_cbtn;
+  // split the new child; nobody else can reach it while the root is latched
+  return chidb_Btree_split(bt, nroot, npage_cbtn, 0, &npage_lower);
+}
 
-  // write and close the root
-  if (st = chidb_Btree_writeNode(bt, rbtn)) {
+
+/* Insert a BTreeCell into a B-Tree
+ *
+ * The chidb_Btree_insert and chidb_Btree_insertNonFull functions
+ * are responsible for inserting new entries into a B-Tree, although
+ * chidb_Btree_insertNonFull is the one that actually does the
+ * insertion. chidb_Btree_insert, however, first checks if the root
+ * has to be split (a splitting operation that is different from
+ * splitting any other node). If so, chidb_Btree_split is called
+ * before calling chidb_Btree_insertNonFull.
+ *
+ * Several connections sharing the write lock of a shared pager (see
+ * chidb_Btree_beginSharedWrite) may insert into the same B-Tree at
+ * once, so nodes are latched (see chidb_Pager_latchPage). An insert
+ * first descends with shared latches, releasing each parent once its
+ * child is latched, and only latches the leaf exclusively; this is
+ * enough unless the leaf is full. Otherwise, the insert starts over
+ * from the root with exclusive latches, releasing the latches above
+ * a node as soon as that node is known not to need a split.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this cell in.
+ * - btc: BTreeCell to insert into B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
+  BTreeNode *rbtn;
+  bool full;
+  int st, room;
+
+  if ((st = __chidb_Btree_insertLeaf(bt, nroot, btc, &full)) || !full) {
     return st;
   }
-  if (st = chidb_Btree_freeMemNode(bt, rbtn)) {
+
+  if (st = chidb_Pager_latchPage(bt->pager, nroot, true)) {
     return st;
   }
 
-  // split the root
-  if (st = chidb_Btree_split(bt, nroot, npage_cbtn, 0, &npage_lower)) {
+  if (st = chidb_Btree_getNodeByPage(bt, nroot, &rbtn)) {
+    chidb_Pager_unlatchPage(bt->pager, nroot, true);
     return st;
   }
+  room = notEnoughSpace(rbtn, btc);
+  chidb_Btree_freeMemNode(bt, rbtn);
+
+  // root doesn't have room, so we need to prepare a new right child
+  // and populate it with everything in the root
+  if (!room && (st = __chidb_Btree_splitRoot(bt, nroot))) {
+    chidb_Pager_unlatchPage(bt->pager, nroot, true);
+    return st;
+  }
+
+  // the root now has room for the cell
+  return chidb_Btree_insertNonFull(bt, nroot, btc);
 }
-  
+
 /* Insert a BTreeCell into a non-full B-Tree node
  *
  * chidb_Btree_insertNonFull inserts a BTreeCell into a node that is
@@ -877,14 +1683,18 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
  * node is a leaf node, the cell is directly added in the appropriate
  * position according to its key. If the node is an internal node, the
  * function will determine what child node it must insert it in, and
- * calls itself recursively on that child node. However, before doing so
+ * continues down to that child node. However, before doing so
  * it will check if the child node is full or not. If it is, then it will
  * have to be split first.
  *
+ * The caller must hold the exclusive latch on the node, and this
+ * function releases it. Each child is latched exclusively before it is
+ * checked; the latch on its parent is released once the child is
+ * known to have room.
+ *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this cell in.
+ * - npage: Page number of the node we want to insert this cell in.
  * - btc: BTreeCell to insert into B-Tree
  *
  * Return
@@ -897,207 +1707,79 @@ int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc)
 {
   BTreeNode *ubtn;
   BTreeNode *cbtn;
-  BTreeCell tcell;
-  int i, st;
-  npage_t npage_cbtn, npage_tbtn;
+  npage_t npage_child, npage_cbtn;
+  ncell_t ncell;
+  int st, room;
 
   if(!npage) {
     chilog(CRITICAL, "insertNonFull: npage is 0.\n");
     exit(1);
   }
 
-  if (st = chidb_Btree_getNodeByPage(bt, npage, &ubtn)) {
-      return st;
-  }
-
-  for (i = 0; i < ubtn->n_cells; i++) {
-
-    // check no cell
-    if (chidb_Btree_getCell(ubtn, i, &tcell)) {
-      fprintf(stderr,"insertNonFull: invalid cell, no(%d)\n",i);
-      return CHIDB_ECELLNO;
+  while (true) {
+    if (st = chidb_Btree_getNodeByPage(bt, npage, &ubtn)) {
+      break;
     }
 
-    // check already have
-    if ((tcell.key == btc->key) && (ubtn->type != PGTYPE_TABLE_INTERNAL)) {
-      if (st = chidb_Btree_freeMemNode(bt, ubtn)) {
-        return st;
-      }
-      return CHIDB_EDUPLICATE;
+    if (st = __chidb_Btree_locate(ubtn, btc, &ncell, &npage_child)) {
+      chidb_Btree_freeMemNode(bt, ubtn);
+      break;
     }
 
-    if (btc->key <= tcell.key) {
-
-      switch(ubtn->type) {
-        
-        case PGTYPE_TABLE_INTERNAL:
-
-          if (st = chidb_Btree_freeMemNode(bt, ubtn)) {
-            return st;
-          }
-
-          if (st = chidb_Btree_getNodeByPage(bt, tcell.fields.tableInternal.child_page, 
-              &cbtn)) {
-            return st;
-          }
-
-          if (!notEnoughSpace(cbtn, btc)) {
-            
-            if (st = chidb_Btree_freeMemNode(bt, cbtn)) {
-              return st;
-            }
-            if (st = chidb_Btree_split(bt, npage, tcell.fields.tableInternal.child_page, 
-                i, &npage_cbtn)) {
-              return st;
-            }
-            return chidb_Btree_insertNonFull(bt, npage, btc);
-          }
-
-          return chidb_Btree_insertNonFull(bt, tcell.fields.tableInternal.child_page, btc);
-
-        case PGTYPE_INDEX_INTERNAL:   
-
-          if (st = chidb_Btree_freeMemNode(bt, ubtn)) {
-            return st;
-          }
-
-          if (st = chidb_Btree_getNodeByPage(bt, tcell.fields.indexInternal.child_page, 
-              &cbtn)) {
-            return st;
-          }
-
-          if (!notEnoughSpace(cbtn, btc)) {
-            
-            if (st = chidb_Btree_freeMemNode(bt, cbtn)) {
-              return st;
-            }
-            if (st = chidb_Btree_split(bt, npage, tcell.fields.indexInternal.child_page, 
-                i, &npage_cbtn)) {
-              return st;
-            }
-            return chidb_Btree_insertNonFull(bt, npage, btc);
-          }
-
-          return chidb_Btree_insertNonFull(bt, tcell.fields.indexInternal.child_page, btc); 
-            
-        case PGTYPE_TABLE_LEAF:
-        case PGTYPE_INDEX_LEAF:
-          st = chidb_Btree_insertCell(ubtn, i, btc);
-          chidb_Btree_writeNode(bt, ubtn);
-          chidb_Btree_freeMemNode(bt, ubtn);
-          return st;
+    if ((ubtn->type == PGTYPE_INDEX_LEAF) || (ubtn->type == PGTYPE_TABLE_LEAF) ||
+        (ubtn->type == PGTYPE_VARINDEX_LEAF)) {
+      if (!(st = chidb_Btree_insertCell(ubtn, ncell, btc))) {
+        st = chidb_Btree_writeNode(bt, ubtn);
       }
+      chidb_Btree_freeMemNode(bt, ubtn);
+      break;
     }
-  } // end for (i = 0; i < ubtn->n_cells; i++)
-
-  if ((ubtn->type == PGTYPE_INDEX_LEAF) || (ubtn->type == PGTYPE_TABLE_LEAF)) {
-    st = chidb_Btree_insertCell(ubtn, i, btc);
-    chidb_Btree_writeNode(bt, ubtn);
     chidb_Btree_freeMemNode(bt, ubtn);
-    return st;
-  }
-
-  npage_tbtn = ubtn->right_page;
-
-  chidb_Btree_freeMemNode(bt, ubtn);
-
-  if (st = chidb_Btree_getNodeByPage(bt, npage_tbtn, &cbtn)) {
-      return st;
-  }
 
-  if (!notEnoughSpace(cbtn, btc)) {
-    
-    if (st = chidb_Btree_freeMemNode(bt, cbtn)) {
-      return st;
+    if (st = chidb_Pager_latchPage(bt->pager, npage_child, true)) {
+      break;
     }
-    if (st = chidb_Btree_split(bt, npage, npage_tbtn, i, &npage_cbtn)) {
-        return st;
+    if (st = chidb_Btree_getNodeByPage(bt, npage_child, &cbtn)) {
+      chidb_Pager_unlatchPage(bt->pager, npage_child, true);
+      break;
+    }
+    room = notEnoughSpace(cbtn, btc);
+    chidb_Btree_freeMemNode(bt, cbtn);
+
+    if (!room) {
+      // split the child while both nodes are latched, and look again
+      st = chidb_Btree_split(bt, npage, npage_child, ncell, &npage_cbtn);
+      chidb_Pager_unlatchPage(bt->pager, npage_child, true);
+      if (st) {
+        break;
+      }
+      continue;
     }
-    return chidb_Btree_insertNonFull(bt, npage, btc);
+
+    // the child will not be split, so its parent can be released
+    chidb_Pager_unlatchPage(bt->pager, npage, true);
+    npage = npage_child;
   }
 
-  return chidb_Btree_insertNonFull(bt, npage_tbtn, btc);
+  chidb_Pager_unlatchPage(bt->pager, npage, true);
+
+  return st;
 }
 
-/* Split a B-Tree node
- *
- * Splits a B-Tree node N. This involves the following:
- * - Find the median cell in N.
- * - Create a new B-Tree node M.
- * - Move the cells before the median cell to M (if the
- *   cell is a table leaf cell, the median cell is moved too)
- * - Add a cell to the parent (which, by definition, will be an
- *   internal page) with the median key and the page number of M.
- *
- * Parameters
- * - bt: B-Tree file
- * - npage_parent: Page number of the parent node
- * - npage_child: Page number of the node to split
- * - parent_ncell: Position in the parent where the new cell will
- *                 be inserted.
- * - npage_child2: Out parameter. Used to return the page of the new child node.
- *
- * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_ENOMEM: Could not allocate memory
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
- */
-int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, npage_t *npage_child2)
+// the work of chidb_Btree_split, on in-memory nodes: the parent, the
+// original child, the child to rebuild as upper and the new node vbtn
+static int __chidb_Btree_splitNodes(BTree *bt, BTreeNode *pbtn, BTreeNode *cbtn,
+                                    BTreeNode *ubtn, BTreeNode *vbtn, ncell_t parent_ncell)
 {
-  BTreeNode *pbtn;
-  BTreeNode *cbtn;
-
-  BTreeNode *ubtn;
-  npage_t npage_ubtn;
-
-  BTreeNode *vbtn;
-  npage_t npage_vbtn, npage_uright;
-
-  BTreeNode *tbtn;
-  npage_t npage_tbtn;
-
   BTreeCell ncell;  // inserted cell
   BTreeCell ucell;  // original cell
   BTreeCell tcell;  // temp cell
 
   int i, j, st, midx;  // midx: median index
 
-  // get parent page
-  if (st = chidb_Btree_getNodeByPage(bt, npage_parent, &pbtn)) {
-    return st;
-  }
-
-  // get child page
-  if (st = chidb_Btree_getNodeByPage(bt, npage_child, &cbtn)) {
-    return st;
-  }
-
   // set median index
   midx = cbtn->n_cells / 2;
 
-  // initialize new node with page_num = npage_vbtn
-  if (st = chidb_Btree_newNode(bt, &npage_vbtn, cbtn->type)) {
-    return st;
-  }
-
-  // get page at page_num = npage_vbtn
-  if (st = chidb_Btree_getNodeByPage(bt, npage_vbtn, &vbtn)) {
-    return st;
-  }
-
-  ubtn = cbtn;
-  npage_ubtn = npage_child;
-
-  // initialize new node with page_num = npage_tbtn
-  if (st = chidb_Btree_newNode(bt, &npage_tbtn, cbtn->type)) {
-    return st;
-  }
-
-  // get page at page_num = npage_tbtn
-  if (st = chidb_Btree_getNodeByPage(bt, npage_tbtn, &tbtn)) {
-    return st;
-  }
-
   // Setup ncell for insertion into parent
   if ((st = chidb_Btree_getCell(cbtn, midx, &ucell)) != CHIDB_OK) {
     return st;
@@ -1108,11 +1790,11 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
 
   switch(ncell.type) {
     case PGTYPE_TABLE_INTERNAL:
-      ncell.fields.tableInternal.child_page = npage_vbtn;
+      ncell.fields.tableInternal.child_page = vbtn->page->npage;
       break;
 
     case PGTYPE_INDEX_INTERNAL:
-      ncell.fields.indexInternal.child_page = npage_vbtn;
+      ncell.fields.indexInternal.child_page = vbtn->page->npage;
 
       if (ucell.type == PGTYPE_INDEX_INTERNAL) {
           ncell.fields.indexInternal.keyPk = ucell.fields.indexInternal.keyPk;
@@ -1120,20 +1802,25 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
           ncell.fields.indexInternal.keyPk = ucell.fields.indexLeaf.keyPk;
       }
     break;
+
+    case PGTYPE_VARINDEX_INTERNAL:
+      ncell.fields.varIndex = ucell.fields.varIndex;
+      ncell.fields.varIndex.child_page = vbtn->page->npage;
+      break;
       default:
     chilog(CRITICAL, "split: type of parent should never be a leaf type; got type (%d)\n", ncell.type);
     exit(1);
   }
 
   // Insert ncell into pbtn
-  if (st = chidb_Btree_insertCell(st, parent_ncell, &ncell)) {
+  if (st = chidb_Btree_insertCell(pbtn, parent_ncell, &ncell)) {
     chilog(CRITICAL, "split: median cell insert into parent error (%d)\n", st);
     return st;
   }
 
   //copy cells below the median to vbtn
   for (i = 0; i < midx; i++) {
-    if (st = chidb_Btree_getCell(ubtn, i, &tcell)) {
+    if (st = chidb_Btree_getCell(cbtn, i, &tcell)) {
       return st;
     }
     if (st = chidb_Btree_insertCell(vbtn, i, &tcell)) {
@@ -1142,24 +1829,21 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
   }
 
   // copy original median cell if necessary
-  // get that original median cell into tcell
-  if (st = chidb_Btree_getCell(ubtn, i, &tcell)) {
-    return st;
-  }	
-
-  if (ubtn->type == PGTYPE_TABLE_LEAF) {
-    if (st = chidb_Btree_insertCell(vbtn, i, &tcell)) {
+  if (cbtn->type == PGTYPE_TABLE_LEAF) {
+    if (st = chidb_Btree_insertCell(vbtn, i, &ucell)) {
       return st;
     }
-    i++;
-  } else if (tcell.type != PGTYPE_INDEX_LEAF) {
+  } else if (ucell.type != PGTYPE_INDEX_LEAF && ucell.type != PGTYPE_VARINDEX_LEAF) {
     // if the type of the children is not a leaf type, then we must set right_page of vbtn to the former child of the median
-    switch(tcell.type) {
+    switch(ucell.type) {
       case PGTYPE_TABLE_INTERNAL:
-        vbtn->right_page = tcell.fields.tableInternal.child_page;
+        vbtn->right_page = ucell.fields.tableInternal.child_page;
         break;
       case PGTYPE_INDEX_INTERNAL:
-        vbtn->right_page = tcell.fields.indexInternal.child_page;
+        vbtn->right_page = ucell.fields.indexInternal.child_page;
+        break;
+      case PGTYPE_VARINDEX_INTERNAL:
+        vbtn->right_page = ucell.fields.varIndex.child_page;
         break;
     }
 
@@ -1168,73 +1852,264 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
       exit(2);
     }
   }
+  // the median cell now lives in the parent (or in vbtn), not in upper
+  i++;
 
-  // copy cells above the median to tbtn
+  // rebuild upper with the cells above the median
+  __chidb_Btree_resetNode(bt, ubtn, cbtn->type);
+  ubtn->right_page = cbtn->right_page;
   for (j = 0; i < cbtn->n_cells; i++, j++) {
     if (st = chidb_Btree_getCell(cbtn, i, &tcell)) {
       return st;
     }
-    if (st = chidb_Btree_insertCell(tbtn, j, &tcell)) {
+    if (st = chidb_Btree_insertCell(ubtn, j, &tcell)) {
       return st;
-    }        
+    }
   }
 
-  npage_uright = cbtn->right_page;
-  // close cbtn
-
-  if (st = chidb_Btree_freeMemNode(bt,cbtn)) {
+  // write vbtn before the parent points to it, and upper last, so that
+  // a reader without latches never misses a cell
+  if (st = chidb_Btree_writeNode(bt, vbtn)) {
     return st;
   }
-
-  // clear upper
-  if (st = chidb_Btree_initEmptyNode(bt, npage_ubtn, tbtn->type)) {
+  if (st = chidb_Btree_writeNode(bt, pbtn)) {
     return st;
   }
+  return chidb_Btree_writeNode(bt, ubtn);
+}
 
-  // reopen upper
-  if (st = chidb_Btree_getNodeByPage(bt, npage_ubtn, &cbtn)) {
-    return st;
-  }
+/* Split a B-Tree node
+ *
+ * Splits a B-Tree node N. This involves the following:
+ * - Find the median cell in N.
+ * - Create a new B-Tree node M.
+ * - Move the cells before the median cell to M (if the
+ *   cell is a table leaf cell, the median cell is moved too)
+ * - Add a cell to the parent (which, by definition, will be an
+ *   internal page) with the median key and the page number of M.
+ *
+ * The caller must hold the exclusive latches on the parent and on N.
+ * M is only reachable through the parent, so it needs no latch.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage_parent: Page number of the parent node
+ * - npage_child: Page number of the node to split
+ * - parent_ncell: Position in the parent where the new cell will
+ *                 be inserted.
+ * - npage_child2: Out parameter. Used to return the page of the new child node.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, npage_t *npage_child2)
+{
+  BTreeNode *pbtn = NULL;
+  BTreeNode *cbtn = NULL;   // original contents of the child
+  BTreeNode *ubtn = NULL;   // upper half, rebuilt in the child's page
+  BTreeNode *vbtn = NULL;   // lower half, in a new page
+  npage_t npage_vbtn;
+  int st;
 
-  ubtn->right_page = npage_uright;
+  // get parent page, and child page twice: cbtn keeps the original
+  // cells while ubtn is rebuilt
+  if (!(st = chidb_Btree_getNodeByPage(bt, npage_parent, &pbtn)) &&
+      !(st = chidb_Btree_getNodeByPage(bt, npage_child, &cbtn)) &&
+      !(st = chidb_Btree_getNodeByPage(bt, npage_child, &ubtn)) &&
+      !(st = chidb_Btree_newNode(bt, &npage_vbtn, cbtn->type)) &&
+      !(st = chidb_Btree_getNodeByPage(bt, npage_vbtn, &vbtn))) {
+    st = __chidb_Btree_splitNodes(bt, pbtn, cbtn, ubtn, vbtn, parent_ncell);
+  }
 
-  // insert each cell in tbtn into upper
-  for (i = 0; i < tbtn->n_cells; i++) {
-    if (st = chidb_Btree_getCell(tbtn, i, &tcell)) {
-      return st;
-    }
-    if (st = chidb_Btree_insertCell(ubtn, i, &tcell)) {
-      return st;
-    }           
+  if (!st) {
+    // set out parameter to page number of child node
+    *npage_child2 = npage_vbtn;
   }
 
-  // free tbtn
-  // decrement number of pages (like it was never here)
-  chidb_Btree_freeMemNode(bt, tbtn);
-  bt->pager->n_pages--;
+  //free in-memory nodes
+  if (pbtn) chidb_Btree_freeMemNode(bt, pbtn);
+  if (cbtn) chidb_Btree_freeMemNode(bt, cbtn);
+  if (ubtn) chidb_Btree_freeMemNode(bt, ubtn);
+  if (vbtn) chidb_Btree_freeMemNode(bt, vbtn);
 
-  // write pbtn
-  if (st = chidb_Btree_writeNode(bt, pbtn)) {
+  return st;
+}
+
+
+// remove the last cell of a node being loaded (which is also the last
+// one that was added to its cell area) and return it in btc
+static int __chidb_Btree_loadPop(BTreeNode *btn, BTreeCell *btc)
+{
+  uint32_t shared, rest;
+  uint8_t *data;
+  int st;
+
+  if (st = chidb_Btree_getCell(btn, btn->n_cells - 1, btc)) {
     return st;
   }
 
-  // write upper
-  if (st = chidb_Btree_writeNode(bt, ubtn)) {
+  switch (btn->type) {
+    case PGTYPE_VARINDEX_INTERNAL:
+    case PGTYPE_VARINDEX_LEAF:
+      data = __chidb_Btree_varIndexCell(btn, btn->n_cells - 1, &shared, &rest);
+      btn->cells_offset += data + rest - (btn->page->data + btn->cells_offset);
+      break;
+    case PGTYPE_INDEX_INTERNAL:
+      btn->cells_offset += INDEXINTCELL_SIZE;
+      break;
+    default:
+      btn->cells_offset += INDEXLEAFCELL_SIZE;
+      break;
+  }
+  btn->cache = NULL;
+  btn->n_cells--;
+  btn->free_offset -= 2;
+
+  return CHIDB_OK;
+}
+
+
+// write a finished node of a load to a new page, whose number is
+// returned in npage, and empty the in-memory node so it can be reused
+static int __chidb_Btree_loadFlush(BTree *bt, BTreeNode *btn, npage_t *npage)
+{
+  int st;
+
+  if (st = chidb_Pager_allocatePage(bt->pager, npage)) {
     return st;
   }
+  btn->page->npage = *npage;
+  if (st = chidb_Btree_writeNode(bt, btn)) {
+    return st;
+  }
+  __chidb_Btree_resetNode(bt, btn, btn->type);
 
-  // write vbtn
-  if (st = chidb_Btree_writeNode(bt, vbtn)) {
+  return CHIDB_OK;
+}
+
+
+/* Load the entries of an index B-Tree bottom-up
+ *
+ * Builds an index B-Tree from entries that are already sorted by
+ * (keyIdx, keyPk), or by their bytes in a variable-length index,
+ * without searching the tree for each of them. Nodes
+ * are filled from left to right, one per level at a time: when a node
+ * is full, it is written to a new page and its last entry moves up to
+ * the level above (along with the page as its child), so the tree is
+ * balanced and no node is left empty. The node at the top ends up in
+ * the root page. Unlike chidb_Btree_insertInIndex, several entries may
+ * have the same keyIdx.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root of an empty index B-Tree
+ * - next: Function that returns the entries, in order (CHIDB_OK and
+ *         the next entry, or CHIDB_DONE once there are no more entries)
+ *         as leaf cells of the index
+ * - arg: Argument passed to next
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The B-Tree is not an empty index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - Any other error returned by next
+ */
+int chidb_Btree_loadIndex(BTree *bt, npage_t nroot, chidb_Btree_indexSource next, void *arg)
+{
+  BTreeNode *levels[BTREE_LOAD_MAX_DEPTH];
+  BTreeCell btc, up;
+  npage_t child;
+  uint8_t leaf_type, internal_type;
+  int depth, level;
+  int st;
+
+  // every node is built in a copy of the root page, and only gets a
+  // page of its own once it is full (so the root can't be the first
+  // page, whose nodes start after the file header)
+  if (nroot == 1) {
+    return CHIDB_EMISUSE;
+  }
+  if (st = chidb_Btree_getNodeByPage(bt, nroot, &levels[0])) {
     return st;
   }
+  depth = 1;
+  leaf_type = levels[0]->type;
+  internal_type = (leaf_type == PGTYPE_VARINDEX_LEAF) ? PGTYPE_VARINDEX_INTERNAL : PGTYPE_INDEX_INTERNAL;
+  if ((leaf_type != PGTYPE_INDEX_LEAF && leaf_type != PGTYPE_VARINDEX_LEAF) ||
+      levels[0]->n_cells != 0) {
+    st = CHIDB_EMISUSE;
+  }
 
-  // set out parameter to page number of child node
-  *npage_child2 = npage_vbtn;
+  while (!st && !(st = next(arg, &btc))) {
+    btc.type = leaf_type;
 
-  //free in-memory nodes
-  chidb_Btree_freeMemNode(bt, pbtn);
-  chidb_Btree_freeMemNode(bt, ubtn);
-  chidb_Btree_freeMemNode(bt, vbtn);
+    level = 0;
+    while (!notEnoughSpace(levels[level], &btc)) {
+      // the node is full: its last entry goes up, with the node as its
+      // child, and the new entry starts the next node of this level
+      if (st = __chidb_Btree_loadPop(levels[level], &up)) {
+        break;
+      }
+      if (level > 0) {
+        levels[level]->right_page = (internal_type == PGTYPE_VARINDEX_INTERNAL) ?
+                                    up.fields.varIndex.child_page : up.fields.indexInternal.child_page;
+      }
+      if ((st = __chidb_Btree_loadFlush(bt, levels[level], &child)) ||
+          (st = chidb_Btree_insertCell(levels[level], 0, &btc))) {
+        break;
+      }
 
-  return CHIDB_OK;
-}
\ No newline at end of file
+      if (++level == depth) {
+        if (depth == BTREE_LOAD_MAX_DEPTH) {
+          st = CHIDB_ENOMEM;
+          break;
+        }
+        if (st = chidb_Btree_getNodeByPage(bt, nroot, &levels[level])) {
+          break;
+        }
+        __chidb_Btree_resetNode(bt, levels[level], internal_type);
+        depth++;
+      }
+
+      btc.type = internal_type;
+      btc.key = up.key;
+      if (internal_type == PGTYPE_VARINDEX_INTERNAL) {
+        btc.fields.varIndex = up.fields.varIndex;
+        btc.fields.varIndex.child_page = child;
+      } else {
+        btc.fields.indexInternal.keyPk = (up.type == PGTYPE_INDEX_LEAF) ?
+                                         up.fields.indexLeaf.keyPk : up.fields.indexInternal.keyPk;
+        btc.fields.indexInternal.child_page = child;
+      }
+    }
+
+    if (!st) {
+      st = chidb_Btree_insertCell(levels[level], levels[level]->n_cells, &btc);
+    }
+  }
+  if (st == CHIDB_DONE) {
+    st = CHIDB_OK;
+  }
+
+  // the last node of each level is the right child of the level above
+  for (level = 0; !st && level < depth; level++) {
+    if (level > 0) {
+      levels[level]->right_page = child;
+    }
+    if (level < depth - 1) {
+      st = __chidb_Btree_loadFlush(bt, levels[level], &child);
+    } else {
+      levels[level]->page->npage = nroot;
+      st = chidb_Btree_writeNode(bt, levels[level]);
+    }
+  }
+
+  for (level = 0; level < depth; level++) {
+    chidb_Btree_freeMemNode(bt, levels[level]);
+  }
+
+  return st;
+}
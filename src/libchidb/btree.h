@@ -49,6 +49,8 @@
 #define PGTYPE_TABLE_LEAF (0x0D)
 #define PGTYPE_INDEX_INTERNAL (0x02)
 #define PGTYPE_INDEX_LEAF (0x0A)
+#define PGTYPE_VARINDEX_INTERNAL (0x12)
+#define PGTYPE_VARINDEX_LEAF (0x1A)
 
 #define PGHEADER_PGTYPE_OFFSET (0)
 #define PGHEADER_FREE_OFFSET (1)
@@ -62,15 +64,15 @@
 
 /* Cell offsets and sizes */
 
+/* Table internal cells are a 4-byte child page followed by the key,
+ * and table leaf cells the size of the data, the key and the data. The
+ * key and the size are varints, so these are only the largest sizes
+ * (without the data) */
 #define TABLEINTCELL_CHILD_OFFSET (0)
 #define TABLEINTCELL_KEY_OFFSET (4)
 
-#define TABLELEAFCELL_SIZE_OFFSET (0)
-#define TABLELEAFCELL_KEY_OFFSET (4)
-#define TABLELEAFCELL_DATA_OFFSET (8)
-
-#define TABLEINTCELL_SIZE (8)
-#define TABLELEAFCELL_SIZE_WITHOUTDATA (8)
+#define TABLEINTCELL_MAXSIZE (4 + 9)
+#define TABLELEAFCELL_MAXSIZE_WITHOUTDATA (5 + 9)
 
 #define INDEXINTCELL_CHILD_OFFSET (0)
 #define INDEXINTCELL_KEYIDX_OFFSET (8)
@@ -83,19 +85,69 @@
 #define INDEXINTCELL_SIZE (16)
 #define INDEXLEAFCELL_SIZE (12)
 
+/* Variable-length index cells hold a key of up to VARINDEX_MAXKEY bytes
+ * (see index.c for its encoding), whose last 8 bytes are the primary key.
+ * A cell only stores the part of its key that differs from the key of
+ * the previous cell: the length of the prefix they share and the length
+ * of the rest are varints, followed by the rest (internal cells start
+ * with the 4-byte child page). Cells that share nothing are restart
+ * points, which hold their whole key; there is one at least every
+ * VARINDEX_RESTART_INTERVAL cells, so any key can be decoded without
+ * going back to the first cell of the node. */
+#define VARINDEX_MAXKEY (256)
+#define VARINDEX_PKEY_SIZE (8)
+#define VARINDEX_RESTART_INTERVAL (16)
+
+#define VARINDEXLEAFCELL_MAXSIZE (1 + 2 + VARINDEX_MAXKEY)
+#define VARINDEXINTCELL_MAXSIZE (4 + VARINDEXLEAFCELL_MAXSIZE)
+
+/* Maximum depth of a B-Tree built by chidb_Btree_loadIndex */
+#define BTREE_LOAD_MAX_DEPTH (32)
+
 // Advance declarations
 typedef struct BTreeCell BTreeCell;
+
+/* Writes the data of a table leaf cell straight into the page (see
+ * chidb_Btree_insertCell) */
+typedef void (*chidb_Btree_cellFill)(void *arg, uint8_t *dst);
 typedef struct BTreeNode BTreeNode;
 
 /* The BTree struct represent a "B-Tree file". It contains a pointer to the
  * chidb database it is a part of, and a pointer to a Pager, which it will
- * use to access pages on the file */
+ * use to access pages on the file. Nodes are read through snapshot if it
+ * is not NULL (see chidb_Pager_openSnapshot). writer is true while the
+ * BTree holds the write lock of a shared pager (see chidb_Btree_beginWrite),
+ * and shared_writer is also true if that lock is held in shared mode
+ * (see chidb_Btree_beginSharedWrite) */
 typedef struct BTree
 {
     chidb *db;
     Pager *pager;
+    PagerSnapshot *snapshot;
+    bool writer;
+    bool shared_writer;
 } Btree;
 
+/* The BTreeNodeCache struct is the decoded form of a committed B-Tree node,
+ * built by the first reader of the node and kept with the page's buffer in
+ * the pager's buffer pool (see chidb_Pager_setAux), so that later readers
+ * neither parse the page header nor decode cells to search the node. keys
+ * holds the key of every cell of a table or index node (NULL in variable-length
+ * index nodes, whose keys are compared in place), and children the child page
+ * of every cell of an internal node (NULL in leaf nodes). Both are allocated
+ * along with the struct, which is freed with a single free().
+ */
+typedef struct BTreeNodeCache
+{
+    uint8_t type;
+    uint16_t free_offset;
+    ncell_t n_cells;
+    uint16_t cells_offset;
+    npage_t right_page;
+    chidb_key_t *keys;
+    npage_t *children;
+} BTreeNodeCache;
+
 /* The BTreeNode struct is an in-memory representation of a B-Tree node. Thus,
  * most of the values in this struct are simply a copy, for ease of access,
  * of what can be found in the raw disk page. When modifying type, free_offset,
@@ -103,7 +155,9 @@ typedef struct BTree
  * of the BTreeNode variable (the changes will be effective once the BTreeNode
  * is written to disk, using chidb_Btree_writeNode). Modifications of the
  * cell offset array or of the cells should be done directly on the in-memory
- * page returned by the Pager.
+ * page returned by the Pager. cache is the decoded form of the node shared
+ * through the buffer pool, if the node was read from it; it is dropped as
+ * soon as the node is modified.
  *
  * See The chidb File Format document for more details on the meaning of each
  * field.
@@ -117,6 +171,7 @@ struct BTreeNode
     uint16_t cells_offset;     /* Byte offset of start of cells in page */
     npage_t right_page;        /* Right page (internal nodes only) */
     uint8_t *celloffset_array; /* Pointer to start of cell offset array in the in-memory page */
+    const BTreeNodeCache *cache; /* Decoded node (NULL if none) */
 };
 
 /* BTreeCell is an in-memory representation of a cell. See The chidb File Format
@@ -135,6 +190,8 @@ struct BTreeCell
         {
             uint32_t data_size;  /* Number of bytes of data stored in this cell */
             uint8_t *data;       /* Pointer to in-memory copy of data stored in this cell */
+            chidb_Btree_cellFill fill;  /* If data is NULL, writes the data into the page */
+            void *fill_arg;
         } tableLeaf;
         struct
         {
@@ -145,11 +202,28 @@ struct BTreeCell
         {
             chidb_key_t keyPk;         /* Primary key of row where the indexed field is equal to key */
         } indexLeaf;
+        struct
+        {
+            npage_t child_page;  /* Child page with keys < key (internal cells only) */
+            chidb_key_t keyPk;   /* Primary key of row, the last bytes of the key */
+            uint16_t key_size;   /* Number of bytes of the key */
+            uint8_t key[VARINDEX_MAXKEY];  /* Whole key (decompressed) */
+        } varIndex;
     } fields;
 };
 
+/* Returns the next entry of an index loaded by chidb_Btree_loadIndex,
+ * as a leaf cell of the index: CHIDB_OK and the entry, CHIDB_DONE if
+ * there are no more entries, or an error code that stops the load */
+typedef int (*chidb_Btree_indexSource)(void *arg, BTreeCell *btc);
+
 
 int chidb_Btree_open(const char *filename, chidb *db, BTree **bt);
+int chidb_Btree_openShared(const char *filename, chidb *db, BTree **bt);
+int chidb_Btree_beginWrite(BTree *bt);
+int chidb_Btree_endWrite(BTree *bt);
+int chidb_Btree_beginSharedWrite(BTree *bt);
+int chidb_Btree_endSharedWrite(BTree *bt, bool failed);
 int chidb_Btree_close(BTree *bt);
 
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **node);
@@ -162,13 +236,22 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *node);
 int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
 int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
 
+int chidb_Btree_keySearch(BTreeNode *btn, chidb_key_t key, bool after, ncell_t *ncell, npage_t *child, bool *match);
+
 int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size);
 
 int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size);
 int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk);
+int chidb_Btree_insertInVarIndex(BTree *bt, npage_t nroot, uint8_t *key, uint16_t size);
 int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc);
 int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc);
 int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_cell, npage_t *npage_child2);
 
+int chidb_Btree_keyCmp(const uint8_t *key1, uint16_t size1, const uint8_t *key2, uint16_t size2);
+int chidb_Btree_varIndexSearch(BTreeNode *btn, const uint8_t *key, uint16_t size, bool after,
+                               ncell_t *ncell, BTreeCell *cell);
+
+int chidb_Btree_loadIndex(BTree *bt, npage_t nroot, chidb_Btree_indexSource next, void *arg);
+
 
 #endif /*BTREE_H_*/
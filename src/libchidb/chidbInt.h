@@ -74,12 +74,14 @@
 #define CHIDB_EQUIT (8000)  // when user typed .quit in the shell
 
 #define DEFAULT_PAGE_SIZE (1024)
+#define DEFAULT_BUSY_TIMEOUT (5000)  /* Milliseconds (see chidb_busy_timeout) */
+#define DEFAULT_SCAN_THREADS (0)     /* One per processor (see chidb_scan_threads) */
 
 #define MAX_STR_LEN (256)
 
 typedef uint16_t ncell_t;
 typedef uint32_t npage_t;
-typedef uint32_t chidb_key_t;
+typedef uint64_t chidb_key_t;
 
 /* Forward declaration */
 typedef struct BTree BTree;
@@ -92,6 +94,8 @@ typedef struct chidb_sql_schema
   char *assoc;
   int rpage;
   chisql_statement_t *stmt;
+  struct chidb_stat *stat;  /* Statistics collected by ANALYZE (NULL if none) */
+  npage_t bloom;            /* Header page of its Bloom filter (0 if none) */
 } chidb_sql_schema_t;
 
 /* A chidb database is initially only a BTree.
@@ -104,6 +108,10 @@ struct chidb
     BTree   *bt;
     list_t schemas;
     int need_refresh;
+    int autocommit;     /* 0 while an explicit transaction is active */
+    int busy_timeout;   /* Milliseconds to wait for the write lock */
+    int scan_threads;   /* Threads that scan a table (0: one per processor) */
+    uint32_t schema_cookie; /* Schema cookie of the pager when the schema was loaded */
 };
 
 #endif /*CHIDBINT_H_*/
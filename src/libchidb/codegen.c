@@ -37,11 +37,32 @@
  *
  */
 
+#include <inttypes.h>
 #include <chidb/chidb.h>
 #include <chisql/chisql.h>
 #include "dbm.h"
 #include "util.h"
-
+#include "stats.h"
+#include "bloom.h"
+#include "index.h"
+#include "optimizer.h"
+
+
+/* Where the rows produced by a SELECT go. A row can be checked against
+ * (and added to) record sets before being produced, or just added to a
+ * record set (to be used by a later SELECT). Rows can also be skipped
+ * (OFFSET) and counted (LIMIT), stopping the SELECT once the count runs
+ * out. Cursors and registers are -1 if unused. */
+typedef struct select_sink
+{
+    int distinct_c;     // Skip rows already in this record set (and add the rest)
+    int filter_c;       // Skip rows depending on whether they are in this record set
+    bool filter_found;  // If filtering, keep the rows that are in it (or the ones that are not)
+    int collect_c;      // Add the rows to this record set instead of producing them
+    int limit_reg;      // Rows still to be produced
+    int offset_reg;     // Rows still to be skipped
+    int topn;           // If sorting, only the first topn rows can be produced (0 if any)
+} select_sink_t;
 
 int chidb_get_tables(list_t tables, chisql_statement_t *sql_statement);
 int chidb_get_sra_tables(list_t tables, SRA_t *s);
@@ -50,27 +71,62 @@ int chidb_get_select_columns(list_t column_names, Expression_t *exp_list);
 int load_schema(chidb *db, npage_t nroot);
 
 int chidb_stmt_seed(chidb_stmt *stmt, list_t *ops, list_t *tables, list_t *names);
+int chidb_stmt_index_columns(chidb_sql_schema_t *table, Index_t *index, int *pos, int *ncolumns, int *nkeys, bool *var);
+int chidb_stmt_insert_indexes(chidb_stmt *stmt, list_t *ops, char *table_name, Literal_t *values, int reg);
 int chidb_stmt_insert_op(chidb_stmt *stmt, list_t *ops, chidb_dbm_op_t *new_op);
 int chidb_stmt_select_project(chidb_stmt *stmt, list_t tables);
 int chidb_stmt_project_expand(chidb_stmt *stmt, SRA_t *sra, list_t tables);
 
 int chidb_stmt_select_star_expand(SRA_Project_t *sra_project, list_t names, list_t names2);
+int chidb_stmt_load_index_column(chidb_stmt *stmt, list_t *ops, chidb_plan_t *plan, list_t *cnames1,
+                                 int idx_c_reg, char *col_name, int reg);
+int chidb_stmt_load_column(chidb_stmt *stmt, list_t *ops, list_t *cnames1, list_t *cnames2,
+                           int c1_reg, int c2_reg, char *col_name, int reg);
+char chidb_stmt_agg_func(Expression_t *expr);
+int chidb_stmt_select_core(chidb_stmt *stmt, SRA_t *sra, int base, select_sink_t *sink,
+                           list_t *ops, list_t *snames);
+int chidb_stmt_select_limit(chidb_stmt *stmt, list_t *ops, SRA_Project_t *sra_project, int reg, select_sink_t *sink);
+int chidb_stmt_row_len(select_sink_t *sink);
+int chidb_stmt_emit_row(chidb_stmt *stmt, list_t *ops, select_sink_t *sink, int first_reg, int nregs, int rec_reg);
+int chidb_stmt_patch_jumps(list_t *jumps, int addr);
+int chidb_stmt_vectorize(list_t *ops, int first, int last);
 int chidb_count_select_columns(int *ncols, Expression_t *exp_list);
 
 /* Step 1 schema loading is in api.c, steps 2-5 contained in here */
 
-//Creates and allocates an op
-chidb_dbm_op_t *chidb_make_op(opcode_t code, int32_t p1, int32_t p2, int32_t p3, char *p4)
+//Creates and allocates an op (in the statement's arena, so it does not
+//need to be freed once it has been copied into the program). p4 is copied
+//too, since it may be a buffer of the function that generates the op.
+chidb_dbm_op_t *chidb_make_op(chidb_stmt *stmt, opcode_t code, int32_t p1, int32_t p2, int32_t p3, char *p4)
 {
-    chidb_dbm_op_t *ret = malloc(sizeof(chidb_dbm_op_t));
+    chidb_dbm_op_t *ret = chidb_Arena_alloc(&stmt->arena, sizeof(chidb_dbm_op_t));
     ret->opcode = code;
     ret->p1 = p1;
     ret->p2 = p2;
     ret->p3 = p3;
-    ret->p4 = p4;
+    ret->p4 = p4 ? chidb_Arena_strdup(&stmt->arena, p4) : NULL;
     return ret;
 }
 
+// Makes the instruction that loads a numeric literal into a register.
+// Integers that fit in p1 use Integer; wider ones (Int64) and doubles
+// (Real) are spelled out in p4 instead
+chidb_dbm_op_t *chidb_make_number_op(chidb_stmt *stmt, Literal_t *lit, int32_t reg)
+{
+    char num[32];
+
+    if(lit->t == TYPE_DOUBLE)
+    {
+        snprintf(num, sizeof(num), "%.17g", lit->val.dval);
+        return chidb_make_op(stmt, Op_Real, 0, reg, 0, num);
+    }
+    if(lit->val.ival >= INT32_MIN && lit->val.ival <= INT32_MAX)
+        return chidb_make_op(stmt, Op_Integer, (int32_t) lit->val.ival, reg, 0, NULL);
+
+    snprintf(num, sizeof(num), "%" PRId64, lit->val.ival);
+    return chidb_make_op(stmt, Op_Int64, 0, reg, 0, num);
+}
+
 //Standardized function for error checking
 int chidb_stmt_check(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t table_names)
 {   
@@ -109,12 +165,113 @@ int chidb_stmt_check(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t tabl
 
 /********************** Step 4: Create Table Code Generation ***********************/
 
+int chidb_stmt_create_index(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+    Index_t *index = sql_stmt->stmt.create->index;
+    chidb_sql_schema_t *table = NULL;
+    char columns[INDEX_MAX_COLUMNS * 4 + 1] = "";
+    char options[sizeof(columns) + 32];
+    int pos[INDEX_MAX_COLUMNS], ncolumns, nkeys, nOps, i;
+    bool var = false;
+
+    if(chidb_table_exists(stmt->db->schemas, index->name) == CHIDB_OK)
+        return CHIDB_EINVALIDSQL;
+
+    list_iterator_start(&(stmt->db->schemas));
+    while(list_iterator_hasnext(&(stmt->db->schemas)))
+    {
+        chidb_sql_schema_t *next = (chidb_sql_schema_t *)list_iterator_next(&(stmt->db->schemas));
+        if(!strcmp(next->type, "table") && !strcmp(next->name, index->table_name))
+            table = next;
+    }
+    list_iterator_stop(&(stmt->db->schemas));
+    if(table == NULL)
+        return CHIDB_EINVALIDSQL;
+
+    if(chidb_stmt_index_columns(table, index, pos, &ncolumns, &nkeys, &var) != CHIDB_OK)
+        return CHIDB_EINVALIDSQL;
+    for(i = 0; i < ncolumns; i++)
+        sprintf(columns + strlen(columns), "%s%d", i ? "," : "", pos[i]);
+
+    // A single integer column is indexed with integer cells, and anything
+    // else in a variable-length index (see btree.h)
+    if(ncolumns > 1)
+        sprintf(options, "%srecord columns=%s keys=%d", index->unique ? "unique " : "", columns, nkeys);
+    else if(var)
+        strcpy(options, index->unique ? "unique record" : "record");
+    else
+        strcpy(options, index->unique ? "unique" : "");
+
+    // clipping the semicolon
+    (sql_stmt->text)[strlen(sql_stmt->text)-1] = '\0';
+
+    // The index is filled with the table's rows when it is created
+    chidb_dbm_op_t ops[] = {
+            {Op_Integer, 1, 0, 0, NULL},
+            {Op_OpenWrite, 0, 0, 5, NULL},
+            {Op_CreateIndex, 4, table->rpage, pos[0], *options ? options : NULL},
+            {Op_String, 5, 1, 0, "index"},
+            {Op_String, (int32_t)strlen(index->name), 2, 0, index->name},
+            {Op_String, (int32_t)strlen(index->table_name), 3, 0, index->table_name},
+            {Op_String, (int32_t)strlen(sql_stmt->text), 5, 0, sql_stmt->text},
+            {Op_MakeRecord, 1, 5, 6, NULL},
+            {Op_Integer, (int32_t)list_size(&(stmt->db->schemas))+1, 7, 0, NULL},
+            {Op_Insert, 0, 6, 7, NULL},
+            {Op_Close, 0, 0, 0, NULL}
+    };
+
+    nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+
+    stmt->sql = sql_stmt;
+    stmt->nOps = nOps;
+
+    for(i=0; i < nOps; i++)
+        chidb_stmt_set_op(stmt, &ops[i], i);
+
+    stmt->db->need_refresh = 1;
+
+    return CHIDB_OK;
+}
+
+/* Finds the positions (in the table) of the columns of an index: the
+ * indexed columns, followed by the included ones. nkeys is the number of
+ * indexed columns, and var is set if any column is not an integer */
+int chidb_stmt_index_columns(chidb_sql_schema_t *table, Index_t *index, int *pos, int *ncolumns, int *nkeys, bool *var)
+{
+    StrList_t *names[2] = { index->columns, index->include };
+    int col_pos, i;
+
+    *ncolumns = *nkeys = 0;
+    *var = false;
+    for(i = 0; i < 2; i++)
+    {
+        for(StrList_t *name = names[i]; name != NULL; name = name->next)
+        {
+            Column_t *column = table->stmt->stmt.create->table->columns;
+            for(col_pos = 0; column != NULL && strcmp(column->name, name->str); col_pos++)
+                column = column->next;
+            if(column == NULL || *ncolumns == INDEX_MAX_COLUMNS ||
+               (column->type != TYPE_INT && column->type != TYPE_TEXT && column->type != TYPE_DOUBLE))
+                return CHIDB_EINVALIDSQL;
+
+            *var = *var || column->type != TYPE_INT;
+            pos[(*ncolumns)++] = col_pos;
+            *nkeys += (i == 0);
+        }
+    }
+
+    return CHIDB_OK;
+}
+
 int chidb_stmt_create(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 {
     int opnum = 0;
     int nOps;
     int i;
 
+    if(sql_stmt->stmt.create->t == CREATE_INDEX)
+        return chidb_stmt_create_index(stmt, sql_stmt);
+
     int ret = chidb_table_exists(stmt->db->schemas, sql_stmt->stmt.create->table->name);
     if(ret == CHIDB_OK)
         return CHIDB_EINVALIDSQL;
@@ -152,6 +309,75 @@ int chidb_stmt_create(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     return CHIDB_OK;
 }
 
+/********************** Analyze Code Generation ***********************/
+
+int chidb_stmt_analyze(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+    char *table = sql_stmt->stmt.analyze;
+
+    if(table != NULL && chidb_table_exists(stmt->db->schemas, table) != CHIDB_OK)
+        return CHIDB_EINVALIDSQL;
+
+    chidb_dbm_op_t ops[] = {
+            {Op_Analyze, 0, 0, 0, table},
+            {Op_Halt, 0, 0, 0, NULL}
+    };
+
+    stmt->sql = sql_stmt;
+    stmt->nOps = 2;
+
+    for(int i=0; i < 2; i++)
+        chidb_stmt_set_op(stmt, &ops[i], i);
+
+    return CHIDB_OK;
+}
+
+/********************** Bloom Filter Code Generation ***********************/
+
+int chidb_stmt_bloom(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+    char *name = sql_stmt->stmt.bloom;
+    // (no table or index has its root in page 1, which is the schema's)
+    int rpage = chidb_get_root(stmt->db->schemas, name);
+
+    // the filters of the tables chidb writes to itself would go stale
+    if(rpage == CHIDB_EINVALIDSQL || !strncmp(name, "chidb_", 6))
+        return CHIDB_EINVALIDSQL;
+
+    chidb_dbm_op_t ops[] = {
+            {Op_CreateBloom, 0, 0, 0, name},
+            {Op_Halt, 0, 0, 0, NULL}
+    };
+
+    stmt->sql = sql_stmt;
+    stmt->nOps = 2;
+
+    for(int i=0; i < 2; i++)
+        chidb_stmt_set_op(stmt, &ops[i], i);
+
+    return CHIDB_OK;
+}
+
+/********************** Transaction Code Generation ***********************/
+
+int chidb_stmt_transaction(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+    /* BEGIN turns autocommit off; COMMIT and ROLLBACK turn it back on,
+     * ROLLBACK discarding the transaction's changes */
+    chidb_dbm_op_t ops[] = {
+            {Op_AutoCommit, sql_stmt->type != STMT_BEGIN, sql_stmt->type == STMT_ROLLBACK, 0, NULL},
+            {Op_Halt, 0, 0, 0, NULL}
+    };
+
+    stmt->sql = sql_stmt;
+    stmt->nOps = 2;
+
+    for(int i=0; i < 2; i++)
+        chidb_stmt_set_op(stmt, &ops[i], i);
+
+    return CHIDB_OK;
+}
+
 /********************** Step 3: Insert Code Generation ***********************/
 
 int chidb_stmt_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
@@ -190,8 +416,8 @@ int chidb_stmt_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     {
         char *col_name = (char *)(list_iterator_next(&cnames));
         int ret = chidb_column_get_type(stmt->db->schemas, table_name, col_name);
-        if(ret == CHIDB_EINVALIDSQL)
-            return ret;
+        if(ret < 0)
+            return CHIDB_EINVALIDSQL;
         else
         {
             if(values == NULL)
@@ -199,6 +425,12 @@ int chidb_stmt_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
                 // If the values list runs out before the string list, something is really wrong
                 return CHIDB_EINVALIDSQL;
             }
+            if(values->t == TYPE_INT && ret == TYPE_DOUBLE) // Integers are widened
+            {
+                double d = (double) values->val.ival;
+                values->t = TYPE_DOUBLE;
+                values->val.dval = d;
+            }
             if(values->t != ret) // Ret holds the type of the column
             {
                 fprintf(stderr, "Input data type mismatch in column %s\n", col_name);
@@ -218,9 +450,9 @@ int chidb_stmt_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     int root = chidb_get_root(stmt->db->schemas, table_name);
     if(root == CHIDB_EINVALIDSQL){return root;}
 
-    chidb_dbm_op_t *first = chidb_make_op(Op_Integer, root, 0, 0, NULL); // The root page number is now in reg 0
+    chidb_dbm_op_t *first = chidb_make_op(stmt, Op_Integer, root, 0, 0, NULL); // The root page number is now in reg 0
     list_append(&ops, first); // I'm fine passing the address, because this list will only be used in this function
-    chidb_dbm_op_t *second = chidb_make_op(Op_OpenWrite, 0, 0, list_size(&cnames), NULL);
+    chidb_dbm_op_t *second = chidb_make_op(stmt, Op_OpenWrite, 0, 0, list_size(&cnames), NULL);
     list_append(&ops, second);
     // Open write using cursor zero
 
@@ -229,14 +461,14 @@ int chidb_stmt_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     values = sql_stmt->stmt.insert->values; // Need to put this back because we ruined it before
     while(values != NULL)
     {
-        if(values->t == TYPE_INT)
+        if(values->t == TYPE_INT || values->t == TYPE_DOUBLE)
         {
-            chidb_dbm_op_t *next = chidb_make_op(Op_Integer, values->val.ival, reg, 0, NULL);
+            chidb_dbm_op_t *next = chidb_make_number_op(stmt, values, reg);
             list_append(&ops, next);
         }
         else if(values->t == TYPE_TEXT)
         {
-            chidb_dbm_op_t *next = chidb_make_op(Op_String, strlen(values->val.strval), reg, 0, values->val.strval);
+            chidb_dbm_op_t *next = chidb_make_op(stmt, Op_String, strlen(values->val.strval), reg, 0, values->val.strval);
             list_append(&ops, next);
         }
         // Other values are unspported by chisql
@@ -244,7 +476,7 @@ int chidb_stmt_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
         if(reg==1) //The key slot in CHIDB needs to be null, as specified in the project spec
         {
             reg++;
-            chidb_dbm_op_t * next = chidb_make_op(Op_Null, 0, reg, 0, NULL);
+            chidb_dbm_op_t * next = chidb_make_op(stmt, Op_Null, 0, reg, 0, NULL);
             list_append(&ops, next);
             reg++;
         }
@@ -258,16 +490,25 @@ int chidb_stmt_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 
     // Create record from r1 through (r1+n-1), store in r2
     // *NOTE: the primary key will always be first
-    chidb_dbm_op_t *make = chidb_make_op(Op_MakeRecord,2,reg-2,reg, NULL);
+    chidb_dbm_op_t *make = chidb_make_op(stmt, Op_MakeRecord,2,reg-2,reg, NULL);
     list_append(&ops, make);
 
     // Cursor 0, record stored at reg+1, the first one is the primary key
-    chidb_dbm_op_t *insert = chidb_make_op(Op_Insert,0,reg,1, NULL);
+    chidb_dbm_op_t *insert = chidb_make_op(stmt, Op_Insert,0,reg,1, NULL);
     list_append(&ops, insert);
     // Close Cursor 0
-    chidb_dbm_op_t *close = chidb_make_op(Op_Close,0,0,0,NULL);
+    chidb_dbm_op_t *close = chidb_make_op(stmt, Op_Close,0,0,0,NULL);
     list_append(&ops, close);
 
+    // Then add the row to every index on the table
+    ret = chidb_stmt_insert_indexes(stmt, &ops, table_name, sql_stmt->stmt.insert->values, reg + 1);
+    if(ret != CHIDB_OK)
+    {
+        list_destroy(&ops);
+        list_destroy(&cnames);
+        return ret;
+    }
+
     // Finally, transfer the list of ops into an array of ops, and fix it all up in the actual stmt
     int numOps = list_size(&ops);
     int i;
@@ -275,46 +516,236 @@ int chidb_stmt_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     {
         chidb_dbm_op_t *next = (chidb_dbm_op_t *)list_get_at(&ops, i);
         chidb_stmt_set_op(stmt, next, i);
-        // There seems to be a leak having to do with set_op but I can't figure out how to plug it...
     }
 
-    //Free everything! 
-    chidb_dbm_op_t *op_free;
-    while(!list_empty(&ops))
+    list_destroy(&ops);
+    list_destroy(&cnames);
+
+    return CHIDB_OK;
+}
+
+/* Adds the row inserted by an INSERT to the indexes on its table, using
+ * registers from reg up. The key of each index is loaded again from the
+ * values of the INSERT (the primary key being the first one), as a
+ * record of its columns if it has more than one. UNIQUE is only checked
+ * when the index is created. */
+int chidb_stmt_insert_indexes(chidb_stmt *stmt, list_t *ops, char *table_name, Literal_t *values, int reg)
+{
+    chidb_sql_schema_t *table = NULL;
+    int pos[INDEX_MAX_COLUMNS], ncolumns, nkeys, c = 1, i, j;
+    bool var;
+
+    list_iterator_start(&(stmt->db->schemas));
+    while(list_iterator_hasnext(&(stmt->db->schemas)))
     {
-        op_free = (chidb_dbm_op_t *)list_fetch(&ops);
-        free(op_free->p4);
-        free(op_free);
+        chidb_sql_schema_t *next = (chidb_sql_schema_t *)list_iterator_next(&(stmt->db->schemas));
+        if(!strcmp(next->type, "table") && !strcmp(next->name, table_name))
+            table = next;
     }
+    list_iterator_stop(&(stmt->db->schemas));
+    if(table == NULL)
+        return CHIDB_EINVALIDSQL;
 
-    list_destroy(&ops);
-    list_destroy(&cnames);
+    for(int n = 0; n < list_size(&(stmt->db->schemas)); n++)
+    {
+        chidb_sql_schema_t *next = (chidb_sql_schema_t *)list_get_at(&(stmt->db->schemas), n);
+        if(strcmp(next->type, "index") || strcmp(next->assoc, table_name))
+            continue;
+
+        if(chidb_stmt_index_columns(table, next->stmt->stmt.create->index, pos, &ncolumns, &nkeys, &var) != CHIDB_OK)
+            return CHIDB_EINVALIDSQL;
+
+        list_append(ops, chidb_make_op(stmt, Op_Integer, next->rpage, reg, 0, NULL));
+        list_append(ops, chidb_make_op(stmt, Op_OpenWrite, c, reg, 0, NULL));
+        for(i = 0; i < ncolumns; i++)
+        {
+            Literal_t *value = values;
+            for(j = 0; value != NULL && j < pos[i]; j++)
+                value = value->next;
+            if(value == NULL)
+                return CHIDB_EINVALIDSQL;
+            if(value->t == TYPE_TEXT)
+                list_append(ops, chidb_make_op(stmt, Op_String, strlen(value->val.strval), reg + 1 + i, 0,
+                                               value->val.strval));
+            else
+                list_append(ops, chidb_make_number_op(stmt, value, reg + 1 + i));
+        }
+        if(ncolumns > 1)
+            list_append(ops, chidb_make_op(stmt, Op_MakeRecord, reg + 1, ncolumns, reg + 1 + ncolumns, NULL));
+        // the primary key was loaded in register 1
+        list_append(ops, chidb_make_op(stmt, Op_IdxInsert, c, ncolumns > 1 ? reg + 1 + ncolumns : reg + 1, 1, NULL));
+        list_append(ops, chidb_make_op(stmt, Op_Close, c, 0, 0, NULL));
+        c++;
+    }
 
     return CHIDB_OK;
 }
 
 /********************** Step 2: Simple Select Code Generation ***********************/
 
+/*
+ * A SELECT DISTINCT drops the rows it has already produced, using a record
+ * set. A set operation runs both SELECTs one after the other: UNION
+ * produces the rows of both (through a shared DISTINCT record set), while
+ * INTERSECT and EXCEPT first collect the rows of the right SELECT in a
+ * record set, and then produce the (distinct) rows of the left SELECT that
+ * are, or are not, in it.
+ *
+ * LIMIT and OFFSET (which, in a set operation, come after the right SELECT
+ * but apply to the whole statement) are counted down in registers below
+ * those of the SELECTs. Once the limit is reached, the scan stops early.
+ */
+int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+    list_t ops;         // Chidb_ops held in here
+    list_t snames;      // Column names that are being selected
+    list_t snames2;     // Column names selected by the right SELECT (if set operation)
+
+    list_init(&ops);
+    list_init(&snames);
+    list_init(&snames2);
+
+    SRA_t *sra = sql_stmt->stmt.select;
+    select_sink_t sink = { -1, -1, false, -1, -1, -1, 0 };
+    select_sink_t collect = { -1, -1, false, -1, -1, -1, 0 };
+    SRA_Project_t *last;    // The SELECT that has the LIMIT and OFFSET (if any)
+    int nsets = 0;      // Number of record set cursors (numbered from 0)
+    int base;           // First register and cursor of each SELECT
+    int rc, j;
+
+    if(sra->t == SRA_PROJECT)
+    {
+        last = &sra->project;
+        if(sra->project.distinct)
+        {
+            list_append(&ops, chidb_make_op(stmt, Op_SetOpen, 0, 0, 0, NULL));
+            sink.distinct_c = 0;
+            nsets = 1;
+        }
+
+        base = chidb_stmt_select_limit(stmt, &ops, last, nsets, &sink);
+        if((rc = chidb_stmt_select_core(stmt, sra, base, &sink, &ops, &snames)) != CHIDB_OK)
+            return rc;
+    }
+    else if(sra->t == SRA_UNION || sra->t == SRA_INTERSECT || sra->t == SRA_EXCEPT)
+    {
+        SRA_t *sra1 = sra->binary.sra1;
+        SRA_t *sra2 = sra->binary.sra2;
+
+        // We only support combining two plain SELECTs
+        if(sra1->t != SRA_PROJECT || sra2->t != SRA_PROJECT)
+        {
+            fprintf(stderr, "%s\n", "esql: only two selects can be combined");
+            return CHIDB_EINVALIDSQL;
+        }
+        if(sra1->project.order_by != NULL || sra2->project.order_by != NULL)
+        {
+            fprintf(stderr, "%s\n", "esql: order by is not supported with set operations");
+            return CHIDB_EINVALIDSQL;
+        }
+
+        // A LIMIT (or OFFSET) after the right SELECT applies to the whole statement
+        if(sra1->project.limit >= 0 || sra1->project.offset > 0)
+        {
+            fprintf(stderr, "%s\n", "esql: limit must come after the last select");
+            return CHIDB_EINVALIDSQL;
+        }
+        last = &sra2->project;
+
+        if(sra->t == SRA_UNION)
+        {
+            list_append(&ops, chidb_make_op(stmt, Op_SetOpen, 0, 0, 0, NULL));
+            sink.distinct_c = 0;
+            nsets = 1;
+
+            base = chidb_stmt_select_limit(stmt, &ops, last, nsets, &sink);
+            if((rc = chidb_stmt_select_core(stmt, sra1, base, &sink, &ops, &snames)) != CHIDB_OK)
+                return rc;
+            if((rc = chidb_stmt_select_core(stmt, sra2, base, &sink, &ops, &snames2)) != CHIDB_OK)
+                return rc;
+        }
+        else
+        {
+            list_append(&ops, chidb_make_op(stmt, Op_SetOpen, 0, 0, 0, NULL));
+            list_append(&ops, chidb_make_op(stmt, Op_SetOpen, 1, 0, 0, NULL));
+            collect.collect_c = 0;
+            sink.filter_c = 0;
+            sink.filter_found = (sra->t == SRA_INTERSECT);
+            sink.distinct_c = 1;
+            nsets = 2;
+
+            base = chidb_stmt_select_limit(stmt, &ops, last, nsets, &sink);
+            if((rc = chidb_stmt_select_core(stmt, sra2, base, &collect, &ops, &snames2)) != CHIDB_OK)
+                return rc;
+            if((rc = chidb_stmt_select_core(stmt, sra1, base, &sink, &ops, &snames)) != CHIDB_OK)
+                return rc;
+        }
+
+        if(list_size(&snames) != list_size(&snames2))
+        {
+            fprintf(stderr, "%s\n", "esql: selects have a different number of columns");
+            return CHIDB_EINVALIDSQL;
+        }
+    }
+    else
+    {
+        // We don't support anything else
+        fprintf(stderr, "%s\n", "esql: unsupported select");
+        return CHIDB_EINVALIDSQL;
+    }
+
+    for(j = 0; j < nsets; j++)
+        list_append(&ops, chidb_make_op(stmt, Op_Close, j, 0, 0, NULL));
+    list_append(&ops, chidb_make_op(stmt, Op_Halt, 0, 0, 0, NULL));
+
+    // ------------------convert instructions to stmt struct------------------
+    for(j = 0; j < list_size(&ops); j++)
+    {
+        chidb_dbm_op_t *next = (chidb_dbm_op_t *)list_get_at(&ops, j);
+        chidb_stmt_set_op(stmt, next, j);
+    }
+    // ------------------convert column names from list to array--------------
+
+    char **cols = chidb_Arena_alloc(&stmt->arena, sizeof(char *) * list_size(&snames));
+    for(j=0; j < list_size(&snames); j++)
+    {
+        cols[j] = chidb_Arena_strdup(&stmt->arena, list_get_at(&snames, j));
+    }
+
+    stmt->nCols = list_size(&snames);
+    stmt->cols = cols;
+
+    list_destroy(&ops);
+    list_destroy(&snames);
+    list_destroy(&snames2);
+
+    return CHIDB_OK;
+}
+
 /* 
  * assumes well-formed sql queries abiding by project spec limitations.
  * note: sra_select != NULL means there is a WHERE
  *       sra_table2 != NULL means there is a NATURAL JOIN
+ *
+ * Generates the code of a single SELECT (without the final halt) into ops.
+ * Registers and cursors are numbered from base up, so that the cursors
+ * below base can be used by the caller (e.g., for the record sets of a
+ * set operation). Rows go to the given sink, and the names of the
+ * selected columns are appended to snames.
  */
-int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+int chidb_stmt_select_core(chidb_stmt *stmt, SRA_t *sra, int base, select_sink_t *sink,
+                           list_t *ops, list_t *snames)
 {
     // ---------------------convenience list setup-----------------------------
 
     list_t tnames;      // Tables we are selecting from
     list_t cnames1;     // Column names in table 1
     list_t cnames2;     // Column names in table 2 (if natural join)
-    list_t snames;      // Column names that are being selected
-    list_t ops;         // Chidb_ops held in here
-
+    list_t unames;      // Column names used by the query (if on a single table)
+    
     list_init(&tnames);
     list_init(&cnames1);
     list_init(&cnames2);
-    list_init(&snames);
-    list_init(&ops);
 
 
     // ------------------------sql_stmt unpacking------------------------------
@@ -325,8 +756,9 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     SRA_Table_t *sra_table1 = NULL;
     SRA_Table_t *sra_table2 = NULL;
 
-    SRA_t *sra_next = sql_stmt->stmt.select;
+    SRA_t *sra_next = sra;
     char *next_name;
+    int j;
     
     while(sra_next != NULL)
     {
@@ -346,7 +778,7 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
                 }
 
                 // Add name of table1 to tnames list
-                list_append(&tnames, strdup(sra_table1->ref->table_name));
+                list_append(&tnames, chidb_Arena_strdup(&stmt->arena, sra_table1->ref->table_name));
 
                 // Populate cnames1 list with column names of table1
                 chidb_column_names(stmt->db->schemas, list_get_at(&tnames, 0), &cnames1);
@@ -364,14 +796,38 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 
             case SRA_NATURAL_JOIN:
                 // If single table, set in SRA_TABLE case
-                // We only support 2 tables being natural joined
-                sra_table1 = &(sra_next->binary.sra1->table);
-                sra_table2 = &(sra_next->binary.sra2->table);
+                // We only support 2 tables being natural joined. The
+                // optimizer may have pushed the where down to one of them.
+                for(j = 0; j < 2; j++)
+                {
+                    SRA_t *side = (j == 0) ? sra_next->binary.sra1 : sra_next->binary.sra2;
+
+                    if(side->t == SRA_SELECT)
+                    {
+                        if(sra_select != NULL)
+                        {
+                            fprintf(stderr, "%s\n", "esql: only one where condition is supported");
+                            return CHIDB_EINVALIDSQL;
+                        }
+                        sra_select = &(side->select);
+                        side = sra_select->sra;
+                    }
+                    if(side->t != SRA_TABLE)
+                    {
+                        fprintf(stderr, "%s\n", "esql: can only join two tables");
+                        return CHIDB_EINVALIDSQL;
+                    }
+
+                    if(j == 0)
+                        sra_table1 = &(side->table);
+                    else
+                        sra_table2 = &(side->table);
+                }
                 sra_next = NULL;
 
                 // Append names of tables to tnames list
-                list_append(&tnames, strdup(sra_table1->ref->table_name));
-                list_append(&tnames, strdup(sra_table2->ref->table_name));
+                list_append(&tnames, chidb_Arena_strdup(&stmt->arena, sra_table1->ref->table_name));
+                list_append(&tnames, chidb_Arena_strdup(&stmt->arena, sra_table2->ref->table_name));
 
                 // Check to see if tables exist
                 list_iterator_start(&tnames);
@@ -402,16 +858,39 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 
     // ----------select columns error checking and upstream expansion----------
 
-    char *first_col = sra_project->expr_list->expr.term.ref->columnName;
+    // Any aggregate function (or a group by) makes this an aggregate query
+    bool aggregate = (sra_project->group_by != NULL);
 
     Expression_t *expr_next = sra_project->expr_list;
     while(expr_next != NULL)
     {
+        // We can only select columns and aggregate functions of a column
+        if(expr_next->t != EXPR_TERM)
+        {
+            fprintf(stderr, "%s\n", "esql: can only select columns");
+            return CHIDB_EINVALIDSQL;
+        }
+        if(expr_next->expr.term.t == TERM_FUNC)
+        {
+            if(chidb_stmt_agg_func(expr_next) == 0)
+            {
+                fprintf(stderr, "%s\n", "esql: unsupported aggregate function");
+                return CHIDB_EINVALIDSQL;
+            }
+            aggregate = true;
+        }
+        else if(expr_next->expr.term.t != TERM_COLREF)
+        {
+            fprintf(stderr, "%s\n", "esql: can only select columns");
+            return CHIDB_EINVALIDSQL;
+        }
+
         // Update for next iteration
         expr_next = expr_next->next;
     }
 
-    if(*first_col == '*')
+    Expression_t *first_expr = sra_project->expr_list;
+    if(first_expr->expr.term.t == TERM_COLREF && *first_expr->expr.term.ref->columnName == '*')
     {
         // fprintf(stderr, "%s\n", "star needed expanding");
         
@@ -423,8 +902,26 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     expr_next = sra_project->expr_list;
     while(expr_next != NULL)
     {
+        // Aggregate functions are named after the function (e.g., "COUNT(*)")
+        // unless they have an alias
+        if(expr_next->expr.term.t == TERM_FUNC && expr_next->alias == NULL)
+        {
+            static const char *func_names[] = {
+                [FUNC_MAX] = "MAX", [FUNC_MIN] = "MIN", [FUNC_COUNT] = "COUNT",
+                [FUNC_AVG] = "AVG", [FUNC_SUM] = "SUM"
+            };
+            Func *f = &expr_next->expr.term.f;
+            char *arg = f->expr->expr.term.ref->columnName;
+
+            expr_next->alias = chisql_malloc(strlen(func_names[f->t]) + strlen(arg) + 3);
+            sprintf(expr_next->alias, "%s(%s)", func_names[f->t], arg);
+        }
+
         // Add to the select names list
-        list_append(&snames, expr_next->expr.term.ref->columnName); 
+        if(expr_next->expr.term.t == TERM_FUNC)
+            list_append(snames, expr_next->alias);
+        else
+            list_append(snames, expr_next->expr.term.ref->columnName);
 
         // Update for next iteration
         expr_next = expr_next->next;
@@ -437,37 +934,213 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     // Newop for clarity
     chidb_dbm_op_t *new_op;
 
-    // Registers
-    int comp_val_reg;   // Where comparison register
-    int comp_col_reg;   // The column we're comparing to if there is a where
-    int c1_reg;
-    int c2_reg = 0;
+    // Registers (cursors are numbered like the registers that hold their root page)
+    int comp_val_reg = -1;  // Where comparison register
+    int comp_col_reg = -1;  // The column we're comparing to if there is a where
+    int c1_reg;         // The outer table
+    int c2_reg = 0;     // The inner table (if natural join)
+    int idx_c_reg = -1; // The index on the outer table (if reading through it)
+    int last_c_reg;     // The last of the cursors above
     int comp_nj_t1_reg;
     int comp_nj_t2_reg; 
-    int first_col_reg;  // Either last cursor reg + 1 or comp_nj_t2_reg + 1;
+    int first_col_reg;  // Last cursor reg + 1
 
     // Instruction offsets
-    int open_off; // Offset of first open read integer injection
-    int rewind_off; // Offset of the last rewind insn (next jumps to rewind_off+1)
-    int comp_off = 0;   // Where comparison insn (this will be rewind_off+2)
-    int comp_nj_off; // Offset of first comparison thingy for natural join
-    int col_off;    // Offset of when we start calling columns
-    int rr_off;     // Result row instruction (next is rr_off-1)
+    int loop_off;       // First insn of the outer loop (the outer next jumps here)
+    int inner_off = 0;  // First insn of the inner loop (the inner next jumps here)
+    int next_off;       // Offset of the (inner) next insn
+    int outer_next_off; // Offset of the outer next insn
+    int close_off;      // Offset of the close insns
+
+    // Ops that must jump to the (inner) next, the outer next, or the
+    // close insns, which are updated once those are added
+    list_t next_jumps;
+    list_t outer_next_jumps;
+    list_t close_jumps;
 
     // Other
     npage_t root;   // Used to load in the root page
     int col_pos;    // Position of the column we want to produce
     int col_pos2;   // Position of column we want to pull out (table 2 for joining)
     int col_c_reg;  // The cursor that points to the particular cursor
-    int jump_addr;  // Makes clear where we are jumping to
-    int num_common_cols = 0;    // If natural joining
+    chidb_plan_t plan;          // How the table(s) are accessed
 
     // These are used only in the case of having select
     // Documentation says: column OP value. we say comp_column comp_op comp_value
-    ColumnReference_t *comp_column; 
+    ColumnReference_t *comp_column = NULL;
     Literal_t *comp_value;         
     enum CondType comp_op; 
 
+    // These are used only in the case of having an order by. Rows are
+    // fed into a sorter (as records whose first field is the sort key)
+    // and produced once the scan is done.
+    int sort_c_reg = -1;    // The sorter cursor
+    int sort_rr_reg;        // First result row register when sorting
+    int sort_loop_off;      // Offset of the first insn of the sorter loop
+
+    // These are used only in the case of an aggregate query. Each row is
+    // fed into an aggregator (as a record with the group by column, if
+    // any, followed by the argument of each aggregate function) and the
+    // groups are produced once the scan is done. If the rows are scanned
+    // in group by column order (i.e., grouping by the key of the outer
+    // table), the aggregator streams groups out during the scan instead.
+    int agg_c_reg = -1;     // The aggregator cursor
+    int agg_nkeys = 0;      // Number of group by columns
+    int agg_rr_reg;         // First result row register when aggregating
+    int agg_loop_off;       // Offset of the first insn of the aggregator loop
+    bool agg_streaming = false;
+    char agg_funcs[AGG_MAX_FUNCS + 1];
+
+    // These are used only if the sink has a limit. Once it is reached,
+    // the loop that produced the last row jumps to its close ops.
+    int limit_off = -1;     // Offset of the IfNot that skips the whole SELECT
+    int limit_reached_off;  // Offset of a DecrJumpZero after the scan
+
+    // *** We can only filter on a comparison of a column with a value ***
+    if(sra_select != NULL)
+    {
+        Condition_t *cond = sra_select->cond;
+
+        if(cond->t > RA_COND_GEQ ||
+           cond->cond.comp.expr1->t != EXPR_TERM || cond->cond.comp.expr1->expr.term.t != TERM_COLREF ||
+           cond->cond.comp.expr2->t != EXPR_TERM || cond->cond.comp.expr2->expr.term.t != TERM_LITERAL)
+        {
+            fprintf(stderr, "%s\n", "esql: unsupported where condition");
+            return CHIDB_EINVALIDSQL;
+        }
+
+        // Integers compared with a real column are widened, since an index
+        // on it only holds reals (and sorts integers apart from them)
+        Literal_t *lit = cond->cond.comp.expr2->expr.term.val;
+        char *colname = cond->cond.comp.expr1->expr.term.ref->columnName;
+        for(int t = 0; lit->t == TYPE_INT && t < list_size(&tnames); t++)
+        {
+            if(chidb_column_get_type(stmt->db->schemas, list_get_at(&tnames, t), colname) == TYPE_DOUBLE)
+            {
+                double d = lit->val.ival;
+                lit->t = TYPE_DOUBLE;
+                lit->val.dval = d;
+            }
+        }
+    }
+
+    // *** Choose how to access the table(s), and number the cursors ***
+    // On a single table, the plan may read every column the query uses
+    // from an index (if it holds all of them)
+    list_init(&unames);
+    for(expr_next = sra_project->expr_list; expr_next != NULL; expr_next = expr_next->next)
+    {
+        ColumnReference_t *ref = expr_next->expr.term.t == TERM_FUNC ?
+                                 expr_next->expr.term.f.expr->expr.term.ref :
+                                 expr_next->expr.term.ref;
+        if(*ref->columnName != '*')
+            list_append(&unames, ref->columnName);
+    }
+    if(sra_select != NULL)
+        list_append(&unames, sra_select->cond->cond.comp.expr1->expr.term.ref->columnName);
+    if(sra_project->order_by != NULL && sra_project->order_by->t == EXPR_TERM &&
+       sra_project->order_by->expr.term.t == TERM_COLREF)
+        list_append(&unames, sra_project->order_by->expr.term.ref->columnName);
+    if(sra_project->group_by != NULL && sra_project->group_by->t == EXPR_TERM &&
+       sra_project->group_by->expr.term.t == TERM_COLREF)
+        list_append(&unames, sra_project->group_by->expr.term.ref->columnName);
+
+    chidb_optimizer_plan(stmt->db, &tnames, &cnames1, &cnames2, snames, sra_table2 == NULL ? &unames : NULL,
+                         sra_select == NULL ? NULL : sra_select->cond, &plan);
+    list_destroy(&unames);
+
+    // From here on, the first table is the one in the outer loop
+    if(plan.swap)
+    {
+        list_t tmp = cnames1;
+        cnames1 = cnames2;
+        cnames2 = tmp;
+        list_append(&tnames, list_extract_at(&tnames, 0));
+    }
+
+    c1_reg = base + (sra_select == NULL ? 0 : 2);
+    last_c_reg = c1_reg;
+    if(sra_table2 != NULL)
+        c2_reg = ++last_c_reg;
+    if(plan.access == ACCESS_INDEX)
+        idx_c_reg = ++last_c_reg;
+    first_col_reg = last_c_reg + 1;
+
+    list_init(&next_jumps);
+    list_init(&outer_next_jumps);
+    list_init(&close_jumps);
+
+    // *** If the limit has already been reached (e.g., by the left SELECT
+    // of a UNION, or LIMIT 0), skip this SELECT altogether ***
+    if(sink->limit_reg >= 0)
+    {
+        limit_off = list_size(ops);
+        list_append(ops, chidb_make_op(stmt, Op_IfNot, sink->limit_reg, 0, 0, NULL));
+    }
+
+    // *** If aggregating, open the aggregator first ***
+    if(aggregate)
+    {
+        if(sra_project->order_by != NULL)
+        {
+            fprintf(stderr, "%s\n", "esql: order by is not supported with aggregates");
+            return CHIDB_EINVALIDSQL;
+        }
+        if(list_size(snames) > AGG_MAX_FUNCS)
+        {
+            fprintf(stderr, "%s\n", "esql: too many columns");
+            return CHIDB_EINVALIDSQL;
+        }
+
+        if(sra_project->group_by != NULL)
+        {
+            if(sra_project->group_by->t != EXPR_TERM ||
+               sra_project->group_by->expr.term.t != TERM_COLREF)
+            {
+                // We only support grouping by a column
+                fprintf(stderr, "%s\n", "esql: group by must be a column");
+                return CHIDB_EINVALIDSQL;
+            }
+            agg_nkeys = 1;
+
+            // Rows come out of the (outer) table in key order, unless
+            // they are read through an index
+            agg_streaming = chidb_column_position(&cnames1,
+                                sra_project->group_by->expr.term.ref->columnName) == 0 &&
+                            plan.access != ACCESS_INDEX;
+        }
+
+        j = 0;
+        for(expr_next = sra_project->expr_list; expr_next != NULL; expr_next = expr_next->next)
+            agg_funcs[j++] = chidb_stmt_agg_func(expr_next);
+        agg_funcs[j] = '\0';
+
+        // Past the table (and index) cursors
+        agg_c_reg = last_c_reg + 1;
+        list_append(ops, chidb_make_op(stmt, Op_AggOpen, agg_c_reg, agg_nkeys, agg_streaming, agg_funcs));
+    }
+
+    // *** If we have an order by, open the sorter first ***
+    if(sra_project->order_by != NULL)
+    {
+        if(sra_project->order_by->t != EXPR_TERM ||
+           sra_project->order_by->expr.term.t != TERM_COLREF)
+        {
+            // We only support ordering by a column
+            fprintf(stderr, "%s\n", "esql: order by must be a column");
+            return CHIDB_EINVALIDSQL;
+        }
+
+        // Past the table (and index) cursors
+        sort_c_reg = last_c_reg + 1;
+        list_append(ops, chidb_make_op(stmt, Op_SorterOpen, sort_c_reg, 1, 0,
+                                        sra_project->asc_desc == ORDER_BY_DESC ? "-" : "+"));
+
+        // Only the first rows will be produced, so keep just those
+        if(sink->topn > 0)
+            list_append(ops, chidb_make_op(stmt, Op_SorterLimit, sort_c_reg, sink->topn, 0, NULL));
+    }
+
     // *** If we have a where, insert the comp value at first instruction ***
     if(sra_select != NULL)
     {
@@ -477,27 +1150,24 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 
 
         // Set the first register(s)
-        comp_val_reg = 0;
-        comp_col_reg = 1;
+        comp_val_reg = base;
+        comp_col_reg = base + 1;
 
         switch(comp_value->t)
         {
             case TYPE_INT:
-                new_op = chidb_make_op(Op_Integer,
-                                       comp_value->val.ival,
-                                       comp_val_reg,
-                                       0,
-                                       NULL);
-                list_append(&ops, new_op);
+            case TYPE_DOUBLE:
+                new_op = chidb_make_number_op(stmt, comp_value, comp_val_reg);
+                list_append(ops, new_op);
                 break;
 
             case TYPE_TEXT:
-                new_op = chidb_make_op(Op_String, 
+                new_op = chidb_make_op(stmt, Op_String, 
                                        strlen(comp_value->val.strval), 
                                        comp_val_reg, 
                                        0, 
                                        comp_value->val.strval);
-                list_append(&ops, new_op);
+                list_append(ops, new_op);
                 break;
 
             default:
@@ -506,60 +1176,103 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 
         }
 
-        // Update the offset of open
-        open_off = 1;
-
     }
-    else
-    {
-        // Update the offset of open read
-        open_off = 0;
-    }
-
-    // *** Open cursor(s) for reading and rewind ***
-    // First cursor
-    if(sra_select == NULL)
-        c1_reg = 0; // Gets 0 register if no where
-    else
-        c1_reg = 2; // Gets 2 register if column doing where on is not selected
 
+    // *** Open cursor(s) for reading ***
     // Get root page of first table
     root = chidb_get_root(stmt->db->schemas, list_get_at(&tnames, 0));
 
     // Insert page into register we are opening the cursor on, open for reading
-    list_append(&ops, chidb_make_op(Op_Integer, root, c1_reg, 0, NULL));
-    list_append(&ops, chidb_make_op(Op_OpenRead, c1_reg, c1_reg, list_size(&cnames1), NULL));
-
-    // Update rewind offset
-    rewind_off = open_off + 2;
+    // (unless the index holds every column, and the table is not needed)
+    if(!plan.covering)
+    {
+        list_append(ops, chidb_make_op(stmt, Op_Integer, root, c1_reg, 0, NULL));
+        list_append(ops, chidb_make_op(stmt, Op_OpenRead, c1_reg, c1_reg, list_size(&cnames1), NULL));
+    }
 
     // Second cursor (if there is a natural join)
     if(sra_table2 != NULL)
     {
-        c2_reg = c1_reg + 1;
-
         root = chidb_get_root(stmt->db->schemas, list_get_at(&tnames,1));
 
-        list_append(&ops, chidb_make_op(Op_Integer, root, c2_reg, 0, NULL));
-        list_append(&ops, chidb_make_op(Op_OpenRead, c2_reg, c2_reg, list_size(&cnames2), NULL));
-        rewind_off += 2; // Leave rewind offset at first rewind for now
+        list_append(ops, chidb_make_op(stmt, Op_Integer, root, c2_reg, 0, NULL));
+        list_append(ops, chidb_make_op(stmt, Op_OpenRead, c2_reg, c2_reg, list_size(&cnames2), NULL));
     }
 
-    // Rewind cursor(s) -- these must be updated later with close insn location
-    list_append(&ops, chidb_make_op(Op_Rewind, c1_reg, 0, 0, NULL));
+    // Index cursor (if reading the first table through an index)
+    if(idx_c_reg >= 0)
+    {
+        list_append(ops, chidb_make_op(stmt, Op_Integer, plan.index_root, idx_c_reg, 0, NULL));
+        list_append(ops, chidb_make_op(stmt, Op_OpenRead, idx_c_reg, idx_c_reg, 0, NULL));
+    }
 
+    // *** Position the outer cursor on the first row ***
+    // If there is no such row, jump to the close insns. When seeking,
+    // the where value is the key (or the indexed value) to seek. Seek
+    // lands on the first index entry with that value, like SeekGe, but
+    // can tell from a Bloom filter that there is none.
+    col_c_reg = (idx_c_reg >= 0) ? idx_c_reg : c1_reg;
+    if(plan.access == ACCESS_SCAN || comp_op == RA_COND_LT || comp_op == RA_COND_LEQ)
+        new_op = chidb_make_op(stmt, Op_Rewind, col_c_reg, 0, 0, NULL);
+    else if(comp_op == RA_COND_GT)
+        new_op = chidb_make_op(stmt, Op_SeekGt, col_c_reg, 0, comp_val_reg, NULL);
+    else if(comp_op == RA_COND_EQ)
+        new_op = chidb_make_op(stmt, Op_Seek, col_c_reg, 0, comp_val_reg, NULL);
+    else
+        new_op = chidb_make_op(stmt, Op_SeekGe, col_c_reg, 0, comp_val_reg, NULL);
+    list_append(ops, new_op);
+    list_append(&close_jumps, new_op);
+
+    loop_off = list_size(ops);
+
+    if(plan.access == ACCESS_INDEX)
+    {
+        // Stop at the first indexed value past the ones we want
+        new_op = NULL;
+        if(comp_op == RA_COND_EQ || comp_op == RA_COND_LEQ)
+            new_op = chidb_make_op(stmt, Op_IdxGt, idx_c_reg, 0, comp_val_reg, NULL);
+        else if(comp_op == RA_COND_LT)
+            new_op = chidb_make_op(stmt, Op_IdxGe, idx_c_reg, 0, comp_val_reg, NULL);
+        if(new_op != NULL)
+        {
+            list_append(ops, new_op);
+            list_append(&close_jumps, new_op);
+        }
+
+        // Move the table cursor to the row the index entry points to
+        if(!plan.covering)
+        {
+            list_append(ops, chidb_make_op(stmt, Op_IdxPKey, idx_c_reg, idx_c_reg, 0, NULL));
+            new_op = chidb_make_op(stmt, Op_Seek, c1_reg, 0, idx_c_reg, NULL);
+            list_append(ops, new_op);
+            list_append(&outer_next_jumps, new_op);
+        }
+    }
+
+    // *** Position the inner cursor (if there is a natural join) ***
     if(sra_table2 != NULL)
     {
-        list_append(&ops, chidb_make_op(Op_Rewind, c2_reg, 0, 0, NULL));
-        rewind_off++; // Advance rewind offset to be at the last rewind
+        if(plan.join == JOIN_NESTED_LOOP)
+        {
+            // Go over the whole inner table (if it is empty, there are no rows)
+            new_op = chidb_make_op(stmt, Op_Rewind, c2_reg, 0, 0, NULL);
+            list_append(ops, new_op);
+            list_append(&close_jumps, new_op);
+            inner_off = list_size(ops);
+        }
+        else
+        {
+            // Seek the inner row whose key is the outer row's value of that column
+            chidb_stmt_load_column(stmt, ops, &cnames1, NULL, c1_reg, 0, list_get_at(&cnames2, 0), c2_reg);
+            new_op = chidb_make_op(stmt, Op_Seek, c2_reg, 0, c2_reg, NULL);
+            list_append(ops, new_op);
+            list_append(&outer_next_jumps, new_op);
+        }
     }
 
     // *** Revisiting the case if we have a where ***
     if(sra_select != NULL)
     {
-        // Update the comparison offset
-        comp_off = rewind_off + 2;
-
         // Get the column position to get the column with op_key or op_column
         col_pos = chidb_column_position(&cnames1, comp_column->columnName);
         col_c_reg = c1_reg; 
@@ -576,122 +1289,158 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
         }
 
         // Add the op to grab the column
-        if(col_pos == 0)
-            new_op = chidb_make_op(Op_Key, col_c_reg, comp_col_reg, 0, NULL);
+        if(plan.covering)
+            chidb_stmt_load_index_column(stmt, ops, &plan, &cnames1, idx_c_reg, comp_column->columnName, comp_col_reg);
+        else if(col_pos == 0)
+            list_append(ops, chidb_make_op(stmt, Op_Key, col_c_reg, comp_col_reg, 0, NULL));
         else
-            new_op = chidb_make_op(Op_Column, col_c_reg, col_pos, comp_col_reg, NULL);
-        list_append(&ops, new_op); // Actually add
+            list_append(ops, chidb_make_op(stmt, Op_Column, col_c_reg, col_pos, comp_col_reg, NULL));
 
         // Add the op to make the comparison. needs to be updated with jump to next later.
         switch(comp_op)
         {
             case RA_COND_EQ:
-                new_op = chidb_make_op(Op_Ne, comp_val_reg, 0, comp_col_reg, NULL);
+                new_op = chidb_make_op(stmt, Op_Ne, comp_val_reg, 0, comp_col_reg, NULL);
                 break;
             case RA_COND_LT:
-                new_op = chidb_make_op(Op_Ge, comp_val_reg, 0, comp_col_reg, NULL);
+                new_op = chidb_make_op(stmt, Op_Ge, comp_val_reg, 0, comp_col_reg, NULL);
                 break;
             case RA_COND_GT:
-                new_op = chidb_make_op(Op_Le, comp_val_reg, 0, comp_col_reg, NULL);
+                new_op = chidb_make_op(stmt, Op_Le, comp_val_reg, 0, comp_col_reg, NULL);
                 break;
             case RA_COND_LEQ:
-                new_op = chidb_make_op(Op_Gt, comp_val_reg, 0, comp_col_reg, NULL);
+                new_op = chidb_make_op(stmt, Op_Gt, comp_val_reg, 0, comp_col_reg, NULL);
                 break;
             case RA_COND_GEQ:
-                new_op = chidb_make_op(Op_Lt, comp_val_reg, 0, comp_col_reg, NULL);
+                new_op = chidb_make_op(stmt, Op_Lt, comp_val_reg, 0, comp_col_reg, NULL);
                 break;
             default:
                 // Our implementation of chidb does not support the other options
                 fprintf(stderr, "%s\n", "esql: 579");
                 return CHIDB_EINVALIDSQL;
         }
-        list_append(&ops, new_op); // Actually add
+        list_append(ops, new_op); // Actually add
+
+        // Keys come in ascending order, so once a key is too large,
+        // none of the following rows can match
+        if(plan.access == ACCESS_KEY && (comp_op == RA_COND_LT || comp_op == RA_COND_LEQ))
+            list_append(&close_jumps, new_op);
+        else
+            list_append(&next_jumps, new_op);
     }
 
     // *** some natural join goes here ***
     if(sra_table2 != NULL)
     {
-        // Set the offsets of where the nj comparistons start
-        // These are in blocks of 3 instructions
-        if(sra_select == NULL)
-        {
-            comp_nj_off = rewind_off + 1;
-        }
-        else
-        {
-            comp_nj_off = comp_off + 1;
-        }
-
         // Set the registers we'll be using
-        comp_nj_t1_reg = c2_reg + 1; // We share with first_col_reg
-        comp_nj_t2_reg = c2_reg + 2;
+        comp_nj_t1_reg = last_c_reg + 1; // We share with first_col_reg
+        comp_nj_t2_reg = last_c_reg + 2;
 
-        // Count number of common columns and add the ops to list
-        num_common_cols = 0;
-        list_iterator_start(&snames);
-        while(list_iterator_hasnext(&snames))
+        // For each common column, add the ops to list
+        list_iterator_start(snames);
+        while(list_iterator_hasnext(snames))
         {
-            next_name = (char *)list_iterator_next(&snames);
+            next_name = (char *)list_iterator_next(snames);
             col_pos = chidb_column_position(&cnames1, next_name);
             col_pos2 = chidb_column_position(&cnames2, next_name);
             if(col_pos >=0 && col_pos2 >=0)
             {
-                num_common_cols++;
-
                 // Load column from table 1
                 if(col_pos == 0)
-                    new_op = chidb_make_op(Op_Key, c1_reg, comp_nj_t1_reg, 0, NULL);
+                    new_op = chidb_make_op(stmt, Op_Key, c1_reg, comp_nj_t1_reg, 0, NULL);
                 else
-                    new_op = chidb_make_op(Op_Column, c1_reg, col_pos, comp_nj_t1_reg, NULL);
-                list_append(&ops, new_op);
+                    new_op = chidb_make_op(stmt, Op_Column, c1_reg, col_pos, comp_nj_t1_reg, NULL);
+                list_append(ops, new_op);
 
                 // Load column from table 2
                 if(col_pos2 == 0)
-                    new_op = chidb_make_op(Op_Key, c2_reg, comp_nj_t2_reg, 0, NULL);
+                    new_op = chidb_make_op(stmt, Op_Key, c2_reg, comp_nj_t2_reg, 0, NULL);
                 else
-                    new_op = chidb_make_op(Op_Column, c2_reg, col_pos2, comp_nj_t2_reg, NULL);
-                list_append(&ops, new_op);
+                    new_op = chidb_make_op(stmt, Op_Column, c2_reg, col_pos2, comp_nj_t2_reg, NULL);
+                list_append(ops, new_op);
 
                 // Not equal op. Each one of these needs to be updated at end w/ jump to inner next
-                list_append(&ops, chidb_make_op(Op_Ne, comp_nj_t1_reg, 0, comp_nj_t2_reg, NULL));
+                new_op = chidb_make_op(stmt, Op_Ne, comp_nj_t1_reg, 0, comp_nj_t2_reg, NULL);
+                list_append(ops, new_op);
+                list_append(&next_jumps, new_op);
             }
         }
-        list_iterator_stop(&snames);
+        list_iterator_stop(snames);
     }
 
     // *** Column and result row ops! ***
-    // Update the col_off, first_col_reg
-    if(sra_select == NULL)
+    list_iterator_start(snames);
+    while(list_iterator_hasnext(snames))
     {
-        col_off = rewind_off + 1;
+        fprintf(stderr, "col: %s\n", (char *)list_iterator_next(snames));
     }
-    else
-    {
-        col_off = comp_off + 1;
-    }
-    // Also, if natural join, register is different
-    if(sra_table2 == NULL)
-    {
-        first_col_reg = c1_reg + 1;
-    }
-    else
+    list_iterator_stop(snames);
+
+    int col_reg = first_col_reg; // Next col register
+    char *next_col_name;
+
+    // If sorting, the sort key goes first (the rest of the row follows it)
+    if(sort_c_reg >= 0)
     {
-        first_col_reg = c2_reg + 1;
+        char *name = sra_project->order_by->expr.term.ref->columnName;
+
+        if((plan.covering ? chidb_stmt_load_index_column(stmt, ops, &plan, &cnames1, idx_c_reg, name, col_reg) :
+                            chidb_stmt_load_column(stmt, ops, &cnames1, sra_table2 == NULL ? NULL : &cnames2,
+                                                   c1_reg, c2_reg, name, col_reg)) != CHIDB_OK)
+        {
+            // The column trying to order by does not exist
+            fprintf(stderr, "%s\n", "esql: unknown order by column");
+            return CHIDB_EINVALIDSQL;
+        }
+
+        col_reg++;
     }
 
-    list_iterator_start(&snames);
-    while(list_iterator_hasnext(&snames))
+    // If aggregating, the group by column goes first, followed by the
+    // argument of each aggregate function (or the selected column)
+    if(agg_c_reg >= 0)
     {
-        fprintf(stderr, "col: %s\n", (char *)list_iterator_next(&snames));
+        if(agg_nkeys > 0)
+        {
+            char *name = sra_project->group_by->expr.term.ref->columnName;
+
+            if((plan.covering ? chidb_stmt_load_index_column(stmt, ops, &plan, &cnames1, idx_c_reg, name, col_reg) :
+                                chidb_stmt_load_column(stmt, ops, &cnames1, sra_table2 == NULL ? NULL : &cnames2,
+                                                       c1_reg, c2_reg, name, col_reg)) != CHIDB_OK)
+            {
+                // The column trying to group by does not exist
+                fprintf(stderr, "%s\n", "esql: unknown group by column");
+                return CHIDB_EINVALIDSQL;
+            }
+            col_reg++;
+        }
+
+        for(expr_next = sra_project->expr_list; expr_next != NULL; expr_next = expr_next->next)
+        {
+            ColumnReference_t *ref = expr_next->expr.term.t == TERM_FUNC ?
+                                     expr_next->expr.term.f.expr->expr.term.ref :
+                                     expr_next->expr.term.ref;
+
+            // COUNT(*) doesn't look at any column
+            if(*ref->columnName == '*')
+                list_append(ops, chidb_make_op(stmt, Op_Integer, 0, col_reg, 0, NULL));
+            else if((plan.covering ?
+                     chidb_stmt_load_index_column(stmt, ops, &plan, &cnames1, idx_c_reg, ref->columnName, col_reg) :
+                     chidb_stmt_load_column(stmt, ops, &cnames1, sra_table2 == NULL ? NULL : &cnames2,
+                                            c1_reg, c2_reg, ref->columnName, col_reg)) != CHIDB_OK)
+            {
+                // The column trying to aggregate does not exist
+                fprintf(stderr, "%s\n", "esql: unknown aggregate column");
+                return CHIDB_EINVALIDSQL;
+            }
+            col_reg++;
+        }
     }
-    list_iterator_stop(&snames);
 
-    int col_reg = first_col_reg; // Next col register
-    char *next_col_name;
-    list_iterator_start(&snames);
-    while(list_iterator_hasnext(&snames))
+    list_iterator_start(snames);
+    while(agg_c_reg < 0 && list_iterator_hasnext(snames))
     {
-        next_col_name = (char *)list_iterator_next(&snames);
+        next_col_name = (char *)list_iterator_next(snames);
 
         // Get the column position to get the column with op_key or op_column
         col_pos = chidb_column_position(&cnames1, next_col_name);
@@ -715,114 +1464,161 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 
         // fprintf(stderr, "Column position is %d\n", col_pos);
         // Create and add the op for putting column contents into registers
-        if(col_pos == 0)
-            new_op = chidb_make_op(Op_Key, col_c_reg, col_reg, 0, NULL);
+        if(plan.covering)
+            chidb_stmt_load_index_column(stmt, ops, &plan, &cnames1, idx_c_reg, next_col_name, col_reg);
+        else if(col_pos == 0)
+            list_append(ops, chidb_make_op(stmt, Op_Key, col_c_reg, col_reg, 0, NULL));
         else
-            new_op = chidb_make_op(Op_Column, col_c_reg, col_pos, col_reg, NULL);
-        list_append(&ops, new_op); // Actually append the op
+            list_append(ops, chidb_make_op(stmt, Op_Column, col_c_reg, col_pos, col_reg, NULL));
 
         // Update col_reg
         col_reg++;
     }
-    list_iterator_stop(&snames);
+    list_iterator_stop(snames);
 
-    // Update result row insn offset
-    rr_off = col_off + list_size(&snames) + (3*(num_common_cols));
+    // Produce the row (or, if sorting or aggregating, hand the row
+    // to the sorter or the aggregator)
+    agg_rr_reg = col_reg + 1;
+    if(agg_c_reg >= 0)
+    {
+        int nsnames = list_size(snames);
 
-    // Add the result row op.
-    new_op = chidb_make_op(Op_ResultRow, first_col_reg, list_size(&snames), 0, NULL);
-    list_append(&ops, new_op);
+        list_append(ops, chidb_make_op(stmt, Op_MakeRecord, first_col_reg, agg_nkeys + nsnames, col_reg, NULL));
 
-    // *** Add the next op(s) depending on if natural join or not ***
-    if(sra_table2 == NULL)
+        if(!agg_streaming)
+            list_append(ops, chidb_make_op(stmt, Op_AggStep, agg_c_reg, col_reg, list_size(ops) + 1, NULL));
+        else
+        {
+            // When a group is complete, produce it right away
+            list_append(ops, chidb_make_op(stmt, Op_AggStep, agg_c_reg, col_reg,
+                                           list_size(ops) + nsnames + 1 + chidb_stmt_row_len(sink), NULL));
+            for(j = 0; j < nsnames; j++)
+                list_append(ops, chidb_make_op(stmt, Op_Column, agg_c_reg, j, agg_rr_reg + j, NULL));
+            chidb_stmt_emit_row(stmt, ops, sink, agg_rr_reg, nsnames, agg_rr_reg + nsnames);
+            if(sink->limit_reg >= 0)
+                list_append(&close_jumps, list_get_at(ops, list_size(ops) - 1));
+        }
+    }
+    else if(sort_c_reg < 0)
     {
-        jump_addr = rewind_off + 1; // Jump to below rewind
-        list_append(&ops, chidb_make_op(Op_Next, c1_reg, jump_addr, 0, NULL));
+        chidb_stmt_emit_row(stmt, ops, sink, first_col_reg, list_size(snames), col_reg);
+        if(sink->limit_reg >= 0)
+            list_append(&close_jumps, list_get_at(ops, list_size(ops) - 1));
     }
     else
     {
-        // Inner next jumps to area right below last rewind when cursor 2 goes to next
-        jump_addr = rewind_off + 1;
-        list_append(&ops, chidb_make_op(Op_Next, c2_reg, jump_addr, 0, NULL));
-
-        // Outer next jumps to the last rewind (cursor 2 rewind) when cursor 1 goes to next
-        jump_addr = rewind_off;
-        list_append(&ops, chidb_make_op(Op_Next, c1_reg, jump_addr, 0, NULL));
+        list_append(ops, chidb_make_op(stmt, Op_MakeRecord, first_col_reg, list_size(snames) + 1, col_reg, NULL));
+        list_append(ops, chidb_make_op(stmt, Op_SorterInsert, sort_c_reg, col_reg, 0, NULL));
     }
 
-    // *** Update all of the ops that need an accurate close position ***
-    // Or any offset positions that got updated later...
-    // Ex: new_op = chidb_make_op(Op_Ne, comp_val_reg, comp_jump_addr, comp_col_reg, NULL);
-    // Update at comp_off for the jump to next
-    // Update at rewinds for the jump to close
-    chidb_dbm_op_t *to_update;
+    // Update (inner) next insn offset
+    next_off = list_size(ops);
+
+    // *** Add the next op(s) ***
+    // The inner next (only when going over the whole inner table)
+    if(sra_table2 != NULL && plan.join == JOIN_NESTED_LOOP)
+        list_append(ops, chidb_make_op(stmt, Op_Next, c2_reg, inner_off, 0, NULL));
+
+    // The outer next (a single key has no next row)
+    outer_next_off = list_size(ops);
+    if(plan.access == ACCESS_INDEX)
+        list_append(ops, chidb_make_op(stmt, Op_Next, idx_c_reg, loop_off, 0, NULL));
+    else if(plan.access == ACCESS_SCAN || comp_op != RA_COND_EQ)
+        list_append(ops, chidb_make_op(stmt, Op_Next, c1_reg, loop_off, 0, NULL));
+
+    // *** Update all of the ops that need an accurate next or close position ***
+    close_off = list_size(ops);
+    chidb_stmt_patch_jumps(&next_jumps, next_off);
+    chidb_stmt_patch_jumps(&outer_next_jumps, outer_next_off);
+    chidb_stmt_patch_jumps(&close_jumps, close_off);
+
+    // *** A plain scan that only produces rows runs on batches of rows ***
+    if(plan.access == ACCESS_SCAN && sra_table2 == NULL && sort_c_reg < 0 && agg_c_reg < 0)
+        chidb_stmt_vectorize(ops, loop_off - 1, outer_next_off);
+
+    // *** Add the close ops ***
+    if(!plan.covering)
+        list_append(ops, chidb_make_op(stmt, Op_Close, c1_reg, 0, 0, NULL));
+    if(sra_table2 != NULL)
+        list_append(ops, chidb_make_op(stmt, Op_Close, c2_reg, 0, 0, NULL));
+    if(idx_c_reg >= 0)
+        list_append(ops, chidb_make_op(stmt, Op_Close, idx_c_reg, 0, 0, NULL));
 
-    if(sra_select != NULL)
+    // *** If sorting, produce the rows in order from the sorter ***
+    // The sort key is field 0 of each record; the row is fields 1..n
+    chidb_dbm_op_t *to_update;
+    sort_rr_reg = first_col_reg + 1;
+    if(sort_c_reg >= 0)
     {
-        jump_addr = rr_off + 1; // This is the current location of next (no nj)
-        to_update = (chidb_dbm_op_t *)list_get_at(&ops, comp_off);
-        to_update->p2 = jump_addr;
-    }
+        int nsnames = list_size(snames);
 
-    if(sra_table2 != NULL)
-    {
-        int i;
-        jump_addr = rr_off + 1; // This is location of inner next
-        for(i = comp_nj_off - 1; i < comp_nj_off + (3*num_common_cols); i+=3)
+        // Jumps past the loop (to the sorter close) if there are no rows
+        sort_loop_off = list_size(ops) + 1;
+        list_append(ops, chidb_make_op(stmt, Op_SorterSort, sort_c_reg,
+                                       sort_loop_off + nsnames + chidb_stmt_row_len(sink) + 1, 0, NULL));
+
+        for(j = 0; j < nsnames; j++)
+            list_append(ops, chidb_make_op(stmt, Op_Column, sort_c_reg, j + 1, sort_rr_reg + j, NULL));
+
+        chidb_stmt_emit_row(stmt, ops, sink, sort_rr_reg, nsnames, sort_rr_reg + nsnames);
+        limit_reached_off = list_size(ops) - 1;
+        list_append(ops, chidb_make_op(stmt, Op_SorterNext, sort_c_reg, sort_loop_off, 0, NULL));
+        if(sink->limit_reg >= 0)
         {
-            to_update = (chidb_dbm_op_t *)list_get_at(&ops, i);
-            to_update->p2 = jump_addr;
+            to_update = (chidb_dbm_op_t *)list_get_at(ops, limit_reached_off);
+            to_update->p2 = list_size(ops);
         }
+        list_append(ops, chidb_make_op(stmt, Op_Close, sort_c_reg, 0, 0, NULL));
     }
 
-    jump_addr = list_size(&ops); // This is the insn addr for close
-    to_update = (chidb_dbm_op_t *)list_get_at(&ops, rewind_off);
-    to_update->p2 = jump_addr;
-    if(sra_table2 != NULL)
+    // *** If aggregating, produce the (remaining) groups ***
+    if(agg_c_reg >= 0)
     {
-        to_update = (chidb_dbm_op_t *)list_get_at(&ops, rewind_off-1);
-        to_update->p2 = jump_addr;
-    }
+        int nsnames = list_size(snames);
 
-    // *** Add the close and halt ops ***
-    list_append(&ops, chidb_make_op(Op_Close, c1_reg, 0, 0, NULL));
-    if(sra_table2 != NULL)
-        list_append(&ops, chidb_make_op(Op_Close, c2_reg, 0, 0, NULL));
+        // If the limit was reached while streaming groups, skip the loop
+        if(sink->limit_reg >= 0)
+            list_append(ops, chidb_make_op(stmt, Op_IfNot, sink->limit_reg,
+                                           list_size(ops) + nsnames + chidb_stmt_row_len(sink) + 3, 0, NULL));
 
-    list_append(&ops, chidb_make_op(Op_Halt, 0, 0, 0, NULL));
+        // Jumps past the loop (to the aggregator close) if there are no groups
+        agg_loop_off = list_size(ops) + 1;
+        list_append(ops, chidb_make_op(stmt, Op_AggFinal, agg_c_reg,
+                                       agg_loop_off + nsnames + chidb_stmt_row_len(sink) + 1, 0, NULL));
 
-    // ======================== END CODEGEN SECTION ===========================
+        for(j = 0; j < nsnames; j++)
+            list_append(ops, chidb_make_op(stmt, Op_Column, agg_c_reg, j, agg_rr_reg + j, NULL));
 
-    // ------------------convert instructions to stmt struct------------------
-    int j;
-    for(j = 0; j < list_size(&ops); j++)
-    {
-        chidb_dbm_op_t *next = (chidb_dbm_op_t *)list_get_at(&ops, j);
-        chidb_stmt_set_op(stmt, next, j);
-        
-        // should be able to free the op now...
-        free(next);
+        chidb_stmt_emit_row(stmt, ops, sink, agg_rr_reg, nsnames, agg_rr_reg + nsnames);
+        limit_reached_off = list_size(ops) - 1;
+        list_append(ops, chidb_make_op(stmt, Op_AggNext, agg_c_reg, agg_loop_off, 0, NULL));
+        if(sink->limit_reg >= 0)
+        {
+            to_update = (chidb_dbm_op_t *)list_get_at(ops, limit_reached_off);
+            to_update->p2 = list_size(ops);
+        }
+        list_append(ops, chidb_make_op(stmt, Op_Close, agg_c_reg, 0, 0, NULL));
     }
-    // ------------------convert column names from list to array--------------
 
-    char **cols = malloc(sizeof(char *) * list_size(&snames));
-    for(j=0; j < list_size(&snames); j++)
+    if(limit_off >= 0)
     {
-        cols[j] = strdup(list_get_at(&snames, j)); 
+        to_update = (chidb_dbm_op_t *)list_get_at(ops, limit_off);
+        to_update->p2 = list_size(ops);
     }
 
+    // ======================== END CODEGEN SECTION ===========================
+
     // -------------------- fill in rest of stmt struct ----------------------
-    stmt->nRR = list_size(&snames);
-    stmt->startRR = first_col_reg;
-    stmt->nCols = list_size(&snames);
-    stmt->cols = cols;
+    stmt->nRR = list_size(snames);
+    if(agg_c_reg >= 0)
+        stmt->startRR = agg_rr_reg;
+    else
+        stmt->startRR = (sort_c_reg < 0) ? first_col_reg : sort_rr_reg;
     // --------------------convenience list destruction-----------------------
 
     list_destroy(&tnames); 
     list_destroy(&cnames1);
     list_destroy(&cnames2);
-    list_destroy(&snames);
-    list_destroy(&ops);
 
     return CHIDB_OK;
 }
@@ -845,10 +1641,10 @@ int chidb_stmt_select_star_expand(SRA_Project_t *sra_project, list_t names, list
         if(!first_done)
         {
             // Free the original star
-            free(next_ref->columnName);
+            chisql_free(next_ref->columnName);
 
             // Overwrite the original column ref 
-            next_ref->columnName = strdup(next_name);
+            next_ref->columnName = chisql_strdup(next_name);
 
             // Ignoring aliasing
 
@@ -860,10 +1656,10 @@ int chidb_stmt_select_star_expand(SRA_Project_t *sra_project, list_t names, list
             // Populate all fields of new_term to add to new expression
             ExprTerm new_term;
             new_term.t = TERM_COLREF;
-            new_term.ref = malloc(sizeof(ColumnReference_t));
+            new_term.ref = chisql_malloc(sizeof(ColumnReference_t));
 
             // Populate all fields of new expression
-            expr_to_add = malloc(sizeof(Expression_t));            
+            expr_to_add = chisql_malloc(sizeof(Expression_t));            
             expr_to_add->t = EXPR_TERM;
             expr_to_add->expr.term = new_term;
             expr_to_add->alias = NULL;
@@ -879,8 +1675,8 @@ int chidb_stmt_select_star_expand(SRA_Project_t *sra_project, list_t names, list
 
 
             // Write in the table and column names. alias set to null
-            next_ref->tableName = table_name==NULL ? NULL : strdup(table_name);
-            next_ref->columnName = strdup(next_name);
+            next_ref->tableName = table_name==NULL ? NULL : chisql_strdup(table_name);
+            next_ref->columnName = chisql_strdup(next_name);
             next_ref->columnAlias = NULL;
         }
     }
@@ -899,10 +1695,10 @@ int chidb_stmt_select_star_expand(SRA_Project_t *sra_project, list_t names, list
                 // Populate all fields of new_term to add to new expression
                 ExprTerm new_term;
                 new_term.t = TERM_COLREF;
-                new_term.ref = malloc(sizeof(ColumnReference_t));
+                new_term.ref = chisql_malloc(sizeof(ColumnReference_t));
 
                 // Populate all fields of new expression
-                expr_to_add = malloc(sizeof(Expression_t));            
+                expr_to_add = chisql_malloc(sizeof(Expression_t));            
                 expr_to_add->t = EXPR_TERM;
                 expr_to_add->expr.term = new_term;
                 expr_to_add->alias = NULL;
@@ -918,8 +1714,8 @@ int chidb_stmt_select_star_expand(SRA_Project_t *sra_project, list_t names, list
 
 
                 // Write in the table and column names. alias set to null
-                next_ref->tableName = table_name==NULL ? NULL : strdup(table_name);
-                next_ref->columnName = strdup(next_name);
+                next_ref->tableName = table_name==NULL ? NULL : chisql_strdup(table_name);
+                next_ref->columnName = chisql_strdup(next_name);
                 next_ref->columnAlias = NULL;
             }
         }
@@ -929,22 +1725,279 @@ int chidb_stmt_select_star_expand(SRA_Project_t *sra_project, list_t names, list
     return CHIDB_OK;
 }
 
+/* Adds the op that loads a column (of either table being selected
+ * from) into a register. cnames2 is NULL if there is only one table. */
+int chidb_stmt_load_column(chidb_stmt *stmt, list_t *ops, list_t *cnames1, list_t *cnames2,
+                           int c1_reg, int c2_reg, char *col_name, int reg)
+{
+    int col_pos = chidb_column_position(cnames1, col_name);
+    int col_c_reg = c1_reg;
+
+    if(cnames2 != NULL && col_pos < 0) // If not found in first table
+    {
+        col_pos = chidb_column_position(cnames2, col_name);
+        col_c_reg = c2_reg;
+    }
+    if(col_pos < 0) // Not found in either table
+        return CHIDB_EINVALIDSQL;
+
+    if(col_pos == 0)
+        list_append(ops, chidb_make_op(stmt, Op_Key, col_c_reg, reg, 0, NULL));
+    else
+        list_append(ops, chidb_make_op(stmt, Op_Column, col_c_reg, col_pos, reg, NULL));
+
+    return CHIDB_OK;
+}
+
+/* Adds the op that loads a column of the outer table into reg, when the
+ * index the plan reads holds every column (see chidb_plan_t): from its
+ * field in the index entry, or from the primary key that ends it */
+int chidb_stmt_load_index_column(chidb_stmt *stmt, list_t *ops, chidb_plan_t *plan, list_t *cnames1,
+                                 int idx_c_reg, char *col_name, int reg)
+{
+    int pos = chidb_index_column_position(plan->index, col_name);
+
+    if(pos >= 0)
+        list_append(ops, chidb_make_op(stmt, Op_Column, idx_c_reg, pos, reg, NULL));
+    else if(chidb_column_position(cnames1, col_name) == 0)
+        list_append(ops, chidb_make_op(stmt, Op_IdxPKey, idx_c_reg, reg, 0, NULL));
+    else
+        return CHIDB_EINVALIDSQL;
+
+    return CHIDB_OK;
+}
+
+/* Adds the ops that load the LIMIT and OFFSET of a SELECT (if any)
+ * into the registers starting at reg, and sets them in the sink.
+ * Returns the first register after them. */
+int chidb_stmt_select_limit(chidb_stmt *stmt, list_t *ops, SRA_Project_t *sra_project, int reg, select_sink_t *sink)
+{
+    if(sra_project->limit >= 0)
+    {
+        list_append(ops, chidb_make_op(stmt, Op_Integer, sra_project->limit, reg, 0, NULL));
+        sink->limit_reg = reg++;
+
+        // Sorting only has to keep the rows that can be produced, unless
+        // some of them might be dropped after sorting
+        if(sink->distinct_c < 0 && sink->filter_c < 0 &&
+           sra_project->offset <= INT32_MAX - sra_project->limit)
+            sink->topn = sra_project->limit + sra_project->offset;
+    }
+    if(sra_project->offset > 0)
+    {
+        list_append(ops, chidb_make_op(stmt, Op_Integer, sra_project->offset, reg, 0, NULL));
+        sink->offset_reg = reg++;
+    }
+
+    return reg;
+}
+
+/* Number of ops that chidb_stmt_emit_row adds for a sink */
+int chidb_stmt_row_len(select_sink_t *sink)
+{
+    if(sink->collect_c >= 0)
+        return 2;   // MakeRecord, SetInsert
+
+    return (sink->distinct_c >= 0 || sink->filter_c >= 0)
+           + (sink->filter_c >= 0)
+           + (sink->distinct_c >= 0)
+           + (sink->offset_reg >= 0)
+           + 1
+           + (sink->limit_reg >= 0);    // [MakeRecord], [SetFound/SetNotFound], [SetInsert],
+                                        // [IfPos], ResultRow, [DecrJumpZero]
+}
+
+/* Adds the ops that send a row (held in nregs registers starting at
+ * first_reg) to a sink. rec_reg is a free register where the record
+ * of the row can be made. A row that is skipped jumps past these ops.
+ * If the sink has a limit, the last op jumps once the limit is reached;
+ * the caller must set its jump address (p2). */
+int chidb_stmt_emit_row(chidb_stmt *stmt, list_t *ops, select_sink_t *sink, int first_reg, int nregs, int rec_reg)
+{
+    int end_off = list_size(ops) + chidb_stmt_row_len(sink);
+
+    if(sink->collect_c >= 0)
+    {
+        list_append(ops, chidb_make_op(stmt, Op_MakeRecord, first_reg, nregs, rec_reg, NULL));
+        list_append(ops, chidb_make_op(stmt, Op_SetInsert, sink->collect_c, rec_reg, end_off, NULL));
+        return CHIDB_OK;
+    }
+
+    if(sink->distinct_c >= 0 || sink->filter_c >= 0)
+        list_append(ops, chidb_make_op(stmt, Op_MakeRecord, first_reg, nregs, rec_reg, NULL));
+
+    if(sink->filter_c >= 0)
+        list_append(ops, chidb_make_op(stmt, sink->filter_found ? Op_SetNotFound : Op_SetFound,
+                                       sink->filter_c, rec_reg, end_off, NULL));
+
+    if(sink->distinct_c >= 0)
+        list_append(ops, chidb_make_op(stmt, Op_SetInsert, sink->distinct_c, rec_reg, end_off, NULL));
+
+    if(sink->offset_reg >= 0)
+        list_append(ops, chidb_make_op(stmt, Op_IfPos, sink->offset_reg, end_off, 1, NULL));
+
+    list_append(ops, chidb_make_op(stmt, Op_ResultRow, first_reg, nregs, 0, NULL));
+
+    if(sink->limit_reg >= 0)
+        list_append(ops, chidb_make_op(stmt, Op_DecrJumpZero, sink->limit_reg, 0, 0, NULL));
+
+    return CHIDB_OK;
+}
+
+/* Sets the jump address (p2) of every op in a list of ops, and empties
+ * the list (the ops themselves are still in the program) */
+int chidb_stmt_patch_jumps(list_t *jumps, int addr)
+{
+    while(!list_empty(jumps))
+        ((chidb_dbm_op_t *)list_fetch(jumps))->p2 = addr;
+
+    list_destroy(jumps);
+
+    return CHIDB_OK;
+}
+
+/* Is reg loaded by a Column or Key op in [from, to)? */
+static bool chidb_stmt_loop_loads(list_t *ops, int from, int to, int reg)
+{
+    for(int j = from; j < to; j++)
+    {
+        chidb_dbm_op_t *op = (chidb_dbm_op_t *)list_get_at(ops, j);
+
+        if((op->opcode == Op_Column && op->p3 == reg) || (op->opcode == Op_Key && op->p2 == reg))
+            return true;
+    }
+
+    return false;
+}
+
+/* Rewrites a scan loop (from its Rewind at first to its Next at last)
+ * into batch ops (see dbm-batch.h), if all its body does is load
+ * columns of the scanned table, skip the rows whose columns don't
+ * compare with a value, and produce a result row. Each op is replaced
+ * by the batch op that does the same thing over a batch of rows, so
+ * every op keeps its address. Any other loop is left as it is. */
+int chidb_stmt_vectorize(list_t *ops, int first, int last)
+{
+    chidb_dbm_op_t *rewind = (chidb_dbm_op_t *)list_get_at(ops, first);
+    chidb_dbm_op_t *next = (chidb_dbm_op_t *)list_get_at(ops, last);
+    chidb_dbm_op_t *op;
+    int j;
+
+    if(rewind->opcode != Op_Rewind || next->opcode != Op_Next ||
+       next->p1 != rewind->p1 || next->p2 != first + 1)
+        return CHIDB_OK;
+
+    // The row is produced last, after all the comparisons
+    op = (chidb_dbm_op_t *)list_get_at(ops, last - 1);
+    if(op->opcode != Op_ResultRow)
+        return CHIDB_OK;
+
+    for(j = first + 1; j < last - 1; j++)
+    {
+        op = (chidb_dbm_op_t *)list_get_at(ops, j);
+        switch(op->opcode)
+        {
+            case Op_Column:
+            case Op_Key:
+                if(op->p1 != rewind->p1)
+                    return CHIDB_OK;
+                break;
+            case Op_Eq:
+            case Op_Ne:
+            case Op_Lt:
+            case Op_Le:
+            case Op_Gt:
+            case Op_Ge:
+                // A column compared with a value (or with a column loaded
+                // before), skipping to the next row
+                if(op->p2 != last || !chidb_stmt_loop_loads(ops, first + 1, j, op->p3) ||
+                   (chidb_stmt_loop_loads(ops, j, last, op->p1) &&
+                    !chidb_stmt_loop_loads(ops, first + 1, j, op->p1)))
+                    return CHIDB_OK;
+                break;
+            default:
+                return CHIDB_OK;
+        }
+    }
+
+    for(j = first; j <= last; j++)
+    {
+        op = (chidb_dbm_op_t *)list_get_at(ops, j);
+        switch(op->opcode)
+        {
+            case Op_Rewind:
+                op->opcode = Op_BatchRewind;
+                break;
+            case Op_Next:
+                op->opcode = Op_BatchNext;
+                break;
+            case Op_Column:
+                op->opcode = Op_BatchColumn;
+                break;
+            case Op_Key:
+                op->opcode = Op_BatchKey;
+                break;
+            case Op_ResultRow:
+                op->opcode = Op_BatchResult;
+                break;
+            default:
+                // A comparison: rows are dropped instead of skipped
+                op->p4 = (char *)opcode_to_str(op->opcode);
+                op->opcode = Op_BatchFilter;
+                op->p2 = 0;
+                break;
+        }
+    }
+
+    return CHIDB_OK;
+}
+
+/* Returns the aggregator function (see aggregator.h) that computes a
+ * selected expression, or 0 if the expression can't be aggregated. A
+ * plain column is computed with AGG_VALUE. */
+char chidb_stmt_agg_func(Expression_t *expr)
+{
+    if(expr->expr.term.t == TERM_COLREF)
+        return AGG_VALUE;
+
+    // The argument of the function must be a column (or a star)
+    Expression_t *arg = expr->expr.term.f.expr;
+    if(arg == NULL || arg->t != EXPR_TERM || arg->expr.term.t != TERM_COLREF)
+        return 0;
+
+    switch(expr->expr.term.f.t)
+    {
+        case FUNC_COUNT:
+            return *arg->expr.term.ref->columnName == '*' ? AGG_COUNT_STAR : AGG_COUNT;
+        case FUNC_SUM:
+            return *arg->expr.term.ref->columnName == '*' ? 0 : AGG_SUM;
+        case FUNC_AVG:
+            return *arg->expr.term.ref->columnName == '*' ? 0 : AGG_AVG;
+        case FUNC_MIN:
+            return *arg->expr.term.ref->columnName == '*' ? 0 : AGG_MIN;
+        case FUNC_MAX:
+            return *arg->expr.term.ref->columnName == '*' ? 0 : AGG_MAX;
+        default:
+            return 0;
+    }
+}
+
 
 //Main function that calls all the helpers
 int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 {
     int ret = 0;
     list_t tables;
+    uint32_t cookie = chidb_Pager_getSchemaCookie(stmt->db->bt->pager);
 
-    if (chidb_stmt_check(stmt, sql_stmt, tables) != CHIDB_OK)
-        return CHIDB_EINVALIDSQL;
-
-    //Refresh the in-memory schema table if necessary
-    if(stmt->db->need_refresh == 1) {
+    //Refresh the in-memory schema table if necessary (including when
+    //another connection sharing the pager has changed the schema)
+    if(stmt->db->need_refresh == 1 || stmt->db->schema_cookie != cookie) {
         list_iterator_start(&(stmt->db->schemas));
         while(list_iterator_hasnext(&(stmt->db->schemas)))
         {
             chidb_sql_schema_t *next = (chidb_sql_schema_t *)(list_iterator_next(&(stmt->db->schemas)));
+            free(next->stat);
             free(next);
         }
         list_iterator_stop(&(stmt->db->schemas));
@@ -952,12 +2005,18 @@ int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 
         list_init(&(stmt->db->schemas));
         load_schema(stmt->db,1);
+        chidb_Stats_load(stmt->db);
+        chidb_Bloom_load(stmt->db);
         stmt->db->need_refresh = 0;
+        stmt->db->schema_cookie = cookie;
 
         // fprintf(stderr, "%s\n", "Schema has been refreshed");
         //print_schema_list(stmt->db->schemas);
     }
 
+    if (chidb_stmt_check(stmt, sql_stmt, tables) != CHIDB_OK)
+        return CHIDB_EINVALIDSQL;
+
     switch(sql_stmt->type)
     {
         case STMT_CREATE: 
@@ -969,6 +2028,17 @@ int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
         case STMT_INSERT: 
             ret =  chidb_stmt_insert(stmt, sql_stmt);
             break;
+        case STMT_ANALYZE:
+            ret =  chidb_stmt_analyze(stmt, sql_stmt);
+            break;
+        case STMT_BLOOM:
+            ret =  chidb_stmt_bloom(stmt, sql_stmt);
+            break;
+        case STMT_BEGIN:
+        case STMT_COMMIT:
+        case STMT_ROLLBACK:
+            ret =  chidb_stmt_transaction(stmt, sql_stmt);
+            break;
     }
 
     return ret;
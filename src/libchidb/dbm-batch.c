@@ -0,0 +1,650 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Batched (vectorized) table scans
+ *
+ */
+
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ *  Running a scan loop one row at a time costs several instruction
+ *  dispatches per row (a Column or Key per column, a comparison, a
+ *  ResultRow and a Next), each of which checks its operands, and a
+ *  Column unpacks the whole record just to read one field. The batch
+ *  instructions run the same loop over up to DBM_BATCH_SIZE rows at a
+ *  time (see dbm-batch.h): the rows are read from consecutive leaf
+ *  cells, each column is decoded into a column vector in a tight loop,
+ *  and filters (see dbm-simd.c) shrink a selection vector, so that only
+ *  the columns of the rows that pass them are decoded afterwards.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbm.h"
+#include "dbm-batch.h"
+#include "dbm-simd.h"
+#include "btree.h"
+#include "record.h"
+
+/* Defined in dbm-ops.c */
+int chidb_dbm_op_WriteReg(chidb_stmt *stmt, int regNo, int reg_type, void *data);
+
+
+/* Make room for len bytes in a buffer */
+static int __chidb_dbm_batch_reserve(void **buf, uint32_t *size, uint32_t len)
+{
+    uint32_t nsize = *size ? *size : 4096;
+    void *nbuf;
+
+    if (len <= *size)
+        return CHIDB_OK;
+
+    while (nsize < len)
+        nsize *= 2;
+    if ((nbuf = realloc(*buf, nsize)) == NULL)
+        return CHIDB_ENOMEM;
+    *buf = nbuf;
+    *size = nsize;
+
+    return CHIDB_OK;
+}
+
+
+/* Get the column vector of a register, allocating it if needed */
+static int __chidb_dbm_batch_vector(chidb_dbm_batch_t *b, int32_t reg, chidb_dbm_vector_t **vec)
+{
+    if (reg < 0)
+        return CHIDB_ENOREG;
+
+    if ((uint32_t) reg >= b->nvecs)
+    {
+        uint32_t nvecs = reg + 1;
+        chidb_dbm_vector_t **vecs = realloc(b->vecs, nvecs * sizeof(chidb_dbm_vector_t *));
+
+        if (vecs == NULL)
+            return CHIDB_ENOMEM;
+        memset(vecs + b->nvecs, 0, (nvecs - b->nvecs) * sizeof(chidb_dbm_vector_t *));
+        b->vecs = vecs;
+        b->nvecs = nvecs;
+    }
+
+    if (b->vecs[reg] == NULL && (b->vecs[reg] = calloc(1, sizeof(chidb_dbm_vector_t))) == NULL)
+        return CHIDB_ENOMEM;
+    *vec = b->vecs[reg];
+
+    return CHIDB_OK;
+}
+
+
+/* Store a real or a wide integer of a row in the number buffer */
+static int __chidb_dbm_batch_addNumber(chidb_dbm_batch_t *b, chidb_dbm_vector_t *v, uint16_t r,
+                                       uint8_t type, chidb_dbm_number_t num)
+{
+    int rc;
+
+    if ((rc = __chidb_dbm_batch_reserve((void **) &b->nums, &b->nums_size,
+                                        (b->nums_len + 1) * sizeof(chidb_dbm_number_t))) != CHIDB_OK)
+        return rc;
+
+    b->nums[b->nums_len] = num;
+    v->type[r] = type;
+    v->i[r] = b->nums_len++;
+
+    return CHIDB_OK;
+}
+
+
+/* Add a row to a batch */
+static int __chidb_dbm_batch_addRow(chidb_dbm_batch_t *b, chidb_key_t key, uint8_t *data, uint32_t size)
+{
+    int rc;
+
+    if ((rc = __chidb_dbm_batch_reserve((void **) &b->recs, &b->recs_size, b->recs_len + size)) != CHIDB_OK)
+        return rc;
+
+    memcpy(b->recs + b->recs_len, data, size);
+    b->keys[b->nrows] = key;
+    b->rec_off[b->nrows] = b->recs_len;
+    b->recs_len += size;
+    b->nrows++;
+
+    return CHIDB_OK;
+}
+
+
+/* Fill the batch of a program
+ *
+ * Reads up to DBM_BATCH_SIZE rows, starting with the row the cursor is
+ * on, and leaves the cursor on the row that follows them. All the rows
+ * are selected, and the column vectors are left empty. If the cursor
+ * goes past the last row of the table (or of its range, if it is
+ * ranged), the batch is marked as done.
+ *
+ * Parameters
+ * - stmt: DBM program
+ * - cursor: Table cursor, on a row that hasn't been read yet
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_PROBLEM: The cursor is not valid
+ * - CHIDB_ETYPE: The cursor is not on a table
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_batch_fill(chidb_stmt *stmt, int32_t cursor)
+{
+    chidb_dbm_batch_t *b = stmt->batch;
+    chidb_dbm_cursor_t *c;
+    chidb_dbm_cursor_trail_t *ct;
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, cursor))
+        return CHIDB_PROBLEM;
+    c = &stmt->cursors[cursor];
+
+    if (b == NULL && (b = stmt->batch = calloc(1, sizeof(chidb_dbm_batch_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    b->cursor = cursor;
+    b->done = false;
+    b->nrows = 0;
+    b->recs_len = 0;
+    b->strs_len = 0;
+    b->nums_len = 0;
+    b->next = 0;
+    for(uint32_t i = 0; i < b->nvecs; i++)
+        if (b->vecs[i] != NULL)
+            b->vecs[i]->valid = false;
+
+    ct = list_get_at(&c->trail, list_size(&c->trail) - 1);
+    while (b->nrows < DBM_BATCH_SIZE)
+    {
+        if (c->current_cell.type != PGTYPE_TABLE_LEAF)
+            return CHIDB_ETYPE;
+
+        if ((rc = __chidb_dbm_batch_addRow(b, c->current_cell.key, c->current_cell.fields.tableLeaf.data,
+                                           c->current_cell.fields.tableLeaf.data_size)) != CHIDB_OK)
+            return rc;
+
+        /* Consecutive cells of a leaf are read directly; only moving on
+         * to the next leaf goes through the cursor */
+        if (ct->n_current_cell + 1 < ct->btn->n_cells)
+        {
+            ct->n_current_cell++;
+            if ((rc = chidb_Btree_getCell(ct->btn, ct->n_current_cell, &c->current_cell)) != CHIDB_OK)
+                return rc;
+        }
+        else
+        {
+            rc = chidb_dbm_cursor_fwd(stmt->db->bt, c);
+            if (rc == CHIDB_CURSORCANTMOVE)
+            {
+                b->done = true;
+                break;
+            }
+            else if (rc != CHIDB_OK)
+                return rc;
+            ct = list_get_at(&c->trail, list_size(&c->trail) - 1);
+        }
+
+        if (c->ranged && c->current_cell.key > c->key_max)
+        {
+            b->done = true;
+            break;
+        }
+    }
+
+    b->nsel = b->nrows;
+    for(uint32_t i = 0; i < b->nrows; i++)
+        b->sel[i] = i;
+
+    return CHIDB_OK;
+}
+
+
+/* Load the keys of the selected rows into a column vector
+ *
+ * Parameters
+ * - stmt: DBM program
+ * - reg: Register whose vector is loaded
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_PROBLEM: The program has no batch
+ * - CHIDB_ENOREG: Invalid register
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_batch_key(chidb_stmt *stmt, int32_t reg)
+{
+    chidb_dbm_batch_t *b = stmt->batch;
+    chidb_dbm_vector_t *v;
+    int rc;
+
+    if (b == NULL)
+        return CHIDB_PROBLEM;
+    if ((rc = __chidb_dbm_batch_vector(b, reg, &v)) != CHIDB_OK)
+        return rc;
+
+    for(uint32_t j = 0; j < b->nsel; j++)
+    {
+        uint16_t r = b->sel[j];
+
+        if (b->keys[r] <= INT32_MAX)
+        {
+            v->type[r] = REG_INTEGER;
+            v->i[r] = (int32_t) b->keys[r];
+        }
+        else if ((rc = __chidb_dbm_batch_addNumber(b, v, r, DBM_VEC_INT64,
+                                                   (chidb_dbm_number_t) { .i = (int64_t) b->keys[r] })) != CHIDB_OK)
+            return rc;
+    }
+    v->valid = true;
+
+    return CHIDB_OK;
+}
+
+
+/* Load a column of the selected rows into a column vector
+ *
+ * Values are read straight from the records, without unpacking them.
+ * Rows whose record doesn't have the column are loaded as unspecified
+ * values (like the Column instruction does).
+ *
+ * Parameters
+ * - stmt: DBM program
+ * - col: Column (field of the records)
+ * - reg: Register whose vector is loaded
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_PROBLEM: The program has no batch
+ * - CHIDB_ENOREG: Invalid register
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_batch_column(chidb_stmt *stmt, uint32_t col, int32_t reg)
+{
+    chidb_dbm_batch_t *b = stmt->batch;
+    chidb_dbm_vector_t *v;
+    int rc;
+
+    if (b == NULL)
+        return CHIDB_PROBLEM;
+    if ((rc = __chidb_dbm_batch_vector(b, reg, &v)) != CHIDB_OK)
+        return rc;
+
+    for(uint32_t j = 0; j < b->nsel; j++)
+    {
+        uint16_t r = b->sel[j];
+        const uint8_t *raw = b->recs + b->rec_off[r];
+        const uint8_t *value = NULL;
+        uint32_t hpos = 1, dpos = raw[0], type = SQL_NULL;
+
+        rc = CHIDB_OK;
+        for(uint32_t f = 0; f <= col && rc == CHIDB_OK; f++)
+            rc = chidb_DBRecord_nextRawField(raw, &hpos, &dpos, &type, &value);
+
+        if (rc != CHIDB_OK)
+            v->type[r] = REG_UNSPECIFIED;
+        else if (type == SQL_NULL)
+            v->type[r] = REG_NULL;
+        else if (type <= SQL_INTEGER_8BYTE)
+        {
+            int64_t i = chidb_DBRecord_rawInt(value, type);
+
+            if (i >= INT32_MIN && i <= INT32_MAX)
+            {
+                v->type[r] = REG_INTEGER;
+                v->i[r] = (int32_t) i;
+            }
+            else if ((rc = __chidb_dbm_batch_addNumber(b, v, r, DBM_VEC_INT64,
+                                                       (chidb_dbm_number_t) { .i = i })) != CHIDB_OK)
+                return rc;
+        }
+        else if (type == SQL_REAL)
+        {
+            if ((rc = __chidb_dbm_batch_addNumber(b, v, r, REG_REAL,
+                                                  (chidb_dbm_number_t) { .r = chidb_DBRecord_rawReal(value) })) != CHIDB_OK)
+                return rc;
+        }
+        else if ((type - SQL_TEXT) % 2 == 0)
+        {
+            uint32_t len = (type - SQL_TEXT) / 2;
+
+            if ((rc = __chidb_dbm_batch_reserve((void **) &b->strs, &b->strs_size, b->strs_len + len + 1)) != CHIDB_OK)
+                return rc;
+            memcpy(b->strs + b->strs_len, value, len);
+            b->strs[b->strs_len + len] = '\0';
+
+            v->type[r] = REG_STRING;
+            v->i[r] = b->strs_len;
+            b->strs_len += len + 1;
+        }
+        else
+            v->type[r] = REG_UNSPECIFIED;
+    }
+    v->valid = true;
+
+    return CHIDB_OK;
+}
+
+
+/* Drop the selected rows whose bit is set in a bitmap. Returns the
+ * number of rows left in sel. */
+static uint32_t __chidb_dbm_batch_drop(uint16_t *sel, uint32_t nsel, const uint64_t *bitmap)
+{
+    uint32_t n = 0;
+
+    for(uint32_t j = 0; j < nsel; j++)
+    {
+        uint16_t r = sel[j];
+
+        sel[n] = r;
+        n += !((bitmap[r >> 6] >> (r & 63)) & 1);
+    }
+
+    return n;
+}
+
+
+/* Does a string comparison hold? These are the same comparisons made
+ * by the Eq, Ne, Lt, Le, Gt and Ge instructions (s is the value in
+ * their p3 register, and k the one in their p1 register). */
+static bool __chidb_dbm_batch_strHolds(opcode_t cmp, const char *s, const char *k)
+{
+    switch(cmp)
+    {
+    case Op_Eq:
+        return strncmp(s, k, strlen(s)) == 0;
+    case Op_Ne:
+        return strncmp(s, k, strlen(s)) != 0;
+    case Op_Lt:
+        return strncmp(s, k, strlen(s)) < 0;
+    case Op_Le:
+        return strncmp(s, k, strlen(s)) <= 0;
+    case Op_Gt:
+        return strcmp(s, k) > 0;
+    case Op_Ge:
+        return strcmp(s, k) >= 0;
+    default:
+        return false;
+    }
+}
+
+
+/* Get the value of a row of a vector as a register. Returns false if
+ * it is not a number. */
+static bool __chidb_dbm_batch_number(chidb_dbm_batch_t *b, chidb_dbm_vector_t *v, uint16_t r,
+                                     chidb_dbm_register_t *reg)
+{
+    switch(v->type[r])
+    {
+    case REG_INTEGER:
+        reg->type = REG_INTEGER;
+        reg->value.i = v->i[r];
+        return true;
+    case DBM_VEC_INT64:
+        reg->type = REG_INTEGER;
+        reg->value.i = b->nums[v->i[r]].i;
+        return true;
+    case REG_REAL:
+        reg->type = REG_REAL;
+        reg->value.r = b->nums[v->i[r]].r;
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+/* Does a numeric comparison hold? Integers are compared as integers,
+ * and any other pair of numbers as reals, like the comparison
+ * instructions do. */
+static bool __chidb_dbm_batch_numHolds(opcode_t cmp, const chidb_dbm_register_t *s, const chidb_dbm_register_t *k)
+{
+    int c;
+
+    if (s->type == REG_INTEGER && k->type == REG_INTEGER)
+        c = (s->value.i > k->value.i) - (s->value.i < k->value.i);
+    else
+    {
+        double ds = s->type == REG_REAL ? s->value.r : (double) s->value.i;
+        double dk = k->type == REG_REAL ? k->value.r : (double) k->value.i;
+
+        c = (ds > dk) - (ds < dk);
+    }
+
+    switch(cmp)
+    {
+    case Op_Eq:
+        return c == 0;
+    case Op_Ne:
+        return c != 0;
+    case Op_Lt:
+        return c < 0;
+    case Op_Le:
+        return c <= 0;
+    case Op_Gt:
+        return c > 0;
+    case Op_Ge:
+        return c >= 0;
+    default:
+        return false;
+    }
+}
+
+
+/* Filter the selected rows of a batch
+ *
+ * Drops the rows for which a comparison instruction (Eq, Ne, Lt, Le,
+ * Gt or Ge) with the column vector of register vreg as its p3 and
+ * register reg as its p1 would jump, i.e., the rows that the scalar
+ * loop would skip. If reg has a loaded column vector too, each row is
+ * compared with its own value in it. As with those instructions, a row
+ * is only dropped if both values are numbers or both are strings.
+ * Integers that fit in 32 bits are compared by the SIMD kernels in
+ * dbm-simd.c, and any other numbers one row at a time.
+ *
+ * Parameters
+ * - stmt: DBM program
+ * - cmp: Comparison (the opcode of the instruction)
+ * - reg: Register with the value (or vector) to compare with
+ * - vreg: Register whose (loaded) vector is filtered on
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_PROBLEM: The program has no batch, the register is not valid,
+ *                  or the vector has not been loaded
+ */
+int chidb_dbm_batch_filter(chidb_stmt *stmt, opcode_t cmp, int32_t reg, int32_t vreg)
+{
+    chidb_dbm_batch_t *b = stmt->batch;
+    chidb_dbm_vector_t *v, *kv = NULL;
+    chidb_dbm_register_t *k = NULL;
+    uint64_t bitmap[DBM_SIMD_BITMAP_WORDS(DBM_BATCH_SIZE)];
+    uint32_t n = 0;
+
+    if (b == NULL || vreg < 0 || (uint32_t) vreg >= b->nvecs || b->vecs[vreg] == NULL || !b->vecs[vreg]->valid)
+        return CHIDB_PROBLEM;
+    v = b->vecs[vreg];
+
+    if (reg >= 0 && (uint32_t) reg < b->nvecs && b->vecs[reg] != NULL && b->vecs[reg]->valid)
+        kv = b->vecs[reg];
+    else if (IS_VALID_REGISTER(stmt, reg))
+        k = &stmt->reg[reg];
+    else
+        return CHIDB_PROBLEM;
+
+    /* Integers */
+    if (kv != NULL)
+        chidb_dbm_simd_cmpVector(cmp, v->type, v->i, kv->type, kv->i, b->nrows, bitmap);
+    else if (k->type == REG_INTEGER && DBM_REG_INT32(k))
+        chidb_dbm_simd_cmpConst(cmp, v->type, v->i, (int32_t) k->value.i, b->nrows, bitmap);
+    if (kv != NULL || (k->type == REG_INTEGER && DBM_REG_INT32(k)))
+        b->nsel = __chidb_dbm_batch_drop(b->sel, b->nsel, bitmap);
+
+    /* Other numbers */
+    if (b->nums_len > 0 || (k != NULL && DBM_REG_NUMERIC(k) && !(k->type == REG_INTEGER && DBM_REG_INT32(k))))
+    {
+        n = 0;
+        for(uint32_t j = 0; j < b->nsel; j++)
+        {
+            uint16_t r = b->sel[j];
+            chidb_dbm_register_t s, rk;
+            bool drop = false;
+
+            if (kv != NULL)
+                drop = (v->type[r] != REG_INTEGER || kv->type[r] != REG_INTEGER) &&
+                       __chidb_dbm_batch_number(b, v, r, &s) && __chidb_dbm_batch_number(b, kv, r, &rk) &&
+                       __chidb_dbm_batch_numHolds(cmp, &s, &rk);
+            else if (DBM_REG_NUMERIC(k))
+                drop = (v->type[r] != REG_INTEGER || !DBM_REG_INT32(k) || k->type != REG_INTEGER) &&
+                       __chidb_dbm_batch_number(b, v, r, &s) && __chidb_dbm_batch_numHolds(cmp, &s, k);
+
+            b->sel[n] = r;
+            n += !drop;
+        }
+        b->nsel = n;
+        n = 0;
+    }
+
+    /* Strings */
+    if (k != NULL && k->type == REG_STRING && chidb_dbm_reg_text(stmt, k) == NULL)
+        return CHIDB_ENOMEM;
+    if (kv != NULL || k->type == REG_STRING)
+    {
+        for(uint32_t j = 0; j < b->nsel; j++)
+        {
+            uint16_t r = b->sel[j];
+            bool drop = v->type[r] == REG_STRING;
+
+            if (kv != NULL)
+                drop = drop && kv->type[r] == REG_STRING &&
+                       __chidb_dbm_batch_strHolds(cmp, b->strs + v->i[r], b->strs + kv->i[r]);
+            else
+                drop = drop && __chidb_dbm_batch_strHolds(cmp, b->strs + v->i[r], k->value.s);
+
+            b->sel[n] = r;
+            n += !drop;
+        }
+        b->nsel = n;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Load the next selected row of a batch into registers
+ *
+ * Each register in [first_reg, first_reg + nregs) that has a loaded
+ * column vector is set to the row's value in it; the others are left
+ * as they are.
+ *
+ * Parameters
+ * - stmt: DBM program
+ * - first_reg: First register
+ * - nregs: Number of registers
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_DONE: All the selected rows have been loaded
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_batch_load(chidb_stmt *stmt, int32_t first_reg, int32_t nregs)
+{
+    chidb_dbm_batch_t *b = stmt->batch;
+    uint16_t r;
+    int rc = CHIDB_OK;
+
+    if (b == NULL || b->next >= b->nsel)
+        return CHIDB_DONE;
+    r = b->sel[b->next++];
+
+    for(int32_t i = first_reg; i < first_reg + nregs && rc == CHIDB_OK; i++)
+    {
+        chidb_dbm_vector_t *v = (i >= 0 && (uint32_t) i < b->nvecs) ? b->vecs[i] : NULL;
+
+        if (v == NULL || !v->valid)
+            continue;
+
+        switch(v->type[r])
+        {
+        case REG_INTEGER:
+            rc = chidb_dbm_reg_setInt(stmt, i, v->i[r]);
+            break;
+        case DBM_VEC_INT64:
+            rc = chidb_dbm_reg_setInt(stmt, i, b->nums[v->i[r]].i);
+            break;
+        case REG_REAL:
+            rc = chidb_dbm_reg_setReal(stmt, i, b->nums[v->i[r]].r);
+            break;
+        case REG_STRING:
+            // borrowed until the batch is refilled, see chidb_dbm_op_unpin
+            rc = chidb_dbm_reg_borrowText(stmt, i, b->cursor, b->strs + v->i[r],
+                                          strlen(b->strs + v->i[r]));
+            break;
+        case REG_NULL:
+            rc = chidb_dbm_op_WriteReg(stmt, i, REG_NULL, NULL);
+            break;
+        default:
+            rc = chidb_dbm_op_WriteReg(stmt, i, REG_UNSPECIFIED, NULL);
+            break;
+        }
+    }
+
+    return rc;
+}
+
+
+/* Free the batch of a program
+ *
+ * Parameters
+ * - stmt: DBM program
+ */
+void chidb_dbm_batch_free(chidb_stmt *stmt)
+{
+    chidb_dbm_batch_t *b = stmt->batch;
+
+    if (b == NULL)
+        return;
+
+    for(uint32_t i = 0; i < b->nvecs; i++)
+        free(b->vecs[i]);
+    free(b->vecs);
+    free(b->recs);
+    free(b->strs);
+    free(b->nums);
+    free(b);
+    stmt->batch = NULL;
+}
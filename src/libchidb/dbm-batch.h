@@ -0,0 +1,129 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Batched (vectorized) table scans header.
+ *
+ */
+
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_BATCH_H_
+#define DBM_BATCH_H_
+
+#include "dbm-types.h"
+
+/* Maximum number of rows in a batch */
+#define DBM_BATCH_SIZE (1024)
+
+/* A column vector: the value of a register for each row of a batch.
+ * Integers that fit in 32 bits are stored in i. Strings are stored in
+ * the string buffer of the batch, and reals and wider integers in its
+ * number buffer; i holds their offset (or index) in it. */
+typedef struct chidb_dbm_vector
+{
+    bool valid;                         // Loaded for the current batch
+    uint8_t type[DBM_BATCH_SIZE];       // Register type of each row
+    int32_t i[DBM_BATCH_SIZE];
+} chidb_dbm_vector_t;
+
+/* Vector type of an integer that doesn't fit in 32 bits. The SIMD
+ * kernels only compare REG_INTEGER rows, so these (and REG_REAL rows)
+ * are compared one at a time instead. */
+#define DBM_VEC_INT64 (0x80)
+
+typedef union chidb_dbm_number
+{
+    int64_t i;
+    double r;
+} chidb_dbm_number_t;
+
+/* A batch of consecutive rows of a table, read by the batch
+ * instructions (BatchRewind, BatchNext, BatchColumn, BatchKey,
+ * BatchFilter and BatchResult). A scan loop of the form
+ *
+ *     rewind: BatchRewind  cursor exit
+ *             ...          (BatchColumn, BatchKey, BatchFilter)
+ *             BatchResult  reg n
+ *             BatchNext    cursor rewind+1
+ *     exit:   ...
+ *
+ * runs its body once per batch of up to DBM_BATCH_SIZE rows instead of
+ * once per row. BatchColumn and BatchKey load a column vector for a
+ * register, BatchFilter drops the rows that don't satisfy a comparison
+ * from the selection vector, and BatchResult produces the selected
+ * rows, one at a time. */
+struct chidb_dbm_batch
+{
+    int32_t cursor;     // Cursor the rows are read from
+    bool done;          // The cursor has gone past the last row
+
+    /* Key and record of each row. The records are copied into recs
+     * (rec_off holds their offsets), since the cursor moves on to other
+     * pages while the batch is filled */
+    uint32_t nrows;
+    chidb_key_t keys[DBM_BATCH_SIZE];
+    uint32_t rec_off[DBM_BATCH_SIZE];
+    uint8_t *recs;
+    uint32_t recs_len;
+    uint32_t recs_size;
+
+    /* Strings loaded into column vectors (NUL-terminated) */
+    char *strs;
+    uint32_t strs_len;
+    uint32_t strs_size;
+
+    /* Numbers loaded into column vectors (see DBM_VEC_INT64) */
+    chidb_dbm_number_t *nums;
+    uint32_t nums_len;
+    uint32_t nums_size;
+
+    /* Selection vector: the rows that have passed the filters so far,
+     * and the next one to be produced by BatchResult */
+    uint16_t sel[DBM_BATCH_SIZE];
+    uint32_t nsel;
+    uint32_t next;
+
+    /* Column vectors, indexed by register (NULL if not used) */
+    chidb_dbm_vector_t **vecs;
+    uint32_t nvecs;
+};
+
+int chidb_dbm_batch_fill(chidb_stmt *stmt, int32_t cursor);
+int chidb_dbm_batch_key(chidb_stmt *stmt, int32_t reg);
+int chidb_dbm_batch_column(chidb_stmt *stmt, uint32_t col, int32_t reg);
+int chidb_dbm_batch_filter(chidb_stmt *stmt, opcode_t cmp, int32_t reg, int32_t vreg);
+int chidb_dbm_batch_load(chidb_stmt *stmt, int32_t first_reg, int32_t nregs);
+void chidb_dbm_batch_free(chidb_stmt *stmt);
+
+#endif /* DBM_BATCH_H_ */
@@ -38,6 +38,7 @@
  */
 
 
+#include <inttypes.h>
 #include "dbm-cursor.h"
 
 int chidb_dbm_cursor_print(chidb_dbm_cursor_t *c)
@@ -45,7 +46,7 @@ int chidb_dbm_cursor_print(chidb_dbm_cursor_t *c)
     fprintf(stderr, "\n");
     fprintf(stderr, "+++++++++ CURSOR PRINTOUT +++++++\n");
     fprintf(stderr, "Current Cell Type: %d\n", c->current_cell.type);
-    fprintf(stderr, "Current Key: %d\n", c->current_cell.key);
+    fprintf(stderr, "Current Key: %" PRIu64 "\n", c->current_cell.key);
     fprintf(stderr, "Root Page: %d\n", c->root_page);
     fprintf(stderr, "Root type: %d\n", c->root_type);
     fprintf(stderr, "Number of Columns: %d\n", c->n_cols);
@@ -228,6 +229,7 @@ int chidb_dbm_cursor_init(BTree *bt, chidb_dbm_cursor_t *c, npage_t root_page, n
     c->root_page = root_page;
     c->root_type = btn->type;
     c->n_cols = n_cols;
+    c->ranged = false;
     list_insert_at(&(c->trail), ct, ct->depth); 
 
     return CHIDB_OK;
@@ -240,6 +242,33 @@ int chidb_dbm_cursor_init(BTree *bt, chidb_dbm_cursor_t *c, npage_t root_page, n
  */
 int chidb_dbm_cursor_destroy(BTree *bt, chidb_dbm_cursor_t *c)
 {
+    // sorter cursors have no trail, just the sorter itself
+    if (c->type == CURSOR_SORTER)
+    {
+        chidb_Sorter_close(c->sorter);
+        c->sorter = NULL;
+        c->type = CURSOR_UNSPECIFIED;
+        return CHIDB_OK;
+    }
+
+    // same goes for aggregator cursors
+    if (c->type == CURSOR_AGGREGATOR)
+    {
+        chidb_Aggregator_close(c->agg);
+        c->agg = NULL;
+        c->type = CURSOR_UNSPECIFIED;
+        return CHIDB_OK;
+    }
+
+    // and record set cursors
+    if (c->type == CURSOR_SET)
+    {
+        chidb_RecordSet_close(c->set);
+        c->set = NULL;
+        c->type = CURSOR_UNSPECIFIED;
+        return CHIDB_OK;
+    }
+
     // free all of the btn's held within the cursor trail structs
     chidb_dbm_cursor_trail_list_destroy(bt, &(c->trail));
 
@@ -248,6 +277,27 @@ int chidb_dbm_cursor_destroy(BTree *bt, chidb_dbm_cursor_t *c)
     return CHIDB_OK;
 }
 
+/* Checks whether moving a table cursor to the next (or previous) cell
+ * keeps it in the same leaf, so the cell it points to now stays in memory
+ *
+ * Return
+ * - true: The cursor will stay in its current leaf
+ * - false: The cursor may move to another node (or is not a table cursor)
+ */
+bool chidb_dbm_cursor_staysOnLeaf(chidb_dbm_cursor_t *c, bool forward)
+{
+    chidb_dbm_cursor_trail_t *ct;
+
+    if ((c->type != CURSOR_READ && c->type != CURSOR_WRITE) || list_size(&(c->trail)) == 0)
+        return false;
+
+    ct = list_get_at(&(c->trail), list_size(&(c->trail)) - 1);
+    if (ct->btn->type != PGTYPE_TABLE_LEAF)
+        return false;
+
+    return forward ? ct->n_current_cell < ct->btn->n_cells - 1 : ct->n_current_cell > 0;
+}
+
 /* Wrapper for the index and table versions of forward
  *
  * Branches on index or table to call proper fwd functions
@@ -274,6 +324,8 @@ int chidb_dbm_cursor_fwd(BTree *bt, chidb_dbm_cursor_t *c)
 
         case PGTYPE_INDEX_INTERNAL:
         case PGTYPE_INDEX_LEAF:
+        case PGTYPE_VARINDEX_INTERNAL:
+        case PGTYPE_VARINDEX_LEAF:
             ret = chidb_dbm_cursorIndex_fwd(bt, c);
             break;
 
@@ -459,6 +511,7 @@ int chidb_dbm_cursorIndex_fwd(BTree *bt, chidb_dbm_cursor_t *c)
     switch(node_type)
     {
     	case PGTYPE_INDEX_LEAF:
+    	case PGTYPE_VARINDEX_LEAF:
     		//check if we can go to the next cell
             if(ct->n_current_cell == ct->btn->n_cells - 1) // we're at the last cell in the leaf
             {
@@ -476,6 +529,7 @@ int chidb_dbm_cursorIndex_fwd(BTree *bt, chidb_dbm_cursor_t *c)
                 return CHIDB_OK;
             }
     	case PGTYPE_INDEX_INTERNAL:
+    	case PGTYPE_VARINDEX_INTERNAL:
     		//at this point we always need to go down the next cell's child page
             //first though, need to check if there is another cell to go to
             ct->n_current_cell++;
@@ -516,23 +570,16 @@ int chidb_dbm_cursorIndex_fwdUp(BTree *bt, chidb_dbm_cursor_t *c)
 
     chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
 
-    ct->n_current_cell++; // advance the current cell as if we are going down to next one
-
+    // n_current_cell is the child we just came out of
     if(ct->n_current_cell < ct->btn->n_cells)
     {
         //since this is an index, and you are looking for the next biggest value, we need to stop here
-        //at the internal's next cell because it holds the key value pair that is greater than the leaf
-        //we just came out of
-        BTreeCell cell;
-        chidb_Btree_getCell(ct->btn, ct->n_current_cell, &cell);
+        //at the cell whose child we just came out of, because it holds the key value pair that is
+        //greater than everything in that child
+        chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
 
         return CHIDB_OK;
     }
-    else if(ct->n_current_cell == ct->btn->n_cells)
-    {
-        //need to go down right page
-        return chidb_dbm_cursorIndex_fwdDwn(bt,c);
-    }
     else //we've already explored the right page and are out of cells to go down
     {
         // remove the old portion of the trail, we're going up
@@ -563,12 +610,14 @@ int chidb_dbm_cursorIndex_fwdDwn(BTree *bt, chidb_dbm_cursor_t *c)
     switch(node_type)
     {
         case PGTYPE_INDEX_INTERNAL:
+        case PGTYPE_VARINDEX_INTERNAL:
             if(ct->n_current_cell < ct->btn->n_cells)
             {
                 // we need to make the new part of trail on the cell num
                 BTreeCell cell;
                 chidb_Btree_getCell(ct->btn, ct->n_current_cell, &cell);
-                pg = cell.fields.indexInternal.child_page;
+                pg = (node_type == PGTYPE_VARINDEX_INTERNAL) ?
+                     cell.fields.varIndex.child_page : cell.fields.indexInternal.child_page;
             }
             else if(ct->n_current_cell == ct->btn->n_cells)
             {
@@ -590,6 +639,7 @@ int chidb_dbm_cursorIndex_fwdDwn(BTree *bt, chidb_dbm_cursor_t *c)
             return chidb_dbm_cursorIndex_fwdDwn(bt, c);
 
         case PGTYPE_INDEX_LEAF:
+        case PGTYPE_VARINDEX_LEAF:
             // get the cell and put it in the cursor
             chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
             // update cursor fields
@@ -623,6 +673,8 @@ int chidb_dbm_cursor_rev(BTree *bt, chidb_dbm_cursor_t *c)
 
         case PGTYPE_INDEX_INTERNAL:
         case PGTYPE_INDEX_LEAF:
+        case PGTYPE_VARINDEX_INTERNAL:
+        case PGTYPE_VARINDEX_LEAF:
             ret = chidb_dbm_cursorIndex_rev(bt, c);
             break;
 
@@ -798,6 +850,7 @@ int chidb_dbm_cursorIndex_rev(BTree *bt, chidb_dbm_cursor_t *c)
     switch(node_type)
     {
         case PGTYPE_INDEX_LEAF:
+        case PGTYPE_VARINDEX_LEAF:
             //check if we can go to the next cell
             if(ct->n_current_cell == 0) // we're at the first cell in the leaf
             {
@@ -815,6 +868,7 @@ int chidb_dbm_cursorIndex_rev(BTree *bt, chidb_dbm_cursor_t *c)
                 return CHIDB_OK;
             }
         case PGTYPE_INDEX_INTERNAL:
+        case PGTYPE_VARINDEX_INTERNAL:
             //at this point we always need to go down the ~current~ cell's child page
             if(ct->n_current_cell >= 0)
             {
@@ -863,8 +917,7 @@ int chidb_dbm_cursorIndex_revUp(BTree *bt, chidb_dbm_cursor_t *c)
         //since this is an index, and you are looking for the next smallest value, we need to stop here
         //at the internal's next cell because it holds the key value pair that is less than the child
         //we just came out of
-        BTreeCell cell;
-        chidb_Btree_getCell(ct->btn, ct->n_current_cell, &cell);
+        chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
 
         return CHIDB_OK;
     }
@@ -874,7 +927,7 @@ int chidb_dbm_cursorIndex_revUp(BTree *bt, chidb_dbm_cursor_t *c)
         chidb_dbm_cursor_trail_remove_at(bt, c, list_loc);
 
         // going up
-        return chidb_dbm_cursorIndex_fwdUp(bt, c); 
+        return chidb_dbm_cursorIndex_revUp(bt, c); 
     }
 
     return CHIDB_OK;
@@ -898,17 +951,19 @@ int chidb_dbm_cursorIndex_revDwn(BTree *bt, chidb_dbm_cursor_t *c)
     switch(node_type)
     {
         case PGTYPE_INDEX_INTERNAL:
-            if(ct->n_current_cell >= 0)
+        case PGTYPE_VARINDEX_INTERNAL:
+            if(ct->n_current_cell == ct->btn->n_cells)
+            {
+                // trail on right page
+                pg = ct->btn->right_page;
+            }
+            else if(ct->n_current_cell >= 0)
             {
                 // we need to make the new part of trail on the cell num
                 BTreeCell cell;
                 chidb_Btree_getCell(ct->btn, ct->n_current_cell, &cell);
-                pg = cell.fields.indexInternal.child_page;
-            }
-            else if(ct->n_current_cell == ct->btn->n_cells)
-            {
-                // trail on right page
-                pg = ct->btn->right_page;
+                pg = (node_type == PGTYPE_VARINDEX_INTERNAL) ?
+                     cell.fields.varIndex.child_page : cell.fields.indexInternal.child_page;
             }
             else
                 return CHIDB_ECELLNO;
@@ -923,16 +978,17 @@ int chidb_dbm_cursorIndex_revDwn(BTree *bt, chidb_dbm_cursor_t *c)
             
             // if the new trail instance holds a leaf btn, it doesn't have a right page so
             // its max current cell is n_cells-1.
-            if(ct_new->btn->type == PGTYPE_TABLE_LEAF)
+            if(ct_new->btn->type == PGTYPE_INDEX_LEAF || ct_new->btn->type == PGTYPE_VARINDEX_LEAF)
                 ct_new->n_current_cell--;
 
             // add the new thing to the trail
             list_insert_at(&(c->trail), ct_new, next_depth);
             
-            // call fwdDwn again
-            return chidb_dbm_cursorIndex_fwdDwn(bt, c);
+            // call revDwn again, down to the last entry of the child
+            return chidb_dbm_cursorIndex_revDwn(bt, c);
 
         case PGTYPE_INDEX_LEAF:
+        case PGTYPE_VARINDEX_LEAF:
             // get the cell and put it in the cursor
             chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
 
@@ -945,6 +1001,150 @@ int chidb_dbm_cursorIndex_revDwn(BTree *bt, chidb_dbm_cursor_t *c)
     return CHIDB_OK;
 }
 
+/* Seek the first entry of an index whose key is >= key (> key for
+ * SEEKGT). Several entries of an index may have the same key, and they
+ * may be on both sides of an internal cell with that key, so the search
+ * always goes down to a leaf: the entry is the first qualifying cell of
+ * the leaf or, if there is none, the internal cell the search last went
+ * down to the left of. In a variable-length index, vkey (of vsize bytes)
+ * is the key, and key is not used.
+ *
+ * Return
+ * - CHIDB_OK: Operation sucessful
+ * - CHIDB_ENOTFOUND: SEEK, and there is no entry with that key
+ * - CHIDB_CURSORCANTMOVE: All the entries are smaller than key
+ * - CHIDB_ENOMEM: Malloc failed
+ */
+static int chidb_dbm_cursorIndex_seek(BTree *bt, chidb_dbm_cursor_t *c, chidb_key_t key,
+                                      const uint8_t *vkey, uint16_t vsize, int seek_type)
+{
+    chidb_dbm_cursor_trail_t *ct;
+    BTreeNode *btn;
+    BTreeCell cell;
+    int found = -1; // depth of the last node with a qualifying cell
+    int rc;
+
+    // reload the root, which may have changed since the cursor was opened
+    if ((rc = chidb_Btree_getNodeByPage(bt, c->root_page, &btn)) != CHIDB_OK)
+        return rc;
+    chidb_dbm_cursor_clear_trail_from(bt, c, 0);
+    ct = list_get_at(&(c->trail), 0);
+    chidb_Btree_freeMemNode(bt, ct->btn);
+    ct->btn = btn;
+
+    while (true)
+    {
+        ncell_t i;
+        npage_t child;
+
+        if (ct->btn->type == PGTYPE_VARINDEX_INTERNAL || ct->btn->type == PGTYPE_VARINDEX_LEAF)
+        {
+            if ((rc = chidb_Btree_varIndexSearch(ct->btn, vkey, vsize, seek_type == SEEKGT, &i, &cell)) != CHIDB_OK)
+                return rc;
+            child = (i == ct->btn->n_cells) ? ct->btn->right_page : cell.fields.varIndex.child_page;
+        }
+        else
+            chidb_Btree_keySearch(ct->btn, key, seek_type == SEEKGT, &i, &child, NULL);
+        ct->n_current_cell = i;
+        if (i < ct->btn->n_cells)
+            found = ct->depth;
+
+        if (ct->btn->type != PGTYPE_INDEX_INTERNAL && ct->btn->type != PGTYPE_VARINDEX_INTERNAL)
+            break;
+
+        if ((rc = chidb_dbm_cursor_trail_new(bt, &ct, child, ct->depth + 1)) != CHIDB_OK)
+            return rc;
+        list_append(&(c->trail), ct);
+    }
+
+    if (found < 0)
+        return CHIDB_CURSORCANTMOVE;
+
+    chidb_dbm_cursor_clear_trail_from(bt, c, found);
+    ct = list_get_at(&(c->trail), found);
+    chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
+
+    if (seek_type == SEEK && vkey != NULL &&
+        chidb_Btree_keyCmp(c->current_cell.fields.varIndex.key, c->current_cell.fields.varIndex.key_size,
+                           vkey, vsize) != 0)
+        return CHIDB_ENOTFOUND;
+    if (seek_type == SEEK && vkey == NULL && c->current_cell.key != key)
+        return CHIDB_ENOTFOUND;
+
+    return CHIDB_OK;
+}
+
+/* Move a cursor to the last entry of an index, which is always in its
+ * rightmost leaf
+ *
+ * Return
+ * - CHIDB_OK: Operation sucessful
+ * - CHIDB_CURSORCANTMOVE: The index is empty
+ * - CHIDB_ENOMEM: Malloc failed
+ */
+static int chidb_dbm_cursorIndex_last(BTree *bt, chidb_dbm_cursor_t *c)
+{
+    chidb_dbm_cursor_trail_t *ct;
+    BTreeNode *btn;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, c->root_page, &btn)) != CHIDB_OK)
+        return rc;
+    chidb_dbm_cursor_clear_trail_from(bt, c, 0);
+    ct = list_get_at(&(c->trail), 0);
+    chidb_Btree_freeMemNode(bt, ct->btn);
+    ct->btn = btn;
+
+    while (ct->btn->type == PGTYPE_INDEX_INTERNAL || ct->btn->type == PGTYPE_VARINDEX_INTERNAL)
+    {
+        ct->n_current_cell = ct->btn->n_cells;
+        if ((rc = chidb_dbm_cursor_trail_new(bt, &ct, ct->btn->right_page, ct->depth + 1)) != CHIDB_OK)
+            return rc;
+        list_append(&(c->trail), ct);
+    }
+
+    if (ct->btn->n_cells == 0)
+        return CHIDB_CURSORCANTMOVE;
+    ct->n_current_cell = ct->btn->n_cells - 1;
+
+    return chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
+}
+
+/* Seek an entry of a variable-length index
+ *
+ * Since keys are compared as bytes, and a key is equal to every longer
+ * key that starts with it, key can be the encoding of the first indexed
+ * values alone (see chidb_Index_keyAppendNull), which is equal to the
+ * keys of all the entries that have those values.
+ *
+ * bt:        our full B-tree for searching
+ * c:         our cursor, on a variable-length index
+ * key, size: key we are searching for
+ * seek_type: can be any of the following: SEEK, SEEKLT, SEEKGT, SEEKLE, SEEKGE
+ *
+ * Return
+ * - CHIDB_OK: Operation sucessful
+ * - CHIDB_ENOTFOUND: SEEK, and there is no entry with that key
+ * - CHIDB_CURSORCANTMOVE: There is no entry on the requested side of key
+ * - CHIDB_ENOMEM: Malloc failed
+ */
+int chidb_dbm_cursor_seekKey(BTree *bt, chidb_dbm_cursor_t *c, const uint8_t *key, uint16_t size, int seek_type)
+{
+    int rc;
+
+    if (seek_type == SEEK || seek_type == SEEKGE || seek_type == SEEKGT)
+        return chidb_dbm_cursorIndex_seek(bt, c, 0, key, size, seek_type);
+
+    // the entry before the first one that is not on the requested side
+    rc = chidb_dbm_cursorIndex_seek(bt, c, 0, key, size, seek_type == SEEKLT ? SEEKGE : SEEKGT);
+    if (rc == CHIDB_CURSORCANTMOVE)
+        return chidb_dbm_cursorIndex_last(bt, c);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    return chidb_dbm_cursor_rev(bt, c);
+}
+
 /* seek bt c key next depth seek_type
  * bt:        our full B-tree for searching
  * c:         our cursor for cursing
@@ -957,6 +1157,10 @@ int chidb_dbm_cursor_seek(BTree *bt, chidb_dbm_cursor_t *c, chidb_key_t key, npa
 {
     chidb_dbm_cursor_trail_t *trail_entry;
 
+    if (!depth && (c->root_type == PGTYPE_INDEX_INTERNAL || c->root_type == PGTYPE_INDEX_LEAF) &&
+        (seek_type == SEEK || seek_type == SEEKGE || seek_type == SEEKGT))
+        return chidb_dbm_cursorIndex_seek(bt, c, key, NULL, 0, seek_type);
+
     if (!depth)
     {
         chidb_dbm_cursor_clear_trail_from(bt, c, 0);
@@ -970,165 +1174,70 @@ int chidb_dbm_cursor_seek(BTree *bt, chidb_dbm_cursor_t *c, chidb_key_t key, npa
     
     BTreeCell cell;
     BTreeNode *btn;
-    
-
+    npage_t child;
+    ncell_t i;
+    bool match;
     int status;
-    int i = 0;
 
     if ((status = chidb_Btree_getNodeByPage(bt, next, &btn)) != CHIDB_OK)
     {
         free(btn);
+        if (depth)
+            free(trail_entry);
         return status;
     }
 
+    // the root is reloaded, since it may have changed since the cursor was opened
+    if (!depth)
+        chidb_Btree_freeMemNode(bt, trail_entry->btn);
+
     // Same info no matter what cell we choose. Just need cell # and to append
     trail_entry->depth = depth;
     trail_entry->btn = btn;
 
-    if (btn->type == PGTYPE_TABLE_LEAF)
-    {
-        do 
-        {
-            if (chidb_Btree_getCell(btn, i, &cell) != CHIDB_OK)
-                return CHIDB_ECELLNO;
-
-            if (cell.key == key)
-            {
-                trail_entry->n_current_cell = i;
-                c->current_cell = cell;
-                if (depth)
-                    list_append(&c->trail, trail_entry);
-                
-                if (seek_type == SEEKLT)
-                    return chidb_dbm_cursor_rev(bt, c);
-
-                else if (seek_type == SEEKGT)
-                    return chidb_dbm_cursor_fwd(bt, c);
-
-                return CHIDB_OK;
-            }
-            else if (cell.key > key)
-            {
-                // technically not correct for if it's seek, but doesn't matter...
-                trail_entry->n_current_cell = i;
-                c->current_cell = cell;
-                if (depth)
-                    list_append(&c->trail, trail_entry);
-
-                if (seek_type == SEEK)
-                    return CHIDB_ENOTFOUND;
-
-                else if (seek_type == SEEKLT || seek_type == SEEKLE)
-                    return chidb_dbm_cursor_rev(bt, c);
+    // the first cell whose key is not smaller than key
+    chidb_Btree_keySearch(btn, key, false, &i, &child, &match);
+    trail_entry->n_current_cell = i;
 
-                return CHIDB_OK;
-            }
-            else if (cell.key < key)
-            {
-                i++;
-            }
-
-            // i++;
-        } while (i < btn->n_cells);
-
-        return CHIDB_CURSORCANTMOVE;
-    }
-
-    else if (btn->type == PGTYPE_TABLE_INTERNAL)
+    if (btn->type == PGTYPE_TABLE_INTERNAL ||
+        (btn->type == PGTYPE_INDEX_INTERNAL && !match))
     {
-        do
-        {
-            if (chidb_Btree_getCell(btn, i, &cell) != CHIDB_OK)
-                return CHIDB_ECELLNO;
-
-            if ((cell.key >= key))
-            {
-                // add the node to the cursor's list
-                trail_entry->n_current_cell = i;
-                c->current_cell = cell;
-                if (depth)
-                    list_append(&c->trail, trail_entry);
-
-                if ((status = chidb_dbm_cursor_seek(bt, c, key, 
-                    cell.fields.tableInternal.child_page, depth+1, seek_type)) != CHIDB_OK)
-                    return status;
-                return CHIDB_OK;
-            }
-            else
-            {
-                i++;
-            }
-
-        } while ((cell.key < key) && (i < btn->n_cells));
-
-
-        trail_entry->n_current_cell = btn->n_cells;
-        c->current_cell = cell;
         if (depth)
             list_append(&c->trail, trail_entry);
-
-        return chidb_dbm_cursor_seek(bt, c, key, btn->right_page, depth+1, seek_type);
+        return chidb_dbm_cursor_seek(bt, c, key, child, depth+1, seek_type);
     }
 
-    else
+    // a leaf whose keys are all smaller
+    if (i == btn->n_cells)
     {
-        do 
+        if (depth)
         {
-            if (chidb_Btree_getCell(btn, i, &cell) != CHIDB_OK)
-                return CHIDB_ECELLNO;
-
-            if (cell.key == key) // WE FOUND A THING
-            {
-                trail_entry->n_current_cell = i;
-                c->current_cell = cell;
-                if (depth)
-                    list_append(&c->trail, trail_entry);
-
-                if (seek_type == SEEKLT)
-                    return chidb_dbm_cursor_rev(bt, c);
-                else if (seek_type == SEEKGT)
-                    return chidb_dbm_cursor_fwd(bt, c);
-
-                return CHIDB_OK;
-            }
-            else if (cell.key > key)
-            {
-                trail_entry->n_current_cell = i;
-                c->current_cell = cell;
-                if (depth)
-                    list_append(&c->trail, trail_entry);
-
-                if (btn->type == PGTYPE_INDEX_INTERNAL)
-                    return chidb_dbm_cursor_seek(bt, c, key, 
-                        cell.fields.indexInternal.child_page, depth+1, seek_type);
-                else
-                {
-                    if (seek_type == SEEK)
-                        return CHIDB_ENOTFOUND;
-
-                    else if (seek_type == SEEKLT || seek_type == SEEKLE)
-                        return chidb_dbm_cursor_rev(bt, c);
-                    
-                    return CHIDB_OK;
-                }
-            }
-
-            i++;
-        } while (i < btn->n_cells);
+            chidb_Btree_freeMemNode(bt, btn);
+            free(trail_entry);
+        }
+        return CHIDB_CURSORCANTMOVE;
+    }
 
-        if (btn->type == PGTYPE_INDEX_INTERNAL)
-        {
-            trail_entry->n_current_cell = btn->n_cells;
-            c->current_cell = cell;
-            if (depth)
-                list_append(&c->trail, trail_entry);
+    if (chidb_Btree_getCell(btn, i, &cell) != CHIDB_OK)
+        return CHIDB_ECELLNO;
+    c->current_cell = cell;
+    if (depth)
+        list_append(&c->trail, trail_entry);
 
-            return chidb_dbm_cursor_seek(bt, c, key, btn->right_page, depth+1, seek_type);
-        }
+    if (match) // WE FOUND A THING
+    {
+        if (seek_type == SEEKLT)
+            return chidb_dbm_cursor_rev(bt, c);
+        else if (seek_type == SEEKGT)
+            return chidb_dbm_cursor_fwd(bt, c);
 
-        else if (btn->type == PGTYPE_INDEX_LEAF)
-            return CHIDB_CURSORCANTMOVE;
+        return CHIDB_OK;
     }
 
-    return CHIDB_OK; // this should never be reached!
+    if (seek_type == SEEK)
+        return CHIDB_ENOTFOUND;
+    else if (seek_type == SEEKLT || seek_type == SEEKLE)
+        return chidb_dbm_cursor_rev(bt, c);
+
+    return CHIDB_OK;
 }
\ No newline at end of file
@@ -43,6 +43,10 @@
 
 #include "chidbInt.h"
 #include "btree.h"
+#include "bloom.h"
+#include "sorter.h"
+#include "aggregator.h"
+#include "recordset.h"
 #include "../simclist/simclist.h"
 
 typedef uint32_t ncol_t;   // number of columns a table has OR the number of a column
@@ -51,7 +55,10 @@ typedef enum chidb_dbm_cursor_type
 {
     CURSOR_UNSPECIFIED,
     CURSOR_READ,
-    CURSOR_WRITE
+    CURSOR_WRITE,
+    CURSOR_SORTER,
+    CURSOR_AGGREGATOR,
+    CURSOR_SET
 } chidb_dbm_cursor_type_t;
 
 typedef enum chidb_dbm_seek_type
@@ -80,6 +87,16 @@ typedef struct chidb_dbm_cursor
     ncol_t n_cols;          // number of columns in the table
     list_t trail;           // holds chidb_dbm_cursor_trail
 
+    Sorter *sorter;         // only used by CURSOR_SORTER cursors
+    Aggregator *agg;        // only used by CURSOR_AGGREGATOR cursors
+    RecordSet *set;         // only used by CURSOR_SET cursors
+
+    chidb_bloom_t bloom;    // filter of the B-Tree (see bloom.c)
+
+    bool ranged;            // if true, Rewind and Next only visit the entries
+    chidb_key_t key_min;    // with keys in [key_min, key_max] (used by the
+    chidb_key_t key_max;    // workers of a parallel scan, see dbm-parallel.c)
+
 } chidb_dbm_cursor_t;
 
 /* Cursor function definitions go here */
@@ -95,6 +112,7 @@ int chidb_dbm_cursor_init(BTree *bt, chidb_dbm_cursor_t *c, npage_t root_page, n
 int chidb_dbm_cursor_destroy(BTree *bt, chidb_dbm_cursor_t *c);
 
 int chidb_dbm_cursor_fwd(BTree *bt, chidb_dbm_cursor_t *c);
+bool chidb_dbm_cursor_staysOnLeaf(chidb_dbm_cursor_t *c, bool forward);
 int chidb_dbm_cursorTable_fwd(BTree *bt, chidb_dbm_cursor_t *c);
 int chidb_dbm_cursorTable_fwdUp(BTree *bt, chidb_dbm_cursor_t *c);
 int chidb_dbm_cursorTable_fwdDwn(BTree *bt, chidb_dbm_cursor_t *c);
@@ -111,6 +129,7 @@ int chidb_dbm_cursorIndex_revUp(BTree *bt, chidb_dbm_cursor_t *c);
 int chidb_dbm_cursorIndex_revDwn(BTree *bt, chidb_dbm_cursor_t *c);
 
 int chidb_dbm_cursor_seek(BTree *bt, chidb_dbm_cursor_t *c, chidb_key_t key, npage_t next, int depth, int seek_type);
+int chidb_dbm_cursor_seekKey(BTree *bt, chidb_dbm_cursor_t *c, const uint8_t *key, uint16_t size, int seek_type);
 
 
 #endif /* DBM_CURSOR_H_ */
@@ -112,7 +112,19 @@ int __chidb_dbm_is_sql(char* line)
 
 	return (strncasecmp("SELECT", s, 6) == 0 || strncasecmp("INSERT", s, 6) == 0 ||
 			strncasecmp("UPDATE", s, 6) == 0 || strncasecmp("DELETE", s, 6) == 0 ||
-			strncasecmp("CREATE", s, 6) == 0);
+			strncasecmp("CREATE", s, 6) == 0 || strncasecmp("ANALYZE", s, 7) == 0 ||
+			strncasecmp("BEGIN", s, 5) == 0 || strncasecmp("COMMIT", s, 6) == 0 ||
+			strncasecmp("ROLLBACK", s, 8) == 0);
+}
+
+/* Removes a database file, along with any write-ahead log left next to it */
+void __chidb_dbm_file_remove_db(const char *dbfile)
+{
+    char walfile[MAX_FILENAME_SIZE + sizeof(PAGER_WAL_SUFFIX)];
+
+    remove(dbfile);
+    snprintf(walfile, sizeof(walfile), "%s%s", dbfile, PAGER_WAL_SUFFIX);
+    remove(walfile);
 }
 
 int __chidb_dbm_file_load_db(chidb_dbm_file_t *dbmf, char *line, const char* dbfiledir, const char* genfiledir)
@@ -152,7 +164,7 @@ int __chidb_dbm_file_load_db(chidb_dbm_file_t *dbmf, char *line, const char* dbf
         if (rc >= MAX_FILENAME_SIZE)
             return CHIDB_ENOMEM;
 
-        remove(dbmf->dbfile);
+        __chidb_dbm_file_remove_db(dbmf->dbfile);
         dbmf->delete_dbfile = false;
     }
     else if (strcmp(tokens[0], "USE") == 0)
@@ -169,7 +181,7 @@ int __chidb_dbm_file_load_db(chidb_dbm_file_t *dbmf, char *line, const char* dbf
             if (rc >= MAX_FILENAME_SIZE)
                 return CHIDB_ENOMEM;
 
-            remove(dbmf->dbfile);
+            __chidb_dbm_file_remove_db(dbmf->dbfile);
             if(copy(srcfile, dbmf->dbfile) == NULL)
                 return CHIDB_EIO;
 
@@ -277,10 +289,19 @@ int __chidb_dbm_file_parse_register(char *line, chidb_dbm_file_register_t *reg)
     }
     else if (strcmp(tokens[1], "integer") == 0)
     {
-        reg->reg.type = REG_INT32;
+        reg->reg.type = REG_INTEGER;
+        if(ntokens == 3)
+        {
+            reg->reg.value.i = strtoll(tokens[2], NULL, 10);
+            reg->has_value = true;
+        }
+    }
+    else if (strcmp(tokens[1], "real") == 0)
+    {
+        reg->reg.type = REG_REAL;
         if(ntokens == 3)
         {
-            reg->reg.value.i = atoi(tokens[2]);
+            reg->reg.value.r = strtod(tokens[2], NULL);
             reg->has_value = true;
         }
     }
@@ -290,6 +311,8 @@ int __chidb_dbm_file_parse_register(char *line, chidb_dbm_file_register_t *reg)
         if(ntokens == 3)
         {
             reg->reg.value.s = strdup(tokens[2]);
+            reg->reg.len = strlen(reg->reg.value.s);
+            reg->reg.text = REG_TEXT_HEAP;
             reg->has_value = true;
         }
     }
@@ -531,7 +554,7 @@ int chidb_dbm_file_close(chidb_dbm_file_t *dbmf)
 
     if(dbmf->delete_dbfile)
     {
-        remove(dbmf->dbfile);
+        __chidb_dbm_file_remove_db(dbmf->dbfile);
     }
 
     return CHIDB_OK;
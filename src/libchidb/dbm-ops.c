@@ -41,6 +41,13 @@
 #include "dbm.h"
 #include "btree.h"
 #include "record.h"
+#include "sorter.h"
+#include "aggregator.h"
+#include "stats.h"
+#include "index.h"
+#include "dbm-parallel.h"
+#include "dbm-batch.h"
+#include "util.h"
 
 // Forward declaration
  int chidb_dbm_op_WriteReg (chidb_stmt *stmt, int regNo, int reg_type, void *data);
@@ -76,9 +83,73 @@ struct handler_entry dbm_handlers[] =
     FOREACH_OP(HANDLER_ENTRY)
 };
 
+/* Column does not copy the strings it reads: their registers borrow them
+ * from the cell the cursor points to, which stays in memory until the
+ * cursor moves to another node (or the batch of rows it points to is
+ * refilled). Before running an instruction that can do that, make the
+ * registers that borrow from its cursor copy their string. */
+static int chidb_dbm_op_unpin (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    switch(op->opcode)
+    {
+        case Op_Next:
+        case Op_Prev:
+            // moving within a leaf keeps the previous cell in memory
+            if (IS_VALID_CURSOR(stmt, op->p1) &&
+                chidb_dbm_cursor_staysOnLeaf(&stmt->cursors[op->p1], op->opcode == Op_Next))
+                return CHIDB_OK;
+            return chidb_dbm_reg_release(stmt, op->p1);
+        case Op_OpenRead:
+        case Op_OpenWrite:
+        case Op_Close:
+        case Op_Rewind:
+        case Op_Seek:
+        case Op_SeekGt:
+        case Op_SeekGe:
+        case Op_SeekLt:
+        case Op_SeekLe:
+        case Op_Insert:
+        case Op_IdxInsert:
+        case Op_SorterOpen:
+        case Op_SorterSort:
+        case Op_SorterNext:
+        case Op_AggOpen:
+        case Op_AggStep:
+        case Op_AggFinal:
+        case Op_AggNext:
+        case Op_SetOpen:
+        case Op_BatchRewind:
+        case Op_BatchNext:
+        case Op_BatchColumn:
+            // the batch may have been read from another cursor
+            if (stmt->batch != NULL && stmt->batch->cursor != op->p1)
+            {
+                int rc = chidb_dbm_reg_release(stmt, stmt->batch->cursor);
+                if (rc != CHIDB_OK)
+                    return rc;
+            }
+            return chidb_dbm_reg_release(stmt, op->p1);
+        case Op_Halt:
+            // registers can be read once the program is done
+            return chidb_dbm_reg_release(stmt, -1);
+        default:
+            return CHIDB_OK;
+    }
+}
+
 int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    return dbm_handlers[op->opcode].func(stmt, op);
+    int rc;
+
+    if (stmt->nborrowed > 0 && (rc = chidb_dbm_op_unpin(stmt, op)) != CHIDB_OK)
+        return rc;
+
+    rc = dbm_handlers[op->opcode].func(stmt, op);
+
+    /* Scratch memory only lives until the instruction is done */
+    chidb_Arena_reset(&stmt->scratch);
+
+    return rc;
 }
 
 
@@ -93,7 +164,7 @@ int chidb_dbm_op_OpenRead (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     // If cursor doesn't exist, allocate it
     if (!EXISTS_CURSOR(stmt, op->p1))
-        realloc_cur(stmt, op->p1);
+        realloc_cur(stmt, op->p1 + 1);
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
     chidb_dbm_cursor_init(stmt->db->bt, c, stmt->reg[op->p2].value.i, op->p3);
@@ -104,14 +175,14 @@ int chidb_dbm_op_OpenRead (chidb_stmt *stmt, chidb_dbm_op_t *op)
     if (!IS_VALID_CURSOR(stmt, op->p1))
         return CHIDB_PROBLEM;
 
-    return CHIDB_OK;
+    return chidb_Bloom_open(stmt->db, stmt->db->bt, c->root_page, &c->bloom);
 }
 
 int chidb_dbm_op_OpenWrite (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     // If cursor doesn't exist, allocate it
     if (!EXISTS_CURSOR(stmt, op->p1))
-        realloc_cur(stmt, op->p1);
+        realloc_cur(stmt, op->p1 + 1);
     
     chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
     chidb_dbm_cursor_init(stmt->db->bt, c, stmt->reg[op->p2].value.i, op->p3);
@@ -122,7 +193,7 @@ int chidb_dbm_op_OpenWrite (chidb_stmt *stmt, chidb_dbm_op_t *op)
     if (!IS_VALID_CURSOR(stmt, op->p1))
         return CHIDB_PROBLEM;
 
-    return CHIDB_OK;
+    return chidb_Bloom_open(stmt->db, stmt->db->bt, c->root_page, &c->bloom);
 }
 
 int chidb_dbm_op_Close (chidb_stmt *stmt, chidb_dbm_op_t *op)
@@ -137,6 +208,99 @@ int chidb_dbm_op_Close (chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
+/* Whether a cursor is open on a variable-length index (see btree.h) */
+static bool chidb_dbm_cursor_varIndex(chidb_dbm_cursor_t *c)
+{
+    return c->root_type == PGTYPE_VARINDEX_INTERNAL || c->root_type == PGTYPE_VARINDEX_LEAF;
+}
+
+/* Encodes the value of a register as (the start of) a key of a
+ * variable-length index: a record stands for its fields, in order, and
+ * any other register for its value (see chidb_Index_keyAppendNull) */
+static int chidb_dbm_reg_indexKey(chidb_dbm_register_t *r, uint8_t *key, uint16_t *size)
+{
+    uint32_t hpos = 1, dpos, type;
+    const uint8_t *value;
+    int rc = CHIDB_OK;
+
+    *size = 0;
+    switch(r->type)
+    {
+        case REG_NULL:
+            return chidb_Index_keyAppendNull(key, size);
+        case REG_INTEGER:
+            return chidb_Index_keyAppendInt(key, size, r->value.i);
+        case REG_REAL:
+            return chidb_Index_keyAppendReal(key, size, r->value.r);
+        case REG_STRING:
+            return chidb_Index_keyAppendText(key, size, r->value.s, r->len);
+        case REG_BINARY:
+            if (r->value.bin.bytes == NULL)
+                return CHIDB_PROBLEM;
+            dpos = r->value.bin.bytes[0];
+            while (rc == CHIDB_OK &&
+                   chidb_DBRecord_nextRawField(r->value.bin.bytes, &hpos, &dpos, &type, &value) == CHIDB_OK)
+                rc = chidb_Index_keyAppendRaw(key, size, type, value);
+            return rc;
+        default:
+            return CHIDB_PROBLEM;
+    }
+}
+
+/* Moves a cursor to the entry given by the value of a register: its key
+ * in a table or an index, and its encoding in a variable-length index.
+ * An exact SEEK first asks the filter of the B-Tree (if it has one)
+ * whether the entry may be there, and fails without descending the
+ * B-Tree if it can't. Filters of variable-length indexes hold the first
+ * value of each entry, so this is only done if there is one to look for. */
+static int chidb_dbm_cursor_seekReg(chidb_stmt *stmt, chidb_dbm_cursor_t *c, chidb_dbm_register_t *r, int seek_type)
+{
+    uint8_t key[VARINDEX_MAXKEY];
+    uint16_t size, len;
+    int rc;
+
+    if (!chidb_dbm_cursor_varIndex(c))
+    {
+        if (seek_type == SEEK && c->bloom.npages > 0 &&
+            !chidb_Bloom_mayContain(stmt->db->bt, &c->bloom, chidb_Bloom_hashKey(r->value.i)))
+            return CHIDB_ENOTFOUND;
+        return chidb_dbm_cursor_seek(stmt->db->bt, c, r->value.i, c->root_page, 0, seek_type);
+    }
+
+    if ((rc = chidb_dbm_reg_indexKey(r, key, &size)) != CHIDB_OK)
+        return rc;
+
+    if (seek_type == SEEK && c->bloom.npages > 0 &&
+        (rc = chidb_Index_keyPrefix(key, size, 1, &len)) != CHIDB_ECORRUPT && len > 0 &&
+        !chidb_Bloom_mayContain(stmt->db->bt, &c->bloom, chidb_Bloom_hash(key, len)))
+        return CHIDB_ENOTFOUND;
+
+    return chidb_dbm_cursor_seekKey(stmt->db->bt, c, key, size, seek_type);
+}
+
+/* Compares the index entry a cursor is on with the value of a register
+ * (see chidb_dbm_cursor_seekReg), into cmp */
+static int chidb_dbm_cursor_cmpReg(chidb_dbm_cursor_t *c, chidb_dbm_register_t *r, int *cmp)
+{
+    uint8_t key[VARINDEX_MAXKEY];
+    uint16_t size;
+    chidb_key_t k = r->value.i;
+    int rc;
+
+    if (c->current_cell.type != PGTYPE_VARINDEX_INTERNAL && c->current_cell.type != PGTYPE_VARINDEX_LEAF)
+    {
+        *cmp = (c->current_cell.key > k) - (c->current_cell.key < k);
+        return CHIDB_OK;
+    }
+
+    if ((rc = chidb_dbm_reg_indexKey(r, key, &size)) != CHIDB_OK)
+        return rc;
+    *cmp = chidb_Btree_keyCmp(c->current_cell.fields.varIndex.key, c->current_cell.fields.varIndex.key_size,
+                              key, size);
+
+    return CHIDB_OK;
+}
+
 int chidb_dbm_op_Rewind (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     uint32_t jmp_addr = op->p2;
@@ -156,6 +320,17 @@ int chidb_dbm_op_Rewind (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
         stmt->pc = jmp_addr;
     }
+    else if (c->ranged) // set cursor to the first entry in its range
+    {
+        if (chidb_dbm_cursor_seek(stmt->db->bt, c, c->key_min, c->root_page, 0, SEEKGE) != CHIDB_OK
+            || c->current_cell.key > c->key_max)
+        {
+            if (!IS_VALID_ADDRESS(stmt, jmp_addr))
+                return CHIDB_PROBLEM;
+
+            stmt->pc = jmp_addr;
+        }
+    }
     else // set cursor to the first entry
     {
         // remove the old trail from the cursor
@@ -173,6 +348,8 @@ int chidb_dbm_op_Rewind (chidb_stmt *stmt, chidb_dbm_op_t *op)
                 break;
             case PGTYPE_INDEX_INTERNAL:
             case PGTYPE_INDEX_LEAF:
+            case PGTYPE_VARINDEX_INTERNAL:
+            case PGTYPE_VARINDEX_LEAF:
                 chidb_dbm_cursorIndex_fwdDwn(stmt->db->bt, c);
                 break;
             default:
@@ -196,6 +373,9 @@ int chidb_dbm_op_Next (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     // move the cursor forward
     fwd_ret = chidb_dbm_cursor_fwd(stmt->db->bt,c);
+    // a ranged cursor can't move past the end of its range either
+    if (fwd_ret != CHIDB_CURSORCANTMOVE && c->ranged && c->current_cell.key > c->key_max)
+        fwd_ret = CHIDB_CURSORCANTMOVE;
     // if the cursor can't move and the jump op is valid, jump. else, get out!
     if(fwd_ret != CHIDB_CURSORCANTMOVE)
     {
@@ -241,7 +421,6 @@ int chidb_dbm_op_Seek (chidb_stmt *stmt, chidb_dbm_op_t *op)
     }
 
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    uint32_t key = r1->value.i;
 
     int seek_ret;
 
@@ -253,7 +432,7 @@ int chidb_dbm_op_Seek (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
-    seek_ret = chidb_dbm_cursor_seek(stmt->db->bt, c, key, c->root_page, 0, SEEK);
+    seek_ret = chidb_dbm_cursor_seekReg(stmt, c, r1, SEEK);
 
     if(seek_ret != CHIDB_OK)
     {
@@ -277,7 +456,6 @@ int chidb_dbm_op_SeekGt (chidb_stmt *stmt, chidb_dbm_op_t *op)
         return CHIDB_PROBLEM;
 
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    uint32_t key = r1->value.i;
     
     int seek_ret;
 
@@ -286,7 +464,7 @@ int chidb_dbm_op_SeekGt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
-    seek_ret = chidb_dbm_cursor_seek(stmt->db->bt, c, key, c->root_page, 0, SEEKGT);
+    seek_ret = chidb_dbm_cursor_seekReg(stmt, c, r1, SEEKGT);
     if(seek_ret != CHIDB_OK) 
     {
         if (!IS_VALID_ADDRESS(stmt, jmp_addr))
@@ -306,7 +484,6 @@ int chidb_dbm_op_SeekGe (chidb_stmt *stmt, chidb_dbm_op_t *op)
         return CHIDB_PROBLEM;
 
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    uint32_t key = r1->value.i;
 
     int seek_ret;
 
@@ -315,7 +492,7 @@ int chidb_dbm_op_SeekGe (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
-    seek_ret = chidb_dbm_cursor_seek(stmt->db->bt, c, key, c->root_page, 0, SEEKGE);
+    seek_ret = chidb_dbm_cursor_seekReg(stmt, c, r1, SEEKGE);
     if(seek_ret != CHIDB_OK)
     {
         if (!IS_VALID_ADDRESS(stmt, jmp_addr))
@@ -335,7 +512,6 @@ int chidb_dbm_op_SeekLt (chidb_stmt *stmt, chidb_dbm_op_t *op)
         return CHIDB_PROBLEM;
 
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    uint32_t key = r1->value.i;
     
     int seek_ret;
 
@@ -344,7 +520,7 @@ int chidb_dbm_op_SeekLt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
-    seek_ret = chidb_dbm_cursor_seek(stmt->db->bt, c, key, c->root_page, 0, SEEKLT);
+    seek_ret = chidb_dbm_cursor_seekReg(stmt, c, r1, SEEKLT);
     if(seek_ret != CHIDB_OK)
     {
         if (!IS_VALID_ADDRESS(stmt, jmp_addr))
@@ -364,7 +540,6 @@ int chidb_dbm_op_SeekLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
         return CHIDB_PROBLEM;
 
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    uint32_t key = r1->value.i;
     
     int seek_ret;
 
@@ -373,7 +548,7 @@ int chidb_dbm_op_SeekLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
-    seek_ret = chidb_dbm_cursor_seek(stmt->db->bt, c, key, c->root_page, 0, SEEKLE);
+    seek_ret = chidb_dbm_cursor_seekReg(stmt, c, r1, SEEKLE);
     if(seek_ret != CHIDB_OK)
     {
         if (!IS_VALID_ADDRESS(stmt, jmp_addr))
@@ -384,61 +559,105 @@ int chidb_dbm_op_SeekLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
+/* Reads a field of the entry a cursor on a variable-length index is on
+ * into a register (see chidb_Index_keyNextField) */
+static int chidb_dbm_cursor_indexColumn(chidb_stmt *stmt, chidb_dbm_cursor_t *c, int32_t col_num, int32_t reg_index)
+{
+    chidb_index_field_t field;
+    uint16_t pos = 0;
+    int ret = CHIDB_OK;
+
+    for(int32_t f = 0; f <= col_num && ret == CHIDB_OK; f++)
+        ret = chidb_Index_keyNextField(c->current_cell.fields.varIndex.key,
+                                       c->current_cell.fields.varIndex.key_size, &pos, &field);
+
+    if (ret != CHIDB_OK)
+        return chidb_dbm_op_WriteReg(stmt, reg_index, REG_UNSPECIFIED, NULL);
+
+    switch(field.tag)
+    {
+        case INDEX_KEY_INTEGER:
+            return chidb_dbm_reg_setInt(stmt, reg_index, field.i);
+        case INDEX_KEY_REAL:
+            return chidb_dbm_reg_setReal(stmt, reg_index, field.r);
+        case INDEX_KEY_TEXT:
+            return chidb_dbm_reg_setText(stmt, reg_index, field.text, field.len);
+        default:
+            return chidb_dbm_op_WriteReg(stmt, reg_index, REG_NULL, NULL);
+    }
+}
+
+/* Column p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: column
+ * p3: register
+ *
+ * store column p2 of the row the cursor is on in register p3. On a
+ * variable-length index, the columns are the fields of the entry's key.
+ */
 int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     int32_t c_index = op->p1;
     int32_t col_num = op->p2;
     int32_t reg_index = op->p3;
 
-    int8_t byte;
-    int16_t smallint;
-    int32_t integer;
-    char *string;
-
-    int ret;
-    int type;
-    DBRecord *dbr;
+    const uint8_t *value = NULL;
+    uint32_t hpos = 1, dpos, type = SQL_NULL;
+    int ret = CHIDB_OK;
 
     // get cursor and entry data
     if (!IS_VALID_CURSOR(stmt, c_index))
         return CHIDB_PROBLEM;
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
-    uint8_t *entry = c->current_cell.fields.tableLeaf.data;
+    const uint8_t *entry = c->current_cell.fields.tableLeaf.data;
 
-    if((ret = chidb_DBRecord_unpack(&dbr, entry)) != CHIDB_OK)
-        fprintf(stderr,"CHIDB_DBM_OP_COLUMN: couldn't unpack record\n");
+    if (chidb_dbm_cursor_varIndex(c))
+        return chidb_dbm_cursor_indexColumn(stmt, c, col_num, reg_index) == CHIDB_OK ? CHIDB_OK : CHIDB_PROBLEM;
 
-    type = chidb_DBRecord_getType(dbr, (uint8_t)col_num);
+    // walk the record up to the column, without unpacking it
+    dpos = entry[0];
+    for(int32_t f = 0; f <= col_num && ret == CHIDB_OK; f++)
+        ret = chidb_DBRecord_nextRawField(entry, &hpos, &dpos, &type, &value);
+
+    if (ret != CHIDB_OK)
+    {
+        if (EXISTS_REGISTER(stmt, reg_index))
+        {
+            chidb_dbm_reg_clear(stmt, &stmt->reg[reg_index]);
+            (stmt)->reg[reg_index].type = REG_UNSPECIFIED;
+        }
+        return CHIDB_OK;
+    }
 
     switch(type)
     {
         case SQL_INTEGER_1BYTE:
-            ret = chidb_DBRecord_getInt8(dbr, (uint8_t)col_num, &byte);
-            if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_INT32, &byte) != CHIDB_OK)
-                return CHIDB_PROBLEM;
-            break;
         case SQL_INTEGER_2BYTE:
-            ret = chidb_DBRecord_getInt16(dbr, (uint8_t)col_num, &smallint);
-            if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_INT32, &smallint) != CHIDB_OK)
+        case SQL_INTEGER_4BYTE:
+        case SQL_INTEGER_8BYTE:
+            if (chidb_dbm_reg_setInt(stmt, reg_index, chidb_DBRecord_rawInt(value, type)) != CHIDB_OK)
                 return CHIDB_PROBLEM;
             break;
-        case SQL_INTEGER_4BYTE:
-            ret = chidb_DBRecord_getInt32(dbr,(uint8_t)col_num, &integer);
-            if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_INT32, &integer) != CHIDB_OK)
+        case SQL_REAL:
+            if (chidb_dbm_reg_setReal(stmt, reg_index, chidb_DBRecord_rawReal(value)) != CHIDB_OK)
                 return CHIDB_PROBLEM;
             break;
         case SQL_NULL:
             if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_NULL, NULL) != CHIDB_OK)
                 return CHIDB_PROBLEM;
             break;
-        case SQL_TEXT:
-            ret = chidb_DBRecord_getString(dbr, (uint8_t)col_num, &string);
-            if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_STRING, strdup(string)) != CHIDB_OK)
+        default:
+            // the string stays in the cell, see chidb_dbm_op_unpin
+            if ((type - SQL_TEXT) % 2 == 0)
+            {
+                if (chidb_dbm_reg_borrowText(stmt, reg_index, c_index, (const char *) value,
+                                             (type - SQL_TEXT) / 2) != CHIDB_OK)
+                    return CHIDB_PROBLEM;
+            }
+            else if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_UNSPECIFIED, NULL) != CHIDB_OK)
                 return CHIDB_PROBLEM;
             break;
-        case SQL_NOTVALID:
-            (stmt)->reg[reg_index].type = REG_UNSPECIFIED;
-            break;
     }
   
     return CHIDB_OK;
@@ -448,7 +667,6 @@ int chidb_dbm_op_Key (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     int32_t c_index = op->p1;
     int32_t reg_index = op->p2;
-    uint32_t key;
 
     // get cursor
     if (!IS_VALID_CURSOR(stmt, c_index))
@@ -456,10 +674,7 @@ int chidb_dbm_op_Key (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
-    // get key
-    key = c->current_cell.key;
-
-    if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_INT32, &key) != CHIDB_OK)
+    if (chidb_dbm_reg_setInt(stmt, reg_index, (int64_t) c->current_cell.key) != CHIDB_OK)
         return CHIDB_PROBLEM;
 
     return CHIDB_OK;
@@ -467,7 +682,37 @@ int chidb_dbm_op_Key (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
 int chidb_dbm_op_Integer (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    if (chidb_dbm_op_WriteReg(stmt, op->p2, REG_INT32, &(op->p1)) != CHIDB_OK)
+    if (chidb_dbm_reg_setInt(stmt, op->p2, op->p1) != CHIDB_OK)
+        return CHIDB_PROBLEM;
+
+    return CHIDB_OK;
+}
+
+/* Int64 * p2 * p4
+ *
+ * p2: register to store the integer in
+ * p4: the integer, in decimal (for integers that don't fit in p1)
+ */
+int chidb_dbm_op_Int64 (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (op->p4 == NULL)
+        return CHIDB_PROBLEM;
+    if (chidb_dbm_reg_setInt(stmt, op->p2, strtoll(op->p4, NULL, 10)) != CHIDB_OK)
+        return CHIDB_PROBLEM;
+
+    return CHIDB_OK;
+}
+
+/* Real * p2 * p4
+ *
+ * p2: register to store the number in
+ * p4: the floating point number, as text
+ */
+int chidb_dbm_op_Real (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (op->p4 == NULL)
+        return CHIDB_PROBLEM;
+    if (chidb_dbm_reg_setReal(stmt, op->p2, strtod(op->p4, NULL)) != CHIDB_OK)
         return CHIDB_PROBLEM;
 
     return CHIDB_OK;
@@ -475,7 +720,7 @@ int chidb_dbm_op_Integer (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
 int chidb_dbm_op_String (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    if (chidb_dbm_op_WriteReg(stmt, op->p2, REG_STRING, strdup(op->p4)) != CHIDB_OK)
+    if (chidb_dbm_reg_setText(stmt, op->p2, op->p4, strlen(op->p4)) != CHIDB_OK)
         return CHIDB_PROBLEM;
     
     return CHIDB_OK;
@@ -493,7 +738,7 @@ int chidb_dbm_op_ResultRow (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     if (!IS_VALID_REGISTER(stmt, op->p1))
         return CHIDB_PROBLEM;
-    if (!IS_VALID_REGISTER(stmt, op->p2))
+    if (!EXISTS_REGISTER(stmt, op->p1 + op->p2 - 1))
         return CHIDB_PROBLEM;
 
     stmt->startRR = (uint32_t)op->p1;
@@ -502,58 +747,187 @@ int chidb_dbm_op_ResultRow (chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_ROW;
 }
 
-/* MakeREcord p1 p2 p3 *
+/* Size of the record made of registers r1 to r1 + n - 1 (registers
+ * that are not NULL, numbers or strings are left out of it). Integers
+ * take up 4 bytes, or 8 if they don't fit in 32 bits, and the header
+ * entries of strings as many bytes as their varint. */
+static uint32_t chidb_dbm_record_size(chidb_stmt *stmt, int32_t r1, int32_t n)
+{
+    uint32_t size = 1;
+
+    for(int32_t i = r1; i < r1 + n; i++)
+    {
+        chidb_dbm_register_t *r = &stmt->reg[i];
+
+        if (r->type == REG_NULL)
+            size += 1;
+        else if (r->type == REG_INTEGER)
+            size += 1 + (DBM_REG_INT32(r) ? 4 : 8);
+        else if (r->type == REG_REAL)
+            size += 1 + 8;
+        else if (r->type == REG_STRING)
+            size += varintLen32(r->len * 2 + SQL_TEXT) + r->len;
+    }
+
+    return size;
+}
+
+/* Writes the record made of registers r1 to r1 + n - 1 to p, in the
+ * same format as chidb_DBRecord_pack */
+static void chidb_dbm_record_write(chidb_stmt *stmt, int32_t r1, int32_t n, uint8_t *p)
+{
+    uint32_t hpos = 1, dpos = 1;
+
+    for(int32_t i = r1; i < r1 + n; i++)
+    {
+        chidb_dbm_register_t *r = &stmt->reg[i];
+
+        if (r->type == REG_STRING)
+            dpos += varintLen32(r->len * 2 + SQL_TEXT);
+        else if (r->type == REG_NULL || r->type == REG_INTEGER || r->type == REG_REAL)
+            dpos += 1;
+    }
+    p[0] = (uint8_t) dpos;
+
+    for(int32_t i = r1; i < r1 + n; i++)
+    {
+        chidb_dbm_register_t *r = &stmt->reg[i];
+
+        if (r->type == REG_NULL)
+            p[hpos++] = SQL_NULL;
+        else if (r->type == REG_INTEGER && DBM_REG_INT32(r))
+        {
+            p[hpos++] = SQL_INTEGER_4BYTE;
+            put4byte(p + dpos, (uint32_t) r->value.i);
+            dpos += 4;
+        }
+        else if (r->type == REG_INTEGER)
+        {
+            p[hpos++] = SQL_INTEGER_8BYTE;
+            put8byte(p + dpos, (uint64_t) r->value.i);
+            dpos += 8;
+        }
+        else if (r->type == REG_REAL)
+        {
+            uint64_t bits;
+
+            memcpy(&bits, &r->value.r, sizeof(bits));
+            p[hpos++] = SQL_REAL;
+            put8byte(p + dpos, bits);
+            dpos += 8;
+        }
+        else if (r->type == REG_STRING)
+        {
+            hpos += putVarint32(p + hpos, r->len * 2 + SQL_TEXT);
+            memcpy(p + dpos, r->value.s, r->len);
+            dpos += r->len;
+        }
+    }
+}
+
+/* Fills the data of a table cell with a record that was never written
+ * to a register (see chidb_dbm_op_MakeRecord) */
+typedef struct
+{
+    chidb_stmt *stmt;
+    chidb_dbm_register_t *r;
+} chidb_dbm_record_fill_t;
+
+static void chidb_dbm_record_fill(void *arg, uint8_t *dst)
+{
+    chidb_dbm_record_fill_t *fill = arg;
+
+    chidb_dbm_record_write(fill->stmt, fill->r->rec_first, fill->r->rec_n, dst);
+}
+
+/* Does the record that MakeRecord op is making go straight into a table?
+ * It does if the next instruction inserts it, and no other instruction
+ * reads the register it is stored in. Strings borrowed from a cursor
+ * may point into the pages the insert modifies, so they rule it out. */
+static bool chidb_dbm_record_direct(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_op_t *insert, *o;
+    int32_t r = op->p3;
+
+    if (stmt->pc >= stmt->endOp || op != &stmt->ops[stmt->pc - 1])
+        return false;
+    insert = &stmt->ops[stmt->pc];
+    if (insert->opcode != Op_Insert || insert->p2 != r)
+        return false;
+
+    for(int32_t i = op->p1; i < op->p1 + op->p2; i++)
+        if (stmt->reg[i].type == REG_STRING && stmt->reg[i].text == REG_TEXT_BORROWED)
+            return false;
+
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        o = &stmt->ops[i];
+        switch(o->opcode)
+        {
+        case Op_Insert:
+        case Op_SorterInsert:
+        case Op_AggStep:
+        case Op_SetInsert:
+        case Op_SetFound:
+        case Op_SetNotFound:
+            if (o != insert && o->p2 == r)
+                return false;
+            break;
+        case Op_ResultRow:
+            if (r >= o->p1 && r < o->p1 + o->p2)
+                return false;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return true;
+}
+
+/* MakeRecord p1 p2 p3 *
  *
  * p1: register containing first field of record
  * p2: n -- number of fields to be stored
- * p2: register to store new record in
+ * p3: register to store new record in
+ *
+ * The record is written straight into the register's buffer, once its
+ * size is known. A record that only the next instruction uses, to insert
+ * it into a table, is not written at all: the register just remembers
+ * which registers it is made of, and Insert writes it straight into the
+ * leaf page.
  */
- // Now passes tests!
 int chidb_dbm_op_MakeRecord (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     int32_t r1 = op->p1;
     int32_t n = op->p2;
     int32_t r2 = op->p3;
-    int32_t end_reg = (r1+n-1);
-    DBRecord *dbr;
+    chidb_dbm_register_t *reg2;
     uint8_t *record;
+    uint32_t size;
 
-    // Get register that record will be stored in
-    chidb_dbm_register_t *reg2 = &((stmt)->reg[r2]);
-
-    // Initialize the DBRecordBuffer
-    DBRecordBuffer dbrb;
-    chidb_DBRecord_create_empty(&dbrb, (uint8_t)n);
-
-    // get data from registers and append to DBRecordBuffer
-    int i;
-    for(i = r1; i <= end_reg; i++) 
+    for(int32_t i = r1; i < r1 + n; i++)
     {
         if (!IS_VALID_REGISTER(stmt, i))
             return CHIDB_PROBLEM;
-
-        chidb_dbm_register_t *tmp = &((stmt)->reg[i]);
-
-        if(tmp->type == REG_NULL) 
-            chidb_DBRecord_appendNull(&dbrb);
-        else if(tmp->type == REG_INT32) 
-            chidb_DBRecord_appendInt32(&dbrb, tmp->value.i);
-        else if(tmp->type == REG_STRING) 
-            chidb_DBRecord_appendString(&dbrb, tmp->value.s);
     }
+    size = chidb_dbm_record_size(stmt, r1, n);
 
-    chidb_DBRecord_finalize(&dbrb, &dbr);
-    uint32_t packed_len = dbr->packed_len;
-    chidb_DBRecord_pack(dbr, &record);
-    chidb_DBRecord_destroy(dbr);
+    if (!chidb_dbm_record_direct(stmt, op))
+    {
+        if (chidb_dbm_reg_setBinary(stmt, r2, size, &record) != CHIDB_OK)
+            return CHIDB_PROBLEM;
+        chidb_dbm_record_write(stmt, r1, n, record);
+        return CHIDB_OK;
+    }
 
-    // this checks the reg, but does not write the data because there are more fields to set than normal
-    if (chidb_dbm_op_WriteReg(stmt, r2, REG_BINARY, NULL) != CHIDB_OK)
+    if (chidb_dbm_reg_setBinary(stmt, r2, 0, &record) != CHIDB_OK)
         return CHIDB_PROBLEM;
-
-    reg2->type = REG_BINARY;
-    reg2->value.bin.nbytes = packed_len;
-    reg2->value.bin.bytes = record;
+    reg2 = &stmt->reg[r2];
+    reg2->value.bin.bytes = NULL;
+    reg2->value.bin.nbytes = size;
+    reg2->rec_first = r1;
+    reg2->rec_n = n;
 
     return CHIDB_OK;
 }
@@ -578,24 +952,55 @@ int chidb_dbm_op_Insert (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
     //creating a new cell to insert
-    BTreeCell *cell = malloc(sizeof(BTreeCell));
-    cell->type = PGTYPE_TABLE_LEAF;
-    cell->key = (uint32_t)reg2->value.i;
-    // fprintf(stderr, "THE KEY TO INSERT IS %d\n", cell->key);
-
-    cell->fields.tableLeaf.data = reg1->value.bin.bytes; //take the data from the record struct
-    cell->fields.tableLeaf.data_size = reg1->value.bin.nbytes;
-    chidb_Btree_insert(stmt->db->bt, c->root_page, cell);
+    BTreeCell cell;
+    chidb_dbm_record_fill_t fill = {stmt, reg1};
+    cell.type = PGTYPE_TABLE_LEAF;
+    cell.key = (chidb_key_t)reg2->value.i;
+
+    // take the data from the record (or, if it was never written, write
+    // it straight into the page)
+    cell.fields.tableLeaf.data = reg1->value.bin.bytes;
+    cell.fields.tableLeaf.data_size = reg1->value.bin.nbytes;
+    cell.fields.tableLeaf.fill = chidb_dbm_record_fill;
+    cell.fields.tableLeaf.fill_arg = &fill;
+
+    // the filter gets the key first, so it never misses a key the table has
+    int rc = chidb_Bloom_add(stmt->db->bt, &c->bloom, chidb_Bloom_hashKey(cell.key));
+    if (rc != CHIDB_OK)
+        return rc;
+    chidb_Btree_insert(stmt->db->bt, c->root_page, &cell);
 
     //RELOADING THE TREE just in case the insert messed up the treee
     chidb_key_t old_key = c->current_cell.key;
     chidb_dbm_cursor_seek(stmt->db->bt, c, old_key, c->root_page, 0, SEEK);
 
-    free(cell);
-
     return CHIDB_OK;
 }
 
+/* Compares the strings of two registers, which may not be NUL-terminated.
+ * If prefix is true, compares them like strncmp(s2, s1, strlen(s2)) (the
+ * comparison of Eq, Ne, Lt and Le), and like strcmp(s2, s1) otherwise */
+static int chidb_dbm_op_textcmp (chidb_dbm_register_t *reg2, chidb_dbm_register_t *reg1, bool prefix)
+{
+    uint32_t n = reg1->len < reg2->len ? reg1->len : reg2->len;
+    int cmp = memcmp(reg2->value.s, reg1->value.s, n);
+
+    if (cmp != 0)
+        return cmp;
+    if (prefix)
+        return reg1->len < reg2->len ? 1 : 0;
+    return (reg2->len > reg1->len) - (reg2->len < reg1->len);
+}
+
+/* Compares two numbers, one of which (at least) is REG_REAL */
+static int chidb_dbm_op_realcmp (chidb_dbm_register_t *reg2, chidb_dbm_register_t *reg1)
+{
+    double d2 = reg2->type == REG_REAL ? reg2->value.r : (double) reg2->value.i;
+    double d1 = reg1->type == REG_REAL ? reg1->value.r : (double) reg1->value.i;
+
+    return (d2 > d1) - (d2 < d1);
+}
+
 int chidb_dbm_op_Eq (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     uint32_t jmp_addr = op->p2;
@@ -610,13 +1015,18 @@ int chidb_dbm_op_Eq (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+    if(reg1->type == REG_INTEGER && reg2->type == REG_INTEGER) {
         if(reg2->value.i == reg1->value.i) {
             stmt->pc = (uint32_t)jmp_addr;
         }
     }
+    else if(DBM_REG_NUMERIC(reg1) && DBM_REG_NUMERIC(reg2)) {
+        if(chidb_dbm_op_realcmp(reg2, reg1) == 0) {
+            stmt->pc = (uint32_t)jmp_addr;
+        }
+    }
     else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
-        if(!strncmp(reg2->value.s,reg1->value.s, strlen(reg2->value.s))) {
+        if(!chidb_dbm_op_textcmp(reg2, reg1, true)) {
             stmt->pc = (uint32_t)jmp_addr;
         }
     }
@@ -638,13 +1048,18 @@ int chidb_dbm_op_Ne (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+    if(reg1->type == REG_INTEGER && reg2->type == REG_INTEGER) {
         if(reg2->value.i != reg1->value.i) {
             stmt->pc = (uint32_t)jmp_addr;
         }
     }
+    else if(DBM_REG_NUMERIC(reg1) && DBM_REG_NUMERIC(reg2)) {
+        if(chidb_dbm_op_realcmp(reg2, reg1) != 0) {
+            stmt->pc = (uint32_t)jmp_addr;
+        }
+    }
     else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
-        if(strncmp(reg2->value.s,reg1->value.s, strlen(reg2->value.s))) {
+        if(chidb_dbm_op_textcmp(reg2, reg1, true)) {
             stmt->pc = (uint32_t)jmp_addr;
         }
     }
@@ -666,13 +1081,18 @@ int chidb_dbm_op_Lt (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]); 
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+    if(reg1->type == REG_INTEGER && reg2->type == REG_INTEGER) {
         if(reg2->value.i < reg1->value.i) {
             stmt->pc = (uint32_t)jmp_addr;
         }
     }
+    else if(DBM_REG_NUMERIC(reg1) && DBM_REG_NUMERIC(reg2)) {
+        if(chidb_dbm_op_realcmp(reg2, reg1) < 0) {
+            stmt->pc = (uint32_t)jmp_addr;
+        }
+    }
     else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
-        if(strncmp(reg2->value.s,reg1->value.s, strlen(reg2->value.s)) < 0) {
+        if(chidb_dbm_op_textcmp(reg2, reg1, true) < 0) {
             stmt->pc = (uint32_t)jmp_addr;
         }
     }
@@ -686,13 +1106,18 @@ int chidb_dbm_op_Le (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]); 
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+    if(reg1->type == REG_INTEGER && reg2->type == REG_INTEGER) {
         if(reg2->value.i <= reg1->value.i) {
             stmt->pc = (uint32_t)jmp_addr;
         }
     }
+    else if(DBM_REG_NUMERIC(reg1) && DBM_REG_NUMERIC(reg2)) {
+        if(chidb_dbm_op_realcmp(reg2, reg1) <= 0) {
+            stmt->pc = (uint32_t)jmp_addr;
+        }
+    }
     else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
-        if(strncmp(reg2->value.s,reg1->value.s, strlen(reg2->value.s)) <= 0) {
+        if(chidb_dbm_op_textcmp(reg2, reg1, true) <= 0) {
             stmt->pc = (uint32_t)jmp_addr;
         }
     }
@@ -718,13 +1143,18 @@ int chidb_dbm_op_Gt (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg2 = &((stmt)->reg[r2]);
 
     
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+    if(reg1->type == REG_INTEGER && reg2->type == REG_INTEGER) {
         if(reg2->value.i > reg1->value.i) {
             stmt->pc = (uint32_t)jmp_addr;
         }
     }
+    else if(DBM_REG_NUMERIC(reg1) && DBM_REG_NUMERIC(reg2)) {
+        if(chidb_dbm_op_realcmp(reg2, reg1) > 0) {
+            stmt->pc = (uint32_t)jmp_addr;
+        }
+    }
     else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
-        if(strcmp(reg2->value.s,reg1->value.s) > 0) {
+        if(chidb_dbm_op_textcmp(reg2, reg1, false) > 0) {
             stmt->pc = (uint32_t)jmp_addr;
         }
     }
@@ -749,12 +1179,17 @@ int chidb_dbm_op_Ge (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg2 = &((stmt)->reg[r2]);
 
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+    if(reg1->type == REG_INTEGER && reg2->type == REG_INTEGER) {
         if((reg2->value.i >= reg1->value.i))
             stmt->pc = (uint32_t)jmp_addr;
     }
+    else if(DBM_REG_NUMERIC(reg1) && DBM_REG_NUMERIC(reg2)) {
+        if(chidb_dbm_op_realcmp(reg2, reg1) >= 0) {
+            stmt->pc = (uint32_t)jmp_addr;
+        }
+    }
     else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
-        if((strcmp(reg2->value.s,reg1->value.s) >= 0))
+        if((chidb_dbm_op_textcmp(reg2, reg1, false) >= 0))
             stmt->pc = (uint32_t)jmp_addr;
     }
 
@@ -783,12 +1218,14 @@ int chidb_dbm_op_IdxGt (chidb_stmt *stmt, chidb_dbm_op_t *op)
         return CHIDB_PROBLEM;
 
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    int32_t key = r1->value.i;
+    int cmp, rc;
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
   
     // I'm assuming hopefully that current cell points to an index cell
-    if(c->current_cell.key > key) {
+    if ((rc = chidb_dbm_cursor_cmpReg(c, r1, &cmp)) != CHIDB_OK)
+        return rc;
+    if(cmp > 0) {
         stmt->pc = (uint32_t)jmp_addr;
     }
 
@@ -816,12 +1253,14 @@ int chidb_dbm_op_IdxGe (chidb_stmt *stmt, chidb_dbm_op_t *op)
         return CHIDB_PROBLEM;
 
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    int32_t key = r1->value.i;
+    int cmp, rc;
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
   
     // I'm assuming hopefully that current cell points to an index cell
-    if((c->current_cell.key > key) || (c->current_cell.key == key)) {
+    if ((rc = chidb_dbm_cursor_cmpReg(c, r1, &cmp)) != CHIDB_OK)
+        return rc;
+    if(cmp >= 0) {
         stmt->pc = (uint32_t)jmp_addr;
     }
 
@@ -849,12 +1288,14 @@ int chidb_dbm_op_IdxLt (chidb_stmt *stmt, chidb_dbm_op_t *op)
         return CHIDB_PROBLEM;
 
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    int32_t key = r1->value.i;
+    int cmp, rc;
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
   
     // I'm assuming hopefully that current cell points to an index cell
-    if(c->current_cell.key < key) {
+    if ((rc = chidb_dbm_cursor_cmpReg(c, r1, &cmp)) != CHIDB_OK)
+        return rc;
+    if(cmp < 0) {
         stmt->pc = (uint32_t)jmp_addr;
     }
 
@@ -882,12 +1323,14 @@ int chidb_dbm_op_IdxLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
         return CHIDB_PROBLEM;
 
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    int32_t key = r1->value.i;
+    int cmp, rc;
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
   
     // I'm assuming hopefully that current cell points to an index cell
-    if((c->current_cell.key < key) || (c->current_cell.key == key)) {
+    if ((rc = chidb_dbm_cursor_cmpReg(c, r1, &cmp)) != CHIDB_OK)
+        return rc;
+    if(cmp <= 0) {
         stmt->pc = (uint32_t)jmp_addr;
     }
 
@@ -905,7 +1348,7 @@ int chidb_dbm_op_IdxPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     int32_t c_index = op->p1;
     int32_t reg_index = op->p2;
-    uint32_t key;
+    chidb_key_t key;
 
     if (!IS_VALID_CURSOR(stmt, c_index))
         return CHIDB_PROBLEM;
@@ -917,11 +1360,14 @@ int chidb_dbm_op_IdxPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
     if(c->current_cell.type == PGTYPE_INDEX_INTERNAL) {
         key = c->current_cell.fields.indexInternal.keyPk;
     }
+    else if(c->current_cell.type == PGTYPE_VARINDEX_INTERNAL || c->current_cell.type == PGTYPE_VARINDEX_LEAF) {
+        key = c->current_cell.fields.varIndex.keyPk;
+    }
     else {
         key = c->current_cell.fields.indexLeaf.keyPk;
     }
 
-    if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_INT32, &key) != CHIDB_OK)
+    if (chidb_dbm_reg_setInt(stmt, reg_index, (int64_t) key) != CHIDB_OK)
         return CHIDB_PROBLEM;
 
     return CHIDB_OK;
@@ -934,6 +1380,10 @@ int chidb_dbm_op_IdxPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
  * p2: register containing PKey
  *
  * add new (IdkKey,PKey) entry in index BTree pointed at by cursor at p1
+ *
+ * Index cells hold 32-bit values, so larger ones can't be indexed. In a
+ * variable-length index, IdxKey may be any value, or a record with the
+ * values of several columns.
  */
 int chidb_dbm_op_IdxInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
@@ -955,12 +1405,51 @@ int chidb_dbm_op_IdxInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
     // Get cursor
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
+    if (chidb_dbm_cursor_varIndex(c))
+    {
+        uint8_t key[VARINDEX_MAXKEY];
+        uint16_t size, len;
+        int rc;
+
+        if ((rc = chidb_dbm_reg_indexKey(reg1, key, &size)) != CHIDB_OK ||
+            (rc = chidb_Index_keyAppendPk(key, &size, (chidb_key_t) reg2->value.i)) != CHIDB_OK)
+            return rc;
+        if (c->bloom.npages > 0 &&
+            (((rc = chidb_Index_keyPrefix(key, size, 1, &len)) != CHIDB_OK && rc != CHIDB_EEMPTY) ||
+             (rc = chidb_Bloom_add(stmt->db->bt, &c->bloom, chidb_Bloom_hash(key, len))) != CHIDB_OK))
+            return rc;
+        if ((rc = chidb_Btree_insertInVarIndex(stmt->db->bt, c->root_page, key, size)) != CHIDB_OK)
+            return rc;
+
+        // reload the cursor on the entry it was on
+        if (c->current_cell.type == PGTYPE_VARINDEX_INTERNAL || c->current_cell.type == PGTYPE_VARINDEX_LEAF)
+        {
+            size = c->current_cell.fields.varIndex.key_size;
+            memcpy(key, c->current_cell.fields.varIndex.key, size);
+        }
+        else
+            size = 0;
+        chidb_dbm_cursor_seekKey(stmt->db->bt, c, key, size, SEEK);
+
+        return CHIDB_OK;
+    }
+
+    if ((reg1->type == REG_INTEGER && (reg1->value.i < INT32_MIN || reg1->value.i > UINT32_MAX)) ||
+        (reg2->type == REG_INTEGER && (reg2->value.i < 0 || reg2->value.i > UINT32_MAX)))
+        return CHIDB_EMISMATCH;
+
     //creating a new cell to insert
     BTreeCell *cell = malloc(sizeof(BTreeCell));
     cell->type = PGTYPE_INDEX_LEAF;
     cell->key = (uint32_t)reg1->value.i; //grab the idx key
 
     cell->fields.indexLeaf.keyPk = (uint32_t)reg2->value.i;
+    int rc = chidb_Bloom_add(stmt->db->bt, &c->bloom, chidb_Bloom_hashKey(cell->key));
+    if (rc != CHIDB_OK)
+    {
+        free(cell);
+        return rc;
+    }
     chidb_Btree_insert(stmt->db->bt, c->root_page, cell);
 
     //RELOADING THE TREE just in case the insert messed up the tree
@@ -981,8 +1470,9 @@ int chidb_dbm_op_CreateTable (chidb_stmt *stmt, chidb_dbm_op_t *op)
     int ret = chidb_Btree_newNode(stmt->db->bt, root, PGTYPE_TABLE_LEAF);
     if (ret != CHIDB_OK)
         return ret;
+    chidb_Pager_changeSchema(stmt->db->bt->pager);
 
-    if (chidb_dbm_op_WriteReg(stmt, op->p1, REG_INT32, root) != CHIDB_OK)
+    if (chidb_dbm_reg_setInt(stmt, op->p1, *root) != CHIDB_OK)
         return CHIDB_PROBLEM;
 
     free(root);
@@ -990,25 +1480,122 @@ int chidb_dbm_op_CreateTable (chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
-/* CreateIndex p1 * * * 
+/* Whether a space-separated list of options has an option */
+static bool chidb_dbm_op_hasOption(const char *options, const char *option)
+{
+    size_t len = strlen(option);
+
+    for (const char *p = options; p != NULL && *p; p += strcspn(p, " "), p += strspn(p, " "))
+        if (strncmp(p, option, len) == 0 && (p[len] == ' ' || p[len] == '\0'))
+            return true;
+
+    return false;
+}
+
+/* Reads the comma-separated numbers of an "option=n,m,..." option into
+ * values (which has room for max of them). Returns how many there are,
+ * 0 if there is no such option, or -1 if they don't fit or are not
+ * numbers below 256. */
+static int chidb_dbm_op_optionValues(const char *options, const char *option, uint8_t *values, int max)
+{
+    size_t len = strlen(option);
+    int n = 0;
+
+    for (const char *p = options; p != NULL && *p; p += strcspn(p, " "), p += strspn(p, " "))
+    {
+        if (strncmp(p, option, len) != 0 || p[len] != '=')
+            continue;
+
+        for (p += len; *p == '=' || *p == ','; n++)
+        {
+            char *end;
+            long v = strtol(p + 1, &end, 10);
+
+            if (end == p + 1 || v < 0 || v > UINT8_MAX || n == max)
+                return -1;
+            values[n] = (uint8_t) v;
+            p = end;
+        }
+        return (*p == ' ' || *p == '\0') ? n : -1;
+    }
+
+    return 0;
+}
+
+/* CreateIndex p1 p2 p3 p4
  *
  * p1: register containing root page for index table
+ * p2: root page of the table to index (0 to create an empty index)
+ * p3: column of the table to index
+ * p4: options, separated by spaces: "unique" if two rows may not have
+ *     the same value, "record" for a variable-length index (whose
+ *     entries may hold any values, see btree.h), and, for an index on
+ *     several columns, "columns=c1,c2,..." with all of its columns
+ *     (p3 is not used then) and "keys=n" if only the first n of them
+ *     are indexed (the others are only stored in the index)
  *
+ * the index is filled with the values of the columns in every row of
+ * the table (see chidb_Index_build)
  */
 int chidb_dbm_op_CreateIndex (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    npage_t *root = malloc(sizeof(npage_t));
+    npage_t root;
+    uint8_t columns[INDEX_MAX_COLUMNS], nkeys;
+    int ncolumns = chidb_dbm_op_optionValues(op->p4, "columns", columns, INDEX_MAX_COLUMNS);
+    int nk = chidb_dbm_op_optionValues(op->p4, "keys", &nkeys, 1);
+    bool unique = chidb_dbm_op_hasOption(op->p4, "unique");
+    bool record = chidb_dbm_op_hasOption(op->p4, "record");
+
+    if (ncolumns < 0 || nk < 0)
+        return CHIDB_PROBLEM;
+    if (ncolumns == 0)
+    {
+        if (op->p3 < 0 || op->p3 > UINT8_MAX)
+            return CHIDB_PROBLEM;
+        columns[0] = (uint8_t) op->p3;
+        ncolumns = 1;
+    }
+    if (nk == 0 || nkeys > ncolumns)
+        nkeys = ncolumns;
 
-    int ret = chidb_Btree_newNode(stmt->db->bt, root, PGTYPE_INDEX_LEAF);
+    int ret = chidb_Btree_newNode(stmt->db->bt, &root, record ? PGTYPE_VARINDEX_LEAF : PGTYPE_INDEX_LEAF);
     if (ret != CHIDB_OK)
         return ret;
+    chidb_Pager_changeSchema(stmt->db->bt->pager);
+
+    if (op->p2 > 0)
+    {
+        ret = chidb_Index_build(stmt->db->bt, (npage_t) op->p2, columns, (uint8_t) ncolumns,
+                                unique ? nkeys : 0, root, chidb_dbm_parallel_nthreads(stmt->db));
+        if (ret != CHIDB_OK)
+            return ret;
+    }
 
-    if (chidb_dbm_op_WriteReg(stmt, op->p1, REG_INT32, root) != CHIDB_OK)
+    if (chidb_dbm_reg_setInt(stmt, op->p1, root) != CHIDB_OK)
         return CHIDB_PROBLEM;
 
     return CHIDB_OK;
 }
 
+/* CreateBloom * * * p4
+ *
+ * p4: name of the table or index
+ *
+ * Gives the table or index a Bloom filter of its keys (see bloom.c),
+ * which cursors opened from now on consult in Seek and update in
+ * Insert and IdxInsert.
+ */
+int chidb_dbm_op_CreateBloom (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (op->p4 == NULL)
+        return CHIDB_PROBLEM;
+
+    stmt->db->need_refresh = 1;
+    chidb_Pager_changeSchema(stmt->db->bt->pager);
+
+    return chidb_Bloom_create(stmt->db, op->p4);
+}
+
 
 int chidb_dbm_op_Copy (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
@@ -1021,23 +1608,725 @@ int chidb_dbm_op_SCopy (chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
-int chidb_dbm_op_Halt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* Points a cursor's current cell at a packed record, so Column can
+ * read fields from it just like from a table cursor */
+static void chidb_dbm_cursor_set_record(chidb_dbm_cursor_t *c, uint8_t *bytes, uint32_t nbytes)
 {
-    return CHIDB_DONE;
+    c->current_cell.type = PGTYPE_TABLE_LEAF;
+    c->current_cell.key = 0;
+    c->current_cell.fields.tableLeaf.data = bytes;
+    c->current_cell.fields.tableLeaf.data_size = nbytes;
 }
 
-int chidb_dbm_op_WriteReg (chidb_stmt *stmt, int regNo, int reg_type, void *data)
+/* Points a sorter cursor's current cell at the sorter's current record */
+static void chidb_dbm_sorter_set_cell(chidb_dbm_cursor_t *c)
 {
-    if (IS_VALID_REGISTER(stmt, regNo) && regNo > stmt->nReg)
-        realloc_reg(stmt, regNo);
+    uint8_t *bytes;
+    uint32_t nbytes;
 
-    chidb_dbm_register_t *reg = &(stmt->reg[regNo]);
-    reg->type = reg_type;
+    if (chidb_Sorter_current(c->sorter, &bytes, &nbytes) == CHIDB_OK)
+        chidb_dbm_cursor_set_record(c, bytes, nbytes);
+}
 
-    if (reg_type == REG_INT32)
-        reg->value.i = *((int32_t *) data);
-    else if (reg_type == REG_STRING)
-        reg->value.s = (char *) data;
+/* Points an aggregator cursor's current cell at the current group */
+static void chidb_dbm_agg_set_cell(chidb_dbm_cursor_t *c)
+{
+    uint8_t *bytes;
+    uint32_t nbytes;
+
+    if (chidb_Aggregator_current(c->agg, &bytes, &nbytes) == CHIDB_OK)
+        chidb_dbm_cursor_set_record(c, bytes, nbytes);
+}
+
+/* SorterOpen p1 p2 p3 p4
+ *
+ * p1: cursor
+ * p2: number of leading record fields that make up the sort key
+ * p3: memory budget, in bytes (0 for the default budget)
+ * p4: sort direction of each key field ('+' ascending, '-' descending).
+ *     If NULL, all key fields are sorted in ascending order.
+ *
+ * open cursor p1 on a new, empty, sorter
+ */
+int chidb_dbm_op_SorterOpen (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc;
+
+    if (op->p2 < 0 || op->p3 < 0)
+        return CHIDB_PROBLEM;
+
+    // If cursor doesn't exist, allocate it
+    if (!EXISTS_CURSOR(stmt, op->p1) && realloc_cur(stmt, op->p1 + 1) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if ((rc = chidb_Sorter_open(&c->sorter, (uint8_t)op->p2, op->p4, (size_t)op->p3)) != CHIDB_OK)
+        return rc;
+
+    c->type = CURSOR_SORTER;
+    c->n_cols = 0;
+
+    return CHIDB_OK;
+}
+
+/* SorterLimit p1 p2 * *
+ *
+ * p1: sorter cursor
+ * p2: number of records to keep
+ *
+ * only keep the first p2 records (in sort order) inserted into the
+ * sorter, discarding the rest as they are inserted. must be used
+ * before any record is inserted.
+ */
+int chidb_dbm_op_SorterLimit (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (!IS_VALID_CURSOR(stmt, op->p1) || stmt->cursors[op->p1].type != CURSOR_SORTER)
+        return CHIDB_PROBLEM;
+    if (op->p2 < 0)
+        return CHIDB_PROBLEM;
+
+    return chidb_Sorter_setLimit(stmt->cursors[op->p1].sorter, (uint32_t)op->p2);
+}
+
+/* SorterInsert p1 p2 * *
+ *
+ * p1: sorter cursor
+ * p2: register containing a record
+ *
+ * add the record in register p2 to the sorter
+ */
+int chidb_dbm_op_SorterInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (!IS_VALID_CURSOR(stmt, op->p1) || stmt->cursors[op->p1].type != CURSOR_SORTER)
+        return CHIDB_PROBLEM;
+    if (!IS_VALID_REGISTER(stmt, op->p2) || stmt->reg[op->p2].type != REG_BINARY)
+        return CHIDB_PROBLEM;
+
+    chidb_dbm_register_t *r = &((stmt)->reg[op->p2]);
+
+    return chidb_Sorter_insert(stmt->cursors[op->p1].sorter, r->value.bin.bytes, r->value.bin.nbytes);
+}
+
+/* SorterSort p1 p2 * *
+ *
+ * p1: sorter cursor
+ * p2: jump addr
+ *
+ * sort the records in the sorter and point the cursor at the first
+ * one. if the sorter is empty, jump to p2.
+ */
+int chidb_dbm_op_SorterSort (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || stmt->cursors[op->p1].type != CURSOR_SORTER)
+        return CHIDB_PROBLEM;
+
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    rc = chidb_Sorter_sort(c->sorter);
+    if (rc == CHIDB_EEMPTY)
+    {
+        if (!IS_VALID_ADDRESS(stmt, op->p2))
+            return CHIDB_PROBLEM;
+        stmt->pc = (uint32_t)op->p2;
+        return CHIDB_OK;
+    }
+    else if (rc != CHIDB_OK)
+        return rc;
+
+    chidb_dbm_sorter_set_cell(c);
+
+    return CHIDB_OK;
+}
+
+/* SorterNext p1 p2 * *
+ *
+ * p1: sorter cursor
+ * p2: jump addr
+ *
+ * advance the cursor to the next record in the sorter. if there
+ * is one, jump to p2.
+ */
+int chidb_dbm_op_SorterNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || stmt->cursors[op->p1].type != CURSOR_SORTER)
+        return CHIDB_PROBLEM;
+
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    rc = chidb_Sorter_next(c->sorter);
+    if (rc == CHIDB_OK)
+    {
+        if (!IS_VALID_ADDRESS(stmt, op->p2))
+            return CHIDB_PROBLEM;
+        chidb_dbm_sorter_set_cell(c);
+        stmt->pc = (uint32_t)op->p2;
+    }
+    else if (rc != CHIDB_DONE)
+        return rc;
+
+    return CHIDB_OK;
+}
+
+/* SorterData p1 p2 * *
+ *
+ * p1: sorter cursor
+ * p2: register
+ *
+ * store a copy of the record the cursor points to in register p2
+ */
+int chidb_dbm_op_SorterData (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    uint8_t *bytes, *copy;
+    uint32_t nbytes;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || stmt->cursors[op->p1].type != CURSOR_SORTER)
+        return CHIDB_PROBLEM;
+
+    if (chidb_Sorter_current(stmt->cursors[op->p1].sorter, &bytes, &nbytes) != CHIDB_OK)
+        return CHIDB_PROBLEM;
+
+    if (chidb_dbm_reg_setBinary(stmt, op->p2, nbytes, &copy) != CHIDB_OK)
+        return CHIDB_PROBLEM;
+    memcpy(copy, bytes, nbytes);
+
+    return CHIDB_OK;
+}
+
+/* AggOpen p1 p2 p3 p4
+ *
+ * p1: cursor
+ * p2: number of leading record fields that make up the group key
+ * p3: 1 if the input is ordered on the group key (streaming mode), 0 otherwise
+ * p4: aggregate functions, one character per function (see aggregator.h)
+ *
+ * open cursor p1 on a new, empty, aggregator
+ */
+int chidb_dbm_op_AggOpen (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc;
+
+    if (op->p2 < 0 || op->p2 > UINT8_MAX)
+        return CHIDB_PROBLEM;
+
+    // If cursor doesn't exist, allocate it
+    if (!EXISTS_CURSOR(stmt, op->p1) && realloc_cur(stmt, op->p1 + 1) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if ((rc = chidb_Aggregator_open(&c->agg, (uint8_t)op->p2, op->p4, op->p3 != 0)) != CHIDB_OK)
+        return rc;
+
+    c->type = CURSOR_AGGREGATOR;
+    c->n_cols = 0;
+
+    return CHIDB_OK;
+}
+
+/* AggStep p1 p2 p3 *
+ *
+ * p1: aggregator cursor
+ * p2: register containing a record (group key followed by the
+ *     arguments of the aggregate functions)
+ * p3: jump addr
+ *
+ * add the record in register p2 to its group. if this completes a
+ * group (which only happens in streaming mode), the cursor is pointed
+ * at the completed group and execution continues at the next
+ * instruction. otherwise, jump to p3.
+ */
+int chidb_dbm_op_AggStep (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    bool emitted;
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || stmt->cursors[op->p1].type != CURSOR_AGGREGATOR)
+        return CHIDB_PROBLEM;
+    if (!IS_VALID_REGISTER(stmt, op->p2) || stmt->reg[op->p2].type != REG_BINARY)
+        return CHIDB_PROBLEM;
+
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if ((rc = chidb_Aggregator_step(c->agg, stmt->reg[op->p2].value.bin.bytes, &emitted)) != CHIDB_OK)
+        return rc;
+
+    if (emitted)
+        chidb_dbm_agg_set_cell(c);
+    else
+    {
+        if (!IS_VALID_ADDRESS(stmt, op->p3))
+            return CHIDB_PROBLEM;
+        stmt->pc = (uint32_t)op->p3;
+    }
+
+    return CHIDB_OK;
+}
+
+/* AggFinal p1 p2 * *
+ *
+ * p1: aggregator cursor
+ * p2: jump addr
+ *
+ * finish aggregating and point the cursor at the first group. if
+ * there are no groups, jump to p2.
+ */
+int chidb_dbm_op_AggFinal (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || stmt->cursors[op->p1].type != CURSOR_AGGREGATOR)
+        return CHIDB_PROBLEM;
+
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    rc = chidb_Aggregator_final(c->agg);
+    if (rc == CHIDB_EEMPTY)
+    {
+        if (!IS_VALID_ADDRESS(stmt, op->p2))
+            return CHIDB_PROBLEM;
+        stmt->pc = (uint32_t)op->p2;
+        return CHIDB_OK;
+    }
+    else if (rc != CHIDB_OK)
+        return rc;
+
+    chidb_dbm_agg_set_cell(c);
+
+    return CHIDB_OK;
+}
+
+/* AggNext p1 p2 * *
+ *
+ * p1: aggregator cursor
+ * p2: jump addr
+ *
+ * advance the cursor to the next group. if there is one, jump to p2.
+ */
+int chidb_dbm_op_AggNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || stmt->cursors[op->p1].type != CURSOR_AGGREGATOR)
+        return CHIDB_PROBLEM;
+
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    rc = chidb_Aggregator_next(c->agg);
+    if (rc == CHIDB_OK)
+    {
+        if (!IS_VALID_ADDRESS(stmt, op->p2))
+            return CHIDB_PROBLEM;
+        chidb_dbm_agg_set_cell(c);
+        stmt->pc = (uint32_t)op->p2;
+    }
+    else if (rc != CHIDB_DONE)
+        return rc;
+
+    return CHIDB_OK;
+}
+
+/* SetOpen p1 * p3 *
+ *
+ * p1: cursor
+ * p3: memory budget (in bytes) of the record set, or 0 to use the default
+ *
+ * open cursor p1 on a new, empty, record set
+ */
+int chidb_dbm_op_SetOpen (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc;
+
+    if (op->p3 < 0)
+        return CHIDB_PROBLEM;
+
+    // If cursor doesn't exist, allocate it
+    if (!EXISTS_CURSOR(stmt, op->p1) && realloc_cur(stmt, op->p1 + 1) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if ((rc = chidb_RecordSet_open(&c->set, (size_t)op->p3)) != CHIDB_OK)
+        return rc;
+
+    c->type = CURSOR_SET;
+    c->n_cols = 0;
+
+    return CHIDB_OK;
+}
+
+/* SetInsert p1 p2 p3 *
+ *
+ * p1: record set cursor
+ * p2: register containing a record
+ * p3: jump addr
+ *
+ * add the record in register p2 to the record set. if it was
+ * already there, jump to p3.
+ */
+int chidb_dbm_op_SetInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || stmt->cursors[op->p1].type != CURSOR_SET)
+        return CHIDB_PROBLEM;
+    if (!IS_VALID_REGISTER(stmt, op->p2) || stmt->reg[op->p2].type != REG_BINARY)
+        return CHIDB_PROBLEM;
+
+    chidb_dbm_register_t *r = &((stmt)->reg[op->p2]);
+
+    rc = chidb_RecordSet_insert(stmt->cursors[op->p1].set, r->value.bin.bytes, r->value.bin.nbytes);
+    if (rc == CHIDB_EDUPLICATE)
+    {
+        if (!IS_VALID_ADDRESS(stmt, op->p3))
+            return CHIDB_PROBLEM;
+        stmt->pc = (uint32_t)op->p3;
+        return CHIDB_OK;
+    }
+
+    return rc;
+}
+
+/* Jumps to p3 if the record in register p2 is (or is not, depending
+ * on found) in the record set of cursor p1 */
+static int chidb_dbm_set_jump(chidb_stmt *stmt, chidb_dbm_op_t *op, bool found)
+{
+    int rc;
+
+    if (!IS_VALID_CURSOR(stmt, op->p1) || stmt->cursors[op->p1].type != CURSOR_SET)
+        return CHIDB_PROBLEM;
+    if (!IS_VALID_REGISTER(stmt, op->p2) || stmt->reg[op->p2].type != REG_BINARY)
+        return CHIDB_PROBLEM;
+
+    chidb_dbm_register_t *r = &((stmt)->reg[op->p2]);
+
+    rc = chidb_RecordSet_contains(stmt->cursors[op->p1].set, r->value.bin.bytes, r->value.bin.nbytes);
+    if (rc != CHIDB_OK && rc != CHIDB_ENOTFOUND)
+        return rc;
+
+    if ((rc == CHIDB_OK) == found)
+    {
+        if (!IS_VALID_ADDRESS(stmt, op->p3))
+            return CHIDB_PROBLEM;
+        stmt->pc = (uint32_t)op->p3;
+    }
+
+    return CHIDB_OK;
+}
+
+/* SetFound p1 p2 p3 *
+ *
+ * p1: record set cursor
+ * p2: register containing a record
+ * p3: jump addr
+ *
+ * if the record in register p2 is in the record set, jump to p3
+ */
+int chidb_dbm_op_SetFound (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_set_jump(stmt, op, true);
+}
+
+/* SetNotFound p1 p2 p3 *
+ *
+ * p1: record set cursor
+ * p2: register containing a record
+ * p3: jump addr
+ *
+ * if the record in register p2 is not in the record set, jump to p3
+ */
+int chidb_dbm_op_SetNotFound (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_set_jump(stmt, op, false);
+}
+
+/* IfPos p1 p2 p3 *
+ *
+ * p1: register containing an integer
+ * p2: jump addr
+ * p3: decrement
+ *
+ * if the integer in register p1 is positive, subtract p3 from it
+ * and jump to p2
+ */
+int chidb_dbm_op_IfPos (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (!IS_VALID_REGISTER(stmt, op->p1) || stmt->reg[op->p1].type != REG_INTEGER)
+        return CHIDB_PROBLEM;
+    if (!IS_VALID_ADDRESS(stmt, op->p2))
+        return CHIDB_PROBLEM;
+
+    chidb_dbm_register_t *r = &((stmt)->reg[op->p1]);
+
+    if (r->value.i > 0)
+    {
+        r->value.i -= op->p3;
+        stmt->pc = (uint32_t)op->p2;
+    }
+
+    return CHIDB_OK;
+}
+
+/* IfNot p1 p2 * *
+ *
+ * p1: register containing an integer
+ * p2: jump addr
+ *
+ * if the integer in register p1 is zero, jump to p2
+ */
+int chidb_dbm_op_IfNot (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (!IS_VALID_REGISTER(stmt, op->p1) || stmt->reg[op->p1].type != REG_INTEGER)
+        return CHIDB_PROBLEM;
+    if (!IS_VALID_ADDRESS(stmt, op->p2))
+        return CHIDB_PROBLEM;
+
+    if (stmt->reg[op->p1].value.i == 0)
+        stmt->pc = (uint32_t)op->p2;
+
+    return CHIDB_OK;
+}
+
+/* DecrJumpZero p1 p2 * *
+ *
+ * p1: register containing an integer
+ * p2: jump addr
+ *
+ * decrement the integer in register p1, and jump to p2 if it
+ * becomes zero
+ */
+int chidb_dbm_op_DecrJumpZero (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (!IS_VALID_REGISTER(stmt, op->p1) || stmt->reg[op->p1].type != REG_INTEGER)
+        return CHIDB_PROBLEM;
+    if (!IS_VALID_ADDRESS(stmt, op->p2))
+        return CHIDB_PROBLEM;
+
+    if (--stmt->reg[op->p1].value.i == 0)
+        stmt->pc = (uint32_t)op->p2;
+
+    return CHIDB_OK;
+}
+
+/* BatchRewind p1 p2 * *
+ *
+ * p1: cursor
+ * p2: jump addr
+ *
+ * rewind cursor p1 (like Rewind does) and read the first batch of rows
+ * from it (see dbm-batch.h). If the table is empty, jump to p2
+ */
+int chidb_dbm_op_BatchRewind (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    uint32_t pc = stmt->pc;
+    int rc;
+
+    if ((rc = chidb_dbm_op_Rewind(stmt, op)) != CHIDB_OK)
+        return rc;
+
+    // jumped: there are no rows
+    if (stmt->pc != pc)
+        return CHIDB_OK;
+
+    return chidb_dbm_batch_fill(stmt, op->p1);
+}
+
+/* BatchNext p1 p2 * *
+ *
+ * p1: cursor
+ * p2: jump addr
+ *
+ * read the next batch of rows from cursor p1. If there is one, jump
+ * to p2
+ */
+int chidb_dbm_op_BatchNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc;
+
+    if (stmt->batch == NULL || stmt->batch->cursor != op->p1)
+        return CHIDB_PROBLEM;
+
+    if (stmt->batch->done)
+        return CHIDB_OK;
+
+    if ((rc = chidb_dbm_batch_fill(stmt, op->p1)) != CHIDB_OK)
+        return rc;
+
+    if (!IS_VALID_ADDRESS(stmt, op->p2))
+        return CHIDB_DONE;
+    stmt->pc = (uint32_t)op->p2;
+
+    return CHIDB_OK;
+}
+
+/* BatchColumn p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: column
+ * p3: register
+ *
+ * load column p2 of the selected rows of the batch into the column
+ * vector of register p3
+ */
+int chidb_dbm_op_BatchColumn (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (stmt->batch == NULL || stmt->batch->cursor != op->p1 || op->p2 < 0)
+        return CHIDB_PROBLEM;
+
+    return chidb_dbm_batch_column(stmt, (uint32_t)op->p2, op->p3);
+}
+
+/* BatchKey p1 p2 * *
+ *
+ * p1: cursor
+ * p2: register
+ *
+ * load the keys of the selected rows of the batch into the column
+ * vector of register p2
+ */
+int chidb_dbm_op_BatchKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (stmt->batch == NULL || stmt->batch->cursor != op->p1)
+        return CHIDB_PROBLEM;
+
+    return chidb_dbm_batch_key(stmt, op->p2);
+}
+
+/* BatchFilter p1 * p3 p4
+ *
+ * p1: register containing value k (or a column vector)
+ * p3: register whose column vector is filtered on
+ * p4: comparison ("Eq", "Ne", "Lt", "Le", "Gt" or "Ge")
+ *
+ * drop the selected rows of the batch for which instruction "p4 p1 _ p3"
+ * would jump (e.g., with "Le", the rows whose value is <= k). If p1 has
+ * a column vector, each row is compared with its own value in it
+ */
+int chidb_dbm_op_BatchFilter (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int cmp = op->p4 == NULL ? -1 : str_to_opcode(op->p4);
+
+    if (cmp != Op_Eq && cmp != Op_Ne && cmp != Op_Lt && cmp != Op_Le && cmp != Op_Gt && cmp != Op_Ge)
+        return CHIDB_PROBLEM;
+
+    return chidb_dbm_batch_filter(stmt, (opcode_t)cmp, op->p1, op->p3);
+}
+
+/* BatchResult p1 p2 * *
+ *
+ * p1: first register of the result row
+ * p2: number of registers
+ *
+ * produce the next selected row of the batch as a result row (like
+ * ResultRow does), loading registers p1..p1+p2-1 from their column
+ * vectors. This instruction runs again until every selected row has
+ * been produced
+ */
+int chidb_dbm_op_BatchResult (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc = chidb_dbm_batch_load(stmt, op->p1, op->p2);
+
+    if (rc == CHIDB_DONE)
+        return CHIDB_OK;
+    if (rc != CHIDB_OK)
+        return rc;
+
+    stmt->pc--;
+
+    return chidb_dbm_op_ResultRow(stmt, op);
+}
+
+/* Analyze * * * p4
+ *
+ * p4: name of the table to analyze (along with its indexes), or
+ *     NULL to analyze every table and index
+ *
+ * Stores the statistics of the tables and indexes in the statistics
+ * table. The schema is reloaded (with the new statistics) before the
+ * next statement is compiled.
+ */
+int chidb_dbm_op_Analyze (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc = chidb_Stats_analyze(stmt->db, op->p4);
+
+    stmt->db->need_refresh = 1;
+    chidb_Pager_changeSchema(stmt->db->bt->pager);
+
+    return rc;
+}
+
+/* AutoCommit p1 p2 * *
+ *
+ * p1: new value of the autocommit flag
+ * p2: if non-zero, roll back the current transaction
+ *
+ * Turning autocommit off (p1 = 0) starts an explicit transaction:
+ * pages written by the following statements are held by the pager
+ * instead of being committed when each statement finishes. Turning it
+ * back on either commits the transaction (p2 = 0) or rolls it back
+ * (p2 != 0), in which case the schema is reloaded before the next
+ * statement is compiled.
+ *
+ * Returns CHIDB_EMISUSE when starting a transaction within a transaction,
+ * or when committing or rolling back with no transaction active.
+ */
+int chidb_dbm_op_AutoCommit (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    BTree *bt = stmt->db->bt;
+    int rc = CHIDB_OK;
+
+    if (op->p1 == stmt->db->autocommit)
+        return CHIDB_EMISUSE;
+
+    /* Only a transaction that has written anything holds the write lock */
+    if (op->p1 && bt->writer)
+    {
+        if (op->p2)
+        {
+            rc = chidb_Pager_rollback(bt->pager);
+            stmt->db->need_refresh = 1;
+        }
+        else
+            rc = chidb_Pager_commit(bt->pager);
+        chidb_Btree_endWrite(bt);
+    }
+
+    stmt->db->autocommit = op->p1 ? 1 : 0;
+
+    return rc;
+}
+
+int chidb_dbm_op_Halt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return CHIDB_DONE;
+}
+
+int chidb_dbm_op_WriteReg (chidb_stmt *stmt, int regNo, int reg_type, void *data)
+{
+    if (regNo < 0)
+        return CHIDB_ENOREG;
+    if (!EXISTS_REGISTER(stmt, regNo) && realloc_reg(stmt, regNo + 1) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_register_t *reg = &(stmt->reg[regNo]);
+    chidb_dbm_reg_clear(stmt, reg);
+    reg->type = reg_type;
+
+    if (reg_type == REG_INTEGER)
+        reg->value.i = *((int64_t *) data);
+    else if (reg_type == REG_REAL)
+        reg->value.r = *((double *) data);
+    else if (reg_type == REG_STRING)
+    {
+        // the register takes ownership of the string
+        reg->value.s = (char *) data;
+        reg->len = strlen(reg->value.s);
+        reg->text = REG_TEXT_HEAP;
+    }
 
     return CHIDB_OK;
 }
\ No newline at end of file
@@ -0,0 +1,730 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Parallel table scans
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ *  A full scan of a large table keeps a single core busy while the
+ *  others sit idle. When a read-only program consists of a single scan
+ *  loop whose rows all end up in the same place (returned as result
+ *  rows, inserted into a sorter, or fed to a hash aggregator), the loop
+ *  can be run over disjoint key ranges of the table at the same time.
+ *  The ranges are taken from the separator keys in the first two levels
+ *  of the table's B-Tree, so each one covers whole subtrees.
+ *
+ *  The program scans the first range itself, while a worker thread runs
+ *  the loop over each of the other ranges with a private copy of the
+ *  program's state. Workers only buffer their result rows and sorter
+ *  records; aggregates are computed by each worker and then merged.
+ *  Everything is handed to the program in key order, so the output is
+ *  the same as that of a sequential scan.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dbm.h"
+#include "dbm-parallel.h"
+#include "dbm-batch.h"
+#include "btree.h"
+#include "record.h"
+#include "sorter.h"
+#include "aggregator.h"
+
+/* Defined in dbm.c and dbm-ops.c */
+int chidb_dbm_op_handle(chidb_stmt *stmt, chidb_dbm_op_t *op);
+int chidb_dbm_op_WriteReg(chidb_stmt *stmt, int regNo, int reg_type, void *data);
+int realloc_cur(chidb_stmt *stmt, uint32_t size);
+
+
+/* Number of threads that scan a table
+ *
+ * Parameters
+ * - db: chidb database
+ *
+ * Return
+ * - The number of threads set with chidb_scan_threads (one per
+ *   processor if it is 0), at most DBM_PARALLEL_MAX_WORKERS.
+ */
+uint32_t chidb_dbm_parallel_nthreads(chidb *db)
+{
+    long n = db->scan_threads;
+
+    if (n == 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+
+    return n > DBM_PARALLEL_MAX_WORKERS ? DBM_PARALLEL_MAX_WORKERS : (uint32_t) n;
+}
+
+
+/* Can a loop instruction jump to addr? */
+static inline bool __chidb_dbm_parallel_inLoop(chidb_dbm_parallel_t *par, int32_t addr)
+{
+    return addr > (int32_t) par->rewind && addr < (int32_t) par->exit;
+}
+
+
+/* Decide whether a program can scan its table in parallel
+ *
+ * Only read-only programs that run under a read snapshot (see
+ * chidb_stmt_exec) qualify, and only if they have the shape described
+ * in dbm-parallel.h: before the loop, only constants are loaded and
+ * cursors are opened, and the loop body only reads the scan cursor,
+ * computes with registers, and ends in a single sink. If so, the
+ * program's par field is set; the scan itself is only split once the
+ * program reaches the loop (see chidb_dbm_parallel_step).
+ *
+ * Parameters
+ * - stmt: DBM program
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (whether or not the program qualifies)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_parallel_plan(chidb_stmt *stmt)
+{
+    chidb_dbm_parallel_t plan;
+    chidb_dbm_op_t *op;
+    int32_t agg = -1, sorter = -1;
+    uint32_t nthreads, nsinks = 0;
+    bool open = false, rewind = false;
+
+    nthreads = chidb_dbm_parallel_nthreads(stmt->db);
+    if (nthreads < 2 || stmt->explain || stmt->snapshot == NULL || stmt->par != NULL)
+        return CHIDB_OK;
+
+    memset(&plan, 0, sizeof(plan));
+
+    /* A single cursor on a table, and a single loop over it */
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        op = &stmt->ops[i];
+        if (op->opcode == Op_OpenRead)
+        {
+            if (open)
+                return CHIDB_OK;
+            open = true;
+            plan.cursor = op->p1;
+        }
+        else if (op->opcode == Op_Rewind || op->opcode == Op_BatchRewind)
+        {
+            if (rewind)
+                return CHIDB_OK;
+            rewind = true;
+            plan.rewind = i;
+            plan.exit = op->p2;
+        }
+    }
+    if (!open || !rewind || stmt->ops[plan.rewind].p1 != plan.cursor ||
+        plan.exit < plan.rewind + 2 || plan.exit >= stmt->endOp)
+        return CHIDB_OK;
+
+    /* A batch loop (see dbm-batch.h) ends in a BatchNext */
+    op = &stmt->ops[plan.exit - 1];
+    if (op->opcode != (stmt->ops[plan.rewind].opcode == Op_Rewind ? Op_Next : Op_BatchNext) ||
+        op->p1 != plan.cursor || op->p2 != plan.rewind + 1)
+        return CHIDB_OK;
+
+    /* Before the loop */
+    for(uint32_t i = 0; i < plan.rewind; i++)
+    {
+        op = &stmt->ops[i];
+        switch(op->opcode)
+        {
+        case Op_Noop:
+        case Op_Integer:
+        case Op_String:
+        case Op_Null:
+        case Op_OpenRead:
+        case Op_SorterLimit:
+            break;
+        case Op_AggOpen:
+            /* Streaming aggregators rely on the order of their input */
+            if (op->p3 != 0 || agg != -1)
+                return CHIDB_OK;
+            agg = op->p1;
+            break;
+        case Op_SorterOpen:
+            if (sorter != -1)
+                return CHIDB_OK;
+            sorter = op->p1;
+            break;
+        default:
+            return CHIDB_OK;
+        }
+    }
+
+    /* The loop body */
+    for(uint32_t i = plan.rewind + 1; i < plan.exit - 1; i++)
+    {
+        op = &stmt->ops[i];
+        switch(op->opcode)
+        {
+        case Op_Noop:
+        case Op_Integer:
+        case Op_String:
+        case Op_Null:
+        case Op_MakeRecord:
+            break;
+        case Op_Column:
+        case Op_Key:
+        case Op_BatchColumn:
+        case Op_BatchKey:
+            if (op->p1 != plan.cursor)
+                return CHIDB_OK;
+            break;
+        case Op_BatchFilter:
+            break;
+        case Op_Eq:
+        case Op_Ne:
+        case Op_Lt:
+        case Op_Le:
+        case Op_Gt:
+        case Op_Ge:
+            if (!__chidb_dbm_parallel_inLoop(&plan, op->p2))
+                return CHIDB_OK;
+            break;
+        case Op_AggStep:
+            if (op->p1 != agg || !__chidb_dbm_parallel_inLoop(&plan, op->p3))
+                return CHIDB_OK;
+            plan.sink_op = op;
+            nsinks++;
+            break;
+        case Op_SorterInsert:
+            if (op->p1 != sorter)
+                return CHIDB_OK;
+            plan.sink_op = op;
+            nsinks++;
+            break;
+        case Op_ResultRow:
+        case Op_BatchResult:
+            plan.sink_op = op;
+            nsinks++;
+            break;
+        default:
+            return CHIDB_OK;
+        }
+    }
+    if (nsinks != 1)
+        return CHIDB_OK;
+
+    /* A BatchResult produces its rows one at a time, like a ResultRow */
+    plan.sink = plan.sink_op->opcode == Op_BatchResult ? Op_ResultRow : plan.sink_op->opcode;
+    plan.nworkers = nthreads - 1;
+
+    stmt->par = malloc(sizeof(chidb_dbm_parallel_t));
+    if (stmt->par == NULL)
+        return CHIDB_ENOMEM;
+    memcpy(stmt->par, &plan, sizeof(plan));
+
+    return CHIDB_OK;
+}
+
+
+/* Append a separator key to an array of keys */
+static int __chidb_dbm_parallel_addKey(chidb_key_t **keys, uint32_t *nkeys, uint32_t *size, chidb_key_t key)
+{
+    if (*nkeys == *size)
+    {
+        uint32_t nsize = *size ? *size * 2 : 64;
+        chidb_key_t *nk = realloc(*keys, nsize * sizeof(chidb_key_t));
+        if (nk == NULL)
+            return CHIDB_ENOMEM;
+        *keys = nk;
+        *size = nsize;
+    }
+    (*keys)[(*nkeys)++] = key;
+
+    return CHIDB_OK;
+}
+
+
+/* Collect the separator keys of the first two levels of a table B-Tree,
+ * in order. Subtree i of the second level holds the keys in
+ * (keys[i-1], keys[i]]. */
+static int __chidb_dbm_parallel_separators(BTree *bt, npage_t nroot, chidb_key_t **keys, uint32_t *nkeys)
+{
+    BTreeNode *root, *child;
+    BTreeCell cell;
+    uint32_t size = 0;
+    npage_t npage;
+    int rc;
+
+    *keys = NULL;
+    *nkeys = 0;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, nroot, &root)) != CHIDB_OK)
+        return rc;
+
+    for(ncell_t i = 0; root->type == PGTYPE_TABLE_INTERNAL && i <= root->n_cells && rc == CHIDB_OK; i++)
+    {
+        if (i < root->n_cells)
+        {
+            if ((rc = chidb_Btree_getCell(root, i, &cell)) != CHIDB_OK)
+                break;
+            npage = cell.fields.tableInternal.child_page;
+        }
+        else
+            npage = root->right_page;
+
+        if ((rc = chidb_Btree_getNodeByPage(bt, npage, &child)) != CHIDB_OK)
+            break;
+        for(ncell_t j = 0; child->type == PGTYPE_TABLE_INTERNAL && j < child->n_cells && rc == CHIDB_OK; j++)
+        {
+            BTreeCell ccell;
+            if ((rc = chidb_Btree_getCell(child, j, &ccell)) == CHIDB_OK)
+                rc = __chidb_dbm_parallel_addKey(keys, nkeys, &size, ccell.key);
+        }
+        chidb_Btree_freeMemNode(bt, child);
+
+        if (rc == CHIDB_OK && i < root->n_cells)
+            rc = __chidb_dbm_parallel_addKey(keys, nkeys, &size, cell.key);
+    }
+    chidb_Btree_freeMemNode(bt, root);
+
+    if (rc != CHIDB_OK)
+    {
+        free(*keys);
+        *keys = NULL;
+        *nkeys = 0;
+    }
+
+    return rc;
+}
+
+
+/* Append a record of nbytes bytes to a worker's output, and return
+ * where to write it. Records are allocated from the worker's arena, and
+ * freed all at once with the worker. */
+static int __chidb_dbm_parallel_newRec(chidb_dbm_worker_t *w, uint32_t nbytes, uint8_t **bytes)
+{
+    chidb_dbm_parallel_rec_t *rec;
+
+    if (w->nrecs == w->recs_size)
+    {
+        uint32_t nsize = w->recs_size ? w->recs_size * 2 : 256;
+        rec = realloc(w->recs, nsize * sizeof(chidb_dbm_parallel_rec_t));
+        if (rec == NULL)
+            return CHIDB_ENOMEM;
+        w->recs = rec;
+        w->recs_size = nsize;
+    }
+
+    rec = &w->recs[w->nrecs];
+    rec->bytes = chidb_Arena_alloc(&w->stmt.arena, nbytes);
+    if (rec->bytes == NULL)
+        return CHIDB_ENOMEM;
+    rec->nbytes = nbytes;
+    w->nrecs++;
+    *bytes = rec->bytes;
+
+    return CHIDB_OK;
+}
+
+
+/* Append a copy of a record to a worker's output */
+static int __chidb_dbm_parallel_addRec(chidb_dbm_worker_t *w, const uint8_t *bytes, uint32_t nbytes)
+{
+    uint8_t *copy;
+
+    if (__chidb_dbm_parallel_newRec(w, nbytes, &copy) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    memcpy(copy, bytes, nbytes);
+
+    return CHIDB_OK;
+}
+
+
+/* Append the result row of a worker's program to its output, packed
+ * into a record */
+static int __chidb_dbm_parallel_addRow(chidb_dbm_worker_t *w)
+{
+    chidb_stmt *stmt = &w->stmt;
+    DBRecordBuffer dbrb;
+    DBRecord *dbr;
+    uint8_t *record;
+    int rc;
+
+    if (chidb_DBRecord_create_empty_arena(&dbrb, (uint8_t) stmt->nRR, &stmt->scratch) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    for(uint32_t i = stmt->startRR; i < stmt->startRR + stmt->nRR; i++)
+    {
+        chidb_dbm_register_t *r = &stmt->reg[i];
+
+        if (r->type == REG_INTEGER)
+            chidb_DBRecord_appendInteger(&dbrb, r->value.i);
+        else if (r->type == REG_REAL)
+            chidb_DBRecord_appendDouble(&dbrb, r->value.r);
+        else if (r->type == REG_STRING)
+            chidb_DBRecord_appendText(&dbrb, r->value.s, r->len);
+        else
+            chidb_DBRecord_appendNull(&dbrb);
+    }
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+
+    if ((rc = __chidb_dbm_parallel_newRec(w, dbr->packed_len, &record)) == CHIDB_OK)
+        chidb_DBRecord_packInto(dbr, record);
+    chidb_Arena_reset(&stmt->scratch);
+
+    return rc;
+}
+
+
+/* Load a row produced by a worker into the program's result row */
+static int __chidb_dbm_parallel_loadRow(chidb_stmt *stmt, chidb_dbm_parallel_rec_t *rec)
+{
+    chidb_dbm_op_t *op = stmt->par->sink_op;
+    uint32_t hpos = 1, dpos = rec->bytes[0], type;
+    const uint8_t *value;
+    int rc = CHIDB_OK;
+
+    /* The record is read in place, without unpacking it */
+    for(int32_t i = 0; i < op->p2 && rc == CHIDB_OK; i++)
+    {
+        if (chidb_DBRecord_nextRawField(rec->bytes, &hpos, &dpos, &type, &value) != CHIDB_OK)
+            type = SQL_NULL;
+
+        switch(type)
+        {
+        case SQL_INTEGER_1BYTE:
+        case SQL_INTEGER_2BYTE:
+        case SQL_INTEGER_4BYTE:
+        case SQL_INTEGER_8BYTE:
+            rc = chidb_dbm_reg_setInt(stmt, op->p1 + i, chidb_DBRecord_rawInt(value, type));
+            break;
+        case SQL_REAL:
+            rc = chidb_dbm_reg_setReal(stmt, op->p1 + i, chidb_DBRecord_rawReal(value));
+            break;
+        case SQL_NULL:
+            rc = chidb_dbm_op_WriteReg(stmt, op->p1 + i, REG_NULL, NULL);
+            break;
+        default:
+            rc = chidb_dbm_reg_setText(stmt, op->p1 + i, (const char *) value, (type - SQL_TEXT) / 2);
+            break;
+        }
+    }
+
+    stmt->startRR = (uint32_t) op->p1;
+    stmt->nRR = (uint32_t) op->p2;
+
+    return rc;
+}
+
+
+/* Worker thread: runs the program from its first instruction until
+ * the end of the scan loop, over the worker's key range */
+static void *__chidb_dbm_parallel_worker(void *arg)
+{
+    chidb_dbm_worker_t *w = arg;
+    chidb_dbm_parallel_t *par = w->par;
+    chidb_stmt *stmt = &w->stmt;
+    chidb_dbm_op_t *op;
+    int rc = CHIDB_OK;
+
+    while(stmt->pc != par->exit && stmt->pc < stmt->endOp)
+    {
+        if (stmt->pc == par->rewind)
+        {
+            if (!IS_VALID_CURSOR(stmt, par->cursor))
+            {
+                rc = CHIDB_PROBLEM;
+                break;
+            }
+            stmt->cursors[par->cursor].ranged = true;
+            stmt->cursors[par->cursor].key_min = w->key_min;
+            stmt->cursors[par->cursor].key_max = w->key_max;
+        }
+
+        op = &stmt->ops[stmt->pc++];
+        if (op->opcode == Op_SorterInsert)
+        {
+            /* Records are sorted by the program, in key order */
+            if (!IS_VALID_REGISTER(stmt, op->p2) || stmt->reg[op->p2].type != REG_BINARY)
+                rc = CHIDB_PROBLEM;
+            else
+                rc = __chidb_dbm_parallel_addRec(w, stmt->reg[op->p2].value.bin.bytes,
+                                                 stmt->reg[op->p2].value.bin.nbytes);
+        }
+        else if ((rc = chidb_dbm_op_handle(stmt, op)) == CHIDB_ROW)
+            rc = __chidb_dbm_parallel_addRow(w);
+
+        if (rc != CHIDB_OK)
+            break;
+    }
+
+    w->rc = rc;
+
+    return NULL;
+}
+
+
+/* Set up a worker's copy of the program, and start it */
+static int __chidb_dbm_parallel_startWorker(chidb_stmt *stmt, chidb_dbm_worker_t *w)
+{
+    /* The worker reads through the program's snapshot even while the
+     * program is not running (e.g., after returning a row) */
+    w->bt = *stmt->db->bt;
+    w->bt.snapshot = stmt->snapshot;
+    w->db = *stmt->db;
+    w->db.bt = &w->bt;
+
+    memset(&w->stmt, 0, sizeof(chidb_stmt));
+    chidb_Arena_init(&w->stmt.arena);
+    chidb_Arena_init(&w->stmt.scratch);
+    w->stmt.db = &w->db;
+    w->stmt.ops = stmt->ops;
+    w->stmt.nOps = stmt->nOps;
+    w->stmt.endOp = stmt->endOp;
+
+    if (realloc_reg(&w->stmt, stmt->nReg > 0 ? stmt->nReg : DEFAULT_REG_SIZE) != CHIDB_OK ||
+        realloc_cur(&w->stmt, stmt->nCursors > 0 ? stmt->nCursors : DEFAULT_CUR_SIZE) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    if (pthread_create(&w->thread, NULL, __chidb_dbm_parallel_worker, w))
+        return CHIDB_ENOMEM;
+    w->started = true;
+
+    return CHIDB_OK;
+}
+
+
+/* Split the scan into key ranges and start the workers. Tables that
+ * are too small are scanned sequentially. */
+static int __chidb_dbm_parallel_start(chidb_stmt *stmt)
+{
+    chidb_dbm_parallel_t *par = stmt->par;
+    chidb_dbm_cursor_t *c;
+    chidb_key_t *keys, key_max;
+    uint32_t nkeys, nsub, nparts;
+    int rc;
+
+    par->started = true;
+
+    if (!IS_VALID_CURSOR(stmt, par->cursor))
+        return CHIDB_PROBLEM;
+    c = &stmt->cursors[par->cursor];
+
+    if ((rc = __chidb_dbm_parallel_separators(stmt->db->bt, c->root_page, &keys, &nkeys)) != CHIDB_OK)
+        return rc;
+
+    nsub = nkeys + 1;
+    if (nsub < DBM_PARALLEL_MIN_SUBTREES)
+    {
+        free(keys);
+        chidb_dbm_parallel_free(stmt);
+        return CHIDB_OK;
+    }
+
+    /* Each range covers about the same number of subtrees */
+    nparts = par->nworkers + 1 < nsub ? par->nworkers + 1 : nsub;
+    par->nworkers = nparts - 1;
+    par->workers = calloc(par->nworkers, sizeof(chidb_dbm_worker_t));
+    if (par->workers == NULL)
+    {
+        free(keys);
+        return CHIDB_ENOMEM;
+    }
+
+    c->ranged = true;
+    c->key_min = 0;
+    c->key_max = keys[nsub / nparts - 1];
+
+    for(uint32_t j = 1; j < nparts && rc == CHIDB_OK; j++)
+    {
+        chidb_dbm_worker_t *w = &par->workers[j - 1];
+
+        key_max = j + 1 < nparts ? keys[(j + 1) * nsub / nparts - 1] : UINT64_MAX;
+        w->par = par;
+        w->key_min = keys[j * nsub / nparts - 1] + 1;
+        w->key_max = key_max;
+
+        rc = __chidb_dbm_parallel_startWorker(stmt, w);
+    }
+    free(keys);
+
+    return rc;
+}
+
+
+/* Wait for the workers and hand their output to the program's sink.
+ * Result rows are handed over one at a time: CHIDB_ROW is returned
+ * for each of them. */
+static int __chidb_dbm_parallel_finish(chidb_stmt *stmt)
+{
+    chidb_dbm_parallel_t *par = stmt->par;
+    chidb_dbm_cursor_t *sink = NULL;
+    int rc = CHIDB_OK;
+
+    for(uint32_t i = 0; i < par->nworkers; i++)
+    {
+        chidb_dbm_worker_t *w = &par->workers[i];
+
+        if (w->started)
+        {
+            pthread_join(w->thread, NULL);
+            w->started = false;
+            if (rc == CHIDB_OK)
+                rc = w->rc;
+        }
+    }
+    if (rc != CHIDB_OK)
+    {
+        chidb_dbm_parallel_free(stmt);
+        return rc;
+    }
+
+    if (par->sink != Op_ResultRow)
+    {
+        if (!IS_VALID_CURSOR(stmt, par->sink_op->p1))
+            rc = CHIDB_PROBLEM;
+        else
+            sink = &stmt->cursors[par->sink_op->p1];
+    }
+
+    for(uint32_t i = 0; i < par->nworkers && rc == CHIDB_OK; i++)
+    {
+        chidb_dbm_worker_t *w = &par->workers[i];
+
+        switch(par->sink)
+        {
+        case Op_AggStep:
+            if (!IS_VALID_CURSOR(&w->stmt, par->sink_op->p1))
+                rc = CHIDB_PROBLEM;
+            else
+                rc = chidb_Aggregator_merge(sink->agg, w->stmt.cursors[par->sink_op->p1].agg);
+            break;
+
+        case Op_SorterInsert:
+            for(uint32_t j = 0; j < w->nrecs && rc == CHIDB_OK; j++)
+                rc = chidb_Sorter_insert(sink->sorter, w->recs[j].bytes, w->recs[j].nbytes);
+            break;
+
+        default:
+            if (i < par->next_worker)
+                break;
+            if (par->next_rec < w->nrecs)
+                return __chidb_dbm_parallel_loadRow(stmt, &w->recs[par->next_rec++]) == CHIDB_OK ?
+                       CHIDB_ROW : CHIDB_ENOMEM;
+            par->next_worker++;
+            par->next_rec = 0;
+            break;
+        }
+    }
+
+    chidb_dbm_parallel_free(stmt);
+
+    return rc;
+}
+
+
+/* Drive the parallel scan of a program
+ *
+ * Called before each instruction of a program with a parallel scan is
+ * run. When the program is about to rewind the scan cursor, the table
+ * is split into key ranges and the workers are started (the cursor
+ * itself is limited to the first range). When the program leaves the
+ * scan loop, the output of the workers is handed over; once this is
+ * done, the program's par field is freed.
+ *
+ * Parameters
+ * - stmt: DBM program
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ROW: A result row produced by a worker has been loaded into
+ *              the program's registers.
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any error code returned by the workers' instructions.
+ */
+int chidb_dbm_parallel_step(chidb_stmt *stmt)
+{
+    chidb_dbm_parallel_t *par = stmt->par;
+
+    if (stmt->pc == par->rewind && !par->started)
+        return __chidb_dbm_parallel_start(stmt);
+    if (stmt->pc == par->exit && par->started)
+        return __chidb_dbm_parallel_finish(stmt);
+
+    return CHIDB_OK;
+}
+
+
+/* Free the parallel scan of a program
+ *
+ * Waits for any worker that is still running, and frees the workers'
+ * state and output.
+ *
+ * Parameters
+ * - stmt: DBM program
+ */
+void chidb_dbm_parallel_free(chidb_stmt *stmt)
+{
+    chidb_dbm_parallel_t *par = stmt->par;
+
+    if (par == NULL)
+        return;
+
+    for(uint32_t i = 0; par->workers != NULL && i < par->nworkers; i++)
+    {
+        chidb_dbm_worker_t *w = &par->workers[i];
+
+        if (w->started)
+            pthread_join(w->thread, NULL);
+
+        free(w->recs);
+
+        for(uint32_t j = 0; j < w->stmt.nCursors; j++)
+            if (w->stmt.cursors[j].type != CURSOR_UNSPECIFIED)
+                chidb_dbm_cursor_destroy(&w->bt, &w->stmt.cursors[j]);
+        chidb_dbm_batch_free(&w->stmt);
+        if (w->stmt.reg != NULL)
+            free_reg(&w->stmt);
+        free(w->stmt.reg);
+        free(w->stmt.cursors);
+
+        /* Output records and register buffers */
+        chidb_Arena_free(&w->stmt.arena);
+        chidb_Arena_free(&w->stmt.scratch);
+    }
+
+    free(par->workers);
+    free(par);
+    stmt->par = NULL;
+}
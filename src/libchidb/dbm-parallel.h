@@ -0,0 +1,122 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Parallel table scans header.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_PARALLEL_H_
+#define DBM_PARALLEL_H_
+
+#include <pthread.h>
+#include "dbm-types.h"
+
+/* Maximum number of threads scanning a table (including the thread
+ * running the program) */
+#define DBM_PARALLEL_MAX_WORKERS (16)
+
+/* Tables with fewer subtrees than this in the first two levels of their
+ * B-Tree are not worth scanning in parallel */
+#define DBM_PARALLEL_MIN_SUBTREES (8)
+
+/* A record produced by a worker, to be handed to the program */
+typedef struct chidb_dbm_parallel_rec
+{
+    uint8_t *bytes;
+    uint32_t nbytes;
+} chidb_dbm_parallel_rec_t;
+
+/* A worker scanning one key range of the table. It runs a copy of the
+ * program with registers and cursors of its own, reading the database
+ * through the read snapshot of the program. */
+typedef struct chidb_dbm_worker
+{
+    chidb_dbm_parallel_t *par;
+    pthread_t thread;
+    bool started;
+
+    chidb db;
+    BTree bt;
+    chidb_stmt stmt;
+
+    chidb_key_t key_min;
+    chidb_key_t key_max;
+
+    /* Result rows or sorter records produced by the worker */
+    chidb_dbm_parallel_rec_t *recs;
+    uint32_t nrecs;
+    uint32_t recs_size;
+
+    int rc;
+} chidb_dbm_worker_t;
+
+/* A parallel scan. The program scans a table in a single loop
+ *
+ *     rewind: Rewind   cursor exit
+ *             ...      (loop body)
+ *             Next     cursor rewind+1
+ *     exit:   ...
+ *
+ * whose body ends in a single "sink": a ResultRow, a SorterInsert or
+ * an AggStep. The loop may also be a batch loop (BatchRewind ...
+ * BatchNext, see dbm-batch.h) ending in a BatchResult. When the
+ * program reaches the Rewind, the table is split into key ranges: the
+ * program itself scans the first one, and each worker scans another
+ * one. When it reaches exit, the output of the workers is handed to
+ * the program's sink, in key order. */
+struct chidb_dbm_parallel
+{
+    uint32_t rewind;
+    uint32_t exit;
+    int32_t cursor;
+    opcode_t sink;
+    chidb_dbm_op_t *sink_op;
+
+    uint32_t nworkers;
+    chidb_dbm_worker_t *workers;
+    bool started;
+
+    /* Next result row to return (when the sink is ResultRow) */
+    uint32_t next_worker;
+    uint32_t next_rec;
+};
+
+uint32_t chidb_dbm_parallel_nthreads(chidb *db);
+int chidb_dbm_parallel_plan(chidb_stmt *stmt);
+int chidb_dbm_parallel_step(chidb_stmt *stmt);
+void chidb_dbm_parallel_free(chidb_stmt *stmt);
+
+#endif /* DBM_PARALLEL_H_ */
@@ -0,0 +1,330 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  SIMD comparison kernels for column vectors
+ *
+ */
+
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ *  Filtering a batch of rows (see dbm-batch.h) compares a column
+ *  vector with a value, or with another column vector, for every row.
+ *  Done one row at a time, each comparison is a branch that the
+ *  processor mispredicts about half the time on unsorted data. The
+ *  kernels in this file compare 8 (AVX2) or 4 (SSE2) integers at a
+ *  time instead, and produce a bitmap of the rows the comparison holds
+ *  for. The kernel to use is chosen once, according to the features
+ *  of the processor; there is a scalar kernel for other processors.
+ *
+ *  The kernels follow the Eq, Ne, Lt, Le, Gt and Ge instructions: a
+ *  comparison only holds if both values are integers, so it never
+ *  holds for NULL (or string) values.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "dbm-simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DBM_SIMD_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*chidb_dbm_simd_cmpConst_t)(int32_t eq, int32_t gt, int32_t lt, const uint8_t *types,
+                                          const int32_t *vals, int32_t k, uint32_t n, uint64_t *bitmap);
+typedef void (*chidb_dbm_simd_cmpVector_t)(int32_t eq, int32_t gt, int32_t lt,
+                                           const uint8_t *types1, const int32_t *vals1,
+                                           const uint8_t *types2, const int32_t *vals2,
+                                           uint32_t n, uint64_t *bitmap);
+
+static chidb_dbm_simd_cmpConst_t __chidb_dbm_simd_cmpConstKernel;
+static chidb_dbm_simd_cmpVector_t __chidb_dbm_simd_cmpVectorKernel;
+static pthread_once_t __chidb_dbm_simd_once = PTHREAD_ONCE_INIT;
+
+
+/* Which outcomes of a three-way comparison (equal, greater than, less
+ * than) make a comparison hold. Each one is -1 (all bits set) if it
+ * does, and 0 otherwise, so that it can be used as a mask. */
+static void __chidb_dbm_simd_outcomes(opcode_t cmp, int32_t *eq, int32_t *gt, int32_t *lt)
+{
+    *eq = -(cmp == Op_Eq || cmp == Op_Le || cmp == Op_Ge);
+    *gt = -(cmp == Op_Ne || cmp == Op_Gt || cmp == Op_Ge);
+    *lt = -(cmp == Op_Ne || cmp == Op_Lt || cmp == Op_Le);
+}
+
+
+/* Scalar kernels (also used for the rows left over by the others) */
+
+static inline uint64_t __chidb_dbm_simd_holds(int32_t eq, int32_t gt, int32_t lt, int32_t v, int32_t k)
+{
+    return ((v == k) & eq) | ((v > k) & gt) | ((v < k) & lt);
+}
+
+static void __chidb_dbm_simd_cmpConstScalar(int32_t eq, int32_t gt, int32_t lt, const uint8_t *types,
+                                            const int32_t *vals, int32_t k, uint32_t from, uint32_t n,
+                                            uint64_t *bitmap)
+{
+    for(uint32_t i = from; i < n; i++)
+        bitmap[i >> 6] |= (__chidb_dbm_simd_holds(eq, gt, lt, vals[i], k) & (types[i] == REG_INTEGER))
+                          << (i & 63);
+}
+
+static void __chidb_dbm_simd_cmpVectorScalar(int32_t eq, int32_t gt, int32_t lt,
+                                             const uint8_t *types1, const int32_t *vals1,
+                                             const uint8_t *types2, const int32_t *vals2,
+                                             uint32_t from, uint32_t n, uint64_t *bitmap)
+{
+    for(uint32_t i = from; i < n; i++)
+        bitmap[i >> 6] |= (__chidb_dbm_simd_holds(eq, gt, lt, vals1[i], vals2[i]) &
+                           (types1[i] == REG_INTEGER) & (types2[i] == REG_INTEGER)) << (i & 63);
+}
+
+static void __chidb_dbm_simd_cmpConstC(int32_t eq, int32_t gt, int32_t lt, const uint8_t *types,
+                                       const int32_t *vals, int32_t k, uint32_t n, uint64_t *bitmap)
+{
+    __chidb_dbm_simd_cmpConstScalar(eq, gt, lt, types, vals, k, 0, n, bitmap);
+}
+
+static void __chidb_dbm_simd_cmpVectorC(int32_t eq, int32_t gt, int32_t lt,
+                                        const uint8_t *types1, const int32_t *vals1,
+                                        const uint8_t *types2, const int32_t *vals2,
+                                        uint32_t n, uint64_t *bitmap)
+{
+    __chidb_dbm_simd_cmpVectorScalar(eq, gt, lt, types1, vals1, types2, vals2, 0, n, bitmap);
+}
+
+
+#ifdef DBM_SIMD_X86
+
+/* Mask with a bit set for each of the 4 (or 8) types that is REG_INTEGER */
+__attribute__((target("sse2")))
+static inline uint32_t __chidb_dbm_simd_intTypes4(const uint8_t *types)
+{
+    int32_t t;
+
+    memcpy(&t, types, sizeof(t));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_cvtsi32_si128(t), _mm_set1_epi8(REG_INTEGER))) & 0xF;
+}
+
+__attribute__((target("sse2")))
+static inline uint32_t __chidb_dbm_simd_intTypes8(const uint8_t *types)
+{
+    __m128i t = _mm_loadl_epi64((const __m128i *) types);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(t, _mm_set1_epi8(REG_INTEGER))) & 0xFF;
+}
+
+
+/* SSE2 kernels: 4 rows at a time */
+
+__attribute__((target("sse2")))
+static inline uint32_t __chidb_dbm_simd_holds4(__m128i me, __m128i mg, __m128i ml, __m128i v, __m128i k)
+{
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_cmpeq_epi32(v, k), me),
+                                          _mm_and_si128(_mm_cmpgt_epi32(v, k), mg)),
+                             _mm_and_si128(_mm_cmplt_epi32(v, k), ml));
+
+    return _mm_movemask_ps(_mm_castsi128_ps(m));
+}
+
+__attribute__((target("sse2")))
+static void __chidb_dbm_simd_cmpConstSSE2(int32_t eq, int32_t gt, int32_t lt, const uint8_t *types,
+                                          const int32_t *vals, int32_t k, uint32_t n, uint64_t *bitmap)
+{
+    __m128i me = _mm_set1_epi32(eq), mg = _mm_set1_epi32(gt), ml = _mm_set1_epi32(lt);
+    __m128i kv = _mm_set1_epi32(k);
+    uint32_t i;
+
+    for(i = 0; i + 4 <= n; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (vals + i));
+        uint64_t bits = __chidb_dbm_simd_holds4(me, mg, ml, v, kv) & __chidb_dbm_simd_intTypes4(types + i);
+
+        bitmap[i >> 6] |= bits << (i & 63);
+    }
+    __chidb_dbm_simd_cmpConstScalar(eq, gt, lt, types, vals, k, i, n, bitmap);
+}
+
+__attribute__((target("sse2")))
+static void __chidb_dbm_simd_cmpVectorSSE2(int32_t eq, int32_t gt, int32_t lt,
+                                           const uint8_t *types1, const int32_t *vals1,
+                                           const uint8_t *types2, const int32_t *vals2,
+                                           uint32_t n, uint64_t *bitmap)
+{
+    __m128i me = _mm_set1_epi32(eq), mg = _mm_set1_epi32(gt), ml = _mm_set1_epi32(lt);
+    uint32_t i;
+
+    for(i = 0; i + 4 <= n; i += 4)
+    {
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (vals1 + i));
+        __m128i v2 = _mm_loadu_si128((const __m128i *) (vals2 + i));
+        uint64_t bits = __chidb_dbm_simd_holds4(me, mg, ml, v1, v2) &
+                        __chidb_dbm_simd_intTypes4(types1 + i) & __chidb_dbm_simd_intTypes4(types2 + i);
+
+        bitmap[i >> 6] |= bits << (i & 63);
+    }
+    __chidb_dbm_simd_cmpVectorScalar(eq, gt, lt, types1, vals1, types2, vals2, i, n, bitmap);
+}
+
+
+/* AVX2 kernels: 8 rows at a time */
+
+__attribute__((target("avx2")))
+static inline uint32_t __chidb_dbm_simd_holds8(__m256i me, __m256i mg, __m256i ml, __m256i v, __m256i k)
+{
+    __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_cmpeq_epi32(v, k), me),
+                                                _mm256_and_si256(_mm256_cmpgt_epi32(v, k), mg)),
+                                _mm256_and_si256(_mm256_cmpgt_epi32(k, v), ml));
+
+    return _mm256_movemask_ps(_mm256_castsi256_ps(m));
+}
+
+__attribute__((target("avx2")))
+static void __chidb_dbm_simd_cmpConstAVX2(int32_t eq, int32_t gt, int32_t lt, const uint8_t *types,
+                                          const int32_t *vals, int32_t k, uint32_t n, uint64_t *bitmap)
+{
+    __m256i me = _mm256_set1_epi32(eq), mg = _mm256_set1_epi32(gt), ml = _mm256_set1_epi32(lt);
+    __m256i kv = _mm256_set1_epi32(k);
+    uint32_t i;
+
+    for(i = 0; i + 8 <= n; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (vals + i));
+        uint64_t bits = __chidb_dbm_simd_holds8(me, mg, ml, v, kv) & __chidb_dbm_simd_intTypes8(types + i);
+
+        bitmap[i >> 6] |= bits << (i & 63);
+    }
+    __chidb_dbm_simd_cmpConstScalar(eq, gt, lt, types, vals, k, i, n, bitmap);
+}
+
+__attribute__((target("avx2")))
+static void __chidb_dbm_simd_cmpVectorAVX2(int32_t eq, int32_t gt, int32_t lt,
+                                           const uint8_t *types1, const int32_t *vals1,
+                                           const uint8_t *types2, const int32_t *vals2,
+                                           uint32_t n, uint64_t *bitmap)
+{
+    __m256i me = _mm256_set1_epi32(eq), mg = _mm256_set1_epi32(gt), ml = _mm256_set1_epi32(lt);
+    uint32_t i;
+
+    for(i = 0; i + 8 <= n; i += 8)
+    {
+        __m256i v1 = _mm256_loadu_si256((const __m256i *) (vals1 + i));
+        __m256i v2 = _mm256_loadu_si256((const __m256i *) (vals2 + i));
+        uint64_t bits = __chidb_dbm_simd_holds8(me, mg, ml, v1, v2) &
+                        __chidb_dbm_simd_intTypes8(types1 + i) & __chidb_dbm_simd_intTypes8(types2 + i);
+
+        bitmap[i >> 6] |= bits << (i & 63);
+    }
+    __chidb_dbm_simd_cmpVectorScalar(eq, gt, lt, types1, vals1, types2, vals2, i, n, bitmap);
+}
+
+#endif /* DBM_SIMD_X86 */
+
+
+/* Choose the kernels for this processor */
+static void __chidb_dbm_simd_init(void)
+{
+    __chidb_dbm_simd_cmpConstKernel = __chidb_dbm_simd_cmpConstC;
+    __chidb_dbm_simd_cmpVectorKernel = __chidb_dbm_simd_cmpVectorC;
+
+#ifdef DBM_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        __chidb_dbm_simd_cmpConstKernel = __chidb_dbm_simd_cmpConstAVX2;
+        __chidb_dbm_simd_cmpVectorKernel = __chidb_dbm_simd_cmpVectorAVX2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        __chidb_dbm_simd_cmpConstKernel = __chidb_dbm_simd_cmpConstSSE2;
+        __chidb_dbm_simd_cmpVectorKernel = __chidb_dbm_simd_cmpVectorSSE2;
+    }
+#endif
+}
+
+
+/* Compare a column vector with a value
+ *
+ * Sets bit i of the bitmap if "vals[i] cmp k" holds, where cmp is one
+ * of the comparison instructions, and types[i] is REG_INTEGER. Other
+ * bits are cleared.
+ *
+ * Parameters
+ * - cmp: Comparison (Op_Eq, Op_Ne, Op_Lt, Op_Le, Op_Gt or Op_Ge)
+ * - types: Register type of each value
+ * - vals: Values
+ * - k: Value to compare with
+ * - n: Number of values
+ * - bitmap: Out parameter with DBM_SIMD_BITMAP_WORDS(n) words
+ */
+void chidb_dbm_simd_cmpConst(opcode_t cmp, const uint8_t *types, const int32_t *vals,
+                             int32_t k, uint32_t n, uint64_t *bitmap)
+{
+    int32_t eq, gt, lt;
+
+    pthread_once(&__chidb_dbm_simd_once, __chidb_dbm_simd_init);
+
+    __chidb_dbm_simd_outcomes(cmp, &eq, &gt, &lt);
+    memset(bitmap, 0, DBM_SIMD_BITMAP_WORDS(n) * sizeof(uint64_t));
+    __chidb_dbm_simd_cmpConstKernel(eq, gt, lt, types, vals, k, n, bitmap);
+}
+
+
+/* Compare two column vectors
+ *
+ * Sets bit i of the bitmap if "vals1[i] cmp vals2[i]" holds, where cmp
+ * is one of the comparison instructions, and both types1[i] and
+ * types2[i] are REG_INTEGER. Other bits are cleared.
+ *
+ * Parameters
+ * - cmp: Comparison (Op_Eq, Op_Ne, Op_Lt, Op_Le, Op_Gt or Op_Ge)
+ * - types1, vals1: Register types and values of the first vector
+ * - types2, vals2: Register types and values of the second vector
+ * - n: Number of values in each vector
+ * - bitmap: Out parameter with DBM_SIMD_BITMAP_WORDS(n) words
+ */
+void chidb_dbm_simd_cmpVector(opcode_t cmp, const uint8_t *types1, const int32_t *vals1,
+                              const uint8_t *types2, const int32_t *vals2,
+                              uint32_t n, uint64_t *bitmap)
+{
+    int32_t eq, gt, lt;
+
+    pthread_once(&__chidb_dbm_simd_once, __chidb_dbm_simd_init);
+
+    __chidb_dbm_simd_outcomes(cmp, &eq, &gt, &lt);
+    memset(bitmap, 0, DBM_SIMD_BITMAP_WORDS(n) * sizeof(uint64_t));
+    __chidb_dbm_simd_cmpVectorKernel(eq, gt, lt, types1, vals1, types2, vals2, n, bitmap);
+}
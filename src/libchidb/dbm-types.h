@@ -45,6 +45,7 @@
 #include <chidb/chisql.h>
 #include "chidbInt.h"
 #include "dbm-cursor.h"
+#include "arena.h"
 
 #define DEFAULT_OPS_SIZE (50)
 #define DEFAULT_REG_SIZE (10)
@@ -71,6 +72,8 @@
         OP(Column)      \
         OP(Key)         \
         OP(Integer)     \
+        OP(Int64)       \
+        OP(Real)        \
         OP(String)      \
         OP(Null)        \
         OP(ResultRow)   \
@@ -90,8 +93,34 @@
         OP(IdxInsert)   \
         OP(CreateTable) \
         OP(CreateIndex) \
+        OP(CreateBloom) \
+        OP(Analyze)     \
+        OP(AutoCommit)  \
         OP(Copy)        \
         OP(SCopy)       \
+        OP(SorterOpen)  \
+        OP(SorterLimit) \
+        OP(SorterInsert) \
+        OP(SorterSort)  \
+        OP(SorterNext)  \
+        OP(SorterData)  \
+        OP(AggOpen)     \
+        OP(AggStep)     \
+        OP(AggFinal)    \
+        OP(AggNext)     \
+        OP(SetOpen)     \
+        OP(SetInsert)   \
+        OP(SetFound)    \
+        OP(SetNotFound) \
+        OP(IfPos)       \
+        OP(IfNot)       \
+        OP(DecrJumpZero) \
+        OP(BatchRewind) \
+        OP(BatchNext)   \
+        OP(BatchColumn) \
+        OP(BatchKey)    \
+        OP(BatchFilter) \
+        OP(BatchResult) \
         OP(Halt)
 
 /* The following generates an enum type for the opcode. It expands to:
@@ -158,16 +187,17 @@ typedef struct chidb_dbm_op
 } chidb_dbm_op_t;
 
 
-/* A register can be of type integer, string, null or binary.
+/* A register can be of type integer (64 bits), real, string, null or binary.
  * Additionally we define a REG_UNSPECIFIED type, which is
  * the type of any new register than hasn't been assigned a value. */
 typedef enum register_type
 {
     REG_UNSPECIFIED    = 0,
     REG_NULL           = 1,
-    REG_INT32          = 2,
+    REG_INTEGER        = 2,
     REG_STRING         = 3,
-    REG_BINARY         = 4
+    REG_BINARY         = 4,
+    REG_REAL           = 5
 } register_type_t;
 
 static inline const char* regtype_to_str(register_type_t regtype)
@@ -178,17 +208,40 @@ static inline const char* regtype_to_str(register_type_t regtype)
         return "unspecified";
     case REG_NULL:
         return "null";
-    case REG_INT32:
+    case REG_INTEGER:
         return "integer";
     case REG_STRING:
         return "string";
     case REG_BINARY:
         return "binary";
+    case REG_REAL:
+        return "real";
     default:
         return "unknown";
     }
 }
 
+/* Strings of up to this many bytes are kept inside the register itself,
+ * instead of in a string allocated on the heap */
+#define DBM_REG_INLINE_LEN (23)
+
+/* Where the text of a REG_STRING register is stored:
+ *
+ * - REG_TEXT_HEAP: in a string allocated on the heap, owned by the register.
+ * - REG_TEXT_INLINE: in the register's inline buffer.
+ * - REG_TEXT_BORROWED: in memory owned by a cursor (the cell it points to,
+ *   or its batch of rows), which is not necessarily NUL-terminated. It is
+ *   valid until the cursor moves away from it, so the instructions that
+ *   could move the cursor first copy it into the register (see
+ *   chidb_dbm_reg_release).
+ */
+typedef enum register_text
+{
+    REG_TEXT_HEAP      = 0,
+    REG_TEXT_INLINE    = 1,
+    REG_TEXT_BORROWED  = 2
+} register_text_t;
+
 /* A type representing a single register */
 typedef struct chidb_dbm_register
 {
@@ -196,7 +249,8 @@ typedef struct chidb_dbm_register
 
     union
     {
-        int32_t i;
+        int64_t i;
+        double r;
         char* s;
         struct
         {
@@ -205,8 +259,34 @@ typedef struct chidb_dbm_register
         } bin;
     } value;
 
+    /* Strings: length of value.s (without the terminating NUL), where it
+     * is stored and, if it is borrowed, the cursor it is borrowed from */
+    uint32_t len;
+    uint8_t text;
+    int32_t cursor;
+    char inl[DBM_REG_INLINE_LEN + 1];
+
+    /* Binary: buffer (allocated from the statement's arena) that
+     * records made into this register are stored in, and its size.
+     * It is reused, and only grows, from one record to the next. */
+    uint8_t *buf;
+    uint32_t buf_size;
+
+    /* Binary: a record that MakeRecord has sized but not written (its
+     * bytes are NULL) is made of registers rec_first to
+     * rec_first + rec_n - 1, and Insert writes it straight into the
+     * table (see chidb_dbm_op_MakeRecord) */
+    int32_t rec_first;
+    int32_t rec_n;
+
 } chidb_dbm_register_t;
 
+/* Parallel scan of a DBM program (see dbm-parallel.h) */
+typedef struct chidb_dbm_parallel chidb_dbm_parallel_t;
+
+/* Batch of rows read by a DBM program (see dbm-batch.h) */
+typedef struct chidb_dbm_batch chidb_dbm_batch_t;
+
 /*  This is the struct that represents a single DBM program.
  *
  *  Notice how a single DBM program has its own registers and cursors;
@@ -259,6 +339,26 @@ struct chidb_stmt
      * per operation */
     bool explain;
 
+    /* Read snapshot of a read-only statement, opened when it first steps
+     * outside an explicit transaction (NULL otherwise) */
+    PagerSnapshot *snapshot;
+
+    /* Parallel scan of the program, if it runs one (NULL otherwise) */
+    chidb_dbm_parallel_t *par;
+
+    /* Batch of rows of the batch instructions (NULL if none have run) */
+    chidb_dbm_batch_t *batch;
+
+    /* Number of registers with text borrowed from a cursor */
+    uint32_t nborrowed;
+
+    /* Memory that lives as long as the statement (its instructions,
+     * column names, parse tree, and register buffers) */
+    Arena arena;
+
+    /* Memory that only lives until the current instruction is done */
+    Arena scratch;
+
     /* Additional fields go here */
 };
 
@@ -267,6 +367,11 @@ struct chidb_stmt
 #define EXISTS_REGISTER(stmt, r) ((r) >= 0 && (r) < (stmt)->nReg)
 #define IS_VALID_REGISTER(stmt, r) (EXISTS_REGISTER(stmt, r) && (stmt)->reg[r].type != REG_UNSPECIFIED)
 
+/* Integer registers whose value fits in 32 bits, and registers that hold
+ * a number (integer or real) */
+#define DBM_REG_INT32(r) ((r)->value.i >= INT32_MIN && (r)->value.i <= INT32_MAX)
+#define DBM_REG_NUMERIC(r) ((r)->type == REG_INTEGER || (r)->type == REG_REAL)
+
 #define EXISTS_CURSOR(stmt, c) ((c) >= 0 && (c) < (stmt)->nCursors)
 #define IS_VALID_CURSOR(stmt, c) (EXISTS_CURSOR(stmt, c) && (stmt)->cursors[c].type != CURSOR_UNSPECIFIED)
 
@@ -39,7 +39,11 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include "dbm.h"
+#include "dbm-parallel.h"
+#include "dbm-batch.h"
+#include "util.h"
 
 /* Forward declaration of auxiliary functions. */
 int realloc_ops(chidb_stmt *stmt, uint32_t size);
@@ -74,6 +78,12 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
     stmt->db = db;
     stmt->sql = NULL;
     stmt->explain = false;
+    stmt->snapshot = NULL;
+    stmt->par = NULL;
+    stmt->batch = NULL;
+    stmt->nborrowed = 0;
+    chidb_Arena_init(&stmt->arena);
+    chidb_Arena_init(&stmt->scratch);
 
     /* The program starts running in instruction 0 */
     stmt->pc = 0;
@@ -115,7 +125,8 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
 
 /* Free a DBM's resources
  *
- * Frees the resources associated with a statement.
+ * Frees the resources associated with a statement (but not the
+ * chidb_stmt struct itself, which may be embedded in another struct).
  *
  * Parameters
  * - stmt: DBM to free
@@ -125,16 +136,33 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
  */
 int chidb_stmt_free(chidb_stmt *stmt)
 {
-	free(stmt->ops);
-	free(stmt->reg);
-	free(stmt->cursors);
-    return CHIDB_OK;
+    /* Workers of a parallel scan read through the snapshot */
+    chidb_dbm_parallel_free(stmt);
+    chidb_dbm_batch_free(stmt);
+
+    if (stmt->snapshot != NULL)
+        chidb_Pager_closeSnapshot(stmt->db->bt->pager, stmt->snapshot);
+
+    /* Sorters and record sets may own temporary files (and aggregators
+     * a lot of memory), so they are closed even if the program did not
+     * run to completion */
+    for(int i=0; i < stmt->nCursors; i++)
+    {
+        if(stmt->cursors[i].type == CURSOR_SORTER || stmt->cursors[i].type == CURSOR_AGGREGATOR
+           || stmt->cursors[i].type == CURSOR_SET)
+            chidb_dbm_cursor_destroy(stmt->db->bt, &stmt->cursors[i]);
+    }
 
 	free(stmt->ops);
     free_reg(stmt);
+	free(stmt->reg);
 	free(stmt->cursors);
-    free(stmt);
-    return CHIDB_OK;    
+
+    /* Instructions, column names, the parse tree and register buffers */
+    chidb_Arena_free(&stmt->arena);
+    chidb_Arena_free(&stmt->scratch);
+
+    return CHIDB_OK;
 }
 
 
@@ -167,8 +195,8 @@ int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos)
 
     memcpy(&stmt->ops[pos], op, sizeof(chidb_dbm_op_t));
 
-    if(op->p4 != NULL)
-        stmt->ops[pos].p4 = strdup(op->p4);
+    if(op->p4 != NULL && (stmt->ops[pos].p4 = chidb_Arena_strdup(&stmt->arena, op->p4)) == NULL)
+        return CHIDB_ENOMEM;
 
     if(pos >= stmt->endOp)
         stmt->endOp = pos + 1;
@@ -180,6 +208,66 @@ int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos)
 int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
 
 
+/* Does the program write to the database? */
+static bool stmt_writes(chidb_stmt *stmt)
+{
+    for(uint32_t i=0; i < stmt->endOp; i++)
+    {
+        switch(stmt->ops[i].opcode)
+        {
+        case Op_OpenWrite:
+        case Op_Insert:
+        case Op_IdxInsert:
+        case Op_CreateTable:
+        case Op_CreateIndex:
+        case Op_CreateBloom:
+        case Op_Analyze:
+            return true;
+        default:
+            break;
+        }
+    }
+
+    return false;
+}
+
+
+/* Does the program only read the database? */
+static bool stmt_is_readonly(chidb_stmt *stmt)
+{
+    for(uint32_t i=0; i < stmt->endOp; i++)
+        if (stmt->ops[i].opcode == Op_AutoCommit)
+            return false;
+
+    return !stmt_writes(stmt);
+}
+
+
+/* Does the program only insert entries into existing B-Trees? Such a
+ * program can share the write lock with other connections, since
+ * chidb_Btree_insert latches the nodes it modifies */
+static bool stmt_only_inserts(chidb_stmt *stmt)
+{
+    for(uint32_t i=0; i < stmt->endOp; i++)
+    {
+        switch(stmt->ops[i].opcode)
+        {
+        case Op_OpenRead:
+        case Op_CreateTable:
+        case Op_CreateIndex:
+        case Op_CreateBloom:
+        case Op_Analyze:
+        case Op_AutoCommit:
+            return false;
+        default:
+            break;
+        }
+    }
+
+    return stmt_writes(stmt);
+}
+
+
 /* Run the DBM
  *
  * This function will run the DBM until one of the following happens:
@@ -193,20 +281,70 @@ int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
  *    or CHIDB_ROW. The program stops executing and and the return
  *    value of the instruction handler is returned.
  *
+ * Unless an explicit transaction is active (see the AutoCommit
+ * instruction), the pages written by the program are committed to the
+ * write-ahead log when it finishes (see chidb_Pager_commit), and are
+ * rolled back if it fails. Outside an explicit transaction, a program
+ * that only reads the database does so through a read snapshot opened
+ * on its first step (see chidb_Pager_openSnapshot), and closed once it
+ * stops returning rows. If such a program scans a large table, the
+ * scan may be split among several threads (see dbm-parallel.c).
+ *
+ * A program that writes the database first takes its write lock (see
+ * chidb_Btree_beginWrite), which is released once its changes are
+ * committed or rolled back: when the program finishes, or at the end
+ * of the explicit transaction it runs in. Outside an explicit
+ * transaction, programs that only insert entries into a shared pager
+ * share the write lock instead (see chidb_Btree_beginSharedWrite):
+ * they run concurrently and are committed together, so if one of them
+ * fails the others are rolled back too and return CHIDB_EBUSY.
+ *
  * Parameters
  * - stmt: DBM to run.
  *
  * Returns
  * - CHIDB_ROW: Statement returned a row.
  * - CHIDB_DONE: Statement has finished executing.
+ * - CHIDB_EBUSY: Another connection kept the database locked.
  * - Any error code returned by an individual instruction handler.
  */
 int chidb_stmt_exec(chidb_stmt *stmt)
 {
+    BTree *bt = stmt->db->bt;
+    PagerSnapshot *snapshot;
     int rc = CHIDB_OK;
 
+    if (stmt->pc == 0 && !bt->writer && stmt_writes(stmt))
+    {
+        if (stmt->db->autocommit && bt->pager->shared && stmt_only_inserts(stmt))
+            rc = chidb_Btree_beginSharedWrite(bt);
+        else
+            rc = chidb_Btree_beginWrite(bt);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    /* A read-only statement run outside an explicit transaction reads
+     * the database as of its first step, so it keeps seeing a consistent
+     * database while other statements commit */
+    if (stmt->pc == 0 && stmt->snapshot == NULL && stmt->db->autocommit && !bt->writer &&
+        stmt_is_readonly(stmt))
+    {
+        rc = chidb_Pager_openSnapshot(bt->pager, &stmt->snapshot);
+        if (rc == CHIDB_OK)
+            rc = chidb_dbm_parallel_plan(stmt);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    snapshot = bt->snapshot;
+    bt->snapshot = stmt->snapshot;
+
     while(stmt->pc < stmt->endOp)
     {
+        if (stmt->par != NULL && (rc = chidb_dbm_parallel_step(stmt)) != CHIDB_OK)
+            break;
+
         chidb_dbm_op_t *op = &stmt->ops[stmt->pc++];
         rc = chidb_dbm_op_handle(stmt, op);
 
@@ -214,9 +352,38 @@ int chidb_stmt_exec(chidb_stmt *stmt)
             break;
     }
 
+    bt->snapshot = snapshot;
+    if (rc != CHIDB_ROW && stmt->snapshot != NULL)
+    {
+        chidb_dbm_parallel_free(stmt);
+        chidb_Pager_closeSnapshot(bt->pager, stmt->snapshot);
+        stmt->snapshot = NULL;
+    }
+
     if (rc==CHIDB_ROW)
         assert(stmt->nRR == stmt->nCols);
 
+    /* Outside an explicit transaction, a statement that has finished
+     * commits the pages it wrote, and one that failed rolls them back */
+    if (bt->shared_writer && rc != CHIDB_ROW)
+    {
+        if (rc == CHIDB_OK || rc == CHIDB_DONE)
+            rc = chidb_Btree_endSharedWrite(bt, false);
+        else
+            chidb_Btree_endSharedWrite(bt, true);
+    }
+    else if (stmt->db->autocommit && bt->writer && rc != CHIDB_ROW)
+    {
+        if (rc == CHIDB_OK || rc == CHIDB_DONE)
+            rc = chidb_Pager_commit(bt->pager);
+        else
+        {
+            chidb_Pager_rollback(bt->pager);
+            stmt->db->need_refresh = 1;
+        }
+        chidb_Btree_endWrite(bt);
+    }
+
     if (rc == CHIDB_OK || rc == CHIDB_DONE)
         rc = CHIDB_DONE;
 
@@ -256,11 +423,14 @@ char* chidb_stmt_reg_str(chidb_dbm_register_t *r)
     case REG_NULL:
         strcpy(s, "NULL");
         break;
-    case REG_INT32:
-        snprintf(s, MAX_STR_LEN, "%i", r->value.i);
+    case REG_INTEGER:
+        snprintf(s, MAX_STR_LEN, "%" PRId64, r->value.i);
+        break;
+    case REG_REAL:
+        chidb_real_str(s, MAX_STR_LEN, r->value.r);
         break;
     case REG_STRING:
-        snprintf(s, MAX_STR_LEN, "\"%s\"", r->value.s);
+        snprintf(s, MAX_STR_LEN, "\"%.*s\"", (int) r->len, r->value.s);
         break;
     case REG_BINARY:
         snprintf(s, MAX_STR_LEN, "(%i bytes)", r->value.bin.nbytes);
@@ -393,9 +563,18 @@ int realloc_reg(chidb_stmt *stmt, uint32_t size)
     if(stmt->reg == NULL)
         return CHIDB_ENOMEM;
 
+    /* Strings kept inside a register moved with it */
+    for(int i=0; i < stmt->nReg && i < size; i++)
+    {
+        if(stmt->reg[i].type == REG_STRING && stmt->reg[i].text == REG_TEXT_INLINE)
+            stmt->reg[i].value.s = stmt->reg[i].inl;
+    }
+
     for(int i=stmt->nReg; i < size; i++)
     {
         stmt->reg[i].type = REG_UNSPECIFIED;
+        stmt->reg[i].buf = NULL;
+        stmt->reg[i].buf_size = 0;
     }
 
     stmt->nReg = size;
@@ -432,16 +611,281 @@ void free_reg(chidb_stmt *stmt)
         switch (reg.type)
         {
             case REG_STRING:
-                free(reg.value.s);
+                if (reg.text == REG_TEXT_HEAP)
+                    free(reg.value.s);
                 break;
 
+            /* Binary values live in the register's buffer, which
+             * belongs to the statement's arena */
             case REG_BINARY:
-                free(reg.value.bin.bytes);
-
             case REG_UNSPECIFIED:
             case REG_NULL:
-            case REG_INT32:
+            case REG_INTEGER:
+            case REG_REAL:
                 break;
         }
     }
-}
\ No newline at end of file
+}
+
+
+/* Frees the string of a register, if it owns one on the heap, before
+ * the register is overwritten */
+void chidb_dbm_reg_clear(chidb_stmt *stmt, chidb_dbm_register_t *r)
+{
+    if (r->type != REG_STRING)
+        return;
+
+    if (r->text == REG_TEXT_HEAP)
+        free(r->value.s);
+    else if (r->text == REG_TEXT_BORROWED)
+        stmt->nborrowed--;
+    r->type = REG_UNSPECIFIED;
+}
+
+/* Stores a copy of a string in a register, inside the register itself if
+ * it is short enough, or on the heap otherwise */
+static int __chidb_dbm_reg_copyText(chidb_dbm_register_t *r, const char *s, uint32_t len)
+{
+    char *dst = r->inl;
+
+    if (len > DBM_REG_INLINE_LEN && (dst = malloc(len + 1)) == NULL)
+        return CHIDB_ENOMEM;
+
+    memcpy(dst, s, len);
+    dst[len] = '\0';
+
+    r->type = REG_STRING;
+    r->text = dst == r->inl ? REG_TEXT_INLINE : REG_TEXT_HEAP;
+    r->value.s = dst;
+    r->len = len;
+
+    return CHIDB_OK;
+}
+
+/* Write a copy of a string into a register
+ *
+ * Strings of up to DBM_REG_INLINE_LEN bytes are copied into the
+ * register itself, so they do not need to be allocated.
+ *
+ * Parameters
+ * - stmt: DBM program
+ * - regNo: Register to write (it is created if it does not exist)
+ * - s: String (it does not need to be NUL-terminated)
+ * - len: Length of the string
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOREG: Invalid register
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_reg_setText(chidb_stmt *stmt, int regNo, const char *s, uint32_t len)
+{
+    if (regNo < 0)
+        return CHIDB_ENOREG;
+    if (!EXISTS_REGISTER(stmt, regNo) && realloc_reg(stmt, regNo + 1) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_register_t *r = &stmt->reg[regNo];
+    chidb_dbm_reg_clear(stmt, r);
+
+    return __chidb_dbm_reg_copyText(r, s, len);
+}
+
+/* Write an integer into a register
+ *
+ * Parameters
+ * - stmt: DBM program
+ * - regNo: Register to write (it is created if it does not exist)
+ * - v: Value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOREG: Invalid register
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_reg_setInt(chidb_stmt *stmt, int regNo, int64_t v)
+{
+    if (regNo < 0)
+        return CHIDB_ENOREG;
+    if (!EXISTS_REGISTER(stmt, regNo) && realloc_reg(stmt, regNo + 1) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_register_t *r = &stmt->reg[regNo];
+    chidb_dbm_reg_clear(stmt, r);
+    r->type = REG_INTEGER;
+    r->value.i = v;
+
+    return CHIDB_OK;
+}
+
+/* Write a floating point number into a register
+ *
+ * Parameters
+ * - stmt: DBM program
+ * - regNo: Register to write (it is created if it does not exist)
+ * - v: Value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOREG: Invalid register
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_reg_setReal(chidb_stmt *stmt, int regNo, double v)
+{
+    if (regNo < 0)
+        return CHIDB_ENOREG;
+    if (!EXISTS_REGISTER(stmt, regNo) && realloc_reg(stmt, regNo + 1) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_register_t *r = &stmt->reg[regNo];
+    chidb_dbm_reg_clear(stmt, r);
+    r->type = REG_REAL;
+    r->value.r = v;
+
+    return CHIDB_OK;
+}
+
+/* Point a register at a string owned by a cursor
+ *
+ * The string is not copied. It must stay valid until cursor c moves
+ * away from it: instructions that can do that first make the registers
+ * that borrow from c copy their string (see chidb_dbm_reg_release).
+ *
+ * Parameters
+ * - stmt: DBM program
+ * - regNo: Register to write (it is created if it does not exist)
+ * - c: Cursor that owns the string
+ * - s: String (it does not need to be NUL-terminated)
+ * - len: Length of the string
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOREG: Invalid register
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_reg_borrowText(chidb_stmt *stmt, int regNo, int32_t c, const char *s, uint32_t len)
+{
+    if (regNo < 0)
+        return CHIDB_ENOREG;
+    if (!EXISTS_REGISTER(stmt, regNo) && realloc_reg(stmt, regNo + 1) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_register_t *r = &stmt->reg[regNo];
+    chidb_dbm_reg_clear(stmt, r);
+
+    r->type = REG_STRING;
+    r->text = REG_TEXT_BORROWED;
+    r->value.s = (char *) s;
+    r->len = len;
+    r->cursor = c;
+    stmt->nborrowed++;
+
+    return CHIDB_OK;
+}
+
+/* Make a register hold a binary value of a given size
+ *
+ * The value is stored in the register's buffer, which is allocated from
+ * the statement's arena and reused by later binary values written to
+ * the same register (it only grows when a larger value comes along). The
+ * caller fills in the value, which stays valid until the register is
+ * written to again.
+ *
+ * Parameters
+ * - stmt: DBM program
+ * - regNo: Register to write (it is created if it does not exist)
+ * - nbytes: Size of the value
+ * - bytes: Out parameter; location to write the value to
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOREG: Invalid register
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_reg_setBinary(chidb_stmt *stmt, int regNo, uint32_t nbytes, uint8_t **bytes)
+{
+    if (regNo < 0)
+        return CHIDB_ENOREG;
+    if (!EXISTS_REGISTER(stmt, regNo) && realloc_reg(stmt, regNo + 1) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_register_t *r = &stmt->reg[regNo];
+    chidb_dbm_reg_clear(stmt, r);
+
+    if (nbytes > r->buf_size)
+    {
+        uint32_t size = r->buf_size ? r->buf_size : 64;
+
+        while (size < nbytes)
+            size *= 2;
+        if ((r->buf = chidb_Arena_alloc(&stmt->arena, size)) == NULL)
+            return CHIDB_ENOMEM;
+        r->buf_size = size;
+    }
+
+    r->type = REG_BINARY;
+    r->value.bin.bytes = r->buf;
+    r->value.bin.nbytes = nbytes;
+    *bytes = r->buf;
+
+    return CHIDB_OK;
+}
+
+/* Make the registers that borrow their string from a cursor copy it
+ *
+ * Parameters
+ * - stmt: DBM program
+ * - c: Cursor (or -1 for all cursors)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_reg_release(chidb_stmt *stmt, int32_t c)
+{
+    int rc;
+
+    for(uint32_t i = 0; i < stmt->nReg && stmt->nborrowed > 0; i++)
+    {
+        chidb_dbm_register_t *r = &stmt->reg[i];
+
+        if (r->type != REG_STRING || r->text != REG_TEXT_BORROWED || (c >= 0 && r->cursor != c))
+            continue;
+
+        stmt->nborrowed--;
+        if ((rc = __chidb_dbm_reg_copyText(r, r->value.s, r->len)) != CHIDB_OK)
+        {
+            r->type = REG_NULL;
+            return rc;
+        }
+    }
+
+    return CHIDB_OK;
+}
+
+/* Return the string of a register as a NUL-terminated string
+ *
+ * A string borrowed from a cursor is copied into the register first.
+ *
+ * Parameters
+ * - stmt: DBM program
+ * - r: A REG_STRING register of stmt
+ *
+ * Return
+ * - The string, or NULL if it could not be copied
+ */
+const char *chidb_dbm_reg_text(chidb_stmt *stmt, chidb_dbm_register_t *r)
+{
+    if (r->text == REG_TEXT_BORROWED)
+    {
+        stmt->nborrowed--;
+        if (__chidb_dbm_reg_copyText(r, r->value.s, r->len) != CHIDB_OK)
+        {
+            r->type = REG_NULL;
+            return NULL;
+        }
+    }
+
+    return r->value.s;
+}
+
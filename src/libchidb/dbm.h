@@ -55,4 +55,13 @@ int chidb_stmt_print(chidb_stmt *stmt);
 int realloc_reg(chidb_stmt *stmt, uint32_t size);
 void free_reg(chidb_stmt *stmt);
 
+void chidb_dbm_reg_clear(chidb_stmt *stmt, chidb_dbm_register_t *r);
+int chidb_dbm_reg_setText(chidb_stmt *stmt, int regNo, const char *s, uint32_t len);
+int chidb_dbm_reg_setInt(chidb_stmt *stmt, int regNo, int64_t v);
+int chidb_dbm_reg_setReal(chidb_stmt *stmt, int regNo, double v);
+int chidb_dbm_reg_borrowText(chidb_stmt *stmt, int regNo, int32_t c, const char *s, uint32_t len);
+int chidb_dbm_reg_setBinary(chidb_stmt *stmt, int regNo, uint32_t nbytes, uint8_t **bytes);
+int chidb_dbm_reg_release(chidb_stmt *stmt, int32_t c);
+const char *chidb_dbm_reg_text(chidb_stmt *stmt, chidb_dbm_register_t *r);
+
 #endif /* DBM_H_ */
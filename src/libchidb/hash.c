@@ -0,0 +1,294 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Hash table keyed by byte strings
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ *  A simple hash table used by the database machine to group and
+ *  de-duplicate records. Keys are arbitrary byte strings (typically
+ *  packed record fields) and are hashed with FNV-1a.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chidbInt.h"
+#include "hash.h"
+
+
+/* 32-bit FNV-1a hash of a byte string */
+uint32_t chidb_HashTable_hash(const uint8_t *key, uint32_t nkey)
+{
+    uint32_t h = 2166136261u;
+
+    for(uint32_t i = 0; i < nkey; i++)
+    {
+        h ^= key[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+
+/* Returns the bucket where the key is (or where it would be inserted) */
+static uint32_t __chidb_HashTable_probe(HashTable *ht, const uint8_t *key, uint32_t nkey, uint32_t hash)
+{
+    uint32_t mask = ht->nbuckets - 1;
+    uint32_t b = hash & mask;
+
+    while (ht->buckets[b] != 0)
+    {
+        HashEntry *e = &ht->entries[ht->buckets[b] - 1];
+
+        if (e->hash == hash && e->nkey == nkey && memcmp(e->key, key, nkey) == 0)
+            break;
+
+        b = (b + 1) & mask;
+    }
+
+    return b;
+}
+
+
+/* Doubles the number of buckets, and re-inserts every entry */
+static int __chidb_HashTable_grow(HashTable *ht)
+{
+    uint32_t nbuckets = ht->nbuckets * 2;
+    uint32_t *buckets = calloc(nbuckets, sizeof(uint32_t));
+
+    if (buckets == NULL)
+        return CHIDB_ENOMEM;
+
+    for(uint32_t i = 0; i < ht->nentries; i++)
+    {
+        uint32_t b = ht->entries[i].hash & (nbuckets - 1);
+
+        while (buckets[b] != 0)
+            b = (b + 1) & (nbuckets - 1);
+
+        buckets[b] = i + 1;
+    }
+
+    free(ht->buckets);
+    ht->mem_used += (nbuckets - ht->nbuckets) * sizeof(uint32_t);
+    ht->buckets = buckets;
+    ht->nbuckets = nbuckets;
+
+    return CHIDB_OK;
+}
+
+
+/* Create a new, empty, hash table
+ *
+ * Parameters
+ * - ht: Out parameter used to return the hash table
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_HashTable_open(HashTable **ht)
+{
+    *ht = calloc(1, sizeof(HashTable));
+    if (*ht == NULL)
+        return CHIDB_ENOMEM;
+
+    (*ht)->buckets = calloc(HASH_INITIAL_BUCKETS, sizeof(uint32_t));
+    if ((*ht)->buckets == NULL)
+    {
+        free(*ht);
+        return CHIDB_ENOMEM;
+    }
+    (*ht)->nbuckets = HASH_INITIAL_BUCKETS;
+    (*ht)->mem_used = sizeof(HashTable) + HASH_INITIAL_BUCKETS * sizeof(uint32_t);
+
+    return CHIDB_OK;
+}
+
+
+/* Look up a key in a hash table
+ *
+ * Parameters
+ * - ht: Hash table
+ * - key, nkey: The key
+ * - value: Out parameter used to return the value associated with
+ *          the key (may be NULL if only checking for membership)
+ *
+ * Return
+ * - CHIDB_OK: The key was found
+ * - CHIDB_ENOTFOUND: The key is not in the table
+ */
+int chidb_HashTable_find(HashTable *ht, const uint8_t *key, uint32_t nkey, void **value)
+{
+    uint32_t hash = chidb_HashTable_hash(key, nkey);
+    uint32_t b = __chidb_HashTable_probe(ht, key, nkey, hash);
+
+    if (ht->buckets[b] == 0)
+        return CHIDB_ENOTFOUND;
+
+    if (value != NULL)
+        *value = ht->entries[ht->buckets[b] - 1].value;
+
+    return CHIDB_OK;
+}
+
+
+/* Add a key to a hash table
+ *
+ * The key is copied into the table.
+ *
+ * Parameters
+ * - ht: Hash table
+ * - key, nkey: The key
+ * - value: Value to associate with the key
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: The key is already in the table
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_HashTable_insert(HashTable *ht, const uint8_t *key, uint32_t nkey, void *value)
+{
+    uint32_t hash = chidb_HashTable_hash(key, nkey);
+    uint32_t b = __chidb_HashTable_probe(ht, key, nkey, hash);
+    HashEntry *e;
+    int rc;
+
+    if (ht->buckets[b] != 0)
+        return CHIDB_EDUPLICATE;
+
+    if (ht->nentries == ht->entries_size)
+    {
+        uint32_t size = ht->entries_size ? ht->entries_size * 2 : HASH_INITIAL_BUCKETS / 2;
+
+        e = realloc(ht->entries, size * sizeof(HashEntry));
+        if (e == NULL)
+            return CHIDB_ENOMEM;
+        ht->mem_used += (size - ht->entries_size) * sizeof(HashEntry);
+        ht->entries = e;
+        ht->entries_size = size;
+    }
+
+    e = &ht->entries[ht->nentries];
+    e->key = malloc(nkey ? nkey : 1);
+    if (e->key == NULL)
+        return CHIDB_ENOMEM;
+    memcpy(e->key, key, nkey);
+    e->nkey = nkey;
+    e->hash = hash;
+    e->value = value;
+
+    ht->buckets[b] = ++ht->nentries;
+    ht->mem_used += nkey;
+
+    /* Keep the load factor at or below 1/2 */
+    if (ht->nentries * 2 > ht->nbuckets && (rc = __chidb_HashTable_grow(ht)) != CHIDB_OK)
+        return rc;
+
+    return CHIDB_OK;
+}
+
+
+/* Get the n-th entry of a hash table (in insertion order)
+ *
+ * Parameters
+ * - ht: Hash table
+ * - n: Entry number
+ * - entry: Out parameter used to return the entry
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: There is no such entry
+ */
+int chidb_HashTable_get(HashTable *ht, uint32_t n, HashEntry **entry)
+{
+    if (n >= ht->nentries)
+        return CHIDB_ENOTFOUND;
+
+    *entry = &ht->entries[n];
+
+    return CHIDB_OK;
+}
+
+
+/* Remove every entry from a hash table
+ *
+ * The values are not freed (they're owned by the caller)
+ *
+ * Parameters
+ * - ht: Hash table
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_HashTable_clear(HashTable *ht)
+{
+    for(uint32_t i = 0; i < ht->nentries; i++)
+    {
+        ht->mem_used -= ht->entries[i].nkey;
+        free(ht->entries[i].key);
+    }
+    ht->nentries = 0;
+    memset(ht->buckets, 0, ht->nbuckets * sizeof(uint32_t));
+
+    return CHIDB_OK;
+}
+
+
+/* Destroy a hash table
+ *
+ * The values are not freed (they're owned by the caller)
+ *
+ * Parameters
+ * - ht: Hash table
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_HashTable_close(HashTable *ht)
+{
+    if (ht == NULL)
+        return CHIDB_OK;
+
+    chidb_HashTable_clear(ht);
+    free(ht->entries);
+    free(ht->buckets);
+    free(ht);
+
+    return CHIDB_OK;
+}
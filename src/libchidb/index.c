@@ -0,0 +1,801 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Index builds
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ *  CREATE INDEX fills the new index with an entry for every row of the
+ *  table, which is far too slow if the entries are inserted one at a
+ *  time. Instead, the subtrees below the first two levels of the table
+ *  B-Tree are split among several threads, each of which extracts the
+ *  (indexed value, primary key) pairs of its rows and sorts them. The
+ *  sorted runs are then merged, and the index B-Tree is loaded from the
+ *  bottom up in a single pass (see chidb_Btree_loadIndex).
+ *
+ *  The entries of a variable-length index (see btree.h) are keys made
+ *  of the indexed value and the primary key, encoded as bytes that sort
+ *  like the values they hold (see chidb_Index_keyAppendNull and the
+ *  functions that follow it). Since those bytes are compared with
+ *  memcmp, a key made of the indexed value alone finds every entry that
+ *  has that value.
+ *
+ *  An index on several columns is always a variable-length one, whose
+ *  keys have a field per column (in the order they were given) before
+ *  the primary key. Its first columns are the ones that are indexed,
+ *  and may be followed by columns that are only there to be read back
+ *  (see chidb_Index_keyNextField), so that queries that only need those
+ *  columns don't have to look up the rows in the table.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "index.h"
+#include "record.h"
+#include "util.h"
+
+
+/* Append a NULL field to a variable-length index key
+ *
+ * Parameters
+ * - key: Key, of up to VARINDEX_MAXKEY bytes
+ * - size: In/out parameter. Number of bytes of the key.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The key would be too long
+ */
+int chidb_Index_keyAppendNull(uint8_t *key, uint16_t *size)
+{
+    if (*size + 1 > VARINDEX_MAXKEY)
+        return CHIDB_EMISMATCH;
+    key[(*size)++] = INDEX_KEY_NULL;
+
+    return CHIDB_OK;
+}
+
+
+/* Append an 8-byte value, with its tag, to a variable-length index key */
+static int __chidb_Index_keyAppend8(uint8_t *key, uint16_t *size, uint8_t tag, uint64_t v)
+{
+    if (*size + 9 > VARINDEX_MAXKEY)
+        return CHIDB_EMISMATCH;
+    key[*size] = tag;
+    put8byte(key + *size + 1, v);
+    *size += 9;
+
+    return CHIDB_OK;
+}
+
+
+/* Append an integer field to a variable-length index key
+ *
+ * Flipping the sign bit makes negative integers sort before positive
+ * ones.
+ *
+ * Parameters
+ * - key: Key, of up to VARINDEX_MAXKEY bytes
+ * - size: In/out parameter. Number of bytes of the key.
+ * - v: Integer
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The key would be too long
+ */
+int chidb_Index_keyAppendInt(uint8_t *key, uint16_t *size, int64_t v)
+{
+    return __chidb_Index_keyAppend8(key, size, INDEX_KEY_INTEGER, (uint64_t) v ^ ((uint64_t) 1 << 63));
+}
+
+
+/* Append a real field to a variable-length index key
+ *
+ * The bits of a negative number are all flipped (so that larger
+ * magnitudes sort first), and only the sign bit of the others is.
+ *
+ * Parameters
+ * - key: Key, of up to VARINDEX_MAXKEY bytes
+ * - size: In/out parameter. Number of bytes of the key.
+ * - v: Real
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The key would be too long
+ */
+int chidb_Index_keyAppendReal(uint8_t *key, uint16_t *size, double v)
+{
+    uint64_t bits;
+
+    /* -0.0 and 0.0 are the same value */
+    if (v == 0)
+        v = 0;
+    memcpy(&bits, &v, sizeof(bits));
+    bits = (bits >> 63) ? ~bits : bits ^ ((uint64_t) 1 << 63);
+
+    return __chidb_Index_keyAppend8(key, size, INDEX_KEY_REAL, bits);
+}
+
+
+/* Append a text field to a variable-length index key
+ *
+ * Parameters
+ * - key: Key, of up to VARINDEX_MAXKEY bytes
+ * - size: In/out parameter. Number of bytes of the key.
+ * - v: Text (it doesn't have to be NUL-terminated)
+ * - len: Number of bytes of the text
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The key would be too long
+ */
+int chidb_Index_keyAppendText(uint8_t *key, uint16_t *size, const char *v, uint32_t len)
+{
+    uint32_t n = *size;
+
+    if (n + 1 > VARINDEX_MAXKEY)
+        return CHIDB_EMISMATCH;
+    key[n++] = INDEX_KEY_TEXT;
+
+    for(uint32_t i = 0; i < len; i++)
+    {
+        if (n + (v[i] == 0 ? 2 : 1) > VARINDEX_MAXKEY)
+            return CHIDB_EMISMATCH;
+        key[n++] = v[i];
+        if (v[i] == 0)
+            key[n++] = 0xFF;
+    }
+
+    if (n + 2 > VARINDEX_MAXKEY)
+        return CHIDB_EMISMATCH;
+    key[n++] = 0;
+    key[n++] = 0;
+    *size = n;
+
+    return CHIDB_OK;
+}
+
+
+/* Append a field of a raw binary database record to a variable-length
+ * index key
+ *
+ * Parameters
+ * - key: Key, of up to VARINDEX_MAXKEY bytes
+ * - size: In/out parameter. Number of bytes of the key.
+ * - type, value: Type (as stored in the record header) and value of the
+ *                field (see chidb_DBRecord_nextRawField)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The key would be too long
+ */
+int chidb_Index_keyAppendRaw(uint8_t *key, uint16_t *size, uint32_t type, const uint8_t *value)
+{
+    if (type == SQL_NULL)
+        return chidb_Index_keyAppendNull(key, size);
+    else if (type == SQL_REAL)
+        return chidb_Index_keyAppendReal(key, size, chidb_DBRecord_rawReal(value));
+    else if (type < SQL_TEXT)
+        return chidb_Index_keyAppendInt(key, size, chidb_DBRecord_rawInt(value, type));
+    else
+        return chidb_Index_keyAppendText(key, size, (const char *) value, chidb_DBRecord_typeLen(type));
+}
+
+
+/* Append the primary key, which ends every key of a variable-length
+ * index, to a key
+ *
+ * Parameters
+ * - key: Key, of up to VARINDEX_MAXKEY bytes
+ * - size: In/out parameter. Number of bytes of the key.
+ * - pk: Primary key
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The key would be too long
+ */
+int chidb_Index_keyAppendPk(uint8_t *key, uint16_t *size, chidb_key_t pk)
+{
+    if (*size + VARINDEX_PKEY_SIZE > VARINDEX_MAXKEY)
+        return CHIDB_EMISMATCH;
+    put8byte(key + *size, pk);
+    *size += VARINDEX_PKEY_SIZE;
+
+    return CHIDB_OK;
+}
+
+
+/* Decode the next field of the key of a variable-length index entry
+ *
+ * Parameters
+ * - key: Key of an entry (ending with the primary key)
+ * - size: Number of bytes of the key
+ * - pos: In/out parameter. Offset of the field, which is moved past it.
+ * - field: Out parameter. The decoded field.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: There are no more fields
+ * - CHIDB_ECORRUPT: The key is malformed
+ */
+int chidb_Index_keyNextField(const uint8_t *key, uint16_t size, uint16_t *pos, chidb_index_field_t *field)
+{
+    uint16_t p = *pos, end = size - VARINDEX_PKEY_SIZE;
+    uint64_t bits;
+
+    if (size < VARINDEX_PKEY_SIZE || p >= end)
+        return CHIDB_ENOTFOUND;
+
+    field->tag = key[p++];
+    switch(field->tag)
+    {
+    case INDEX_KEY_NULL:
+        break;
+    case INDEX_KEY_INTEGER:
+    case INDEX_KEY_REAL:
+        if (p + 8 > end)
+            return CHIDB_ECORRUPT;
+        bits = get8byte(key + p);
+        p += 8;
+        if (field->tag == INDEX_KEY_INTEGER)
+            field->i = (int64_t) (bits ^ ((uint64_t) 1 << 63));
+        else
+        {
+            bits = (bits >> 63) ? bits ^ ((uint64_t) 1 << 63) : ~bits;
+            memcpy(&field->r, &bits, sizeof(bits));
+        }
+        break;
+    case INDEX_KEY_TEXT:
+        field->len = 0;
+        while (p + 1 < end && !(key[p] == 0 && key[p + 1] == 0))
+        {
+            field->text[field->len++] = key[p];
+            p += (key[p] == 0) ? 2 : 1;
+        }
+        if (p + 1 >= end)
+            return CHIDB_ECORRUPT;
+        p += 2;
+        break;
+    default:
+        return CHIDB_ECORRUPT;
+    }
+    *pos = p;
+
+    return CHIDB_OK;
+}
+
+
+/* Compute the number of bytes taken by the first fields of the key of
+ * a variable-length index entry
+ *
+ * Parameters
+ * - key: Key of an entry (ending with the primary key)
+ * - size: Number of bytes of the key
+ * - nfields: Number of fields
+ * - len: Out parameter. Number of bytes of those fields (or of all the
+ *        fields, if there are fewer).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful, and none of the fields is NULL
+ * - CHIDB_EEMPTY: Operation successful, and some field is NULL
+ * - CHIDB_ECORRUPT: The key is malformed
+ */
+int chidb_Index_keyPrefix(const uint8_t *key, uint16_t size, uint8_t nfields, uint16_t *len)
+{
+    chidb_index_field_t field;
+    uint16_t pos = 0;
+    bool null = false;
+    int rc = CHIDB_OK;
+
+    for(uint8_t i = 0; i < nfields && rc == CHIDB_OK; i++)
+        if ((rc = chidb_Index_keyNextField(key, size, &pos, &field)) == CHIDB_OK && field.tag == INDEX_KEY_NULL)
+            null = true;
+    if (rc != CHIDB_OK && rc != CHIDB_ENOTFOUND)
+        return rc;
+    *len = pos;
+
+    return null ? CHIDB_EEMPTY : CHIDB_OK;
+}
+
+
+/* Append a page to an array of pages */
+static int __chidb_Index_addPage(npage_t **pages, uint32_t *npages, uint32_t *size, npage_t npage)
+{
+    if (*npages == *size)
+    {
+        uint32_t nsize = *size ? *size * 2 : 64;
+        npage_t *np = realloc(*pages, nsize * sizeof(npage_t));
+        if (np == NULL)
+            return CHIDB_ENOMEM;
+        *pages = np;
+        *size = nsize;
+    }
+    (*pages)[(*npages)++] = npage;
+
+    return CHIDB_OK;
+}
+
+
+/* Collect the roots of the subtrees below the first two levels of a
+ * table B-Tree (or the root itself, if it is a leaf) */
+static int __chidb_Index_subtrees(BTree *bt, npage_t nroot, npage_t **pages, uint32_t *npages)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    uint32_t size = 0, first, last;
+    int rc;
+
+    *pages = NULL;
+    *npages = 0;
+
+    if ((rc = __chidb_Index_addPage(pages, npages, &size, nroot)) != CHIDB_OK)
+        return rc;
+
+    /* Replace each page of the level by its children, twice */
+    first = 0;
+    for(int level = 0; level < 2 && rc == CHIDB_OK; level++)
+    {
+        last = *npages;
+        for(uint32_t i = first; i < last && rc == CHIDB_OK; i++)
+        {
+            if ((rc = chidb_Btree_getNodeByPage(bt, (*pages)[i], &btn)) != CHIDB_OK)
+                break;
+            if (btn->type != PGTYPE_TABLE_INTERNAL)
+                rc = __chidb_Index_addPage(pages, npages, &size, (*pages)[i]);
+            for(ncell_t j = 0; btn->type == PGTYPE_TABLE_INTERNAL && j <= btn->n_cells && rc == CHIDB_OK; j++)
+            {
+                if (j == btn->n_cells)
+                    rc = __chidb_Index_addPage(pages, npages, &size, btn->right_page);
+                else if ((rc = chidb_Btree_getCell(btn, j, &cell)) == CHIDB_OK)
+                    rc = __chidb_Index_addPage(pages, npages, &size, cell.fields.tableInternal.child_page);
+            }
+            chidb_Btree_freeMemNode(bt, btn);
+        }
+        first = last;
+    }
+
+    if (rc == CHIDB_OK)
+    {
+        memmove(*pages, *pages + first, (*npages - first) * sizeof(npage_t));
+        *npages -= first;
+    }
+    else
+    {
+        free(*pages);
+        *pages = NULL;
+        *npages = 0;
+    }
+
+    return rc;
+}
+
+
+/* Add an entry to a worker's entries */
+static int __chidb_Index_newEntry(chidb_index_worker_t *w, chidb_index_entry_t **entry)
+{
+    if (w->nentries == w->size)
+    {
+        uint32_t nsize = w->size ? w->size * 2 : 1024;
+        chidb_index_entry_t *ne = realloc(w->entries, nsize * sizeof(chidb_index_entry_t));
+        if (ne == NULL)
+            return CHIDB_ENOMEM;
+        w->entries = ne;
+        w->size = nsize;
+    }
+    *entry = &w->entries[w->nentries++];
+
+    return CHIDB_OK;
+}
+
+
+/* Append the value of a column of a row to a variable-length index key */
+static int __chidb_Index_keyAppendColumn(uint8_t *key, uint16_t *size, BTreeCell *cell, uint8_t column)
+{
+    uint32_t hpos = 1, dpos, type = SQL_NULL;
+    const uint8_t *value = NULL;
+
+    /* Column 0 is the primary key */
+    if (column == 0)
+        return chidb_Index_keyAppendInt(key, size, (int64_t) cell->key);
+
+    dpos = cell->fields.tableLeaf.data[0];
+    for(uint8_t i = 0; i <= column; i++)
+        if (chidb_DBRecord_nextRawField(cell->fields.tableLeaf.data, &hpos, &dpos, &type, &value) != CHIDB_OK)
+            type = SQL_NULL;
+
+    return chidb_Index_keyAppendRaw(key, size, type, value);
+}
+
+
+/* Add the entry of a row to a worker's entries, in a variable-length
+ * index. Its key is stored in the worker's keys (and the entry only
+ * holds its offset until they are sorted, since they may move). */
+static int __chidb_Index_addKey(chidb_index_worker_t *w, BTreeCell *cell)
+{
+    chidb_index_entry_t *entry;
+    uint8_t key[VARINDEX_MAXKEY];
+    uint16_t size = 0;
+    int rc = CHIDB_OK;
+
+    for(uint8_t i = 0; i < w->ncolumns && rc == CHIDB_OK; i++)
+        rc = __chidb_Index_keyAppendColumn(key, &size, cell, w->columns[i]);
+    if (rc == CHIDB_OK)
+        rc = chidb_Index_keyAppendPk(key, &size, cell->key);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (w->keys_len + size > w->keys_size)
+    {
+        uint32_t nsize = w->keys_size ? w->keys_size * 2 : 16384;
+        uint8_t *nk = realloc(w->keys, nsize);
+        if (nk == NULL)
+            return CHIDB_ENOMEM;
+        w->keys = nk;
+        w->keys_size = nsize;
+    }
+
+    if ((rc = __chidb_Index_newEntry(w, &entry)) != CHIDB_OK)
+        return rc;
+    entry->keyIdx = w->keys_len;
+    entry->keyPk = cell->key;
+    entry->key = NULL;
+    entry->key_size = size;
+    memcpy(w->keys + w->keys_len, key, size);
+    w->keys_len += size;
+
+    return CHIDB_OK;
+}
+
+
+/* Add the entry of a row to a worker's entries. Rows where the indexed
+ * column is not an integer (e.g., NULL) are not indexed. Index cells
+ * hold 32-bit values, so rows with a wider key or value can't be. */
+static int __chidb_Index_addRow(chidb_index_worker_t *w, BTreeCell *cell)
+{
+    chidb_index_entry_t *entry;
+    DBRecord *dbr;
+    int8_t byte;
+    int16_t smallint;
+    int32_t integer;
+    bool indexed = true;
+    int rc;
+
+    if (w->var)
+        return __chidb_Index_addKey(w, cell);
+
+    if (cell->key > UINT32_MAX)
+        return CHIDB_EMISMATCH;
+
+    /* Column 0 is the primary key */
+    if (w->columns[0] == 0)
+        integer = (int32_t) cell->key;
+    else
+    {
+        if (chidb_DBRecord_unpack(&dbr, cell->fields.tableLeaf.data) != CHIDB_OK)
+            return CHIDB_ENOMEM;
+
+        switch(chidb_DBRecord_getType(dbr, w->columns[0]))
+        {
+        case SQL_INTEGER_1BYTE:
+            chidb_DBRecord_getInt8(dbr, w->columns[0], &byte);
+            integer = byte;
+            break;
+        case SQL_INTEGER_2BYTE:
+            chidb_DBRecord_getInt16(dbr, w->columns[0], &smallint);
+            integer = smallint;
+            break;
+        case SQL_INTEGER_4BYTE:
+            chidb_DBRecord_getInt32(dbr, w->columns[0], &integer);
+            break;
+        case SQL_INTEGER_8BYTE:
+            chidb_DBRecord_destroy(dbr);
+            return CHIDB_EMISMATCH;
+        default:
+            indexed = false;
+            break;
+        }
+        chidb_DBRecord_destroy(dbr);
+    }
+
+    if (!indexed)
+        return CHIDB_OK;
+
+    if ((rc = __chidb_Index_newEntry(w, &entry)) != CHIDB_OK)
+        return rc;
+    entry->keyIdx = (chidb_key_t) integer;
+    entry->keyPk = cell->key;
+    entry->key = NULL;
+
+    return CHIDB_OK;
+}
+
+
+/* Extract the entries of the rows of a subtree */
+static int __chidb_Index_scan(chidb_index_worker_t *w, npage_t npage)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(w->bt, npage, &btn)) != CHIDB_OK)
+        return rc;
+
+    for(ncell_t i = 0; i < btn->n_cells && rc == CHIDB_OK; i++)
+    {
+        if ((rc = chidb_Btree_getCell(btn, i, &cell)) != CHIDB_OK)
+            break;
+        if (btn->type == PGTYPE_TABLE_INTERNAL)
+            rc = __chidb_Index_scan(w, cell.fields.tableInternal.child_page);
+        else
+            rc = __chidb_Index_addRow(w, &cell);
+    }
+    if (rc == CHIDB_OK && btn->type == PGTYPE_TABLE_INTERNAL)
+        rc = __chidb_Index_scan(w, btn->right_page);
+
+    chidb_Btree_freeMemNode(w->bt, btn);
+
+    return rc;
+}
+
+
+/* Order of index entries */
+static int __chidb_Index_cmp(const void *a, const void *b)
+{
+    const chidb_index_entry_t *e1 = a, *e2 = b;
+
+    /* Keys of a variable-length index end with the primary key */
+    if (e1->key != NULL)
+    {
+        int cmp = memcmp(e1->key, e2->key, e1->key_size < e2->key_size ? e1->key_size : e2->key_size);
+        return cmp ? cmp : (e1->key_size > e2->key_size) - (e1->key_size < e2->key_size);
+    }
+
+    if (e1->keyIdx != e2->keyIdx)
+        return e1->keyIdx < e2->keyIdx ? -1 : 1;
+    if (e1->keyPk != e2->keyPk)
+        return e1->keyPk < e2->keyPk ? -1 : 1;
+
+    return 0;
+}
+
+
+/* Worker thread: scans its subtrees and sorts their entries */
+static void *__chidb_Index_worker(void *arg)
+{
+    chidb_index_worker_t *w = arg;
+    int rc = CHIDB_OK;
+
+    for(uint32_t i = 0; i < w->npages && rc == CHIDB_OK; i++)
+        rc = __chidb_Index_scan(w, w->pages[i]);
+
+    /* The keys won't move anymore */
+    for(uint32_t i = 0; i < w->nentries && w->var; i++)
+        w->entries[i].key = w->keys + w->entries[i].keyIdx;
+
+    if (rc == CHIDB_OK && w->nentries > 1)
+        qsort(w->entries, w->nentries, sizeof(chidb_index_entry_t), __chidb_Index_cmp);
+
+    w->rc = rc;
+
+    return NULL;
+}
+
+
+/* State of the merge of the workers' sorted entries */
+typedef struct chidb_index_merge
+{
+    chidb_index_worker_t *workers;
+    uint32_t nworkers;
+    uint8_t nunique;        /* Leading fields that must be unique (0 if any) */
+    bool first;
+    chidb_key_t last;       /* Last indexed value returned */
+    chidb_index_entry_t *last_entry;
+} chidb_index_merge_t;
+
+
+/* Return the smallest entry that has not been merged yet (a source
+ * for chidb_Btree_loadIndex) */
+static int __chidb_Index_next(void *arg, BTreeCell *btc)
+{
+    chidb_index_merge_t *m = arg;
+    chidb_index_worker_t *min = NULL;
+    chidb_index_entry_t *entry;
+
+    for(uint32_t i = 0; i < m->nworkers; i++)
+    {
+        chidb_index_worker_t *w = &m->workers[i];
+
+        if (w->next < w->nentries &&
+            (min == NULL || __chidb_Index_cmp(&w->entries[w->next], &min->entries[min->next]) < 0))
+            min = w;
+    }
+    if (min == NULL)
+        return CHIDB_DONE;
+
+    entry = &min->entries[min->next++];
+
+    if (entry->key != NULL)
+    {
+        /* Rows where some of those fields are NULL don't break uniqueness */
+        if (m->nunique > 0 && !m->first)
+        {
+            uint16_t len, last_len;
+            int rc = chidb_Index_keyPrefix(entry->key, entry->key_size, m->nunique, &len);
+
+            if (rc != CHIDB_OK && rc != CHIDB_EEMPTY)
+                return rc;
+            if (rc == CHIDB_OK &&
+                chidb_Index_keyPrefix(m->last_entry->key, m->last_entry->key_size, m->nunique, &last_len) == CHIDB_OK &&
+                len == last_len && !memcmp(entry->key, m->last_entry->key, len))
+                return CHIDB_ECONSTRAINT;
+        }
+        m->first = false;
+        m->last_entry = entry;
+
+        btc->fields.varIndex.key_size = entry->key_size;
+        memcpy(btc->fields.varIndex.key, entry->key, entry->key_size);
+        btc->fields.varIndex.keyPk = entry->keyPk;
+        btc->key = entry->keyPk;
+
+        return CHIDB_OK;
+    }
+
+    if (m->nunique > 0 && !m->first && entry->keyIdx == m->last)
+        return CHIDB_ECONSTRAINT;
+    m->first = false;
+    m->last = entry->keyIdx;
+
+    btc->key = entry->keyIdx;
+    btc->fields.indexLeaf.keyPk = entry->keyPk;
+
+    return CHIDB_OK;
+}
+
+
+/* Build an index on columns of a table
+ *
+ * Fills an empty index with the values of columns of a table: the
+ * table is scanned and the entries are sorted by up to nthreads threads
+ * (one of them is the calling thread), and the index B-Tree is then
+ * loaded from the bottom up. Rows whose value is not an integer are not
+ * indexed, unless the index is a variable-length one (whose empty root
+ * is a PGTYPE_VARINDEX_LEAF node), which indexes every row. Only a
+ * variable-length index can have more than one column.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - table_root: Root page of the table
+ * - columns: Columns to index, in order (0 is the primary key)
+ * - ncolumns: Number of columns
+ * - nunique: Fail if two rows have the same values in this many of the
+ *            first columns (0 if they may)
+ * - index_root: Root page of an empty index
+ * - nthreads: Maximum number of threads
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECONSTRAINT: The index is unique, and two rows have the same values
+ * - CHIDB_EMISMATCH: A value can't be stored in the index, or there are
+ *                    several columns and the index is not a
+ *                    variable-length one
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Index_build(BTree *bt, npage_t table_root, const uint8_t *columns, uint8_t ncolumns,
+                      uint8_t nunique, npage_t index_root, uint32_t nthreads)
+{
+    chidb_index_worker_t *workers;
+    chidb_index_merge_t merge;
+    BTreeNode *btn;
+    npage_t *pages;
+    uint32_t npages, nworkers;
+    bool var;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, index_root, &btn)) != CHIDB_OK)
+        return rc;
+    var = (btn->type == PGTYPE_VARINDEX_LEAF);
+    chidb_Btree_freeMemNode(bt, btn);
+    if (ncolumns < 1 || (ncolumns > 1 && !var))
+        return CHIDB_EMISMATCH;
+
+    if ((rc = __chidb_Index_subtrees(bt, table_root, &pages, &npages)) != CHIDB_OK)
+        return rc;
+
+    /* Each worker scans about the same number of subtrees */
+    nworkers = nthreads < npages ? nthreads : npages;
+    if (nworkers > INDEX_BUILD_MAX_THREADS)
+        nworkers = INDEX_BUILD_MAX_THREADS;
+    if (nworkers < 1)
+        nworkers = 1;
+
+    workers = calloc(nworkers, sizeof(chidb_index_worker_t));
+    if (workers == NULL)
+    {
+        free(pages);
+        return CHIDB_ENOMEM;
+    }
+
+    for(uint32_t i = 0; i < nworkers; i++)
+    {
+        chidb_index_worker_t *w = &workers[i];
+
+        w->bt = bt;
+        w->columns = columns;
+        w->ncolumns = ncolumns;
+        w->var = var;
+        w->pages = pages + (uint64_t) i * npages / nworkers;
+        w->npages = (uint64_t) (i + 1) * npages / nworkers - (uint64_t) i * npages / nworkers;
+
+        /* The first worker is the calling thread */
+        if (i > 0 && pthread_create(&w->thread, NULL, __chidb_Index_worker, w) == 0)
+            w->started = true;
+        else if (i > 0)
+            rc = CHIDB_ENOMEM;
+    }
+    if (rc == CHIDB_OK)
+        __chidb_Index_worker(&workers[0]);
+
+    for(uint32_t i = 0; i < nworkers; i++)
+    {
+        if (workers[i].started)
+            pthread_join(workers[i].thread, NULL);
+        if (rc == CHIDB_OK)
+            rc = workers[i].rc;
+    }
+
+    if (rc == CHIDB_OK)
+    {
+        merge.workers = workers;
+        merge.nworkers = nworkers;
+        merge.nunique = nunique;
+        merge.first = true;
+        merge.last = 0;
+        merge.last_entry = NULL;
+
+        rc = chidb_Btree_loadIndex(bt, index_root, __chidb_Index_next, &merge);
+    }
+
+    for(uint32_t i = 0; i < nworkers; i++)
+    {
+        free(workers[i].entries);
+        free(workers[i].keys);
+    }
+    free(workers);
+    free(pages);
+
+    return rc;
+}
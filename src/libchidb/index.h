@@ -0,0 +1,119 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Index builds -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef INDEX_H_
+#define INDEX_H_
+
+#include <pthread.h>
+#include "chidbInt.h"
+#include "btree.h"
+
+/* Maximum number of threads that build an index */
+#define INDEX_BUILD_MAX_THREADS (16)
+
+/* Maximum number of columns of an index (indexed and included ones) */
+#define INDEX_MAX_COLUMNS (16)
+
+/* Tags of the fields of a variable-length index key. Each field is its
+ * tag followed by its value, encoded so that keys sort as their bytes
+ * do: integers and reals as 8 big-endian bytes (with their order bits
+ * flipped) and text as its bytes, with every 0x00 escaped as 0x00 0xFF,
+ * followed by 0x00 0x00. The primary key ends the key, as 8 bytes. A
+ * key may have several fields (one per column of the index, see
+ * chidb_Index_build). */
+#define INDEX_KEY_NULL (0x01)
+#define INDEX_KEY_INTEGER (0x02)
+#define INDEX_KEY_REAL (0x03)
+#define INDEX_KEY_TEXT (0x04)
+
+/* A field of a variable-length index key, decoded */
+typedef struct chidb_index_field
+{
+    uint8_t tag;                    /* INDEX_KEY_* */
+    int64_t i;                      /* INDEX_KEY_INTEGER */
+    double r;                       /* INDEX_KEY_REAL */
+    char text[VARINDEX_MAXKEY];     /* INDEX_KEY_TEXT (not NUL-terminated) */
+    uint32_t len;
+} chidb_index_field_t;
+
+/* An entry of the index being built */
+typedef struct chidb_index_entry
+{
+    chidb_key_t keyIdx;     /* Indexed value */
+    chidb_key_t keyPk;      /* Primary key of its row */
+    uint8_t *key;           /* Key, in a variable-length index */
+    uint16_t key_size;
+} chidb_index_entry_t;
+
+/* A thread of an index build. Each one scans some of the subtrees of the
+ * table and sorts the entries it extracted from them. */
+typedef struct chidb_index_worker
+{
+    BTree *bt;
+    const uint8_t *columns;     /* Columns of the table that are indexed */
+    uint8_t ncolumns;
+    npage_t *pages;             /* Roots of the subtrees to scan */
+    uint32_t npages;
+    bool var;                   /* Variable-length index */
+    chidb_index_entry_t *entries;
+    uint32_t nentries;
+    uint32_t size;
+    uint8_t *keys;              /* Keys of the entries of a variable-length index */
+    uint32_t keys_len;
+    uint32_t keys_size;
+    uint32_t next;              /* Next entry to merge */
+    pthread_t thread;
+    bool started;
+    int rc;
+} chidb_index_worker_t;
+
+int chidb_Index_build(BTree *bt, npage_t table_root, const uint8_t *columns, uint8_t ncolumns,
+                      uint8_t nunique, npage_t index_root, uint32_t nthreads);
+
+int chidb_Index_keyAppendNull(uint8_t *key, uint16_t *size);
+int chidb_Index_keyAppendInt(uint8_t *key, uint16_t *size, int64_t v);
+int chidb_Index_keyAppendReal(uint8_t *key, uint16_t *size, double v);
+int chidb_Index_keyAppendText(uint8_t *key, uint16_t *size, const char *v, uint32_t len);
+int chidb_Index_keyAppendRaw(uint8_t *key, uint16_t *size, uint32_t type, const uint8_t *value);
+int chidb_Index_keyAppendPk(uint8_t *key, uint16_t *size, chidb_key_t pk);
+int chidb_Index_keyNextField(const uint8_t *key, uint16_t size, uint16_t *pos, chidb_index_field_t *field);
+int chidb_Index_keyPrefix(const uint8_t *key, uint16_t size, uint8_t nfields, uint16_t *len);
+
+#endif /*INDEX_H_*/
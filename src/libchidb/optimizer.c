@@ -39,6 +39,9 @@
 
 #include <chidb/chidb.h>
 #include "dbm-types.h"
+#include "optimizer.h"
+#include "stats.h"
+#include "util.h"
 
 
 #define CHIDB_DONT_OPT (808)
@@ -74,14 +77,14 @@ int chidb_stmt_optimize(chidb_stmt *stmt, chisql_statement_t *sql_stmt, chisql_s
  	if(opt_check != CHIDB_OK)
  	{
  		// check verified that no optimization needs to be done
- 		*sql_stmt_opt = malloc(sizeof(chisql_statement_t));
+ 		*sql_stmt_opt = chisql_malloc(sizeof(chisql_statement_t));
     	memcpy(*sql_stmt_opt, sql_stmt, sizeof(chisql_statement_t));
     	fprintf(stderr, "%s\n\n", "No sigma optimization to be completed.");
  	}
  	else
  	{
  		// jaime: need to do actual sigma pushing beyond here
- 		*sql_stmt_opt = malloc(sizeof(chisql_statement_t));
+ 		*sql_stmt_opt = chisql_malloc(sizeof(chisql_statement_t));
 
  		// do sigma pushing
  		int ret = chidb_sigma_push(stmt, sql_stmt->stmt.select);
@@ -121,7 +124,7 @@ int chidb_sra_optimize_check(SRA_t *sra_select)
 {
 	int opt_ret = 0;
 
-	if(sra_select->t == SRA_UNION)
+	if(sra_select->t == SRA_UNION || sra_select->t == SRA_INTERSECT || sra_select->t == SRA_EXCEPT)
 	{
 		int ret1 = chidb_sra_optimize_check(sra_select->binary.sra1);
 		int ret2 = chidb_sra_optimize_check(sra_select->binary.sra2);
@@ -162,12 +165,15 @@ int chidb_sra_optimize_check(SRA_t *sra_select)
 		if (ret == CHIDB_TRUE)
 		{
 			SRA_t *new = SRAProject(select->select.sra, sra_select->project.expr_list);
-			ProjectOption_t *p1 = malloc(sizeof(ProjectOption_t));
-			ProjectOption_t *p2 = malloc(sizeof(ProjectOption_t));
+			ProjectOption_t *p1 = chisql_malloc(sizeof(ProjectOption_t));
+			ProjectOption_t *p2 = chisql_malloc(sizeof(ProjectOption_t));
 			p1 = OrderBy_make(sra_select->project.order_by, sra_select->project.asc_desc);
 			p2 = GroupBy_make(sra_select->project.group_by);
 			ProjectOption_t *option = ProjectOption_combine(p1, p2);
 			SRA_applyOption(new, option);
+			new->project.distinct = sra_select->project.distinct;
+			new->project.limit = sra_select->project.limit;
+			new->project.offset = sra_select->project.offset;
 
 			memcpy(&sra_select->project, &new->project, sizeof(SRA_Project_t));
 			return CHIDB_DONT_OPT;
@@ -208,13 +214,14 @@ int chidb_sigma_push(chidb_stmt *stmt, SRA_t *sra_select)
 {
 	// Do error checking on table names and column/value types!
 
-	// if we're dealing with a union
-	if(sra_select->t == SRA_UNION)
+	// if we're dealing with a union (or another set operation)
+	if(sra_select->t == SRA_UNION || sra_select->t == SRA_INTERSECT || sra_select->t == SRA_EXCEPT)
 	{
 		fprintf(stderr, "FIRST SQL IN UNION\n");
 		chidb_sigma_push(stmt, sra_select->binary.sra1);
 		fprintf(stderr, "SECOND SQL IN UNION\n");
 		chidb_sigma_push(stmt, sra_select->binary.sra2);
+		return CHIDB_OK;
 	}
 	
 	SRA_t *select = sra_select->project.sra;
@@ -355,8 +362,8 @@ int chidb_sigma_push_one_cond(chidb_stmt *stmt, SRA_t *sra_select, Condition_t *
 	// get list of table names from WHERE clause
 	list_t table_names;
 	list_init(&table_names);
-	char *table1 = malloc(sizeof(char)*15);
-	char *table2 = malloc(sizeof(char)*15);
+	char *table1 = chisql_malloc(sizeof(char)*15);
+	char *table2 = chisql_malloc(sizeof(char)*15);
 	// int list_sz = chidb_get_where_tables(select->select.cond, table1, table2);
 	int list_sz = chidb_get_where_tables(table_names, select->select.cond);
 	// fprintf(stderr, "%s%i\n", "list size was: ", list_sz);	
@@ -371,25 +378,25 @@ int chidb_sigma_push_one_cond(chidb_stmt *stmt, SRA_t *sra_select, Condition_t *
 		// E.x: WHERE 1 < 2
 
 		// make copies of cond to make two new select SRA structs
-		Condition_t *c1 = malloc(sizeof(Condition_t));
-		Condition_t *c2 = malloc(sizeof(Condition_t));
+		Condition_t *c1 = chisql_malloc(sizeof(Condition_t));
+		Condition_t *c2 = chisql_malloc(sizeof(Condition_t));
 		memcpy(c1, select->select.cond, sizeof(Condition_t));
 		memcpy(c2, select->select.cond, sizeof(Condition_t));
 
 		// make copies of the two SRA table structs too
-		SRA_t *t1 = malloc(sizeof(SRA_t));
-		SRA_t *t2 = malloc(sizeof(SRA_t));
+		SRA_t *t1 = chisql_malloc(sizeof(SRA_t));
+		SRA_t *t2 = chisql_malloc(sizeof(SRA_t));
 		memcpy(t1, join->binary.sra1, sizeof(SRA_t));
 		memcpy(t2, join->binary.sra2, sizeof(SRA_t));
 
 
-		SRA_t *s1 = malloc(sizeof(SRA_t));
-		SRA_t *s2 = malloc(sizeof(SRA_t));
+		SRA_t *s1 = chisql_malloc(sizeof(SRA_t));
+		SRA_t *s2 = chisql_malloc(sizeof(SRA_t));
 		s1 = SRASelect(t1, c1);
 		s2 = SRASelect(t2, c2);
 
 		// make new NATURAL JOIN STRUCT
-		SRA_t *natj = malloc(sizeof(SRA_t));
+		SRA_t *natj = chisql_malloc(sizeof(SRA_t));
 		natj = SRANaturalJoin(s1, s2);
 
 		// change some pointer stuff
@@ -406,25 +413,31 @@ int chidb_sigma_push_one_cond(chidb_stmt *stmt, SRA_t *sra_select, Condition_t *
 		char *table = (char*)(list_iterator_next(&table_names));
 		list_iterator_stop(&table_names);
 
+		// if the column isn't qualified with its table, we can't tell which
+		// branch it belongs to, so leave the sigma above the NAT JOIN
+		// (code generation finds the table that has the column)
+		if(table == NULL)
+		{
+		}
 		// if the table referenced is the first table of the NAT JOIN
 		// push down that branch
-		if(!strcmp(join->binary.sra1->table.ref->table_name, table))
+		else if(!strcmp(join->binary.sra1->table.ref->table_name, table))
 		{
 			// make copy of cond struct
-			Condition_t *c1 = malloc(sizeof(Condition_t));
+			Condition_t *c1 = chisql_malloc(sizeof(Condition_t));
 			memcpy(c1, select->select.cond, sizeof(Condition_t));
 
 			// make copies of the two SRA table structs too
-			SRA_t *t1 = malloc(sizeof(SRA_t));
-			SRA_t *t2 = malloc(sizeof(SRA_t));
+			SRA_t *t1 = chisql_malloc(sizeof(SRA_t));
+			SRA_t *t2 = chisql_malloc(sizeof(SRA_t));
 			memcpy(t1, join->binary.sra1, sizeof(SRA_t));
 			memcpy(t2, join->binary.sra2, sizeof(SRA_t));
 
 			// make new NATURAL JOIN STRUCT
-			SRA_t *s1 = malloc(sizeof(SRA_t));
+			SRA_t *s1 = chisql_malloc(sizeof(SRA_t));
 			s1 = SRASelect(t1, c1);
 
-			SRA_t *natj = malloc(sizeof(SRA_t));
+			SRA_t *natj = chisql_malloc(sizeof(SRA_t));
 			natj = SRANaturalJoin(s1,t2);
 
 			// change pointers
@@ -433,20 +446,20 @@ int chidb_sigma_push_one_cond(chidb_stmt *stmt, SRA_t *sra_select, Condition_t *
 		else if(!strcmp(join->binary.sra2->table.ref->table_name, table))
 		{
 			// make copy of cond struct
-			Condition_t *c1 = malloc(sizeof(Condition_t));
+			Condition_t *c1 = chisql_malloc(sizeof(Condition_t));
 			memcpy(c1, select->select.cond, sizeof(Condition_t));
 
 			// make copies of the two SRA table structs too
-			SRA_t *t1 = malloc(sizeof(SRA_t));
-			SRA_t *t2 = malloc(sizeof(SRA_t));
+			SRA_t *t1 = chisql_malloc(sizeof(SRA_t));
+			SRA_t *t2 = chisql_malloc(sizeof(SRA_t));
 			memcpy(t1, join->binary.sra1, sizeof(SRA_t));
 			memcpy(t2, join->binary.sra2, sizeof(SRA_t));
 
 			// make new NATURAL JOIN STRUCT
-			SRA_t *s2 = malloc(sizeof(SRA_t));
+			SRA_t *s2 = chisql_malloc(sizeof(SRA_t));
 			s2 = SRASelect(t2, c1);
 
-			SRA_t *natj = malloc(sizeof(SRA_t));
+			SRA_t *natj = chisql_malloc(sizeof(SRA_t));
 			natj = SRANaturalJoin(t1,s2);
 
 			// change pointers
@@ -471,20 +484,20 @@ int chidb_sigma_push_one_cond(chidb_stmt *stmt, SRA_t *sra_select, Condition_t *
 			if(!strcmp(join->binary.sra1->table.ref->table_name, table1))
 			{
 				// make copy of cond struct
-				Condition_t *c1 = malloc(sizeof(Condition_t));
+				Condition_t *c1 = chisql_malloc(sizeof(Condition_t));
 				memcpy(c1, select->select.cond, sizeof(Condition_t));
 
 				// make copies of the two SRA table structs too
-				SRA_t *t1 = malloc(sizeof(SRA_t));
-				SRA_t *t2 = malloc(sizeof(SRA_t));
+				SRA_t *t1 = chisql_malloc(sizeof(SRA_t));
+				SRA_t *t2 = chisql_malloc(sizeof(SRA_t));
 				memcpy(t1, join->binary.sra1, sizeof(SRA_t));
 				memcpy(t2, join->binary.sra2, sizeof(SRA_t));
 
 				// make new NATURAL JOIN STRUCT
-				SRA_t *s1 = malloc(sizeof(SRA_t));
+				SRA_t *s1 = chisql_malloc(sizeof(SRA_t));
 				s1 = SRASelect(t1, c1);
 
-				SRA_t *natj = malloc(sizeof(SRA_t));
+				SRA_t *natj = chisql_malloc(sizeof(SRA_t));
 				natj = SRANaturalJoin(s1,t2);
 
 				// change pointers
@@ -493,20 +506,20 @@ int chidb_sigma_push_one_cond(chidb_stmt *stmt, SRA_t *sra_select, Condition_t *
 			else if(!strcmp(join->binary.sra2->table.ref->table_name, table1))
 			{
 				// make copy of cond struct
-				Condition_t *c1 = malloc(sizeof(Condition_t));
+				Condition_t *c1 = chisql_malloc(sizeof(Condition_t));
 				memcpy(c1, select->select.cond, sizeof(Condition_t));
 
 				// make copies of the two SRA table structs too
-				SRA_t *t1 = malloc(sizeof(SRA_t));
-				SRA_t *t2 = malloc(sizeof(SRA_t));
+				SRA_t *t1 = chisql_malloc(sizeof(SRA_t));
+				SRA_t *t2 = chisql_malloc(sizeof(SRA_t));
 				memcpy(t1, join->binary.sra1, sizeof(SRA_t));
 				memcpy(t2, join->binary.sra2, sizeof(SRA_t));
 
 				// make new NATURAL JOIN STRUCT
-				SRA_t *s2 = malloc(sizeof(SRA_t));
+				SRA_t *s2 = chisql_malloc(sizeof(SRA_t));
 				s2 = SRASelect(t2, c1);
 
-				SRA_t *natj = malloc(sizeof(SRA_t));
+				SRA_t *natj = chisql_malloc(sizeof(SRA_t));
 				natj = SRANaturalJoin(t1,s2);
 
 				// change pointers
@@ -574,7 +587,7 @@ int chidb_sigma_push_SRA(chidb_stmt *stmt, SRA_t *sra, Condition_t *cond)
 				// c->cond.binary.cond1 = cond;
 				// c->cond.binary.cond2 = sra->select.cond;
 				// sra->select.cond = c;
-				Condition_t *c = malloc(sizeof(Condition_t));
+				Condition_t *c = chisql_malloc(sizeof(Condition_t));
 				c->t = RA_COND_AND;
 				memcpy(c->cond.binary.cond1, cond, sizeof(Condition_t));
 				memcpy(c->cond.binary.cond2, sra->select.cond, sizeof(Condition_t));
@@ -641,7 +654,7 @@ int chidb_sigma_cond_simplify(Condition_t *cond, Condition_t **out_cond)
 	int ret1, ret2;
 	Condition_t *c = NULL;
 	Condition_t *v = NULL;
-	*out_cond = malloc(sizeof(Condition_t));
+	*out_cond = chisql_malloc(sizeof(Condition_t));
 
 	if (cond->t <= RA_COND_GEQ)
 	{
@@ -893,4 +906,246 @@ int chidb_sigma_evaluate(Condition_t *cond)
 	}
 
 	return CHIDB_OK;
-}
\ No newline at end of file
+}
+
+
+/*
+ * Access path selection
+ *
+ * A SELECT on one table, or on a natural join of two tables, is evaluated
+ * with nested loops: the outer loop goes over the rows of one table (by
+ * scanning it, seeking its primary key, or seeking an index), and the
+ * inner loop finds the matching rows of the other table (by scanning it,
+ * or by seeking its primary key). Each plan is given a cost, which is the
+ * number of pages it is expected to read according to the statistics
+ * collected by ANALYZE, and the cheapest one is chosen.
+ *
+ * An index that stores every column the query uses (in its key or its
+ * INCLUDE list) covers the query: the rows are read from the index alone,
+ * without looking each one up in the table, so such indexes are preferred.
+ *
+ * If some table has never been analyzed, its rows are produced in the
+ * order in which they are stored, so the tables are never swapped and
+ * indexes are not used. Seeking a primary key is still done, since it
+ * never reads more pages than a scan and keeps the same order.
+ */
+
+/* Statistics assumed for tables that haven't been analyzed */
+static chidb_stat_t default_stat = { .nrows = 1000, .npages = 100, .depth = 2, .ndistinct = 10 };
+
+/* Estimates the fraction of the entries of a B-Tree for which
+ * "key op v" is true (using fixed guesses if there are no statistics) */
+static double chidb_optimizer_selectivity(chidb_stat_t *stat, enum CondType op, int64_t v)
+{
+	if (stat == NULL || v < 0)
+		return (op == RA_COND_EQ) ? 0.1 : 1.0 / 3;
+
+	switch(op)
+	{
+		case RA_COND_EQ:
+			return stat->ndistinct ? 1.0 / stat->ndistinct : 0.0;
+		case RA_COND_LT:
+			return chidb_Stats_fraction(stat, v);
+		case RA_COND_LEQ:
+			return chidb_Stats_fraction(stat, v + 1);
+		case RA_COND_GT:
+			return 1.0 - chidb_Stats_fraction(stat, v + 1);
+		case RA_COND_GEQ:
+			return 1.0 - chidb_Stats_fraction(stat, v);
+		default:
+			return 1.0;
+	}
+}
+
+/* Whether an index (whose first column has type col_type) is a
+ * variable-length one (see btree.h): all of them are, except those on a
+ * single integer column */
+static bool chidb_optimizer_index_var(Index_t *index, int col_type)
+{
+	return index->columns->next != NULL || index->include != NULL || col_type != TYPE_INT;
+}
+
+/* Whether an index holds every column in used, which are columns of a
+ * table (whose columns are cols). The primary key ends every entry of a
+ * variable-length index, so it is always there. */
+static bool chidb_optimizer_covers(Index_t *index, int col_type, list_t *cols, list_t *used)
+{
+	bool covers = true;
+
+	if (used == NULL || !chidb_optimizer_index_var(index, col_type))
+		return false;
+
+	list_iterator_start(used);
+	while (covers && list_iterator_hasnext(used))
+	{
+		char *name = (char *) list_iterator_next(used);
+		if (chidb_index_column_position(index, name) < 0 && chidb_column_position(cols, name) != 0)
+			covers = false;
+	}
+	list_iterator_stop(used);
+
+	return covers;
+}
+
+/* Returns the schema entry of an index whose first column is table.column
+ * (NULL if there is none), preferring one that holds every column in used
+ * (see chidb_optimizer_covers). covering tells whether it does. */
+static chidb_sql_schema_t *chidb_optimizer_find_index(chidb *db, char *table, char *column, int col_type,
+                                                      list_t *cols, list_t *used, bool *covering)
+{
+	chidb_sql_schema_t *index = NULL;
+
+	*covering = false;
+	list_iterator_start(&db->schemas);
+	while (!*covering && list_iterator_hasnext(&db->schemas))
+	{
+		chidb_sql_schema_t *next = (chidb_sql_schema_t *) list_iterator_next(&db->schemas);
+		if (!strcmp(next->type, "index") && !strcmp(next->assoc, table) &&
+			!strcmp(next->stmt->stmt.create->index->column_name, column))
+		{
+			*covering = chidb_optimizer_covers(next->stmt->stmt.create->index, col_type, cols, used);
+			if (index == NULL || *covering)
+				index = next;
+		}
+	}
+	list_iterator_stop(&db->schemas);
+
+	return index;
+}
+
+/* Chooses how to evaluate a SELECT
+ *
+ * Parameters
+ * - db: Database
+ * - tnames: Tables in the FROM clause (one, or two if natural joining)
+ * - cnames1: Columns of the first table
+ * - cnames2: Columns of the second table (if natural joining)
+ * - jnames: Columns compared by the natural join
+ * - used: Columns read by the query, if it is on a single table (NULL
+ *         otherwise). If an index holds all of them, the query can be
+ *         answered from the index alone.
+ * - cond: WHERE condition (a single comparison of a column with a
+ *         literal), or NULL if there is none.
+ * - plan: Out parameter. The cheapest plan.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_optimizer_plan(chidb *db, list_t *tnames, list_t *cnames1, list_t *cnames2,
+                         list_t *jnames, list_t *used, Condition_t *cond, chidb_plan_t *plan)
+{
+	bool join = list_size(tnames) > 1;
+	bool analyzed = true;
+	char *col = NULL;
+	int64_t v = 0;
+	bool seekable = false;
+	int lit_type = -1;
+	chidb_plan_t p;
+	int swap, i;
+
+	if (cond != NULL)
+	{
+		Literal_t *lit = cond->cond.comp.expr2->expr.term.val;
+
+		col = cond->cond.comp.expr1->expr.term.ref->columnName;
+		lit_type = lit->t;
+		if (lit->t == TYPE_INT && lit->val.ival >= 0)
+		{
+			v = lit->val.ival;
+			seekable = true;
+		}
+	}
+
+	for (i = 0; i < list_size(tnames); i++)
+		if (chidb_Stats_get(db, list_get_at(tnames, i)) == NULL)
+			analyzed = false;
+
+	plan->cost = -1;
+	for (swap = 0; swap <= (join && analyzed); swap++)
+	{
+		char *outer = list_get_at(tnames, swap);
+		list_t *ocols = swap ? cnames2 : cnames1;
+		list_t *icols = swap ? cnames1 : cnames2;
+		chidb_stat_t *ts = chidb_Stats_get(db, outer);
+		chidb_stat_t *os = ts ? ts : &default_stat;
+		int pos = col ? chidb_column_position(ocols, col) : -1;
+
+		memset(&p, 0, sizeof(chidb_plan_t));
+		p.swap = swap;
+		p.access = ACCESS_SCAN;
+		p.cost = os->npages;
+		p.rows = os->nrows;
+
+		if (pos == 0)
+		{
+			// The primary key: seek it, then read the range of keys
+			p.rows = chidb_optimizer_selectivity(ts, cond->t, v) * os->nrows;
+			if (seekable)
+			{
+				p.access = ACCESS_KEY;
+				p.cost = os->depth + (cond->t == RA_COND_EQ ? 0 : p.rows / os->nrows * os->npages);
+			}
+		}
+		else if (pos > 0)
+		{
+			// Another column: seek an index on it, and fetch every row it points to
+			// (unless the index holds all the columns that are read).
+			// Variable-length indexes hold ranks in their histograms,
+			// so only equality can use their statistics.
+			bool covering;
+			int col_type = chidb_column_get_type(db->schemas, outer, col);
+			chidb_sql_schema_t *index = chidb_optimizer_find_index(db, outer, col, col_type, ocols, used, &covering);
+			bool var = index != NULL && chidb_optimizer_index_var(index->stmt->stmt.create->index, col_type);
+			bool iseekable = var ? (lit_type == col_type) : seekable;
+
+			p.rows = chidb_optimizer_selectivity(NULL, cond->t, v) * os->nrows;
+			if (analyzed && iseekable && index != NULL && index->stat != NULL)
+			{
+				double sel = (var && cond->t != RA_COND_EQ) ? chidb_optimizer_selectivity(NULL, cond->t, v) :
+				             chidb_optimizer_selectivity(index->stat, cond->t, var ? 0 : v);
+				double cost = index->stat->depth + sel * index->stat->npages;
+
+				if (!covering)
+					cost += sel * os->nrows * os->depth;
+
+				p.rows = sel * os->nrows;
+				if (cost < p.cost)
+				{
+					p.access = ACCESS_INDEX;
+					p.index_root = index->rpage;
+					p.index = index->stmt->stmt.create->index;
+					p.covering = covering;
+					p.cost = cost;
+				}
+			}
+		}
+
+		if (join)
+		{
+			char *inner = list_get_at(tnames, !swap);
+			char *ikey = list_get_at(icols, 0);
+			chidb_stat_t *is = chidb_Stats_get(db, inner);
+
+			if (is == NULL)
+				is = &default_stat;
+
+			// The inner table can be sought if its key is compared with an integer
+			// column (which never reads more pages than scanning it)
+			p.join = JOIN_NESTED_LOOP;
+			if (chidb_column_position(jnames, ikey) >= 0 && chidb_column_position(ocols, ikey) >= 0 &&
+				chidb_column_get_type(db->schemas, outer, ikey) == TYPE_INT)
+				p.join = JOIN_INDEX_NESTED_LOOP;
+
+			p.cost += p.rows * (p.join == JOIN_INDEX_NESTED_LOOP ? is->depth : is->npages);
+
+			// A WHERE on the inner table filters the joined rows
+			if (col != NULL && pos < 0)
+				p.rows *= chidb_optimizer_selectivity(NULL, cond->t, v);
+		}
+
+		if (plan->cost < 0 || p.cost < plan->cost)
+			*plan = p;
+	}
+
+	return CHIDB_OK;
+}
@@ -0,0 +1,82 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Query optimizer -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef OPTIMIZER_H_
+#define OPTIMIZER_H_
+
+#include <stdbool.h>
+#include <chisql/chisql.h>
+#include "chidbInt.h"
+#include "../simclist/simclist.h"
+
+/* How the rows of the outer table of a SELECT are found */
+typedef enum chidb_access
+{
+    ACCESS_SCAN,    /* Scan the whole table */
+    ACCESS_KEY,     /* Seek the primary key (or a range of keys) in the table */
+    ACCESS_INDEX    /* Seek the value (or a range of values) in an index */
+} chidb_access_t;
+
+/* How the rows of the inner table of a natural join are found */
+typedef enum chidb_join
+{
+    JOIN_NESTED_LOOP,       /* Scan the whole inner table for every outer row */
+    JOIN_INDEX_NESTED_LOOP  /* Seek the primary key of the inner table */
+} chidb_join_t;
+
+/* Plan chosen to evaluate a SELECT on one table, or on a natural join
+ * of two tables */
+typedef struct chidb_plan
+{
+    bool swap;              /* The second table goes in the outer loop */
+    chidb_access_t access;  /* Access path of the outer table */
+    npage_t index_root;     /* Root page of the index (ACCESS_INDEX only) */
+    Index_t *index;         /* The index (ACCESS_INDEX only) */
+    bool covering;          /* The index holds every column that is read,
+                               so the rows are not looked up in the table */
+    chidb_join_t join;      /* Join algorithm (natural joins only) */
+    double rows;            /* Estimated number of rows produced */
+    double cost;            /* Estimated number of pages read */
+} chidb_plan_t;
+
+int chidb_optimizer_plan(chidb *db, list_t *tnames, list_t *cnames1, list_t *cnames2,
+                         list_t *jnames, list_t *used, Condition_t *cond, chidb_plan_t *plan);
+
+#endif /* OPTIMIZER_H_ */
@@ -9,12 +9,11 @@
  * modify the page returned by the pager and instruct the pager to
  * write it back to disk.
  *
- * The default pager is very simple and always creates an in-memory copy
- * of any page that is read (even if that page has already been read before).
+ * The pager always creates an in-memory copy of any page that is read.
  * More specifically, pages are read into a MemPage structure, which must
  * be freed (using the releaseMemPage function) once they are not needed.
- * In a real database, the pager component typically does some caching
- * of pages to reduce the number of disk accesses.
+ * Committed versions of pages are cached in a buffer pool (see pager.h),
+ * so pages that have already been read are copied from memory.
  *
  */
 
@@ -55,18 +54,48 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include <chidb/log.h>
 
 #include "chidbInt.h"
 
 #include "pager.h"
+#include "util.h"
+
+#define WAL_FRAME_SIZE(pager) (PAGER_WAL_FRAME_HEADER_SIZE + (pager)->page_size)
+#define WAL_FRAME_OFFSET(pager, frame) \
+    (PAGER_WAL_HEADER_SIZE + (off_t) ((frame) - 1) * WAL_FRAME_SIZE(pager))
+#define WAL_PAGE_OFFSET(pager, frame) \
+    (WAL_FRAME_OFFSET(pager, frame) + PAGER_WAL_FRAME_HEADER_SIZE)
+#define PAGE_OFFSET(pager, npage) ((off_t) ((npage) - 1) * (pager)->page_size)
+
+static int __chidb_Pager_walRecover(Pager *pager);
+static void *__chidb_Pager_writer(void *arg);
+
+/* The write lock is busy for owner, or for a writer joining the shared
+ * transaction (see chidb_Pager_lockWrite and chidb_Pager_lockWriteShared) */
+#define WRITE_BUSY(pager, owner) ((pager)->write_owner != (owner) && \
+    ((pager)->write_owner != NULL || (pager)->write_sharers > 0 || (pager)->write_committing))
+#define JOIN_BUSY(pager) ((pager)->write_owner != NULL || (pager)->write_committing || \
+    (pager)->write_waiting > 0)
+
+/* Shared pagers (see chidb_Pager_openShared) */
+static pthread_mutex_t __chidb_Pager_sharedLock = PTHREAD_MUTEX_INITIALIZER;
+static Pager *__chidb_Pager_shared = NULL;
 
 /* Open a file
  *
- * This function opens a file for paged access.
+ * This function opens a file for paged access. If a write-ahead log
+ * left behind by a previous pager exists, its committed frames are
+ * recovered into the WAL index. The background writer is only started
+ * once there is work for it.
  *
  * Parameters
  * - pager: An out parameter. Used to return a pointer to the
@@ -80,18 +109,106 @@
  */
 int chidb_Pager_open(Pager **pager, const char *filename)
 {
-    *pager = malloc(sizeof(Pager));
-    if (pager == NULL)
+    *pager = calloc(1, sizeof(Pager));
+    if (*pager == NULL)
         return CHIDB_ENOMEM;
-    (*pager)->f = fopen(filename, "r+");
+    (*pager)->fd = open(filename, O_RDWR | O_CREAT, 0666);
 
-    if ((*pager)->f == NULL)
-        (*pager)->f = fopen(filename, "w+");
-
-    if ((*pager)->f == NULL)
+    if ((*pager)->fd == -1)
         return CHIDB_EIO;
-    else
-        return CHIDB_OK;
+
+    (*pager)->wal_name = malloc(strlen(filename) + strlen(PAGER_WAL_SUFFIX) + 1);
+    if ((*pager)->wal_name == NULL)
+        return CHIDB_ENOMEM;
+    sprintf((*pager)->wal_name, "%s%s", filename, PAGER_WAL_SUFFIX);
+
+    (*pager)->group_commit = PAGER_GROUP_COMMIT;
+    (*pager)->wal_salt[0] = (uint32_t) time(NULL);
+    (*pager)->wal_salt[1] = (uint32_t) getpid();
+
+    pthread_mutex_init(&(*pager)->lock, NULL);
+    pthread_cond_init(&(*pager)->work, NULL);
+    pthread_cond_init(&(*pager)->done, NULL);
+    pthread_cond_init(&(*pager)->unlocked, NULL);
+    pthread_cond_init(&(*pager)->unlatched, NULL);
+    pthread_mutex_init(&(*pager)->dirty_lock, NULL);
+
+    (*pager)->cache = calloc(PAGER_CACHE_BUCKETS, sizeof(PagerBuf *));
+    if ((*pager)->cache == NULL)
+        return CHIDB_ENOMEM;
+
+    (*pager)->wal_fd = open((*pager)->wal_name, O_RDWR);
+    if ((*pager)->wal_fd != -1)
+    {
+        int rc = __chidb_Pager_walRecover(*pager);
+
+        /* The page size now comes from the log, so chidb_Pager_setPageSize
+         * may not be the one to size the database */
+        if ((*pager)->page_size != 0)
+        {
+            chidb_Pager_getRealDBSize(*pager, &(*pager)->n_pages);
+            if ((*pager)->wal_npages > (*pager)->n_pages)
+                (*pager)->n_pages = (*pager)->wal_npages;
+            (*pager)->n_pages_committed = (*pager)->n_pages;
+        }
+        return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Open a file with a shared pager
+ *
+ * Like chidb_Pager_open, but if another connection in this process
+ * already has the same file open with a shared pager, that pager (and
+ * its buffer pool) is returned instead of opening a new one. Files are
+ * matched by device and inode, so different paths to the same file
+ * share a pager. Each call must be matched by a call to
+ * chidb_Pager_close; the pager is only closed by the last one.
+ *
+ * Parameters
+ * - pager: An out parameter. Used to return a pointer to the
+ *			 shared Pager.
+ * - filename: Database file (might not exist)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_openShared(Pager **pager, const char *filename)
+{
+    struct stat st;
+    int rc = CHIDB_OK;
+
+    pthread_mutex_lock(&__chidb_Pager_sharedLock);
+
+    if (stat(filename, &st) == 0)
+        for (*pager = __chidb_Pager_shared; *pager != NULL; *pager = (*pager)->next_shared)
+            if ((*pager)->dev == st.st_dev && (*pager)->ino == st.st_ino)
+            {
+                (*pager)->refcount++;
+                pthread_mutex_unlock(&__chidb_Pager_sharedLock);
+                return CHIDB_OK;
+            }
+
+    rc = chidb_Pager_open(pager, filename);
+    if (rc == CHIDB_OK && fstat((*pager)->fd, &st))
+        rc = CHIDB_EIO;
+    if (rc == CHIDB_OK)
+    {
+        (*pager)->shared = true;
+        (*pager)->refcount = 1;
+        (*pager)->dev = st.st_dev;
+        (*pager)->ino = st.st_ino;
+        (*pager)->next_shared = __chidb_Pager_shared;
+        __chidb_Pager_shared = *pager;
+    }
+
+    pthread_mutex_unlock(&__chidb_Pager_sharedLock);
+
+    return rc;
 }
 
 
@@ -101,6 +218,9 @@ int chidb_Pager_open(Pager **pager, const char *filename)
  * This function must be called before operating on pages.
  * It will not verify if the page size makes size. If an incorrect
  * page size is provided, this will result in unexpected behaviour.
+ * Pages that have only been committed to the write-ahead log so far
+ * are included in the page count. Setting the page size a pager
+ * already uses (e.g., when attaching to a shared pager) does nothing.
  *
  * Parameters
  * - pager: A Pager.
@@ -111,13 +231,479 @@ int chidb_Pager_open(Pager **pager, const char *filename)
  */
 int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
 {
+    if (pager->page_size == pagesize)
+        return CHIDB_OK;
     pager->page_size = pagesize;
     chidb_Pager_getRealDBSize(pager, &pager->n_pages);
 
+    if (pager->wal_npages > pager->n_pages)
+        pager->n_pages = pager->wal_npages;
+    pager->n_pages_committed = pager->n_pages;
+
+    return CHIDB_OK;
+}
+
+
+/* Make sure the WAL index, dirty page table and file versions can
+ * hold a page. Must be called with the pager's lock held. */
+static int __chidb_Pager_growIndex(Pager *pager, npage_t npage)
+{
+    npage_t size;
+    uint32_t *wal_index;
+    uint8_t **dirty;
+    uint64_t *file_version;
+    int32_t *latch;
+
+    if (npage < pager->index_size)
+        return CHIDB_OK;
+
+    size = pager->index_size ? pager->index_size * 2 : 64;
+    while (size <= npage)
+        size *= 2;
+
+    wal_index = realloc(pager->wal_index, size * sizeof(uint32_t));
+    if (wal_index == NULL)
+        return CHIDB_ENOMEM;
+    pager->wal_index = wal_index;
+
+    dirty = realloc(pager->dirty, size * sizeof(uint8_t *));
+    if (dirty == NULL)
+        return CHIDB_ENOMEM;
+    pager->dirty = dirty;
+
+    file_version = realloc(pager->file_version, size * sizeof(uint64_t));
+    if (file_version == NULL)
+        return CHIDB_ENOMEM;
+    pager->file_version = file_version;
+
+    latch = realloc(pager->latch, size * sizeof(int32_t));
+    if (latch == NULL)
+        return CHIDB_ENOMEM;
+    pager->latch = latch;
+
+    memset(pager->wal_index + pager->index_size, 0, (size - pager->index_size) * sizeof(uint32_t));
+    memset(pager->dirty + pager->index_size, 0, (size - pager->index_size) * sizeof(uint8_t *));
+    memset(pager->file_version + pager->index_size, 0, (size - pager->index_size) * sizeof(uint64_t));
+    memset(pager->latch + pager->index_size, 0, (size - pager->index_size) * sizeof(int32_t));
+    pager->index_size = size;
+
+    return CHIDB_OK;
+}
+
+
+/* Make sure the version chain can hold a frame. Must be called with
+ * the pager's lock held. */
+static int __chidb_Pager_growPrev(Pager *pager, uint32_t frame)
+{
+    uint32_t size, *wal_prev;
+
+    if (frame < pager->prev_size)
+        return CHIDB_OK;
+
+    size = pager->prev_size ? pager->prev_size * 2 : 1024;
+    while (size <= frame)
+        size *= 2;
+
+    wal_prev = realloc(pager->wal_prev, size * sizeof(uint32_t));
+    if (wal_prev == NULL)
+        return CHIDB_ENOMEM;
+    pager->wal_prev = wal_prev;
+    pager->prev_size = size;
+
+    return CHIDB_OK;
+}
+
+
+/* Latest frame of a page that is not newer than a given frame
+ * (0 if the page has no such frame in the log) */
+static uint32_t __chidb_Pager_frameAt(Pager *pager, npage_t npage, uint32_t limit)
+{
+    uint32_t frame = npage < pager->index_size ? pager->wal_index[npage] : 0;
+
+    while (frame > limit)
+        frame = pager->wal_prev[frame];
+
+    return frame;
+}
+
+
+/* Checksum used by the log header and frames. s[0] is the sum of
+ * all bytes, and s[1] the sum of the running values of s[0]. */
+static void __chidb_Pager_checksum(const uint8_t *data, uint32_t n, uint32_t *s)
+{
+    for (uint32_t i = 0; i < n; i++)
+    {
+        s[0] += data[i];
+        s[1] += s[0];
+    }
+}
+
+
+/* Start a new log (creating the log file if it does not exist yet).
+ * Must not be called while the writer has a checkpoint job. */
+static int __chidb_Pager_walReset(Pager *pager)
+{
+    uint8_t hdr[PAGER_WAL_HEADER_SIZE];
+    uint32_t ck[2] = {0, 0};
+
+    if (pager->wal_fd == -1)
+    {
+        pager->wal_fd = open(pager->wal_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (pager->wal_fd == -1)
+            return CHIDB_EIO;
+    }
+    else if (ftruncate(pager->wal_fd, 0))
+        return CHIDB_EIO;
+
+    /* A new salt makes sure frames left over from an earlier
+     * log are never mistaken for frames of this one */
+    pager->wal_salt[0]++;
+    pager->wal_salt[1] = pager->wal_salt[1] * 1103515245 + 12345;
+
+    memset(hdr, 0, PAGER_WAL_HEADER_SIZE);
+    put4byte(hdr, PAGER_WAL_MAGIC);
+    put4byte(hdr + 4, PAGER_WAL_VERSION);
+    put4byte(hdr + 8, pager->page_size);
+    put4byte(hdr + 16, pager->wal_salt[0]);
+    put4byte(hdr + 20, pager->wal_salt[1]);
+    __chidb_Pager_checksum(hdr, 24, ck);
+    put4byte(hdr + 24, ck[0]);
+    put4byte(hdr + 28, ck[1]);
+
+    if (pwrite(pager->wal_fd, hdr, PAGER_WAL_HEADER_SIZE, 0) != PAGER_WAL_HEADER_SIZE)
+        return CHIDB_EIO;
+
+    pager->wal_nframes = pager->wal_ncommitted = 0;
+    pager->wal_ckpt_frame = pager->wal_backfill = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Recover the log
+ *
+ * Scans the frames of an existing log and adds the frames of every
+ * complete commit to the WAL index. The scan stops at the first frame
+ * that is truncated or fails the salt or checksum test, and any frames
+ * after the last commit frame are discarded.
+ */
+static int __chidb_Pager_walRecover(Pager *pager)
+{
+    uint8_t hdr[PAGER_WAL_HEADER_SIZE], fhdr[PAGER_WAL_FRAME_HEADER_SIZE];
+    uint32_t ck[2] = {0, 0};
+    uint8_t *data;
+    npage_t *pending;
+    npage_t npage, commit;
+    uint32_t frame;
+    int rc = CHIDB_OK;
+
+    if (pread(pager->wal_fd, hdr, PAGER_WAL_HEADER_SIZE, 0) != PAGER_WAL_HEADER_SIZE)
+        return CHIDB_OK;
+
+    __chidb_Pager_checksum(hdr, 24, ck);
+    if (get4byte(hdr) != PAGER_WAL_MAGIC || get4byte(hdr + 4) != PAGER_WAL_VERSION ||
+        get4byte(hdr + 24) != ck[0] || get4byte(hdr + 28) != ck[1])
+        return CHIDB_OK;
+
+    pager->page_size = get4byte(hdr + 8);
+    pager->wal_salt[0] = get4byte(hdr + 16);
+    pager->wal_salt[1] = get4byte(hdr + 20);
+
+    data = malloc(pager->page_size);
+    pending = malloc(sizeof(npage_t));
+    if (data == NULL || pending == NULL)
+    {
+        free(data);
+        free(pending);
+        return CHIDB_ENOMEM;
+    }
+
+    for (frame = 1; ; frame++)
+    {
+        if (pread(pager->wal_fd, fhdr, PAGER_WAL_FRAME_HEADER_SIZE, WAL_FRAME_OFFSET(pager, frame)) != PAGER_WAL_FRAME_HEADER_SIZE ||
+            pread(pager->wal_fd, data, pager->page_size, WAL_PAGE_OFFSET(pager, frame)) != pager->page_size)
+            break;
+
+        ck[0] = ck[1] = 0;
+        __chidb_Pager_checksum(fhdr, 16, ck);
+        __chidb_Pager_checksum(data, pager->page_size, ck);
+        npage = get4byte(fhdr);
+        if (npage == 0 ||
+            get4byte(fhdr + 8) != pager->wal_salt[0] || get4byte(fhdr + 12) != pager->wal_salt[1] ||
+            get4byte(fhdr + 16) != ck[0] || get4byte(fhdr + 20) != ck[1])
+            break;
+
+        /* Frames of a transaction only become visible with its commit frame */
+        npage_t *p = realloc(pending, (frame - pager->wal_ncommitted) * sizeof(npage_t));
+        if (p == NULL)
+        {
+            rc = CHIDB_ENOMEM;
+            break;
+        }
+        pending = p;
+        pending[frame - pager->wal_ncommitted - 1] = npage;
+
+        if ((commit = get4byte(fhdr + 4)) != 0)
+        {
+            for (uint32_t i = pager->wal_ncommitted + 1; i <= frame; i++)
+            {
+                npage = pending[i - pager->wal_ncommitted - 1];
+                if ((rc = __chidb_Pager_growIndex(pager, npage)) != CHIDB_OK ||
+                    (rc = __chidb_Pager_growPrev(pager, i)) != CHIDB_OK)
+                    break;
+                pager->wal_prev[i] = pager->wal_index[npage];
+                pager->wal_index[npage] = i;
+            }
+            if (rc != CHIDB_OK)
+                break;
+            pager->wal_ncommitted = frame;
+            pager->wal_npages = commit;
+        }
+    }
+
+    free(data);
+    free(pending);
+
+    pager->wal_nframes = pager->wal_ncommitted;
+    chilog(TRACE, "Recovered %i frames from %s", pager->wal_ncommitted, pager->wal_name);
+
+    return rc;
+}
+
+
+/* Read part of the current version of a page: its dirty image if
+ * it has been written since the last commit, its latest frame if it
+ * is in the log, and the database file otherwise. Must only be used
+ * by the holder of the write lock (readers use __chidb_Pager_read). */
+static int __chidb_Pager_fetch(Pager *pager, npage_t npage, uint8_t *buf, size_t n, size_t *nread)
+{
+    uint32_t frame;
+
+    if (npage < pager->index_size && pager->dirty[npage] != NULL)
+    {
+        memcpy(buf, pager->dirty[npage], n);
+        *nread = n;
+    }
+    else if ((frame = __chidb_Pager_frameAt(pager, npage, UINT32_MAX)) != 0)
+    {
+        if (pread(pager->wal_fd, buf, n, WAL_PAGE_OFFSET(pager, frame)) != n)
+            return CHIDB_EIO;
+        *nread = n;
+    }
+    else
+    {
+        ssize_t r = pread(pager->fd, buf, n, PAGE_OFFSET(pager, npage));
+        if (r < 0)
+            return CHIDB_EIO;
+        *nread = r;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Read a page image from a frame of the log (or from the database
+ * file if frame is 0). Pages beyond the end of the file are zero. */
+static int __chidb_Pager_readImage(Pager *pager, npage_t npage, uint32_t frame, uint8_t *data)
+{
+    ssize_t r;
+
+    if (frame != 0)
+        r = pread(pager->wal_fd, data, pager->page_size, WAL_PAGE_OFFSET(pager, frame));
+    else
+        r = pread(pager->fd, data, pager->page_size, PAGE_OFFSET(pager, npage));
+    if (r < 0 || (frame != 0 && r != pager->page_size))
+        return CHIDB_EIO;
+    memset(data + r, 0, pager->page_size - r);
+
     return CHIDB_OK;
 }
 
 
+/* Move a buffer to the front of the LRU list (or insert it there).
+ * Must be called with the pager's lock held. */
+static void __chidb_Pager_lruTouch(Pager *pager, PagerBuf *buf, bool linked)
+{
+    if (linked)
+    {
+        if (pager->lru_head == buf)
+            return;
+        buf->lru_prev->lru_next = buf->lru_next;
+        if (buf->lru_next != NULL)
+            buf->lru_next->lru_prev = buf->lru_prev;
+        else
+            pager->lru_tail = buf->lru_prev;
+    }
+
+    buf->lru_prev = NULL;
+    buf->lru_next = pager->lru_head;
+    if (pager->lru_head != NULL)
+        pager->lru_head->lru_prev = buf;
+    pager->lru_head = buf;
+    if (pager->lru_tail == NULL)
+        pager->lru_tail = buf;
+}
+
+
+/* Get a buffer for a page version: a new one if the buffer pool is not
+ * full, and the least recently used buffer nobody is reading otherwise.
+ * The buffer is removed from its hash chain, but stays in the LRU list.
+ * Must be called with the pager's lock held. */
+static int __chidb_Pager_cacheAlloc(Pager *pager, PagerBuf **buf)
+{
+    PagerBuf **p;
+
+    for (*buf = pager->lru_tail; pager->cache_size >= PAGER_CACHE_SIZE && *buf != NULL; *buf = (*buf)->lru_prev)
+        if ((*buf)->pins == 0)
+        {
+            for (p = &pager->cache[(*buf)->bucket]; *p != *buf; p = &(*p)->hash_next);
+            *p = (*buf)->hash_next;
+            if ((*buf)->aux != NULL)
+                (*buf)->free_aux((*buf)->aux);
+            (*buf)->aux = NULL;
+            return CHIDB_OK;
+        }
+
+    /* Every buffer is in use: grow the buffer pool */
+    *buf = calloc(1, sizeof(PagerBuf));
+    if (*buf == NULL)
+        return CHIDB_ENOMEM;
+    (*buf)->data = malloc(pager->page_size);
+    if ((*buf)->data == NULL)
+    {
+        free(*buf);
+        return CHIDB_ENOMEM;
+    }
+    pthread_rwlock_init(&(*buf)->latch, NULL);
+    __chidb_Pager_lruTouch(pager, *buf, false);
+    pager->cache_size++;
+
+    return CHIDB_OK;
+}
+
+
+/* Read a page as of a snapshot, or its current version (including the
+ * pages written since the last commit) if snapshot is NULL. Committed
+ * versions are read through the buffer pool; if page is not NULL, the
+ * buffer stays pinned for it, and its aux is returned in it. */
+static int __chidb_Pager_read(Pager *pager, PagerSnapshot *snapshot, npage_t npage, uint8_t *data,
+                              MemPage *page)
+{
+    PagerBuf *buf;
+    uint32_t frame, bucket;
+    uint64_t version;
+    bool valid;
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    if (npage > (snapshot ? snapshot->n_pages : pager->n_pages) || npage <= 0)
+    {
+        pthread_mutex_unlock(&pager->lock);
+        return CHIDB_EPAGENO;
+    }
+
+    if (snapshot == NULL && npage < pager->index_size && pager->dirty[npage] != NULL)
+    {
+        memcpy(data, pager->dirty[npage], pager->page_size);
+        pthread_mutex_unlock(&pager->lock);
+        return CHIDB_OK;
+    }
+
+    frame = __chidb_Pager_frameAt(pager, npage, snapshot ? snapshot->frame : UINT32_MAX);
+    if (frame > pager->wal_ncommitted)
+    {
+        /* Frames spilled by the current transaction may be discarded by
+         * a rollback (and their numbers reused), so they are not cached */
+        pager->wal_readers++;
+        pthread_mutex_unlock(&pager->lock);
+        rc = __chidb_Pager_readImage(pager, npage, frame, data);
+        pthread_mutex_lock(&pager->lock);
+        pager->wal_readers--;
+        pthread_mutex_unlock(&pager->lock);
+        return rc;
+    }
+
+    if (frame != 0)
+        version = pager->wal_base + frame;
+    else
+        version = npage < pager->index_size ? pager->file_version[npage] : 0;
+    bucket = (npage * 2654435761u ^ (uint32_t) version) % PAGER_CACHE_BUCKETS;
+
+    for (buf = pager->cache[bucket]; buf != NULL; buf = buf->hash_next)
+        if (buf->npage == npage && buf->version == version)
+            break;
+
+    if (buf != NULL)
+    {
+        /* Hit: wait for the buffer to be loaded, if it is being loaded */
+        buf->pins++;
+        __chidb_Pager_lruTouch(pager, buf, true);
+        pthread_mutex_unlock(&pager->lock);
+
+        pthread_rwlock_rdlock(&buf->latch);
+        if ((valid = buf->valid))
+            memcpy(data, buf->data, pager->page_size);
+        pthread_rwlock_unlock(&buf->latch);
+
+        pthread_mutex_lock(&pager->lock);
+        if (valid && page != NULL)
+        {
+            page->buf = buf;
+            page->aux = buf->aux;
+        }
+        else
+            buf->pins--;
+        pthread_mutex_unlock(&pager->lock);
+
+        return valid ? CHIDB_OK : CHIDB_EIO;
+    }
+
+    /* Miss: load the page into a buffer, holding its latch so that
+     * other readers of the same version wait for this read */
+    if ((rc = __chidb_Pager_cacheAlloc(pager, &buf)) != CHIDB_OK)
+    {
+        pthread_mutex_unlock(&pager->lock);
+        return rc;
+    }
+    buf->npage = npage;
+    buf->version = version;
+    buf->valid = false;
+    buf->pins = 1;
+    buf->bucket = bucket;
+    buf->hash_next = pager->cache[bucket];
+    pager->cache[bucket] = buf;
+    __chidb_Pager_lruTouch(pager, buf, true);
+    pthread_rwlock_wrlock(&buf->latch);
+    if (frame != 0)
+        pager->wal_readers++;
+    pthread_mutex_unlock(&pager->lock);
+
+    rc = __chidb_Pager_readImage(pager, npage, frame, buf->data);
+    if (rc == CHIDB_OK)
+    {
+        buf->valid = true;
+        memcpy(data, buf->data, pager->page_size);
+    }
+    pthread_rwlock_unlock(&buf->latch);
+
+    pthread_mutex_lock(&pager->lock);
+    if (rc == CHIDB_OK && page != NULL)
+        page->buf = buf;
+    else
+        buf->pins--;
+    if (frame != 0)
+        pager->wal_readers--;
+    if (rc != CHIDB_OK)
+    {
+        /* Never match the buffer again; it will be recycled */
+        buf->version = UINT64_MAX;
+    }
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
 /* Read the chidb file header
  *
  * This function reads in the header of a chidb file and returns it
@@ -135,10 +721,9 @@ int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
  */
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
 {
-    int count;
-    count = fseek(pager->f, 0, SEEK_SET);
-    count = fread(header, 1, 100, pager->f);
-    if (count != 100)
+    size_t count;
+
+    if (__chidb_Pager_fetch(pager, 1, header, 100, &count) || count != 100)
         return CHIDB_NOHEADER;
     else
         return CHIDB_OK;
@@ -159,7 +744,9 @@ int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
 {
     /* We simply increment the page number counter. readPage
      * and writePage take care of the rest. */
+    pthread_mutex_lock(&pager->lock);
     *npage = ++pager->n_pages;
+    pthread_mutex_unlock(&pager->lock);
 
     return CHIDB_OK;
 }
@@ -186,52 +773,170 @@ int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
  */
 int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
 {
-    if (npage > pager->n_pages || npage <= 0)
-        return CHIDB_EPAGENO;
-    int n;
+    return chidb_Pager_readSnapshotPage(pager, NULL, npage, page);
+}
+
+
+/* Read a page as of a snapshot
+ *
+ * Like chidb_Pager_readPage, but returns the version of the page
+ * that was committed when the snapshot was opened (see
+ * chidb_Pager_openSnapshot). A NULL snapshot reads the current
+ * version of the page.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - snapshot: A snapshot opened on this pager, or NULL.
+ * - npage: Page number of page to read.
+ * - page: Out parameter. Used to return a pointer to newly created MemPage
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page did not exist when the snapshot was opened
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_readSnapshotPage(Pager *pager, PagerSnapshot *snapshot, npage_t npage, MemPage **page)
+{
+    int rc;
 
     *page = malloc(sizeof(MemPage));
-    if (page == NULL)
+    if (*page == NULL)
         return CHIDB_ENOMEM;
     (*page)->npage = npage;
-    (*page)->data = calloc(pager->page_size, 1);
+    (*page)->buf = NULL;
+    (*page)->aux = NULL;
+    (*page)->data = malloc(pager->page_size);
     if ((*page)->data == NULL)
-        return CHIDB_ENOMEM;
-    fseek(pager->f, (npage - 1) * pager->page_size, SEEK_SET);
-    n = fread((*page)->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, npage, *page, (*page)->data);
+        rc = CHIDB_ENOMEM;
+    else
+        rc = __chidb_Pager_read(pager, snapshot, npage, (*page)->data, *page);
+    if (rc != CHIDB_OK)
+    {
+        /* No buffer is pinned for a failed read. The page is freed here,
+         * since chidb_Pager_releaseMemPage refuses pages beyond the end
+         * of the database (which a read fails on). */
+        free((*page)->data);
+        free(*page);
+        *page = NULL;
+        return rc;
+    }
+    chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", pager->page_size, npage, *page, (*page)->data);
 
     return CHIDB_OK;
 }
 
 
-/* Write a page to file
+/* Read the last committed version of a page
  *
- * This page writes the in-memory copy of a page (stored in a MemPage
- * struct) back to disk.
+ * Like chidb_Pager_readPage, but ignores the pages written by the
+ * transaction that has not committed yet. This is how connections that
+ * do not hold the write lock of a shared pager read pages.
  *
  * Parameters
  * - pager: A Pager.
- * - page: In-memory copy of page to write
+ * - npage: Page number of page to read.
+ * - page: Out parameter. Used to return a pointer to newly created MemPage
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EPAGENO: The page has an incorrect page number
+ * - CHIDB_EPAGENO: The page did not exist as of the last commit
+ * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int	chidb_Pager_writePage(Pager *pager, MemPage *page)
+int chidb_Pager_readCommittedPage(Pager *pager, npage_t npage, MemPage **page)
 {
-    if (page->npage > pager->n_pages)
-        return CHIDB_EPAGENO;
-    int n;
-    fseek(pager->f, (page->npage - 1) * pager->page_size, SEEK_SET);
-    n = fwrite(page->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Wrote %i bytes to page %i", n, page->npage);
+    PagerSnapshot *snapshot;
+    int rc;
+
+    /* The snapshot keeps checkpoints from overwriting the page in the
+     * database file while it is read */
+    if ((rc = chidb_Pager_openSnapshot(pager, &snapshot)) != CHIDB_OK)
+        return rc;
+    rc = chidb_Pager_readSnapshotPage(pager, snapshot, npage, page);
+    chidb_Pager_closeSnapshot(pager, snapshot);
+
+    return rc;
+}
+
+
+/* Append a frame to the log and point the WAL index at it */
+static int __chidb_Pager_walAppend(Pager *pager, npage_t npage, const uint8_t *data, npage_t commit)
+{
+    uint8_t fhdr[PAGER_WAL_FRAME_HEADER_SIZE];
+    uint32_t ck[2] = {0, 0};
+    struct iovec iov[2];
+    int rc;
+
+    if (pager->wal_fd == -1 || pager->wal_nframes == 0)
+        if ((rc = __chidb_Pager_walReset(pager)) != CHIDB_OK)
+            return rc;
+    pthread_mutex_lock(&pager->lock);
+    rc = __chidb_Pager_growPrev(pager, pager->wal_nframes + 1);
+    pthread_mutex_unlock(&pager->lock);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    put4byte(fhdr, npage);
+    put4byte(fhdr + 4, commit);
+    put4byte(fhdr + 8, pager->wal_salt[0]);
+    put4byte(fhdr + 12, pager->wal_salt[1]);
+    __chidb_Pager_checksum(fhdr, 16, ck);
+    __chidb_Pager_checksum(data, pager->page_size, ck);
+    put4byte(fhdr + 16, ck[0]);
+    put4byte(fhdr + 20, ck[1]);
+
+    iov[0].iov_base = fhdr;
+    iov[0].iov_len = PAGER_WAL_FRAME_HEADER_SIZE;
+    iov[1].iov_base = (void *) data;
+    iov[1].iov_len = pager->page_size;
+    if (pwritev(pager->wal_fd, iov, 2, WAL_FRAME_OFFSET(pager, pager->wal_nframes + 1)) != WAL_FRAME_SIZE(pager))
+        return CHIDB_EIO;
+
+    /* Readers cannot see the frame until it is in the WAL index */
+    pthread_mutex_lock(&pager->lock);
+    pager->wal_prev[++pager->wal_nframes] = pager->wal_index[npage];
+    pager->wal_index[npage] = pager->wal_nframes;
+    pthread_mutex_unlock(&pager->lock);
+
     return CHIDB_OK;
 }
 
 
-/* Release an in-memory copy of a page
+/* Append every dirty page to the log. If commit is true, the last
+ * frame is marked as the commit frame of the transaction. */
+static int __chidb_Pager_flushDirty(Pager *pager, bool commit)
+{
+    npage_t npage;
+    int rc;
+
+    for (npage_t i = 0; i < pager->n_dirty; i++)
+    {
+        npage = pager->dirty_list[i];
+        rc = __chidb_Pager_walAppend(pager, npage, pager->dirty[npage],
+                                     (commit && i == pager->n_dirty - 1) ? pager->n_pages : 0);
+        if (rc != CHIDB_OK)
+            return rc;
+
+        /* Readers find the page in the log from now on */
+        pthread_mutex_lock(&pager->lock);
+        free(pager->dirty[npage]);
+        pager->dirty[npage] = NULL;
+        pthread_mutex_unlock(&pager->lock);
+    }
+    pager->n_dirty = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Write a page to file
+ *
+ * This page writes the in-memory copy of a page (stored in a MemPage
+ * struct) back to disk. The page is kept in the pager's dirty page
+ * table and is appended to the write-ahead log by the next commit
+ * (or earlier, if more than PAGER_DIRTY_MAX pages become dirty).
+ * Writers sharing the write lock may write pages concurrently.
  *
  * Parameters
  * - pager: A Pager.
@@ -240,52 +945,1035 @@ int	chidb_Pager_writePage(Pager *pager, MemPage *page)
  * Return
  * - CHIDB_OK: Operation successful
  * - CHIDB_EPAGENO: The page has an incorrect page number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
+int	chidb_Pager_writePage(Pager *pager, MemPage *page)
 {
-    if (page->npage > pager->n_pages)
-        return CHIDB_EPAGENO;
+    int rc = CHIDB_OK;
 
-    chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
-    free(page->data);
-    free(page);
+    pthread_mutex_lock(&pager->dirty_lock);
+    pthread_mutex_lock(&pager->lock);
+    if (page->npage > pager->n_pages || page->npage <= 0)
+        rc = CHIDB_EPAGENO;
+    else
+        rc = __chidb_Pager_growIndex(pager, page->npage);
 
-    return CHIDB_OK;
+    if (rc == CHIDB_OK && pager->dirty[page->npage] == NULL)
+    {
+        if (pager->dirty_list == NULL)
+            pager->dirty_list = malloc(PAGER_DIRTY_MAX * sizeof(npage_t));
+
+        /* Too many dirty pages: spill them to the log uncommitted */
+        if (pager->dirty_list == NULL)
+            rc = CHIDB_ENOMEM;
+        else if (pager->n_dirty == PAGER_DIRTY_MAX)
+        {
+            pthread_mutex_unlock(&pager->lock);
+            rc = __chidb_Pager_flushDirty(pager, false);
+            pthread_mutex_lock(&pager->lock);
+        }
+
+        if (rc == CHIDB_OK && (pager->dirty[page->npage] = malloc(pager->page_size)) == NULL)
+            rc = CHIDB_ENOMEM;
+        if (rc == CHIDB_OK)
+            pager->dirty_list[pager->n_dirty++] = page->npage;
+    }
+
+    if (rc == CHIDB_OK)
+    {
+        memcpy(pager->dirty[page->npage], page->data, pager->page_size);
+        /* The page may no longer match the buffer it was read from */
+        if (page->buf != NULL)
+            page->buf->pins--;
+        page->buf = NULL;
+        page->aux = NULL;
+    }
+    pthread_mutex_unlock(&pager->lock);
+    pthread_mutex_unlock(&pager->dirty_lock);
+
+    if (rc == CHIDB_OK)
+        chilog(TRACE, "Wrote %i bytes to page %i", pager->page_size, page->npage);
+
+    return rc;
 }
 
 
-/* Computes the number of pages in a file.
+/* Attach a decoded form to the buffer of a page
+ *
+ * Stores aux in the buffer the page was read from, so that later reads
+ * of the same version of the page return it (in the aux field of the
+ * MemPage) instead of having to decode the page again. The pager frees
+ * aux with free_aux when the buffer is recycled. If another reader of
+ * the buffer attached its own aux first, aux is freed and the page gets
+ * that one instead. Pages that were not read from a buffer, or that
+ * were written since, cannot have an aux: aux is freed and the page
+ * keeps none.
  *
  * Parameters
  * - pager: A Pager.
- * - npages: Out parameter. Number of pages.
+ * - page: A page read from this pager.
+ * - aux: Decoded form of the page
+ * - free_aux: Function that frees aux
  *
  * Return
- * - CHIDB_OK: Operation successful
+ * - CHIDB_OK: Operation successful (page->aux may still be NULL)
  */
-int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
+int chidb_Pager_setAux(Pager *pager, MemPage *page, void *aux, void (*free_aux)(void *))
 {
-    struct stat buf;
-    fstat(fileno(pager->f), &buf);
-    *npages = buf.st_size / pager->page_size;
+    pthread_mutex_lock(&pager->lock);
+    if (page->buf == NULL)
+        free_aux(aux);
+    else if (page->buf->aux != NULL)
+    {
+        free_aux(aux);
+        page->aux = page->buf->aux;
+    }
+    else
+    {
+        page->buf->aux = aux;
+        page->buf->free_aux = free_aux;
+        page->aux = aux;
+    }
+    pthread_mutex_unlock(&pager->lock);
 
     return CHIDB_OK;
 }
 
 
-/* Closes a pager and frees up all resources used by the pager.
- *
- * Parameters
- * - pager: A Pager.
- *
- * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
- */
-int chidb_Pager_close(Pager *pager)
+/* Hand work to the background writer, starting it if needed.
+ * Must be called with the pager's lock held. */
+static int __chidb_Pager_writerSignal(Pager *pager)
 {
-    fclose(pager->f);
-    free(pager);
+    if (!pager->writer_started)
+    {
+        if (pthread_create(&pager->writer, NULL, __chidb_Pager_writer, pager))
+            return CHIDB_ENOMEM;
+        pager->writer_started = true;
+    }
+    pthread_cond_signal(&pager->work);
 
     return CHIDB_OK;
 }
+
+
+/* Copy the pages of a checkpoint job into the database file.
+ * Runs on the writer thread. */
+static int __chidb_Pager_ckptRun(Pager *pager, PagerCkpt *job)
+{
+    struct iovec iov[PAGER_WRITER_MAXRUN];
+    PagerCkptEntry *e = job->entries;
+    uint8_t *buf;
+    npage_t i, j;
+
+    /* The log must be durable before the database file is overwritten */
+    if (fsync(pager->wal_fd))
+        return CHIDB_EIO;
+
+    buf = malloc(PAGER_WRITER_MAXRUN * pager->page_size);
+    if (buf == NULL)
+        return CHIDB_ENOMEM;
+
+    for (i = 0; i < job->n_entries; i = j)
+    {
+        /* Gather a run of adjacent pages and write it with a single call */
+        for (j = i; j < job->n_entries && j - i < PAGER_WRITER_MAXRUN &&
+                    e[j].npage == e[i].npage + (j - i); j++)
+        {
+            iov[j - i].iov_base = buf + (j - i) * pager->page_size;
+            iov[j - i].iov_len = pager->page_size;
+            if (pread(pager->wal_fd, iov[j - i].iov_base, pager->page_size,
+                      WAL_PAGE_OFFSET(pager, e[j].frame)) != pager->page_size)
+            {
+                free(buf);
+                return CHIDB_EIO;
+            }
+        }
+
+        if (pwritev(pager->fd, iov, j - i, PAGE_OFFSET(pager, e[i].npage)) !=
+            (ssize_t) (j - i) * pager->page_size)
+        {
+            free(buf);
+            return CHIDB_EIO;
+        }
+    }
+    free(buf);
+
+    if (fsync(pager->fd))
+        return CHIDB_EIO;
+
+    chilog(TRACE, "Checkpointed %i pages from %s", job->n_entries, pager->wal_name);
+
+    return CHIDB_OK;
+}
+
+
+/* Background writer thread: runs checkpoint jobs and log syncs
+ * until the pager is closed */
+static void *__chidb_Pager_writer(void *arg)
+{
+    Pager *pager = arg;
+    PagerCkpt *job;
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    while (true)
+    {
+        if (pager->ckpt != NULL && !pager->ckpt->done)
+        {
+            job = pager->ckpt;
+            pthread_mutex_unlock(&pager->lock);
+            rc = __chidb_Pager_ckptRun(pager, job);
+            pthread_mutex_lock(&pager->lock);
+            job->rc = rc;
+            job->done = true;
+            pthread_cond_broadcast(&pager->done);
+        }
+        else if (pager->sync_requested > pager->sync_done)
+        {
+            /* The sync covers every commit up to the latest request */
+            uint64_t gen = pager->sync_requested;
+            pthread_mutex_unlock(&pager->lock);
+            rc = fsync(pager->wal_fd) ? CHIDB_EIO : CHIDB_OK;
+            pthread_mutex_lock(&pager->lock);
+            pager->sync_done = gen;
+            pager->sync_rc = rc;
+            pthread_cond_broadcast(&pager->done);
+        }
+        else if (pager->writer_exit)
+            break;
+        else
+            pthread_cond_wait(&pager->work, &pager->lock);
+    }
+    pthread_mutex_unlock(&pager->lock);
+
+    return NULL;
+}
+
+
+/* Hand the writer a checkpoint job with the latest frame of every page
+ * in the log that is not newer than the last commit or than the oldest
+ * open snapshot, unless it already has one */
+static int __chidb_Pager_ckptStart(Pager *pager)
+{
+    PagerCkpt *job;
+    uint32_t limit = pager->wal_ncommitted, frame;
+    npage_t n = 0;
+    int rc;
+
+    if (pager->ckpt != NULL)
+        return CHIDB_OK;
+
+    pthread_mutex_lock(&pager->lock);
+    for (PagerSnapshot *snapshot = pager->snapshots; snapshot != NULL; snapshot = snapshot->next)
+        if (snapshot->frame < limit)
+            limit = snapshot->frame;
+    pthread_mutex_unlock(&pager->lock);
+    if (limit <= pager->wal_backfill)
+        return CHIDB_OK;
+
+    for (npage_t npage = 1; npage < pager->index_size; npage++)
+        if (__chidb_Pager_frameAt(pager, npage, limit) > pager->wal_backfill)
+            n++;
+    if (n == 0)
+        return CHIDB_OK;
+
+    job = calloc(1, sizeof(PagerCkpt));
+    if (job == NULL)
+        return CHIDB_ENOMEM;
+    job->entries = malloc(n * sizeof(PagerCkptEntry));
+    if (job->entries == NULL)
+    {
+        free(job);
+        return CHIDB_ENOMEM;
+    }
+
+    for (npage_t npage = 1; npage < pager->index_size; npage++)
+        if ((frame = __chidb_Pager_frameAt(pager, npage, limit)) > pager->wal_backfill)
+        {
+            job->entries[job->n_entries].npage = npage;
+            job->entries[job->n_entries].frame = frame;
+            job->n_entries++;
+        }
+    job->frame = pager->wal_ckpt_frame = limit;
+
+    pthread_mutex_lock(&pager->lock);
+    pager->ckpt = job;
+    rc = __chidb_Pager_writerSignal(pager);
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Collect the checkpoint job once the writer is done with it (waiting
+ * for the writer if wait is true). Pages whose latest frame has been
+ * copied into the database file are dropped from the WAL index, and
+ * the log is emptied if nothing was appended to it in the meantime. */
+static int __chidb_Pager_ckptCollect(Pager *pager, bool wait)
+{
+    PagerCkpt *job = NULL;
+    int rc = CHIDB_OK;
+
+    pthread_mutex_lock(&pager->lock);
+    while (wait && pager->ckpt != NULL && !pager->ckpt->done)
+        pthread_cond_wait(&pager->done, &pager->lock);
+    if (pager->ckpt != NULL && pager->ckpt->done)
+    {
+        job = pager->ckpt;
+        pager->ckpt = NULL;
+    }
+
+    if (job != NULL && job->rc != CHIDB_OK)
+        rc = job->rc;
+    else if (job != NULL)
+    {
+        for (npage_t i = 0; i < job->n_entries; i++)
+        {
+            npage_t npage = job->entries[i].npage;
+            pager->file_version[npage] = pager->wal_base + job->entries[i].frame;
+            if (pager->wal_index[npage] == job->entries[i].frame)
+                pager->wal_index[npage] = 0;
+        }
+        pager->wal_backfill = job->frame;
+
+        if (pager->wal_nframes == job->frame && pager->wal_readers == 0)
+        {
+            /* The next frame starts a new log (see __chidb_Pager_walReset).
+             * Open snapshots cannot be older than the job, so they now
+             * see exactly the database file. */
+            for (PagerSnapshot *snapshot = pager->snapshots; snapshot != NULL; snapshot = snapshot->next)
+                snapshot->frame = 0;
+            pager->wal_base += pager->wal_nframes;
+            pager->wal_nframes = pager->wal_ncommitted = 0;
+            pager->wal_ckpt_frame = pager->wal_backfill = 0;
+            pager->wal_npages = 0;
+            if (ftruncate(pager->wal_fd, 0))
+                rc = CHIDB_EIO;
+        }
+    }
+    pthread_mutex_unlock(&pager->lock);
+
+    if (job != NULL)
+    {
+        free(job->entries);
+        free(job);
+    }
+
+    return rc;
+}
+
+
+/* Commit the pages written since the last commit
+ *
+ * Appends all dirty pages to the write-ahead log, marking the last
+ * frame as a commit frame, and fsyncs the log, so the commit is durable
+ * once this function returns. If asynchronous commits have been enabled
+ * (see chidb_Pager_setGroupCommit), the log is instead only fsync'ed
+ * once every group_commit commits, by the background writer (the
+ * commit that asks for the sync waits for it), and the commits in
+ * between are not durable yet when they return. Once
+ * PAGER_WAL_AUTOCHECKPOINT frames have been committed to the log, a
+ * checkpoint is handed to the background writer, and the log is
+ * restarted at the first commit that finds all of it checkpointed.
+ * Commits only wait for a checkpoint if the log grows beyond
+ * PAGER_WAL_MAXFRAMES frames.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_commit(Pager *pager)
+{
+    uint8_t fhdr[PAGER_WAL_FRAME_HEADER_SIZE];
+    MemPage *page;
+    bool pinned;
+    int rc;
+
+    if ((rc = __chidb_Pager_ckptCollect(pager, false)) != CHIDB_OK)
+        return rc;
+
+    if (pager->n_dirty == 0 && pager->wal_nframes == pager->wal_ncommitted)
+        return CHIDB_OK;
+
+    if (pager->n_dirty > 0)
+        rc = __chidb_Pager_flushDirty(pager, true);
+    else
+    {
+        /* All pages were spilled: log the last one again as the commit frame */
+        if (pread(pager->wal_fd, fhdr, PAGER_WAL_FRAME_HEADER_SIZE,
+                  WAL_FRAME_OFFSET(pager, pager->wal_nframes)) != PAGER_WAL_FRAME_HEADER_SIZE)
+            return CHIDB_EIO;
+        if ((rc = chidb_Pager_readPage(pager, get4byte(fhdr), &page)) != CHIDB_OK)
+            return rc;
+        rc = __chidb_Pager_walAppend(pager, page->npage, page->data, pager->n_pages);
+        chidb_Pager_releaseMemPage(pager, page);
+    }
+    if (rc != CHIDB_OK)
+        return rc;
+
+    pthread_mutex_lock(&pager->lock);
+    pager->wal_ncommitted = pager->wal_nframes;
+    pager->wal_npages = pager->n_pages_committed = pager->n_pages;
+    if (pager->schema_changed)
+        pager->schema_cookie++;
+    pager->schema_changed = false;
+    pthread_mutex_unlock(&pager->lock);
+
+    if (++pager->wal_unsynced >= pager->group_commit)
+    {
+        pager->wal_unsynced = 0;
+        if (pager->group_commit == 1)
+        {
+            if (fsync(pager->wal_fd))
+                return CHIDB_EIO;
+        }
+        else
+        {
+            /* Wait for a sync covering this commit */
+            pthread_mutex_lock(&pager->lock);
+            uint64_t gen = ++pager->sync_requested;
+            rc = __chidb_Pager_writerSignal(pager);
+            while (rc == CHIDB_OK && pager->sync_done < gen)
+                pthread_cond_wait(&pager->done, &pager->lock);
+            if (rc == CHIDB_OK)
+                rc = pager->sync_rc;
+            pthread_mutex_unlock(&pager->lock);
+            if (rc != CHIDB_OK)
+                return rc;
+        }
+    }
+
+    /* Open snapshots pin the log, and must not stall commits */
+    pthread_mutex_lock(&pager->lock);
+    pinned = pager->snapshots != NULL;
+    pthread_mutex_unlock(&pager->lock);
+    if (pager->wal_nframes >= PAGER_WAL_MAXFRAMES && !pinned)
+        return chidb_Pager_checkpoint(pager);
+    /* Once a checkpoint has run, keep the writer checkpointing the
+     * frames committed since, so the log can be restarted as soon as
+     * the writer catches up with the foreground */
+    if (pager->wal_ncommitted - pager->wal_ckpt_frame >= PAGER_WAL_AUTOCHECKPOINT ||
+        pager->wal_ckpt_frame > 0)
+        return __chidb_Pager_ckptStart(pager);
+
+    return CHIDB_OK;
+}
+
+
+/* Roll back the pages written since the last commit
+ *
+ * Discards all dirty pages, along with any frames they were spilled
+ * to in the write-ahead log, and forgets the pages allocated since
+ * the last commit.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_rollback(Pager *pager)
+{
+    int rc = CHIDB_OK;
+
+    for (npage_t i = 0; i < pager->n_dirty; i++)
+    {
+        free(pager->dirty[pager->dirty_list[i]]);
+        pager->dirty[pager->dirty_list[i]] = NULL;
+    }
+    pager->n_dirty = 0;
+
+    /* Spilled frames have overwritten entries of the WAL index, so
+     * the index is rebuilt from the committed part of the log */
+    pthread_mutex_lock(&pager->lock);
+    if (pager->wal_nframes != pager->wal_ncommitted)
+    {
+        memset(pager->wal_index, 0, pager->index_size * sizeof(uint32_t));
+        pager->wal_nframes = pager->wal_ncommitted = 0;
+        rc = __chidb_Pager_walRecover(pager);
+    }
+
+    pager->n_pages = pager->n_pages_committed;
+    pager->schema_changed = false;
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Checkpoint the write-ahead log
+ *
+ * Copies the latest committed version of every page in the log back
+ * into the database file, syncs the database file, and empties the log.
+ * Unlike the checkpoints started by chidb_Pager_commit, this function
+ * waits for the background writer to finish. Nothing is done while a
+ * transaction has uncommitted frames in the log.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_checkpoint(Pager *pager)
+{
+    int rc;
+
+    /* Finish any checkpoint that is already running */
+    if ((rc = __chidb_Pager_ckptCollect(pager, true)) != CHIDB_OK)
+        return rc;
+
+    if (pager->wal_fd == -1 || pager->wal_ncommitted == 0 ||
+        pager->wal_nframes != pager->wal_ncommitted)
+        return CHIDB_OK;
+
+    if ((rc = __chidb_Pager_ckptStart(pager)) != CHIDB_OK)
+        return rc;
+
+    return __chidb_Pager_ckptCollect(pager, true);
+}
+
+
+/* Set the group commit size
+ *
+ * Sets the number of commits that are batched into a single fsync of
+ * the write-ahead log. With 1 (the default), every commit fsyncs the
+ * log and is durable as soon as it returns. Larger values enable
+ * asynchronous commits: only every ncommits-th commit has the
+ * background writer fsync the log (and waits for it), and the others
+ * return before their frames are durable. The most recent commits may then be lost
+ * on a crash, although the database is never left inconsistent.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - ncommits: Commits per fsync (at least 1)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: ncommits is zero
+ */
+int chidb_Pager_setGroupCommit(Pager *pager, uint32_t ncommits)
+{
+    if (ncommits == 0)
+        return CHIDB_EMISUSE;
+    pager->group_commit = ncommits;
+
+    return CHIDB_OK;
+}
+
+
+/* Open a read snapshot
+ *
+ * Captures the database as of the last commit. Pages read through the
+ * snapshot (see chidb_Pager_readSnapshotPage) keep returning that
+ * version while later transactions commit, until the snapshot is closed
+ * with chidb_Pager_closeSnapshot. Pages written since the last commit
+ * are not part of the snapshot.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - snapshot: Out parameter. Used to return the new snapshot.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_openSnapshot(Pager *pager, PagerSnapshot **snapshot)
+{
+    *snapshot = malloc(sizeof(PagerSnapshot));
+    if (*snapshot == NULL)
+        return CHIDB_ENOMEM;
+
+    pthread_mutex_lock(&pager->lock);
+    (*snapshot)->frame = pager->wal_ncommitted;
+    (*snapshot)->n_pages = pager->n_pages_committed;
+    (*snapshot)->next = pager->snapshots;
+    pager->snapshots = *snapshot;
+    pthread_mutex_unlock(&pager->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Close a read snapshot
+ *
+ * Frees a snapshot opened with chidb_Pager_openSnapshot, allowing
+ * checkpoints to copy the frames it was pinning into the database file.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - snapshot: A snapshot opened on this pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_closeSnapshot(Pager *pager, PagerSnapshot *snapshot)
+{
+    PagerSnapshot **p;
+
+    pthread_mutex_lock(&pager->lock);
+    for (p = &pager->snapshots; *p != NULL; p = &(*p)->next)
+        if (*p == snapshot)
+        {
+            *p = snapshot->next;
+            break;
+        }
+    pthread_mutex_unlock(&pager->lock);
+    free(snapshot);
+
+    return CHIDB_OK;
+}
+
+
+/* Compute the deadline of a wait of timeout milliseconds */
+static void __chidb_Pager_deadline(struct timespec *deadline, int timeout)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += timeout / 1000;
+    deadline->tv_nsec += (long) (timeout % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+
+/* Take the write lock of a pager
+ *
+ * Only the owner of the write lock may write, commit or roll back
+ * pages. The lock is re-entrant: an owner that already holds it
+ * gets it again (and only needs to unlock it once).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - owner: Identifies the connection taking the lock.
+ * - timeout: Milliseconds to wait for another owner to release
+ *            the lock (0 to fail immediately).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EBUSY: Another owner held the lock for the whole timeout
+ */
+int chidb_Pager_lockWrite(Pager *pager, const void *owner, int timeout)
+{
+    struct timespec deadline;
+    int rc = CHIDB_OK;
+
+    __chidb_Pager_deadline(&deadline, timeout);
+
+    pthread_mutex_lock(&pager->lock);
+    pager->write_waiting++;
+    while (WRITE_BUSY(pager, owner))
+        if (pthread_cond_timedwait(&pager->unlocked, &pager->lock, &deadline) == ETIMEDOUT)
+        {
+            if (WRITE_BUSY(pager, owner))
+                rc = CHIDB_EBUSY;
+            break;
+        }
+    pager->write_waiting--;
+    if (rc == CHIDB_OK)
+        pager->write_owner = owner;
+    else
+        pthread_cond_broadcast(&pager->unlocked);   /* writers may join again */
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Release the write lock of a pager
+ *
+ * Pages written by the owner must have been committed or rolled
+ * back. Does nothing if the lock is not held by owner.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - owner: Connection that took the lock.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_unlockWrite(Pager *pager, const void *owner)
+{
+    pthread_mutex_lock(&pager->lock);
+    if (pager->write_owner == owner)
+    {
+        pager->write_owner = NULL;
+        pthread_cond_broadcast(&pager->unlocked);
+    }
+    pthread_mutex_unlock(&pager->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Join the shared transaction of a pager
+ *
+ * Takes the write lock in shared mode (see "Concurrent writers" in
+ * pager.h): any number of writers can hold it at once, as long as they
+ * latch the pages they modify (see chidb_Pager_latchPage). Writers do
+ * not join while the lock is held (or waited for) in exclusive mode.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - timeout: Milliseconds to wait for the exclusive holder to release
+ *            the lock (0 to fail immediately).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EBUSY: The lock was held in exclusive mode for the whole timeout
+ */
+int chidb_Pager_lockWriteShared(Pager *pager, int timeout)
+{
+    struct timespec deadline;
+    int rc = CHIDB_OK;
+
+    __chidb_Pager_deadline(&deadline, timeout);
+
+    pthread_mutex_lock(&pager->lock);
+    while (JOIN_BUSY(pager))
+        if (pthread_cond_timedwait(&pager->unlocked, &pager->lock, &deadline) == ETIMEDOUT)
+        {
+            if (JOIN_BUSY(pager))
+                rc = CHIDB_EBUSY;
+            break;
+        }
+    if (rc == CHIDB_OK)
+        pager->write_sharers++;
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Leave the shared transaction of a pager
+ *
+ * The last writer to leave the transaction commits it, or rolls it back
+ * if any of its writers failed. Every writer waits for that group commit
+ * and gets its result.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - failed: Whether the pages written by the caller must be rolled back.
+ *
+ * Return
+ * - CHIDB_OK: The transaction was committed
+ * - CHIDB_EBUSY: The transaction was rolled back because a writer failed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_unlockWriteShared(Pager *pager, bool failed)
+{
+    uint64_t group;
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    if (failed)
+        pager->write_failed = true;
+
+    if (--pager->write_sharers > 0)
+    {
+        /* Wait for the last writer to commit the group */
+        group = pager->write_group;
+        pager->write_pending++;
+        while (pager->write_group == group)
+            pthread_cond_wait(&pager->unlocked, &pager->lock);
+        rc = pager->write_rc;
+        if (--pager->write_pending == 0)
+        {
+            pager->write_committing = false;
+            pthread_cond_broadcast(&pager->unlocked);
+        }
+        pthread_mutex_unlock(&pager->lock);
+
+        return rc;
+    }
+
+    /* Every other writer is waiting: the transaction is ours */
+    pager->write_committing = true;
+    failed = pager->write_failed;
+    pthread_mutex_unlock(&pager->lock);
+
+    if (failed)
+    {
+        rc = chidb_Pager_rollback(pager);
+        if (rc == CHIDB_OK)
+            rc = CHIDB_EBUSY;
+    }
+    else
+        rc = chidb_Pager_commit(pager);
+
+    pthread_mutex_lock(&pager->lock);
+    pager->write_rc = rc;
+    pager->write_failed = false;
+    pager->write_group++;
+    if (pager->write_pending == 0)
+        pager->write_committing = false;
+    pthread_cond_broadcast(&pager->unlocked);
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Latch a page
+ *
+ * Page latches let writers sharing the write lock modify pages without
+ * stepping on each other: a page is latched exclusively while it is
+ * modified, and in shared mode while it must not change. Latches are
+ * not re-entrant, and must be taken in a consistent order (e.g., from
+ * the root of a B-Tree down to its leaves) to avoid deadlocks.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page to latch.
+ * - exclusive: Whether to latch the page exclusively.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_latchPage(Pager *pager, npage_t npage, bool exclusive)
+{
+    int rc;
+
+    pthread_mutex_lock(&pager->lock);
+    if ((rc = __chidb_Pager_growIndex(pager, npage)) == CHIDB_OK)
+    {
+        while (exclusive ? pager->latch[npage] != 0 : pager->latch[npage] < 0)
+            pthread_cond_wait(&pager->unlatched, &pager->lock);
+        pager->latch[npage] = exclusive ? -1 : pager->latch[npage] + 1;
+    }
+    pthread_mutex_unlock(&pager->lock);
+
+    return rc;
+}
+
+
+/* Release a page latch taken with chidb_Pager_latchPage
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Latched page.
+ * - exclusive: Whether the page was latched exclusively.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_unlatchPage(Pager *pager, npage_t npage, bool exclusive)
+{
+    pthread_mutex_lock(&pager->lock);
+    pager->latch[npage] = exclusive ? 0 : pager->latch[npage] - 1;
+    pthread_cond_broadcast(&pager->unlatched);
+    pthread_mutex_unlock(&pager->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Record that the schema is being changed
+ *
+ * The schema cookie (see chidb_Pager_getSchemaCookie) is bumped when
+ * the change is committed, and left alone if it is rolled back.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_changeSchema(Pager *pager)
+{
+    pthread_mutex_lock(&pager->lock);
+    pager->schema_changed = true;
+    pthread_mutex_unlock(&pager->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Get the schema cookie of a pager
+ *
+ * The cookie changes every time a schema change is committed, so
+ * connections sharing the pager can tell when to reload the schema.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - The current schema cookie
+ */
+uint32_t chidb_Pager_getSchemaCookie(Pager *pager)
+{
+    uint32_t cookie;
+
+    pthread_mutex_lock(&pager->lock);
+    cookie = pager->schema_cookie;
+    pthread_mutex_unlock(&pager->lock);
+
+    return cookie;
+}
+
+
+/* Release an in-memory copy of a page
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - page: In-memory copy of page to write
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page has an incorrect page number
+ */
+int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
+{
+    npage_t n_pages;
+
+    pthread_mutex_lock(&pager->lock);
+    n_pages = pager->n_pages;
+    if (page->buf != NULL)
+        page->buf->pins--;
+    page->buf = NULL;
+    pthread_mutex_unlock(&pager->lock);
+    if (page->npage > n_pages)
+        return CHIDB_EPAGENO;
+
+    chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
+    free(page->data);
+    free(page);
+
+    return CHIDB_OK;
+}
+
+
+/* Computes the number of pages in a file.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: Out parameter. Number of pages.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
+{
+    struct stat buf;
+    fstat(pager->fd, &buf);
+    *npages = buf.st_size / pager->page_size;
+
+    return CHIDB_OK;
+}
+
+
+/* Closes a pager and frees up all resources used by the pager.
+ *
+ * Any pages written since the last commit are committed, and the
+ * write-ahead log is checkpointed and removed. A shared pager is
+ * only closed once every connection using it has closed it.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_close(Pager *pager)
+{
+    int rc = CHIDB_OK;
+
+    if (pager->shared)
+    {
+        pthread_mutex_lock(&__chidb_Pager_sharedLock);
+        if (--pager->refcount > 0)
+        {
+            pthread_mutex_unlock(&__chidb_Pager_sharedLock);
+            return CHIDB_OK;
+        }
+        for (Pager **p = &__chidb_Pager_shared; *p != NULL; p = &(*p)->next_shared)
+            if (*p == pager)
+            {
+                *p = pager->next_shared;
+                break;
+            }
+        pthread_mutex_unlock(&__chidb_Pager_sharedLock);
+    }
+
+    if (pager->wal_fd != -1 || pager->n_dirty > 0)
+    {
+        rc = chidb_Pager_commit(pager);
+        if (rc == CHIDB_OK)
+            rc = chidb_Pager_checkpoint(pager);
+    }
+
+    /* Let the writer finish any pending log sync and stop it */
+    if (pager->writer_started)
+    {
+        pthread_mutex_lock(&pager->lock);
+        pager->writer_exit = true;
+        pthread_cond_signal(&pager->work);
+        pthread_mutex_unlock(&pager->lock);
+        pthread_join(pager->writer, NULL);
+    }
+    if (pager->ckpt != NULL)
+    {
+        free(pager->ckpt->entries);
+        free(pager->ckpt);
+    }
+
+    if (pager->wal_fd != -1)
+    {
+        close(pager->wal_fd);
+        if (rc == CHIDB_OK && pager->wal_nframes == 0)
+            unlink(pager->wal_name);
+    }
+    close(pager->fd);
+
+    pthread_mutex_destroy(&pager->lock);
+    pthread_cond_destroy(&pager->work);
+    pthread_cond_destroy(&pager->done);
+    pthread_cond_destroy(&pager->unlocked);
+    pthread_cond_destroy(&pager->unlatched);
+    pthread_mutex_destroy(&pager->dirty_lock);
+
+    for (uint32_t i = 0; i < PAGER_CACHE_BUCKETS && pager->cache != NULL; i++)
+        while (pager->cache[i] != NULL)
+        {
+            PagerBuf *next = pager->cache[i]->hash_next;
+            pthread_rwlock_destroy(&pager->cache[i]->latch);
+            if (pager->cache[i]->aux != NULL)
+                pager->cache[i]->free_aux(pager->cache[i]->aux);
+            free(pager->cache[i]->data);
+            free(pager->cache[i]);
+            pager->cache[i] = next;
+        }
+    free(pager->cache);
+    free(pager->file_version);
+    free(pager->latch);
+
+    for (npage_t i = 0; i < pager->n_dirty; i++)
+        free(pager->dirty[pager->dirty_list[i]]);
+    free(pager->dirty_list);
+    free(pager->dirty);
+    while (pager->snapshots != NULL)
+    {
+        PagerSnapshot *next = pager->snapshots->next;
+        free(pager->snapshots);
+        pager->snapshots = next;
+    }
+    free(pager->wal_index);
+    free(pager->wal_prev);
+    free(pager->wal_name);
+    free(pager);
+
+    return rc;
+}
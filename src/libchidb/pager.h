@@ -41,31 +41,284 @@
 #define PAGER_H_
 
 #include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
 #include "chidbInt.h"
 
 struct MemPage
 {
     npage_t npage;
     uint8_t *data;
+    struct PagerBuf *buf;       // buffer the page was copied from, pinned until released (NULL if none)
+    void *aux;                  // decoded form of the page (see chidb_Pager_setAux), NULL if none
 };
 typedef struct MemPage MemPage;
 
+/* Write-ahead log
+ *
+ * Modified pages are not written to the database file in place. They are
+ * kept in memory until the pager commits, and are then appended as frames
+ * to a log file (the database file name followed by PAGER_WAL_SUFFIX).
+ * The log starts with a PAGER_WAL_HEADER_SIZE header:
+ *
+ *   0  magic number          16  salt-1
+ *   4  format version        20  salt-2
+ *   8  page size             24  checksum-1 (of bytes 0-23)
+ *  12  reserved (zero)       28  checksum-2 (of bytes 0-23)
+ *
+ * Each frame is a PAGER_WAL_FRAME_HEADER_SIZE header followed by a page:
+ *
+ *   0  page number           12  salt-2 (copied from the log header)
+ *   4  database size in      16  checksum-1 (of bytes 0-15 and the page)
+ *      pages for the last    20  checksum-2 (of bytes 0-15 and the page)
+ *      frame of a commit,
+ *      zero otherwise
+ *   8  salt-1 (copied from the log header)
+ *
+ * Frames after the last commit frame are ignored when a log is recovered,
+ * and are discarded by a rollback.
+ *
+ * Background writer
+ *
+ * Each pager owns a writer thread that keeps checkpoints off the
+ * foreground path. Commits sync the log before returning, unless
+ * asynchronous commits are enabled (see chidb_Pager_setGroupCommit), in
+ * which case the writer is asked to fsync the log once every group_commit
+ * commits. Log syncs are numbered by generation, and the commit asking for
+ * one waits until the writer has finished a sync of that generation (or a
+ * later one), failing if the fsync did. Once PAGER_WAL_AUTOCHECKPOINT
+ * frames have been committed since the last checkpoint, the writer is
+ * handed a checkpoint job: the latest frame of every page in the log, in
+ * page number order. The writer copies those pages back into the database
+ * file, coalescing runs of adjacent pages into a single pwritev, while the
+ * foreground keeps reading and appending to the log. When the job is done,
+ * the foreground drops the checkpointed pages from the WAL index, and
+ * empties the log if no frames were appended in the meantime. If the log
+ * grows beyond PAGER_WAL_MAXFRAMES frames anyway, commits wait for a full
+ * checkpoint.
+ *
+ * Snapshots
+ *
+ * A read snapshot records the last commit frame at the time it was opened.
+ * Reads through a snapshot ignore dirty pages and frames appended after
+ * it, following wal_prev (the previous frame of the same page) back to
+ * the latest frame the snapshot can see, or to the database file if there
+ * is none. Checkpoints never copy frames newer than the oldest open
+ * snapshot into the database file, so long-running readers keep seeing a
+ * consistent database while commits proceed (the log simply grows until
+ * they are done).
+ *
+ * Shared cache
+ *
+ * A pager opened with chidb_Pager_openShared is shared by every connection
+ * to the same file in the process, along with its buffer pool of committed
+ * page images. Buffers are keyed by page number and version (the absolute
+ * number of the frame the image comes from, counting the frames of earlier
+ * logs, or 0 for the database file as it was opened), so readers of
+ * different snapshots never see each other's versions. Each buffer has a
+ * page latch, held exclusively while the buffer is loaded and shared while
+ * it is copied, so concurrent readers of a page wait for a single read.
+ *
+ * Connections take the pager's write lock (chidb_Pager_lockWrite) before
+ * writing, and keep it until they commit or roll back; dirty pages belong
+ * to the holder of the lock. Other connections only read committed pages
+ * (chidb_Pager_readCommittedPage) or snapshots. The pager's mutex protects
+ * the WAL index, version chain, snapshots, buffer pool and write lock; I/O
+ * is done without holding it.
+ *
+ * Concurrent writers
+ *
+ * The write lock can also be taken in shared mode
+ * (chidb_Pager_lockWriteShared) by writers that only insert entries. They
+ * join a single transaction and write pages concurrently, coordinating
+ * through page latches (chidb_Pager_latchPage) held while they modify
+ * B-Tree nodes. The transaction is committed (or rolled back, if any of
+ * them failed) by the last writer to leave it, and the others wait for
+ * that group commit before returning. New writers do not join a group
+ * while an exclusive writer is waiting for the lock. dirty_lock
+ * serializes changes to the dirty page table among the writers.
+ *
+ * Decoded pages
+ *
+ * A buffer can also hold a decoded form of its image (its aux), built
+ * by the layer above the first time the image is read and shared by
+ * every later reader (see chidb_Pager_setAux). Images of committed
+ * versions never change, so an aux stays valid for as long as its
+ * buffer holds the same version; it is freed when the buffer is
+ * recycled. A page read from a buffer keeps it pinned until the page is
+ * released (or written), so the aux it returned can be used until
+ * then. Pages read from the dirty page table or from frames not yet
+ * committed have none, and a page loses its aux when it is written.
+ */
+#define PAGER_WAL_SUFFIX "-wal"
+#define PAGER_WAL_MAGIC (0x63684c67)
+#define PAGER_WAL_VERSION (1)
+#define PAGER_WAL_HEADER_SIZE (32)
+#define PAGER_WAL_FRAME_HEADER_SIZE (24)
+#define PAGER_WAL_AUTOCHECKPOINT (1000)
+#define PAGER_WAL_MAXFRAMES (4 * PAGER_WAL_AUTOCHECKPOINT)
+#define PAGER_GROUP_COMMIT (1)
+#define PAGER_DIRTY_MAX (2000)
+#define PAGER_WRITER_MAXRUN (64)
+#define PAGER_CACHE_SIZE (2000)
+#define PAGER_CACHE_BUCKETS (4096)
+
+/* A page to be copied from the log into the database file */
+typedef struct PagerCkptEntry
+{
+    npage_t npage;
+    uint32_t frame;
+} PagerCkptEntry;
+
+/* A checkpoint job, handed to the background writer */
+typedef struct PagerCkpt
+{
+    PagerCkptEntry *entries;    // sorted by page number
+    npage_t n_entries;
+    uint32_t frame;             // last frame covered by the job
+    bool done;
+    int rc;
+} PagerCkpt;
+
+/* A read snapshot (see chidb_Pager_openSnapshot) */
+typedef struct PagerSnapshot
+{
+    uint32_t frame;             // last commit frame visible to the snapshot
+    npage_t n_pages;            // database size when the snapshot was opened
+    struct PagerSnapshot *next;
+} PagerSnapshot;
+
+/* A buffer of the buffer pool */
+typedef struct PagerBuf
+{
+    npage_t npage;
+    uint64_t version;           // absolute frame of the image (0: database file as opened)
+    uint8_t *data;
+    bool valid;                 // false until loaded, or if loading failed
+    uint32_t pins;              // readers using the buffer (it cannot be evicted)
+    uint32_t bucket;
+    pthread_rwlock_t latch;
+    void *aux;                  // decoded form of the image (NULL until set)
+    void (*free_aux)(void *);
+    struct PagerBuf *hash_next;
+    struct PagerBuf *lru_prev, *lru_next;
+} PagerBuf;
+
 struct Pager
 {
-    FILE *f;
+    int fd;
     npage_t n_pages;
     uint16_t page_size;
+
+    /* Write-ahead log (wal_fd is -1 until the first commit) */
+    char *wal_name;
+    int wal_fd;
+    uint32_t wal_salt[2];
+    uint32_t wal_nframes;       // frames in the log, including uncommitted ones
+    uint32_t wal_ncommitted;    // frames up to and including the last commit frame
+    npage_t wal_npages;         // database size recorded by the last commit
+    uint32_t wal_unsynced;      // commits not yet made durable
+    uint32_t wal_ckpt_frame;    // last frame covered by the latest checkpoint job
+    uint32_t wal_backfill;      // frames already copied into the database file
+    uint32_t group_commit;      // commits per fsync of the log (1: every commit is durable)
+    npage_t n_pages_committed;  // n_pages as of the last commit (restored by rollback)
+
+    /* WAL index and dirty pages, both indexed by page number. wal_index
+     * holds the latest frame of a page (0 if the page is not in the log),
+     * and dirty holds the image of a page written since the last commit
+     * (NULL if the page is clean). */
+    uint32_t *wal_index;
+    uint8_t **dirty;
+    npage_t index_size;
+    npage_t *dirty_list;
+    npage_t n_dirty;
+    pthread_mutex_t dirty_lock;
+
+    /* Page latches, indexed by page number: the number of shared holders,
+     * or -1 if held exclusively */
+    int32_t *latch;
+    pthread_cond_t unlatched;   // signalled when a latch is released
+
+    /* Version chain, indexed by frame: wal_prev holds the previous frame
+     * of the same page (0 if there is none) */
+    uint32_t *wal_prev;
+    uint32_t prev_size;
+
+    /* Versions: wal_base is the absolute number of frame 0 of the current
+     * log, and file_version (indexed by page number) the version of each
+     * page in the database file */
+    uint64_t wal_base;
+    uint64_t *file_version;
+    uint32_t wal_readers;       // reads of log frames in progress
+
+    /* Open read snapshots */
+    PagerSnapshot *snapshots;
+
+    /* Buffer pool */
+    PagerBuf **cache;           // hash table of PAGER_CACHE_BUCKETS chains
+    uint32_t cache_size;
+    PagerBuf *lru_head, *lru_tail;
+
+    /* Write lock and schema cookie (bumped by commits that change the schema) */
+    const void *write_owner;    // connection holding the write lock (NULL if none)
+    pthread_cond_t unlocked;    // signalled when the write lock is released
+    uint32_t write_waiting;     // connections waiting for the exclusive lock
+    uint32_t write_sharers;     // writers in the shared transaction
+    bool write_committing;      // the shared transaction is being committed
+    uint32_t write_pending;     // writers still to collect the group commit result
+    bool write_failed;          // a writer of the shared transaction failed
+    uint64_t write_group;       // shared transactions committed so far
+    int write_rc;               // result of the last group commit
+    uint32_t schema_cookie;
+    bool schema_changed;        // the current transaction changes the schema
+
+    /* Sharing (see chidb_Pager_openShared) */
+    bool shared;
+    uint32_t refcount;
+    dev_t dev;
+    ino_t ino;
+    struct Pager *next_shared;
+
+    /* Background writer. lock also protects the fields below. */
+    pthread_t writer;
+    bool writer_started;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // signalled when the writer has a job
+    pthread_cond_t done;        // signalled when the writer finishes a job
+    bool writer_exit;
+    uint64_t sync_requested;    // latest log sync asked of the writer (by generation)
+    uint64_t sync_done;         // latest log sync finished by the writer
+    int sync_rc;                // result of that sync
+    PagerCkpt *ckpt;            // checkpoint job (NULL if none)
 };
 typedef struct Pager Pager;
 
 int chidb_Pager_open(Pager **pager, const char *filename);
+int chidb_Pager_openShared(Pager **pager, const char *filename);
 int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize);
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header);
 int chidb_Pager_allocatePage(Pager *pager, npage_t *npage);
 int chidb_Pager_releaseMemPage(Pager *pager, MemPage *page);
 int	chidb_Pager_readPage(Pager *pager, npage_t page_num, MemPage **page);
+int chidb_Pager_readSnapshotPage(Pager *pager, PagerSnapshot *snapshot, npage_t npage, MemPage **page);
+int chidb_Pager_readCommittedPage(Pager *pager, npage_t npage, MemPage **page);
 int chidb_Pager_writePage(Pager *pager, MemPage *page);
+int chidb_Pager_setAux(Pager *pager, MemPage *page, void *aux, void (*free_aux)(void *));
 int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages);
+int chidb_Pager_commit(Pager *pager);
+int chidb_Pager_rollback(Pager *pager);
+int chidb_Pager_checkpoint(Pager *pager);
+int chidb_Pager_setGroupCommit(Pager *pager, uint32_t ncommits);
+int chidb_Pager_openSnapshot(Pager *pager, PagerSnapshot **snapshot);
+int chidb_Pager_closeSnapshot(Pager *pager, PagerSnapshot *snapshot);
+int chidb_Pager_lockWrite(Pager *pager, const void *owner, int timeout);
+int chidb_Pager_unlockWrite(Pager *pager, const void *owner);
+int chidb_Pager_lockWriteShared(Pager *pager, int timeout);
+int chidb_Pager_unlockWriteShared(Pager *pager, bool failed);
+int chidb_Pager_latchPage(Pager *pager, npage_t npage, bool exclusive);
+int chidb_Pager_unlatchPage(Pager *pager, npage_t npage, bool exclusive);
+int chidb_Pager_changeSchema(Pager *pager);
+uint32_t chidb_Pager_getSchemaCookie(Pager *pager);
 int chidb_Pager_close(Pager *pager);
 
 #endif /*PAGER_H_*/
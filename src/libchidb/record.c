@@ -68,6 +68,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <inttypes.h>
 
 #include "chidbInt.h"
 
@@ -92,16 +93,79 @@
  */
 int chidb_DBRecord_create_empty(DBRecordBuffer *dbrb, uint8_t nfields)
 {
-    dbrb->dbr = malloc(sizeof(DBRecord));
+    return chidb_DBRecord_create_empty_arena(dbrb, nfields, NULL);
+}
+
+
+/* Allocates memory for a record, from its arena if it has one */
+static void *__chidb_DBRecord_alloc(DBRecordBuffer *dbrb, size_t size)
+{
+    return dbrb->arena ? chidb_Arena_alloc(dbrb->arena, size) : malloc(size);
+}
+
+
+/* Create an empty record in an arena
+ *
+ * Same as chidb_DBRecord_create_empty, but all the memory of the record
+ * is allocated from an arena. The DBRecord returned by "finalize" goes
+ * away with the arena, and must not be destroyed.
+ *
+ * Parameters
+ * - dbrb: Pointer to an uninitialized DBRecordBuffer
+ * - nfields: Number of fields in the record
+ * - arena: Arena to allocate the record from (or NULL to use malloc)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_create_empty_arena(DBRecordBuffer *dbrb, uint8_t nfields, Arena *arena)
+{
+    dbrb->arena = arena;
     dbrb->buf_size = 1024;
     dbrb->field = 0;
     dbrb->offset = 0;
     dbrb->header_size = 1;
 
+    if ((dbrb->dbr = __chidb_DBRecord_alloc(dbrb, sizeof(DBRecord))) == NULL)
+        return CHIDB_ENOMEM;
+
     dbrb->dbr->nfields = nfields;
-    dbrb->dbr->types = malloc(dbrb->dbr->nfields * sizeof(uint32_t));
-    dbrb->dbr->offsets = malloc(dbrb->dbr->nfields * sizeof(uint32_t));
-    dbrb->dbr->data = malloc(dbrb->buf_size);
+    dbrb->dbr->types = __chidb_DBRecord_alloc(dbrb, dbrb->dbr->nfields * sizeof(uint32_t));
+    dbrb->dbr->offsets = __chidb_DBRecord_alloc(dbrb, dbrb->dbr->nfields * sizeof(uint32_t));
+    dbrb->dbr->data = __chidb_DBRecord_alloc(dbrb, dbrb->buf_size);
+    if (dbrb->dbr->data == NULL || (nfields > 0 && (dbrb->dbr->types == NULL || dbrb->dbr->offsets == NULL)))
+        return CHIDB_ENOMEM;
+
+    return CHIDB_OK;
+}
+
+
+/* Makes room for len more bytes of data in a DBRecordBuffer */
+static int __chidb_DBRecord_reserve(DBRecordBuffer *dbrb, uint32_t len)
+{
+    uint32_t size = dbrb->buf_size;
+    uint8_t *data;
+
+    if (dbrb->offset + len <= size)
+        return CHIDB_OK;
+
+    while (dbrb->offset + len > size)
+        size += 1024;
+
+    if (dbrb->arena)
+    {
+        if ((data = chidb_Arena_alloc(dbrb->arena, size)) != NULL)
+            memcpy(data, dbrb->dbr->data, dbrb->offset);
+    }
+    else
+        data = realloc(dbrb->dbr->data, size);
+
+    if (data == NULL)
+        return CHIDB_ENOMEM;
+
+    dbrb->dbr->data = data;
+    dbrb->buf_size = size;
 
     return CHIDB_OK;
 }
@@ -122,11 +186,8 @@ int chidb_DBRecord_appendInt8(DBRecordBuffer *dbrb, int8_t v)
     dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
 
     dbrb->dbr->types[dbrb->field] = SQL_INTEGER_1BYTE;
-    if (dbrb->offset + 1 > dbrb->buf_size)
-    {
-        dbrb->buf_size += 1024;
-        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
-    }
+    if (__chidb_DBRecord_reserve(dbrb, 1) != CHIDB_OK)
+        return CHIDB_ENOMEM;
     dbrb->dbr->data[dbrb->offset] = v;
     dbrb->offset += 1;
     dbrb->header_size++;
@@ -151,11 +212,8 @@ int chidb_DBRecord_appendInt16(DBRecordBuffer *dbrb, int16_t v)
     dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
 
     dbrb->dbr->types[dbrb->field] = SQL_INTEGER_2BYTE;
-    if (dbrb->offset + 2 > dbrb->buf_size)
-    {
-        dbrb->buf_size += 1024;
-        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
-    }
+    if (__chidb_DBRecord_reserve(dbrb, 2) != CHIDB_OK)
+        return CHIDB_ENOMEM;
     put2byte(&dbrb->dbr->data[dbrb->offset], v);
     dbrb->offset += 2;
     dbrb->header_size++;
@@ -180,11 +238,8 @@ int chidb_DBRecord_appendInt32(DBRecordBuffer *dbrb, int32_t v)
     dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
 
     dbrb->dbr->types[dbrb->field] = SQL_INTEGER_4BYTE;
-    if (dbrb->offset + 4 > dbrb->buf_size)
-    {
-        dbrb->buf_size += 1024;
-        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
-    }
+    if (__chidb_DBRecord_reserve(dbrb, 4) != CHIDB_OK)
+        return CHIDB_ENOMEM;
     put4byte(&dbrb->dbr->data[dbrb->offset], v);
     dbrb->offset += 4;
     dbrb->header_size++;
@@ -193,6 +248,87 @@ int chidb_DBRecord_appendInt32(DBRecordBuffer *dbrb, int32_t v)
     return CHIDB_OK;
 }
 
+
+/* Append an 8-byte integer to an initialized DBRecordBuffer
+ *
+ * Parameters
+ * - dbrb: Initialized DBRecordBuffer
+ * - v: Value to append
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_appendInt64(DBRecordBuffer *dbrb, int64_t v)
+{
+    dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
+
+    dbrb->dbr->types[dbrb->field] = SQL_INTEGER_8BYTE;
+    if (__chidb_DBRecord_reserve(dbrb, 8) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    put8byte(&dbrb->dbr->data[dbrb->offset], (uint64_t) v);
+    dbrb->offset += 8;
+    dbrb->header_size++;
+    dbrb->field++;
+
+    return CHIDB_OK;
+}
+
+
+/* Append an integer to an initialized DBRecordBuffer, using the
+ * smallest integer type that holds it
+ *
+ * Parameters
+ * - dbrb: Initialized DBRecordBuffer
+ * - v: Value to append
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_appendInteger(DBRecordBuffer *dbrb, int64_t v)
+{
+    if (v >= INT8_MIN && v <= INT8_MAX)
+        return chidb_DBRecord_appendInt8(dbrb, (int8_t) v);
+    else if (v >= INT16_MIN && v <= INT16_MAX)
+        return chidb_DBRecord_appendInt16(dbrb, (int16_t) v);
+    else if (v >= INT32_MIN && v <= INT32_MAX)
+        return chidb_DBRecord_appendInt32(dbrb, (int32_t) v);
+    else
+        return chidb_DBRecord_appendInt64(dbrb, v);
+}
+
+
+/* Append a floating point number to an initialized DBRecordBuffer
+ *
+ * The number is stored as a big-endian IEEE 754 double.
+ *
+ * Parameters
+ * - dbrb: Initialized DBRecordBuffer
+ * - v: Value to append
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_appendDouble(DBRecordBuffer *dbrb, double v)
+{
+    uint64_t bits;
+
+    dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
+
+    dbrb->dbr->types[dbrb->field] = SQL_REAL;
+    if (__chidb_DBRecord_reserve(dbrb, 8) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    memcpy(&bits, &v, sizeof(bits));
+    put8byte(&dbrb->dbr->data[dbrb->offset], bits);
+    dbrb->offset += 8;
+    dbrb->header_size++;
+    dbrb->field++;
+
+    return CHIDB_OK;
+}
+
 /* Append a NULL value to an initialized DBRecordBuffer
  *
  * Parameters
@@ -224,21 +360,32 @@ int chidb_DBRecord_appendNull(DBRecordBuffer *dbrb)
  */
 int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v)
 {
-    int len;
+    return chidb_DBRecord_appendText(dbrb, v, strlen(v));
+}
+
 
+/* Append a string of a given length to an initialized DBRecordBuffer
+ *
+ * Parameters
+ * - dbrb: Initialized DBRecordBuffer
+ * - v: Value to append (it does not need to be NUL-terminated)
+ * - len: Length of the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_appendText(DBRecordBuffer *dbrb, const char *v, uint32_t len)
+{
     dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
 
-    len = strlen(v);
-    if (dbrb->offset + len > dbrb->buf_size)
-    {
-        dbrb->buf_size += 1024;
-        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
-    }
+    if (__chidb_DBRecord_reserve(dbrb, len) != CHIDB_OK)
+        return CHIDB_ENOMEM;
     memcpy(&dbrb->dbr->data[dbrb->offset], v, len);
     dbrb->offset += len;
     dbrb->dbr->types[dbrb->field] = len * 2 + SQL_TEXT;
     dbrb->field++;
-    dbrb->header_size += 4;
+    dbrb->header_size += varintLen32(len * 2 + SQL_TEXT);
 
     return CHIDB_OK;
 }
@@ -260,7 +407,8 @@ int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v)
 int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr)
 {
     dbrb->dbr->nfields = dbrb->field;
-    dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->offset);
+    if (dbrb->arena == NULL && dbrb->offset > 0)
+        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->offset);
     dbrb->dbr->data_len = dbrb->offset;
     dbrb->dbr->packed_len = dbrb->header_size + dbrb->offset;
 
@@ -289,21 +437,11 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
     (*dbr)->nfields = 0;
 
     uint8_t header_size = raw[0];
-    uint8_t header_pos = 1;
+    uint32_t header_pos = 1;
     (*dbr)->types = malloc(0xFF * sizeof(uint32_t));
     while(header_pos < header_size)
     {
-        if (raw[header_pos] & 0x80)
-        {
-            getVarint32(&raw[header_pos], &(*dbr)->types[(*dbr)->nfields]);
-            header_pos += 4;
-        }
-        else
-        {
-            (*dbr)->types[(*dbr)->nfields] = raw[header_pos];
-            header_pos += 1;
-        }
-
+        header_pos += getVarint32(&raw[header_pos], &(*dbr)->types[(*dbr)->nfields]);
         (*dbr)->nfields++;
     }
     (*dbr)->types = realloc((*dbr)->types, (*dbr)->nfields * sizeof(uint32_t));
@@ -315,21 +453,8 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
     for(int i=0; i<(*dbr)->nfields; i++)
     {
         (*dbr)->offsets[i] = offset;
-        int type = chidb_DBRecord_getType(*dbr, i);
-        if (type == SQL_NULL)
-            offset += 0;
-        else if (type == SQL_INTEGER_1BYTE)
-            offset += 1;
-        else if (type == SQL_INTEGER_2BYTE)
-            offset += 2;
-        else if (type == SQL_INTEGER_4BYTE)
-            offset += 4;
-        else if (type == SQL_TEXT)
-        {
-            int len;
-            chidb_DBRecord_getStringLength(*dbr, i, &len);
-            offset += len;
-        }
+        if (chidb_DBRecord_getType(*dbr, i) != SQL_NOTVALID)
+            offset += chidb_DBRecord_typeLen((*dbr)->types[i]);
     }
 
     (*dbr)->data_len = offset;
@@ -357,25 +482,30 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
 int chidb_DBRecord_pack(DBRecord *dbr, uint8_t **p)
 {
     *p = malloc(dbr->packed_len);
-    if (p == NULL)
+    if (*p == NULL)
         return CHIDB_ENOMEM;
-    (*p)[0] = dbr->packed_len - dbr->data_len;
 
-    uint8_t header_pos = 1;
+    return chidb_DBRecord_packInto(dbr, *p);
+}
+
+
+/* Write the raw binary database record of a DBRecord to a buffer
+ *
+ * Parameters
+ * - dbr: The DBRecord
+ * - p: Buffer with room for at least dbr->packed_len bytes
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_DBRecord_packInto(DBRecord *dbr, uint8_t *p)
+{
+    p[0] = dbr->packed_len - dbr->data_len;
+
+    uint32_t header_pos = 1;
     for(int i=0; i < dbr->nfields; i++)
-    {
-        if (chidb_DBRecord_getType(dbr, i) == SQL_TEXT)
-        {
-            putVarint32(*p + header_pos, dbr->types[i]);
-            header_pos +=4;
-        }
-        else
-        {
-            (*p)[header_pos] = dbr->types[i];
-            header_pos +=1;
-        }
-    }
-    memcpy(*p + (*p)[0], dbr->data, dbr->data_len);
+        header_pos += putVarint32(p + header_pos, dbr->types[i]);
+    memcpy(p + p[0], dbr->data, dbr->data_len);
 
     return CHIDB_OK;
 }
@@ -389,13 +519,14 @@ int chidb_DBRecord_pack(DBRecord *dbr, uint8_t **p)
  *
  * Return
  * - SQL_NULL, SQL_INTEGER_1BYTE, SQL_INTEGER_2BYTE, SQL_INTEGER_4BYTE,
- *   or SQL_TEXT depending on the field type.
+ *   SQL_INTEGER_8BYTE, SQL_REAL or SQL_TEXT depending on the field type.
  * - SQL_NOTVALID if the specified field has an invalid field type.
  */
 int chidb_DBRecord_getType(DBRecord *dbr, uint8_t field)
 {
     if(dbr->types[field] == SQL_NULL || dbr->types[field] == SQL_INTEGER_1BYTE ||
-            dbr->types[field] == SQL_INTEGER_2BYTE || dbr->types[field] == SQL_INTEGER_4BYTE)
+            dbr->types[field] == SQL_INTEGER_2BYTE || dbr->types[field] == SQL_INTEGER_4BYTE ||
+            dbr->types[field] == SQL_INTEGER_8BYTE || dbr->types[field] == SQL_REAL)
         return dbr->types[field];
     else if ((dbr->types[field] - SQL_TEXT) % 2 == 0)
         return SQL_TEXT;
@@ -458,6 +589,42 @@ int chidb_DBRecord_getInt32(DBRecord *dbr, uint8_t field, int32_t *v)
 }
 
 
+/* Returns the value of an 8-byte integer field
+ *
+ * Parameters
+ * - dbr: The DBRecord
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_DBRecord_getInt64(DBRecord *dbr, uint8_t field, int64_t *v)
+{
+    *v = (int64_t) get8byte(&dbr->data[dbr->offsets[field]]);
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the value of a floating point field
+ *
+ * Parameters
+ * - dbr: The DBRecord
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_DBRecord_getDouble(DBRecord *dbr, uint8_t field, double *v)
+{
+    *v = chidb_DBRecord_rawReal(&dbr->data[dbr->offsets[field]]);
+
+    return CHIDB_OK;
+}
+
+
 /* Returns the value of a string field
  *
  * Parameters
@@ -500,6 +667,195 @@ int chidb_DBRecord_getStringLength(DBRecord *dbr, uint8_t field, int *len)
 }
 
 
+/* Reads the next field of a raw binary database record
+ *
+ * Parameters
+ * - raw: Pointer to first byte of raw binary database record
+ * - hpos: In/out parameter. Position of the field's entry in the header.
+ *         Must be 1 for the first field.
+ * - dpos: In/out parameter. Offset of the field's value in the record.
+ *         Must be the header size (raw[0]) for the first field.
+ * - type: Out parameter used to return the field's type (as stored in
+ *         the header)
+ * - value: Out parameter used to return a pointer to the field's value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The record has no more fields
+ */
+int chidb_DBRecord_nextRawField(const uint8_t *raw, uint32_t *hpos, uint32_t *dpos,
+                                uint32_t *type, const uint8_t **value)
+{
+    if (*hpos >= raw[0])
+        return CHIDB_ENOTFOUND;
+
+    *hpos += getVarint32(&raw[*hpos], type);
+    *value = &raw[*dpos];
+    *dpos += chidb_DBRecord_typeLen(*type);
+
+    return CHIDB_OK;
+}
+
+
+/* Compares the leading fields of two raw binary database records
+ *
+ * Records are compared field by field, without unpacking them. NULL
+ * sorts before any number, and numbers sort before strings. Strings
+ * are compared byte by byte. A record with fewer fields than nkeys
+ * compares as if the missing fields were NULL.
+ *
+ * Parameters
+ * - r1: Pointer to first byte of a raw binary database record
+ * - r2: Pointer to first byte of a raw binary database record
+ * - nkeys: Number of leading fields to compare
+ * - order: Sort direction of each field: '+' for ascending and '-' for
+ *          descending. If NULL, all fields are compared in ascending order.
+ *
+ * Return
+ * - A negative value if r1 sorts before r2, zero if their leading fields
+ *   are equal, and a positive value if r1 sorts after r2.
+ */
+int chidb_DBRecord_compareRaw(const uint8_t *r1, const uint8_t *r2, uint8_t nkeys, const char *order)
+{
+    uint32_t hpos1 = 1, hpos2 = 1;
+    uint32_t dpos1 = r1[0], dpos2 = r2[0];
+
+    for(int i=0; i < nkeys; i++)
+    {
+        uint32_t t1 = SQL_NULL, t2 = SQL_NULL;
+        const uint8_t *v1 = NULL, *v2 = NULL;
+        int cmp;
+
+        chidb_DBRecord_nextRawField(r1, &hpos1, &dpos1, &t1, &v1);
+        chidb_DBRecord_nextRawField(r2, &hpos2, &dpos2, &t2, &v2);
+
+        cmp = chidb_DBRecord_compareRawValue(t1, v1, t2, v2);
+        if (cmp != 0)
+            return (order != NULL && order[i] == '-') ? -cmp : cmp;
+    }
+
+    return 0;
+}
+
+
+/* Compares two values stored in raw binary database records
+ *
+ * NULL sorts before any number, and numbers sort before strings.
+ * Integers and floating point numbers are compared by value (as doubles
+ * if one of them is a floating point number). Strings are compared
+ * byte by byte.
+ *
+ * Parameters
+ * - t1, v1: Type (as stored in the record header) and value of the first field
+ * - t2, v2: Type (as stored in the record header) and value of the second field
+ *
+ * Return
+ * - A negative value if the first value sorts before the second one, zero
+ *   if they are equal, and a positive value if it sorts after it.
+ */
+int chidb_DBRecord_compareRawValue(uint32_t t1, const uint8_t *v1, uint32_t t2, const uint8_t *v2)
+{
+    /* 0: NULL, 1: number, 2: string */
+    int cls1 = t1 == SQL_NULL ? 0 : (t1 <= SQL_REAL ? 1 : 2);
+    int cls2 = t2 == SQL_NULL ? 0 : (t2 <= SQL_REAL ? 1 : 2);
+    int cmp = 0;
+
+    if (cls1 != cls2)
+        cmp = cls1 - cls2;
+    else if (cls1 == 1 && t1 != SQL_REAL && t2 != SQL_REAL)
+    {
+        int64_t i1 = chidb_DBRecord_rawInt(v1, t1);
+        int64_t i2 = chidb_DBRecord_rawInt(v2, t2);
+        cmp = (i1 > i2) - (i1 < i2);
+    }
+    else if (cls1 == 1)
+    {
+        double d1 = t1 == SQL_REAL ? chidb_DBRecord_rawReal(v1) : (double) chidb_DBRecord_rawInt(v1, t1);
+        double d2 = t2 == SQL_REAL ? chidb_DBRecord_rawReal(v2) : (double) chidb_DBRecord_rawInt(v2, t2);
+        cmp = (d1 > d2) - (d1 < d2);
+    }
+    else if (cls1 == 2)
+    {
+        uint32_t len1 = (t1 - SQL_TEXT) / 2;
+        uint32_t len2 = (t2 - SQL_TEXT) / 2;
+        cmp = memcmp(v1, v2, len1 < len2 ? len1 : len2);
+        if (cmp == 0)
+            cmp = (len1 > len2) - (len1 < len2);
+    }
+
+    return cmp;
+}
+
+
+/* Decodes an integer value stored in a raw binary database record
+ *
+ * Parameters
+ * - value: Pointer to the first byte of the value
+ * - type: SQL_INTEGER_1BYTE, SQL_INTEGER_2BYTE, SQL_INTEGER_4BYTE, or
+ *         SQL_INTEGER_8BYTE
+ *
+ * Return
+ * - The (signed) value of the integer
+ */
+int64_t chidb_DBRecord_rawInt(const uint8_t *value, uint32_t type)
+{
+    switch(type)
+    {
+        case SQL_INTEGER_1BYTE:
+            return (int8_t) value[0];
+        case SQL_INTEGER_2BYTE:
+            return (int16_t) get2byte(value);
+        case SQL_INTEGER_4BYTE:
+            return (int32_t) get4byte(value);
+        case SQL_INTEGER_8BYTE:
+            return (int64_t) get8byte(value);
+        default:
+            return 0;
+    }
+}
+
+
+/* Decodes a floating point value (SQL_REAL) stored in a raw binary
+ * database record
+ *
+ * Parameters
+ * - value: Pointer to the first byte of the value
+ *
+ * Return
+ * - The value
+ */
+double chidb_DBRecord_rawReal(const uint8_t *value)
+{
+    uint64_t bits = get8byte(value);
+    double v;
+
+    memcpy(&v, &bits, sizeof(v));
+
+    return v;
+}
+
+
+/* Returns the length of a value of a given type
+ *
+ * Parameters
+ * - type: Type of the value (as stored in the record header)
+ *
+ * Return
+ * - The number of bytes the value takes up in the record
+ */
+uint32_t chidb_DBRecord_typeLen(uint32_t type)
+{
+    if (type == SQL_NULL)
+        return 0;
+    else if (type == SQL_INTEGER_1BYTE || type == SQL_INTEGER_2BYTE || type == SQL_INTEGER_4BYTE)
+        return type;
+    else if (type == SQL_INTEGER_8BYTE || type == SQL_REAL)
+        return 8;
+    else
+        return (type - SQL_TEXT) / 2;
+}
+
+
 /* Prints a string representation of a database record to stdout
  *
  * Parameters
@@ -533,6 +889,18 @@ int chidb_DBRecord_print(DBRecord *dbr)
             chidb_DBRecord_getInt32(dbr, i, (int32_t *) &i32);
             printf("| %i ", i32);
         }
+        else if (type == SQL_INTEGER_8BYTE)
+        {
+            int64_t i64;
+            chidb_DBRecord_getInt64(dbr, i, &i64);
+            printf("| %" PRId64 " ", i64);
+        }
+        else if (type == SQL_REAL)
+        {
+            double d;
+            chidb_DBRecord_getDouble(dbr, i, &d);
+            printf("| %.15g ", d);
+        }
         else if (type == SQL_TEXT)
         {
             char *s;
@@ -561,8 +929,10 @@ int chidb_DBRecord_print(DBRecord *dbr)
  * - i1: A 1-byte integer
  * - i2: A 2-byte integer
  * . i4: A 4-byte integer
+ * - i8: An 8-byte integer
+ * - r: A floating point number
  *
- * For example, "|s|0|i1|i2|i4|".
+ * For example, "|s|0|i1|i2|i4|i8|r|".
  *
  * Parameters
  * - dbr: Out parameter to return the DBRecord
@@ -596,6 +966,7 @@ int chidb_DBRecord_create(DBRecord **dbr, const char *spec, ...)
         uint8_t i8;
         uint16_t i16;
         uint32_t i32;
+        int64_t i64;
 
         switch(*aux++)
         {
@@ -615,10 +986,18 @@ int chidb_DBRecord_create(DBRecord **dbr, const char *spec, ...)
                 i32 = va_arg(args, int);
                 chidb_DBRecord_appendInt32(&dbrb, i32);
                 break;
+            case '8':
+                i64 = va_arg(args, int64_t);
+                chidb_DBRecord_appendInt64(&dbrb, i64);
+                break;
             }
 
             break;
 
+        case 'r':
+            chidb_DBRecord_appendDouble(&dbrb, va_arg(args, double));
+            break;
+
         case '0':
             chidb_DBRecord_appendNull(&dbrb);
             break;
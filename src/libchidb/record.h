@@ -41,6 +41,7 @@
 #define RECORD_H_
 
 #include "chidbInt.h"
+#include "arena.h"
 
 struct DBRecord
 {
@@ -56,34 +57,53 @@ typedef struct DBRecord DBRecord;
 struct DBRecordBuffer
 {
     DBRecord *dbr;
-    uint16_t buf_size;
+    uint32_t buf_size;
     uint8_t field;
     uint32_t offset;
     uint8_t header_size;
+
+    /* Arena the record is allocated from (NULL if it is malloc'd) */
+    Arena *arena;
 };
 typedef struct DBRecordBuffer DBRecordBuffer;
 
 int chidb_DBRecord_create(DBRecord **dbr, const char *, ...);
 
 int chidb_DBRecord_create_empty(DBRecordBuffer *dbrb, uint8_t nfields);
+int chidb_DBRecord_create_empty_arena(DBRecordBuffer *dbrb, uint8_t nfields, Arena *arena);
 int chidb_DBRecord_appendInt8(DBRecordBuffer *dbrb, int8_t v);
 int chidb_DBRecord_appendInt16(DBRecordBuffer *dbrb, int16_t v);
 int chidb_DBRecord_appendInt32(DBRecordBuffer *dbrb, int32_t v);
+int chidb_DBRecord_appendInt64(DBRecordBuffer *dbrb, int64_t v);
+int chidb_DBRecord_appendInteger(DBRecordBuffer *dbrb, int64_t v);
+int chidb_DBRecord_appendDouble(DBRecordBuffer *dbrb, double v);
 int chidb_DBRecord_appendNull(DBRecordBuffer *dbrb);
 int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v);
+int chidb_DBRecord_appendText(DBRecordBuffer *dbrb, const char *v, uint32_t len);
 int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr);
 
 int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *);
 int chidb_DBRecord_pack(DBRecord *dbr, uint8_t **);
+int chidb_DBRecord_packInto(DBRecord *dbr, uint8_t *p);
 
 int chidb_DBRecord_getType(DBRecord *dbr, uint8_t field);
 
 int chidb_DBRecord_getInt8(DBRecord *dbr, uint8_t field, int8_t *v);
 int chidb_DBRecord_getInt16(DBRecord *dbr, uint8_t field, int16_t *v);
 int chidb_DBRecord_getInt32(DBRecord *dbr, uint8_t field, int32_t *v);
+int chidb_DBRecord_getInt64(DBRecord *dbr, uint8_t field, int64_t *v);
+int chidb_DBRecord_getDouble(DBRecord *dbr, uint8_t field, double *v);
 int chidb_DBRecord_getString(DBRecord *dbr, uint8_t field, char **v);
 int chidb_DBRecord_getStringLength(DBRecord *dbr, uint8_t field, int *len);
 
+int chidb_DBRecord_nextRawField(const uint8_t *raw, uint32_t *hpos, uint32_t *dpos,
+                                uint32_t *type, const uint8_t **value);
+int chidb_DBRecord_compareRaw(const uint8_t *r1, const uint8_t *r2, uint8_t nkeys, const char *order);
+int chidb_DBRecord_compareRawValue(uint32_t t1, const uint8_t *v1, uint32_t t2, const uint8_t *v2);
+int64_t chidb_DBRecord_rawInt(const uint8_t *value, uint32_t type);
+double chidb_DBRecord_rawReal(const uint8_t *value);
+uint32_t chidb_DBRecord_typeLen(uint32_t type);
+
 int chidb_DBRecord_print(DBRecord *dbr);
 
 
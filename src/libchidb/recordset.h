@@ -0,0 +1,86 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Record sets (for DISTINCT and set operations) -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef RECORDSET_H_
+#define RECORDSET_H_
+
+#include "chidbInt.h"
+#include "hash.h"
+#include "btree.h"
+
+/* Default amount of record memory a record set may hold before new
+ * records are spilled to a temporary B-Tree */
+#define RECSET_DEFAULT_BUDGET (1024 * 1024)
+
+/* Records larger than this are always kept in memory, as they
+ * would not fit in a single B-Tree cell */
+#define RECSET_MAX_SPILL_SIZE (256)
+
+/* Keys of the temporary B-Tree are record hashes. B-Tree keys are
+ * stored as 4-byte varints, which only hold 28 bits. */
+#define RECSET_KEY_MASK (0x0FFFFFFF)
+
+/* A set of records (packed DBRecords), compared byte by byte.
+ *
+ * Records are kept in a hash table until the memory they use exceeds
+ * the set's budget. From then on, new records go to a temporary table
+ * B-Tree keyed by the hash of the record (collisions are resolved by
+ * linear probing on the key), so the set can grow beyond the available
+ * memory.
+ */
+struct RecordSet
+{
+    HashTable *mem;
+    size_t budget;
+
+    /* Temporary B-Tree (opened the first time a record is spilled).
+     * chidb_Btree_open needs a database to attach the B-Tree to. */
+    chidb spill_db;
+    BTree *spill;
+    uint32_t nspilled;
+};
+typedef struct RecordSet RecordSet;
+
+int chidb_RecordSet_open(RecordSet **set, size_t budget);
+int chidb_RecordSet_insert(RecordSet *set, const uint8_t *rec, uint32_t nrec);
+int chidb_RecordSet_contains(RecordSet *set, const uint8_t *rec, uint32_t nrec);
+int chidb_RecordSet_close(RecordSet *set);
+
+#endif /*RECORDSET_H_*/
@@ -0,0 +1,623 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  External merge sorter
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ *  The sorter accepts packed database records (as produced by MakeRecord)
+ *  and returns them in the order given by their leading key fields.
+ *
+ *  Records are accumulated in memory until they exceed the sorter's
+ *  memory budget. At that point, the records in memory are sorted and
+ *  written out to a temporary file as a sorted "run". Once all records
+ *  have been inserted, the runs are merged with a k-way merge driven by
+ *  a loser tree, so each record is produced with O(log k) comparisons.
+ *  If no run was ever spilled, the records are simply sorted in memory.
+ *
+ *  Sorting is stable: records with equal keys are returned in the
+ *  order in which they were inserted.
+ *
+ *  If only the first N records will be read (e.g., ORDER BY ... LIMIT N),
+ *  the sorter can be given a limit. It then keeps the N smallest records
+ *  seen so far in a max-heap, so a new record only has to be compared
+ *  with the largest one kept, and memory stays bounded by N records. If
+ *  those N records exceed the budget anyway, the sorter falls back to
+ *  spilling runs (the records dropped so far can't be among the first N).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <chidb/log.h>
+
+#include "chidbInt.h"
+#include "sorter.h"
+#include "record.h"
+#include "util.h"
+
+
+/* Compares two records using the sorter's key (and their insertion
+ * order, if the keys are equal) */
+static inline int __chidb_Sorter_cmp(Sorter *sorter, SorterRecord *r1, SorterRecord *r2)
+{
+    int cmp = chidb_DBRecord_compareRaw(r1->bytes, r2->bytes, sorter->nkeys, sorter->order);
+
+    if (cmp == 0)
+        cmp = (r1->seq > r2->seq) - (r1->seq < r2->seq);
+
+    return cmp;
+}
+
+
+/* Moves record i of the heap up until its parent is not smaller */
+static void __chidb_Sorter_siftUp(Sorter *sorter, uint32_t i)
+{
+    SorterRecord tmp;
+
+    while (i > 0 && __chidb_Sorter_cmp(sorter, &sorter->recs[(i - 1) / 2], &sorter->recs[i]) < 0)
+    {
+        tmp = sorter->recs[i];
+        sorter->recs[i] = sorter->recs[(i - 1) / 2];
+        sorter->recs[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+
+/* Moves record i of the heap down until its children are not larger */
+static void __chidb_Sorter_siftDown(Sorter *sorter, uint32_t i)
+{
+    SorterRecord tmp;
+    uint32_t largest, child;
+
+    for(;;)
+    {
+        largest = i;
+        for(child = 2 * i + 1; child <= 2 * i + 2 && child < sorter->nrecs; child++)
+            if (__chidb_Sorter_cmp(sorter, &sorter->recs[child], &sorter->recs[largest]) > 0)
+                largest = child;
+
+        if (largest == i)
+            return;
+
+        tmp = sorter->recs[i];
+        sorter->recs[i] = sorter->recs[largest];
+        sorter->recs[largest] = tmp;
+        i = largest;
+    }
+}
+
+
+/* Stable merge sort of the in-memory records (recs[lo..hi-1]) */
+static void __chidb_Sorter_mergesort(Sorter *sorter, SorterRecord *recs, SorterRecord *tmp,
+                                     uint32_t lo, uint32_t hi)
+{
+    uint32_t mid, i, j, k;
+
+    if (hi - lo < 2)
+        return;
+
+    mid = lo + (hi - lo) / 2;
+    __chidb_Sorter_mergesort(sorter, recs, tmp, lo, mid);
+    __chidb_Sorter_mergesort(sorter, recs, tmp, mid, hi);
+
+    /* Already in order? */
+    if (__chidb_Sorter_cmp(sorter, &recs[mid - 1], &recs[mid]) <= 0)
+        return;
+
+    memcpy(&tmp[lo], &recs[lo], (hi - lo) * sizeof(SorterRecord));
+    for(i = lo, j = mid, k = lo; k < hi; k++)
+    {
+        if (j >= hi || (i < mid && __chidb_Sorter_cmp(sorter, &tmp[i], &tmp[j]) <= 0))
+            recs[k] = tmp[i++];
+        else
+            recs[k] = tmp[j++];
+    }
+}
+
+
+/* Sorts the records currently held in memory */
+static int __chidb_Sorter_sortMemory(Sorter *sorter)
+{
+    SorterRecord *tmp;
+
+    if (sorter->nrecs < 2)
+        return CHIDB_OK;
+
+    tmp = malloc(sorter->nrecs * sizeof(SorterRecord));
+    if (tmp == NULL)
+        return CHIDB_ENOMEM;
+
+    __chidb_Sorter_mergesort(sorter, sorter->recs, tmp, 0, sorter->nrecs);
+
+    free(tmp);
+
+    return CHIDB_OK;
+}
+
+
+/* Sorts the records in memory and writes them to a new run
+ *
+ * Each record is written as a 4-byte length followed by the
+ * packed record. The in-memory records are freed afterwards.
+ */
+static int __chidb_Sorter_spill(Sorter *sorter)
+{
+    SorterRun *run;
+    uint8_t len[4];
+    int rc;
+
+    if (sorter->nrecs == 0)
+        return CHIDB_OK;
+
+    if ((rc = __chidb_Sorter_sortMemory(sorter)) != CHIDB_OK)
+        return rc;
+
+    run = realloc(sorter->runs, (sorter->nruns + 1) * sizeof(SorterRun));
+    if (run == NULL)
+        return CHIDB_ENOMEM;
+    sorter->runs = run;
+    run = &sorter->runs[sorter->nruns];
+
+    run->f = tmpfile();
+    if (run->f == NULL)
+    {
+        chilog(ERROR, "Sorter: could not create temporary file for run %i", sorter->nruns);
+        return CHIDB_EIO;
+    }
+    run->head.bytes = NULL;
+    run->head.nbytes = 0;
+    run->head.seq = 0;
+    run->buf_size = 0;
+    run->eof = false;
+    sorter->nruns++;
+
+    for(uint32_t i = 0; i < sorter->nrecs; i++)
+    {
+        put4byte(len, sorter->recs[i].nbytes);
+        if (fwrite(len, 4, 1, run->f) != 1 ||
+            fwrite(sorter->recs[i].bytes, sorter->recs[i].nbytes, 1, run->f) != 1)
+            return CHIDB_EIO;
+        free(sorter->recs[i].bytes);
+    }
+
+    chilog(DEBUG, "Sorter: spilled run %i (%i records, %zu bytes)",
+           sorter->nruns - 1, sorter->nrecs, sorter->mem_used);
+
+    sorter->nrecs = 0;
+    sorter->mem_used = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Reads the next record of a run into the run's head */
+static int __chidb_Sorter_readRun(SorterRun *run)
+{
+    uint8_t len[4];
+    uint32_t nbytes;
+
+    if (fread(len, 4, 1, run->f) != 1)
+    {
+        run->eof = true;
+        return CHIDB_OK;
+    }
+
+    nbytes = get4byte(len);
+    if (nbytes > run->buf_size)
+    {
+        uint8_t *buf = realloc(run->head.bytes, nbytes);
+        if (buf == NULL)
+            return CHIDB_ENOMEM;
+        run->head.bytes = buf;
+        run->buf_size = nbytes;
+    }
+
+    if (fread(run->head.bytes, nbytes, 1, run->f) != 1)
+        return CHIDB_EIO;
+    run->head.nbytes = nbytes;
+
+    return CHIDB_OK;
+}
+
+
+/* Is run r1 "greater" than run r2 (i.e., should r2 be merged first)?
+ *
+ * Index nruns denotes a virtual run whose head is smaller than anything
+ * (used only while building the tree). Exhausted runs are greater than
+ * everything else. Ties are broken by run number, which keeps the merge
+ * stable, since earlier runs contain earlier records.
+ */
+static bool __chidb_Sorter_greater(Sorter *sorter, uint32_t r1, uint32_t r2)
+{
+    int cmp;
+
+    if (r1 == sorter->nruns)
+        return false;
+    if (r2 == sorter->nruns)
+        return true;
+    if (sorter->runs[r1].eof || sorter->runs[r2].eof)
+        return sorter->runs[r1].eof && (!sorter->runs[r2].eof || r1 > r2);
+
+    cmp = __chidb_Sorter_cmp(sorter, &sorter->runs[r1].head, &sorter->runs[r2].head);
+
+    return cmp > 0 || (cmp == 0 && r1 > r2);
+}
+
+
+/* Replays the matches on the path from run r's leaf to the root */
+static void __chidb_Sorter_adjust(Sorter *sorter, uint32_t r)
+{
+    uint32_t winner = r, tmp;
+
+    for(uint32_t t = (r + sorter->nruns) / 2; t > 0; t /= 2)
+    {
+        if (__chidb_Sorter_greater(sorter, winner, sorter->tree[t]))
+        {
+            tmp = winner;
+            winner = sorter->tree[t];
+            sorter->tree[t] = tmp;
+        }
+    }
+
+    sorter->tree[0] = winner;
+}
+
+
+/* Positions the merge on the run at the root of the loser tree */
+static void __chidb_Sorter_mergeCurrent(Sorter *sorter)
+{
+    SorterRun *run = &sorter->runs[sorter->tree[0]];
+
+    sorter->current = run->eof ? NULL : &run->head;
+}
+
+
+/* Appends a copy of a record to the records held in memory */
+static int __chidb_Sorter_append(Sorter *sorter, uint8_t *bytes, uint32_t nbytes)
+{
+    SorterRecord *rec;
+
+    if (sorter->nrecs == sorter->recs_size)
+    {
+        uint32_t size = sorter->recs_size ? sorter->recs_size * 2 : 64;
+        rec = realloc(sorter->recs, size * sizeof(SorterRecord));
+        if (rec == NULL)
+            return CHIDB_ENOMEM;
+        sorter->recs = rec;
+        sorter->recs_size = size;
+    }
+
+    rec = &sorter->recs[sorter->nrecs];
+    rec->bytes = malloc(nbytes);
+    if (rec->bytes == NULL)
+        return CHIDB_ENOMEM;
+    memcpy(rec->bytes, bytes, nbytes);
+    rec->nbytes = nbytes;
+    rec->seq = sorter->nseq++;
+
+    sorter->nrecs++;
+    sorter->mem_used += nbytes + sizeof(SorterRecord);
+
+    return CHIDB_OK;
+}
+
+
+/* Create a new sorter
+ *
+ * Parameters
+ * - sorter: An out parameter. Used to return a pointer to the
+ *           newly created sorter.
+ * - nkeys: Number of leading record fields that make up the sort key
+ * - order: Sort direction of each key field ('+' ascending, '-'
+ *          descending). If NULL, all fields are sorted in ascending order.
+ * - budget: Number of bytes of records the sorter may keep in memory
+ *           before spilling a run to disk. If 0, SORTER_DEFAULT_BUDGET
+ *           is used.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EMISUSE: Too many key fields
+ */
+int chidb_Sorter_open(Sorter **sorter, uint8_t nkeys, const char *order, size_t budget)
+{
+    if (nkeys > SORTER_MAX_KEYS)
+        return CHIDB_EMISUSE;
+
+    *sorter = calloc(1, sizeof(Sorter));
+    if (*sorter == NULL)
+        return CHIDB_ENOMEM;
+
+    (*sorter)->nkeys = nkeys;
+    for(int i = 0; i < nkeys; i++)
+        (*sorter)->order[i] = (order != NULL && i < strlen(order)) ? order[i] : '+';
+
+    (*sorter)->budget = budget ? budget : SORTER_DEFAULT_BUDGET;
+
+    return CHIDB_OK;
+}
+
+
+/* Only keep the first records (in sort order) of a sorter
+ *
+ * Records that can't be among the first limit records are discarded
+ * as they are inserted. Must be called before inserting any record.
+ *
+ * Parameters
+ * - sorter: Sorter
+ * - limit: Number of records to keep. If 0, all records are kept.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Records have already been inserted
+ */
+int chidb_Sorter_setLimit(Sorter *sorter, uint32_t limit)
+{
+    if (sorter->sorted || sorter->nseq > 0)
+        return CHIDB_EMISUSE;
+
+    sorter->limit = limit;
+
+    return CHIDB_OK;
+}
+
+
+/* Add a record to a sorter
+ *
+ * The sorter makes its own copy of the record. If the records held
+ * in memory exceed the sorter's budget, they are spilled to a run.
+ * If the sorter has a limit and already holds that many records, the
+ * record replaces the largest one, or is discarded if it is larger.
+ *
+ * Parameters
+ * - sorter: Sorter
+ * - bytes: Packed database record
+ * - nbytes: Length of the packed record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error occurred while writing a run
+ * - CHIDB_EMISUSE: The sorter has already been sorted
+ */
+int chidb_Sorter_insert(Sorter *sorter, uint8_t *bytes, uint32_t nbytes)
+{
+    SorterRecord *rec;
+    int rc;
+
+    if (sorter->sorted)
+        return CHIDB_EMISUSE;
+
+    if (sorter->limit > 0 && sorter->nrecs == sorter->limit)
+    {
+        SorterRecord new = { bytes, nbytes, sorter->nseq++ };
+
+        /* Equal keys lose to the older record, so they're discarded too */
+        if (__chidb_Sorter_cmp(sorter, &new, &sorter->recs[0]) >= 0)
+            return CHIDB_OK;
+
+        rec = &sorter->recs[0];
+        if (nbytes > rec->nbytes)
+        {
+            uint8_t *buf = realloc(rec->bytes, nbytes);
+            if (buf == NULL)
+                return CHIDB_ENOMEM;
+            rec->bytes = buf;
+        }
+        memcpy(rec->bytes, bytes, nbytes);
+        sorter->mem_used += nbytes;
+        sorter->mem_used -= rec->nbytes;
+        rec->nbytes = nbytes;
+        rec->seq = new.seq;
+
+        __chidb_Sorter_siftDown(sorter, 0);
+    }
+    else
+    {
+        if ((rc = __chidb_Sorter_append(sorter, bytes, nbytes)) != CHIDB_OK)
+            return rc;
+
+        if (sorter->limit > 0)
+            __chidb_Sorter_siftUp(sorter, sorter->nrecs - 1);
+    }
+
+    if (sorter->mem_used > sorter->budget)
+    {
+        /* The first limit records don't fit: keep everything from now on */
+        sorter->limit = 0;
+        return __chidb_Sorter_spill(sorter);
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Sort the records and position the sorter on the first one
+ *
+ * If no runs were spilled, the records are sorted in memory.
+ * Otherwise, the remaining records are spilled to a final run,
+ * and the runs are merged with a loser tree.
+ *
+ * Parameters
+ * - sorter: Sorter
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: The sorter contains no records
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error occurred while reading or writing a run
+ */
+int chidb_Sorter_sort(Sorter *sorter)
+{
+    int rc;
+
+    if (sorter->sorted)
+        return CHIDB_EMISUSE;
+    sorter->sorted = true;
+
+    if (sorter->nruns == 0)
+    {
+        sorter->merging = false;
+        if ((rc = __chidb_Sorter_sortMemory(sorter)) != CHIDB_OK)
+            return rc;
+
+        sorter->pos = 0;
+        sorter->current = sorter->nrecs > 0 ? &sorter->recs[0] : NULL;
+    }
+    else
+    {
+        sorter->merging = true;
+        if ((rc = __chidb_Sorter_spill(sorter)) != CHIDB_OK)
+            return rc;
+
+        for(uint32_t i = 0; i < sorter->nruns; i++)
+        {
+            rewind(sorter->runs[i].f);
+            if ((rc = __chidb_Sorter_readRun(&sorter->runs[i])) != CHIDB_OK)
+                return rc;
+        }
+
+        sorter->tree = malloc(sorter->nruns * sizeof(uint32_t));
+        if (sorter->tree == NULL)
+            return CHIDB_ENOMEM;
+        for(uint32_t i = 0; i < sorter->nruns; i++)
+            sorter->tree[i] = sorter->nruns;
+        for(uint32_t i = sorter->nruns; i > 0; i--)
+            __chidb_Sorter_adjust(sorter, i - 1);
+
+        __chidb_Sorter_mergeCurrent(sorter);
+    }
+
+    return sorter->current == NULL ? CHIDB_EEMPTY : CHIDB_OK;
+}
+
+
+/* Advance a sorted sorter to its next record
+ *
+ * Parameters
+ * - sorter: Sorter
+ *
+ * Return
+ * - CHIDB_OK: The sorter is positioned on the next record
+ * - CHIDB_DONE: There are no more records
+ * - CHIDB_EIO: An I/O error occurred while reading a run
+ */
+int chidb_Sorter_next(Sorter *sorter)
+{
+    int rc;
+
+    if (!sorter->sorted || sorter->current == NULL)
+        return CHIDB_DONE;
+
+    if (!sorter->merging)
+    {
+        sorter->pos++;
+        sorter->current = sorter->pos < sorter->nrecs ? &sorter->recs[sorter->pos] : NULL;
+    }
+    else
+    {
+        uint32_t r = sorter->tree[0];
+
+        if ((rc = __chidb_Sorter_readRun(&sorter->runs[r])) != CHIDB_OK)
+            return rc;
+        __chidb_Sorter_adjust(sorter, r);
+        __chidb_Sorter_mergeCurrent(sorter);
+    }
+
+    return sorter->current == NULL ? CHIDB_DONE : CHIDB_OK;
+}
+
+
+/* Get the record a sorter is positioned on
+ *
+ * The returned pointer belongs to the sorter, and is only valid
+ * until the sorter is advanced or closed.
+ *
+ * Parameters
+ * - sorter: Sorter
+ * - bytes: Out parameter used to return the packed record
+ * - nbytes: Out parameter used to return the length of the record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EEMPTY: The sorter is not positioned on a record
+ */
+int chidb_Sorter_current(Sorter *sorter, uint8_t **bytes, uint32_t *nbytes)
+{
+    if (sorter->current == NULL)
+        return CHIDB_EEMPTY;
+
+    *bytes = sorter->current->bytes;
+    *nbytes = sorter->current->nbytes;
+
+    return CHIDB_OK;
+}
+
+
+/* Close a sorter
+ *
+ * Frees all the records held by the sorter, and closes (and thereby
+ * deletes) its temporary run files.
+ *
+ * Parameters
+ * - sorter: Sorter
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Sorter_close(Sorter *sorter)
+{
+    if (sorter == NULL)
+        return CHIDB_OK;
+
+    for(uint32_t i = 0; i < sorter->nrecs; i++)
+        free(sorter->recs[i].bytes);
+    free(sorter->recs);
+
+    for(uint32_t i = 0; i < sorter->nruns; i++)
+    {
+        fclose(sorter->runs[i].f);
+        free(sorter->runs[i].head.bytes);
+    }
+    free(sorter->runs);
+    free(sorter->tree);
+    free(sorter);
+
+    return CHIDB_OK;
+}
@@ -0,0 +1,113 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  External merge sorter header. See sorter.c for more details.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SORTER_H_
+#define SORTER_H_
+
+#include <stdio.h>
+#include "chidbInt.h"
+
+/* Default amount of record memory a sorter may hold before it spills
+ * a sorted run to a temporary file */
+#define SORTER_DEFAULT_BUDGET (1024 * 1024)
+
+/* Maximum number of sort key columns */
+#define SORTER_MAX_KEYS (32)
+
+/* A single record held by the sorter (a packed DBRecord) */
+typedef struct SorterRecord
+{
+    uint8_t *bytes;
+    uint32_t nbytes;
+    uint32_t seq;           /* Insertion order (breaks ties between equal keys) */
+} SorterRecord;
+
+/* A sorted run that has been spilled to a temporary file */
+typedef struct SorterRun
+{
+    FILE *f;
+    SorterRecord head;      /* Record at the front of the run */
+    uint32_t buf_size;      /* Allocated size of head.bytes */
+    bool eof;               /* Run has been fully consumed */
+} SorterRun;
+
+struct Sorter
+{
+    /* Sort key: the first nkeys fields of every record, each one
+     * sorted in ascending ('+') or descending ('-') order */
+    uint8_t nkeys;
+    char order[SORTER_MAX_KEYS];
+
+    /* Records currently held in memory, and the memory they use */
+    SorterRecord *recs;
+    uint32_t nrecs;
+    uint32_t recs_size;
+    size_t mem_used;
+    size_t budget;
+    uint32_t nseq;          /* Number of records inserted so far */
+
+    /* If not 0, only the first limit records in sort order are kept.
+     * Until they are sorted, the records in memory form a max-heap. */
+    uint32_t limit;
+
+    /* Runs spilled to disk */
+    SorterRun *runs;
+    uint32_t nruns;
+
+    /* Loser tree used for the k-way merge. tree[0] holds the index
+     * of the run with the smallest head record; tree[1..nruns-1]
+     * hold the losers of each internal match. */
+    uint32_t *tree;
+
+    bool sorted;
+    bool merging;
+    uint32_t pos;           /* Current record when sorting in memory */
+    SorterRecord *current;  /* Record the sorter is positioned on */
+};
+typedef struct Sorter Sorter;
+
+int chidb_Sorter_open(Sorter **sorter, uint8_t nkeys, const char *order, size_t budget);
+int chidb_Sorter_setLimit(Sorter *sorter, uint32_t limit);
+int chidb_Sorter_insert(Sorter *sorter, uint8_t *bytes, uint32_t nbytes);
+int chidb_Sorter_sort(Sorter *sorter);
+int chidb_Sorter_next(Sorter *sorter);
+int chidb_Sorter_current(Sorter *sorter, uint8_t **bytes, uint32_t *nbytes);
+int chidb_Sorter_close(Sorter *sorter);
+
+#endif /*SORTER_H_*/
@@ -0,0 +1,491 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Table and index statistics
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ *  ANALYZE walks the B-Tree of every table and index, and stores the
+ *  number of entries, pages, levels, distinct keys and an equi-depth
+ *  histogram of the keys in the chidb_stat table. When the schema is
+ *  loaded, the latest statistics of each table and index are attached
+ *  to its schema entry, so the query planner can estimate how many
+ *  pages each way of evaluating a query will have to read.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "stats.h"
+#include "record.h"
+#include "index.h"
+#include "util.h"
+
+
+/* Function called on every cell visited by __chidb_Stats_walk */
+typedef int (*stats_visit_t)(BTreeCell *cell, void *arg);
+
+/* Growable array of keys, in the order in which they were visited.
+ * The entries of a variable-length index have no numeric key, so each
+ * one gets the rank of its first value instead (last is that value in
+ * the previous entry). */
+typedef struct stats_keys
+{
+    chidb_key_t *keys;
+    uint32_t n;
+    uint32_t size;
+    uint8_t last[VARINDEX_MAXKEY];
+    uint16_t last_size;
+} stats_keys_t;
+
+
+/* Visits the entries of a B-Tree in key order
+ *
+ * In a table B-Tree, only the leaf cells (which hold the rows) are
+ * visited. In an index B-Tree, every cell is an entry of the index,
+ * so the cells of the internal nodes are visited between the entries
+ * of the child pages to their left and to their right.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page of the subtree to visit
+ * - depth: Level of npage (the root is at level 1)
+ * - visit: Function to call on every entry
+ * - arg: Argument to pass to visit
+ * - stat: If not NULL, the pages and levels visited are added to it.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - Any error returned by chidb_Btree_getNodeByPage or visit
+ */
+static int __chidb_Stats_walk(BTree *bt, npage_t npage, uint32_t depth, stats_visit_t visit,
+                              void *arg, chidb_stat_t *stat)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        return rc;
+
+    if (stat)
+    {
+        stat->npages++;
+        if (depth > stat->depth)
+            stat->depth = depth;
+    }
+
+    for (ncell_t i = 0; i < btn->n_cells && rc == CHIDB_OK; i++)
+    {
+        chidb_Btree_getCell(btn, i, &cell);
+
+        switch (btn->type)
+        {
+        case PGTYPE_TABLE_INTERNAL:
+            rc = __chidb_Stats_walk(bt, cell.fields.tableInternal.child_page, depth + 1, visit, arg, stat);
+            break;
+        case PGTYPE_INDEX_INTERNAL:
+        case PGTYPE_VARINDEX_INTERNAL:
+            rc = __chidb_Stats_walk(bt, btn->type == PGTYPE_INDEX_INTERNAL ?
+                                    cell.fields.indexInternal.child_page : cell.fields.varIndex.child_page,
+                                    depth + 1, visit, arg, stat);
+            if (rc == CHIDB_OK)
+                rc = visit(&cell, arg);
+            break;
+        default:
+            rc = visit(&cell, arg);
+            break;
+        }
+    }
+
+    if (rc == CHIDB_OK && (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL ||
+                           btn->type == PGTYPE_VARINDEX_INTERNAL))
+        rc = __chidb_Stats_walk(bt, btn->right_page, depth + 1, visit, arg, stat);
+
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+
+/* Visitor that appends the key of each entry to a stats_keys_t */
+static int __chidb_Stats_addKey(BTreeCell *cell, void *arg)
+{
+    stats_keys_t *keys = (stats_keys_t *) arg;
+
+    if (keys->n == keys->size)
+    {
+        uint32_t size = keys->size? keys->size * 2 : 256;
+        chidb_key_t *k = realloc(keys->keys, size * sizeof(chidb_key_t));
+
+        if (k == NULL)
+            return CHIDB_ENOMEM;
+
+        keys->keys = k;
+        keys->size = size;
+    }
+
+    if (cell->type == PGTYPE_VARINDEX_INTERNAL || cell->type == PGTYPE_VARINDEX_LEAF)
+    {
+        // Entries are ranked by the value of the first column, which is
+        // the one that is sought
+        chidb_key_t rank = keys->n ? keys->keys[keys->n - 1] : 0;
+        uint16_t size;
+        int rc = chidb_Index_keyPrefix(cell->fields.varIndex.key, cell->fields.varIndex.key_size, 1, &size);
+
+        if (rc != CHIDB_OK && rc != CHIDB_EEMPTY)
+            return rc;
+
+        if (keys->n > 0 && (size != keys->last_size || memcmp(cell->fields.varIndex.key, keys->last, size)))
+            rank++;
+        memcpy(keys->last, cell->fields.varIndex.key, size);
+        keys->last_size = size;
+        keys->keys[keys->n++] = rank;
+
+        return CHIDB_OK;
+    }
+
+    keys->keys[keys->n++] = cell->key;
+
+    return CHIDB_OK;
+}
+
+
+/* Visitor that remembers the key of the last entry visited */
+static int __chidb_Stats_lastKey(BTreeCell *cell, void *arg)
+{
+    *((chidb_key_t *) arg) = cell->key;
+
+    return CHIDB_OK;
+}
+
+
+/* Visitor that attaches a row of the statistics table to the
+ * schema entry of the table or index it describes */
+static int __chidb_Stats_loadRow(BTreeCell *cell, void *arg)
+{
+    chidb *db = (chidb *) arg;
+    chidb_sql_schema_t *schema = NULL;
+    chidb_stat_t *stat;
+    DBRecord *dbr;
+    char *name, *hist, *s, *end;
+    int32_t v;
+
+    chidb_DBRecord_unpack(&dbr, cell->fields.tableLeaf.data);
+    chidb_DBRecord_getString(dbr, 1, &name);
+
+    list_iterator_start(&db->schemas);
+    while (list_iterator_hasnext(&db->schemas))
+    {
+        chidb_sql_schema_t *next = (chidb_sql_schema_t *) list_iterator_next(&db->schemas);
+        if (!strcmp(next->name, name))
+        {
+            schema = next;
+            break;
+        }
+    }
+    list_iterator_stop(&db->schemas);
+
+    free(name);
+
+    /* Rows of dropped (or not yet loaded) tables are ignored */
+    if (schema == NULL)
+    {
+        chidb_DBRecord_destroy(dbr);
+        return CHIDB_OK;
+    }
+
+    /* Later rows supersede earlier ones */
+    if (schema->stat == NULL && (schema->stat = malloc(sizeof(chidb_stat_t))) == NULL)
+    {
+        chidb_DBRecord_destroy(dbr);
+        return CHIDB_ENOMEM;
+    }
+    stat = schema->stat;
+    memset(stat, 0, sizeof(chidb_stat_t));
+
+    chidb_DBRecord_getInt32(dbr, 2, &v); stat->nrows = v;
+    chidb_DBRecord_getInt32(dbr, 3, &v); stat->npages = v;
+    chidb_DBRecord_getInt32(dbr, 4, &v); stat->depth = v;
+    chidb_DBRecord_getInt32(dbr, 5, &v); stat->ndistinct = v;
+
+    chidb_DBRecord_getString(dbr, 6, &hist);
+    for (s = hist; stat->nhist <= STATS_NBUCKETS; s = end)
+    {
+        unsigned long long k = strtoull(s, &end, 10);
+        if (end == s)
+            break;
+        stat->hist[stat->nhist++] = k;
+    }
+    free(hist);
+
+    chidb_DBRecord_destroy(dbr);
+
+    return CHIDB_OK;
+}
+
+
+/* Finds the root page of the statistics table
+ *
+ * Parameters
+ * - db: Database
+ * - nroot: Out parameter. Root page of the statistics table.
+ * - create: If true, the statistics table is created if it doesn't
+ *           exist yet. Since this doesn't update the in-memory schema,
+ *           the caller must make sure the schema is reloaded.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The statistics table doesn't exist (and create is false)
+ * - Any error returned by the B-Tree module
+ */
+static int __chidb_Stats_table(chidb *db, npage_t *nroot, bool create)
+{
+    chidb_key_t key = 0;
+    DBRecord *dbr;
+    uint8_t *buf;
+    int rc = CHIDB_ENOTFOUND;
+
+    list_iterator_start(&db->schemas);
+    while (list_iterator_hasnext(&db->schemas))
+    {
+        chidb_sql_schema_t *next = (chidb_sql_schema_t *) list_iterator_next(&db->schemas);
+        if (!strcmp(next->name, STATS_TABLE))
+        {
+            *nroot = next->rpage;
+            rc = CHIDB_OK;
+            break;
+        }
+    }
+    list_iterator_stop(&db->schemas);
+
+    if (rc == CHIDB_OK || !create)
+        return rc;
+
+    /* The schema entry gets the key after the largest one in the schema table */
+    if ((rc = __chidb_Stats_walk(db->bt, 1, 1, __chidb_Stats_lastKey, &key, NULL)) != CHIDB_OK)
+        return rc;
+
+    if ((rc = chidb_Btree_newNode(db->bt, nroot, PGTYPE_TABLE_LEAF)) != CHIDB_OK)
+        return rc;
+
+    chidb_DBRecord_create(&dbr, "|s|s|s|i4|s|", "table", STATS_TABLE, STATS_TABLE, *nroot, STATS_TABLE_SQL);
+    chidb_DBRecord_pack(dbr, &buf);
+    rc = chidb_Btree_insertInTable(db->bt, 1, key + 1, buf, dbr->packed_len);
+    free(buf);
+    chidb_DBRecord_destroy(dbr);
+
+    return rc;
+}
+
+
+/* Computes the statistics of a table or index
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of the table or index
+ * - stat: Out parameter. Statistics of the B-Tree.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any error returned by the B-Tree module
+ */
+int chidb_Stats_collect(BTree *bt, npage_t nroot, chidb_stat_t *stat)
+{
+    stats_keys_t keys = { NULL, 0, 0 };
+    int rc;
+
+    memset(stat, 0, sizeof(chidb_stat_t));
+
+    if ((rc = __chidb_Stats_walk(bt, nroot, 1, __chidb_Stats_addKey, &keys, stat)) == CHIDB_OK)
+    {
+        stat->nrows = keys.n;
+
+        for (uint32_t i = 0; i < keys.n; i++)
+            if (i == 0 || keys.keys[i] != keys.keys[i-1])
+                stat->ndistinct++;
+
+        if (keys.n > 0)
+        {
+            stat->nhist = (keys.n - 1 < STATS_NBUCKETS? keys.n - 1 : STATS_NBUCKETS) + 1;
+            stat->hist[0] = keys.keys[0];
+            for (uint32_t b = 1; b < stat->nhist; b++)
+                stat->hist[b] = keys.keys[(uint64_t) b * (keys.n - 1) / (stat->nhist - 1)];
+        }
+    }
+
+    free(keys.keys);
+
+    return rc;
+}
+
+
+/* Analyzes tables and indexes, and stores their statistics
+ *
+ * The statistics table is created the first time this function is
+ * called. Since the B-Tree doesn't support deleting entries, new rows
+ * are always appended to it (and they supersede the older ones).
+ *
+ * Parameters
+ * - db: Database
+ * - table: Table to analyze (along with its indexes). If NULL, all
+ *          the tables and indexes are analyzed.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: The table doesn't exist
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any error returned by the B-Tree module
+ */
+int chidb_Stats_analyze(chidb *db, const char *table)
+{
+    char hist[(STATS_NBUCKETS + 1) * 21 + 1];
+    chidb_key_t id = 0;
+    chidb_stat_t stat;
+    npage_t nroot;
+    DBRecord *dbr;
+    uint8_t *buf;
+    int rc;
+
+    if (table && chidb_table_exists(db->schemas, (char *) table) != CHIDB_OK)
+        return CHIDB_EINVALIDSQL;
+
+    if ((rc = __chidb_Stats_table(db, &nroot, true)) != CHIDB_OK)
+        return rc;
+
+    if ((rc = __chidb_Stats_walk(db->bt, nroot, 1, __chidb_Stats_lastKey, &id, NULL)) != CHIDB_OK)
+        return rc;
+
+    list_iterator_start(&db->schemas);
+    while (rc == CHIDB_OK && list_iterator_hasnext(&db->schemas))
+    {
+        chidb_sql_schema_t *next = (chidb_sql_schema_t *) list_iterator_next(&db->schemas);
+
+        if (strcmp(next->type, "table") && strcmp(next->type, "index"))
+            continue;
+        if (!strcmp(next->name, STATS_TABLE))
+            continue;
+        if (table && strcmp(next->assoc, table))
+            continue;
+
+        if ((rc = chidb_Stats_collect(db->bt, next->rpage, &stat)) != CHIDB_OK)
+            break;
+
+        hist[0] = '\0';
+        for (uint32_t b = 0, len = 0; b < stat.nhist; b++)
+            len += sprintf(hist + len, b? " %" PRIu64 : "%" PRIu64, stat.hist[b]);
+
+        chidb_DBRecord_create(&dbr, "|0|s|i4|i4|i4|i4|s|", next->name, stat.nrows, stat.npages,
+                              stat.depth, stat.ndistinct, hist);
+        chidb_DBRecord_pack(dbr, &buf);
+        rc = chidb_Btree_insertInTable(db->bt, nroot, ++id, buf, dbr->packed_len);
+        free(buf);
+        chidb_DBRecord_destroy(dbr);
+    }
+    list_iterator_stop(&db->schemas);
+
+    return rc;
+}
+
+
+/* Attaches the stored statistics to the schema entries
+ *
+ * Must be called right after the schema is loaded. Tables and indexes
+ * that have never been analyzed are left without statistics.
+ *
+ * Parameters
+ * - db: Database
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any error returned by the B-Tree module
+ */
+int chidb_Stats_load(chidb *db)
+{
+    npage_t nroot;
+
+    if (__chidb_Stats_table(db, &nroot, false) != CHIDB_OK)
+        return CHIDB_OK;
+
+    return __chidb_Stats_walk(db->bt, nroot, 1, __chidb_Stats_loadRow, db, NULL);
+}
+
+
+/* Returns the statistics of a table or index (NULL if it hasn't been analyzed) */
+chidb_stat_t *chidb_Stats_get(chidb *db, const char *name)
+{
+    chidb_stat_t *stat = NULL;
+
+    list_iterator_start(&db->schemas);
+    while (list_iterator_hasnext(&db->schemas))
+    {
+        chidb_sql_schema_t *next = (chidb_sql_schema_t *) list_iterator_next(&db->schemas);
+        if (!strcmp(next->name, name))
+        {
+            stat = next->stat;
+            break;
+        }
+    }
+    list_iterator_stop(&db->schemas);
+
+    return stat;
+}
+
+
+/* Estimates the fraction of the keys of a B-Tree that are smaller than
+ * a given key, assuming the keys are uniformly distributed within each
+ * bucket of the histogram */
+double chidb_Stats_fraction(chidb_stat_t *stat, chidb_key_t key)
+{
+    uint32_t b;
+
+    if (stat->nhist == 0 || key <= stat->hist[0])
+        return 0.0;
+    if (key > stat->hist[stat->nhist - 1])
+        return 1.0;
+    if (stat->nhist == 1)
+        return 0.0;
+
+    for (b = 0; key > stat->hist[b + 1]; b++)
+        ;
+
+    return (b + (double) (key - stat->hist[b]) / (stat->hist[b + 1] - stat->hist[b])) / (stat->nhist - 1);
+}
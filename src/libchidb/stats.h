@@ -0,0 +1,80 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Table and index statistics -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "chidbInt.h"
+#include "btree.h"
+
+/* Table where ANALYZE stores the statistics of each table and index.
+ * The B-Tree can't delete or replace entries, so every ANALYZE adds
+ * new rows, and the latest row of each table or index is the one used. */
+#define STATS_TABLE "chidb_stat"
+#define STATS_TABLE_SQL "CREATE TABLE chidb_stat(id INTEGER PRIMARY KEY, name TEXT, " \
+                        "nrows INTEGER, npages INTEGER, depth INTEGER, ndistinct INTEGER, hist TEXT)"
+
+/* Number of buckets of a key histogram */
+#define STATS_NBUCKETS (16)
+
+/* Statistics of a table or index B-Tree.
+ *
+ * The histogram is an equi-depth histogram of the keys of the B-Tree
+ * (the primary keys of a table, or the indexed values of an index):
+ * hist[0] is the smallest key, hist[nhist-1] the largest one, and
+ * roughly the same number of keys fall between consecutive boundaries.
+ */
+typedef struct chidb_stat
+{
+    uint32_t nrows;         /* Number of entries (rows or index entries) */
+    uint32_t npages;        /* Number of pages */
+    uint32_t depth;         /* Number of levels */
+    uint32_t ndistinct;     /* Number of distinct keys */
+    uint32_t nhist;         /* Number of histogram boundaries (0 if no keys) */
+    chidb_key_t hist[STATS_NBUCKETS + 1];
+} chidb_stat_t;
+
+int chidb_Stats_collect(BTree *bt, npage_t nroot, chidb_stat_t *stat);
+int chidb_Stats_analyze(chidb *db, const char *table);
+int chidb_Stats_load(chidb *db);
+chidb_stat_t *chidb_Stats_get(chidb *db, const char *name);
+double chidb_Stats_fraction(chidb_stat_t *stat, chidb_key_t key);
+
+#endif /*STATS_H_*/
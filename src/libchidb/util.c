@@ -41,6 +41,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <inttypes.h>
 #include "chidbInt.h"
 #include "util.h"
 #include "record.h"
@@ -62,33 +63,78 @@ void put4byte(unsigned char *p, uint32_t v)
     p[3] = (uint8_t)v;
 }
 
-int getVarint32(const uint8_t *p, uint32_t *v)
+/*
+** Read or write an eight-byte big-endian integer value.
+*/
+uint64_t get8byte(const uint8_t *p)
 {
-    *v = 0;
+    return ((uint64_t) get4byte(p) << 32) | get4byte(p + 4);
+}
 
-    *v  = ((uint32_t) (p[3] & 0x7F));
-    *v |= ((uint32_t) (p[2] & 0x7F)) << 7;
-    *v |= ((uint32_t) (p[1] & 0x7F)) << 14;
-    *v |= ((uint32_t) (p[0] & 0x7F)) << 21;
+void put8byte(uint8_t *p, uint64_t v)
+{
+    put4byte(p, (uint32_t)(v>>32));
+    put4byte(p + 4, (uint32_t)v);
+}
 
-    return CHIDB_OK;
+/*
+** Read or write a 64-bit varint, as in SQLite: 1 to 8 bytes holding 7
+** bits each (the high bit is set in all but the last one), or 8 such
+** bytes followed by a ninth one holding 8 bits. Varints padded with
+** leading 0x80 bytes (as older files have) are read correctly.
+*
+* Both return the number of bytes read or written.
+*/
+int getVarint64(const uint8_t *p, uint64_t *v)
+{
+    uint64_t x = 0;
+
+    for(int i = 0; i < 8; i++)
+    {
+        x = (x << 7) | (p[i] & 0x7F);
+        if (!(p[i] & 0x80))
+        {
+            *v = x;
+            return i + 1;
+        }
+    }
+    *v = (x << 8) | p[8];
+
+    return 9;
 }
 
-int putVarint32(uint8_t *p, uint32_t v)
+int putVarint64(uint8_t *p, uint64_t v)
 {
-    uint32_t aux;
+    int n = varintLen64(v);
 
-    aux = v & 0x0000007F;
-    aux |= ((v & 0x00003F80) << 1) | 0x00008000;
-    aux |= ((v & 0x001FC000) << 2) | 0x00800000;
-    aux |= ((v & 0x0FE00000) << 3) | 0x80000000;
+    if (n == 9)
+    {
+        p[8] = (uint8_t)v;
+        v >>= 8;
+        for(int i = 7; i >= 0; i--, v >>= 7)
+            p[i] = (uint8_t)(v & 0x7F) | 0x80;
+        return 9;
+    }
 
-    p[3] = (uint8_t)(aux);
-    p[2] = (uint8_t)(aux>>8);
-    p[1] = (uint8_t)(aux>>16);
-    p[0] = (uint8_t)(aux>>24);
+    p[n - 1] = (uint8_t)(v & 0x7F);
+    v >>= 7;
+    for(int i = n - 2; i >= 0; i--, v >>= 7)
+        p[i] = (uint8_t)(v & 0x7F) | 0x80;
 
-    return CHIDB_OK;
+    return n;
+}
+
+/* Number of bytes putVarint64 writes for v */
+int varintLen64(uint64_t v)
+{
+    int n = 1;
+
+    if (v >> 56)
+        return 9;
+    while (v >>= 7)
+        n++;
+
+    return n;
 }
 
 
@@ -98,7 +144,7 @@ void chidb_BTree_recordPrinter(BTreeNode *btn, BTreeCell *btc)
 
     chidb_DBRecord_unpack(&dbr, btc->fields.tableLeaf.data);
 
-    printf("< %5i >", btc->key);
+    printf("< %5" PRIu64 " >", btc->key);
     chidb_DBRecord_print(dbr);
     printf("\n");
 
@@ -107,7 +153,7 @@ void chidb_BTree_recordPrinter(BTreeNode *btn, BTreeCell *btc)
 
 void chidb_BTree_stringPrinter(BTreeNode *btn, BTreeCell *btc)
 {
-    printf("%5i -> %10s\n", btc->key, btc->fields.tableLeaf.data);
+    printf("%5" PRIu64 " -> %10s\n", btc->key, btc->fields.tableLeaf.data);
 }
 
 int chidb_astrcat(char **dst, char *src)
@@ -119,6 +165,22 @@ int chidb_astrcat(char **dst, char *src)
     return CHIDB_OK;
 }
 
+/* Writes a floating point number to s (of size n), with up to 15
+ * significant digits, and a ".0" if it would otherwise look like an
+ * integer. Returns the length of the string. */
+int chidb_real_str(char *s, size_t n, double v)
+{
+    int len = snprintf(s, n, "%.15g", v);
+
+    if (len > 0 && (size_t) len + 2 < n && strspn(s, "-0123456789") == (size_t) len)
+    {
+        strcpy(s + len, ".0");
+        len += 2;
+    }
+
+    return len;
+}
+
 
 int chidb_Btree_print(BTree *bt, npage_t npage, fBTreeCellPrinter printer, bool verbose)
 {
@@ -152,11 +214,11 @@ int chidb_Btree_print(BTree *bt, npage_t npage, fBTreeCellPrinter printer, bool
 
             last_key = btc.key;
             if(verbose)
-                printf("Printing Keys <= %i\n", last_key);
+                printf("Printing Keys <= %" PRIu64 "\n", last_key);
             chidb_Btree_print(bt, btc.fields.tableInternal.child_page, printer, verbose);
         }
         if(verbose)
-            printf("Printing Keys > %i\n", last_key);
+            printf("Printing Keys > %" PRIu64 "\n", last_key);
         chidb_Btree_print(bt, btn->right_page, printer, verbose);
     }
     else if (btn->type == PGTYPE_INDEX_LEAF)
@@ -168,7 +230,7 @@ int chidb_Btree_print(BTree *bt, npage_t npage, fBTreeCellPrinter printer, bool
             BTreeCell btc;
 
             chidb_Btree_getCell(btn, i, &btc);
-            printf("%10i -> %10i\n", btc.key, btc.fields.indexLeaf.keyPk);
+            printf("%10" PRIu64 " -> %10" PRIu64 "\n", btc.key, btc.fields.indexLeaf.keyPk);
         }
     }
     else if (btn->type == PGTYPE_INDEX_INTERNAL)
@@ -184,14 +246,34 @@ int chidb_Btree_print(BTree *bt, npage_t npage, fBTreeCellPrinter printer, bool
             chidb_Btree_getCell(btn, i, &btc);
             last_key = btc.key;
             if(verbose)
-                printf("Printing Keys < %i\n", last_key);
+                printf("Printing Keys < %" PRIu64 "\n", last_key);
             chidb_Btree_print(bt, btc.fields.indexInternal.child_page, printer, verbose);
-            printf("%10i -> %10i\n", btc.key, btc.fields.indexInternal.keyPk);
+            printf("%10" PRIu64 " -> %10" PRIu64 "\n", btc.key, btc.fields.indexInternal.keyPk);
         }
         if(verbose)
-            printf("Printing Keys > %i\n", last_key);
+            printf("Printing Keys > %" PRIu64 "\n", last_key);
         chidb_Btree_print(bt, btn->right_page, printer, verbose);
     }
+    else if (btn->type == PGTYPE_VARINDEX_LEAF || btn->type == PGTYPE_VARINDEX_INTERNAL)
+    {
+        bool internal = (btn->type == PGTYPE_VARINDEX_INTERNAL);
+
+        if(verbose)
+            printf("%s node (page %i)\n", internal ? "Internal" : "Leaf", btn->page->npage);
+        for(int i = 0; i<btn->n_cells; i++)
+        {
+            BTreeCell btc;
+
+            chidb_Btree_getCell(btn, i, &btc);
+            if(internal)
+                chidb_Btree_print(bt, btc.fields.varIndex.child_page, printer, verbose);
+            for(int j = 0; j < btc.fields.varIndex.key_size - VARINDEX_PKEY_SIZE; j++)
+                printf("%02x", btc.fields.varIndex.key[j]);
+            printf(" -> %10" PRIu64 "\n", btc.fields.varIndex.keyPk);
+        }
+        if(internal)
+            chidb_Btree_print(bt, btn->right_page, printer, verbose);
+    }
 
     chidb_Btree_freeMemNode(bt, btn);
 
@@ -356,6 +438,8 @@ int chidb_column_exists(list_t s, char *table, char *column)
 }
 
 // Given a table name and a column name, obtain the type of the column.
+// Returns -1 if there is no such column (CHIDB_EINVALIDSQL would be
+// mistaken for TYPE_DOUBLE).
 int chidb_column_get_type(list_t s, char *table, char *column)
 {
     list_iterator_start(&s);
@@ -377,14 +461,14 @@ int chidb_column_get_type(list_t s, char *table, char *column)
                     next_column = next_column->next;
             }
             list_iterator_stop(&s);
-            return CHIDB_EINVALIDSQL;
+            return -1;
             
         }
     }
 
     list_iterator_stop(&s);
 
-    return CHIDB_EINVALIDSQL;
+    return -1;
 }
 
 // S is the schema table
@@ -478,7 +562,15 @@ int chidb_get_tables(list_t tables, chisql_statement_t *sql_statement)
         case STMT_DELETE: 
             list_append(&tables, sql_statement->stmt.delete->table_name);
            break;
+        case STMT_ANALYZE:
+            if (sql_statement->stmt.analyze)
+                list_append(&tables, sql_statement->stmt.analyze);
+            break;
         case STMT_CREATE:
+        case STMT_BLOOM:
+        case STMT_BEGIN:
+        case STMT_COMMIT:
+        case STMT_ROLLBACK:
             break;
     }
 
@@ -677,6 +769,25 @@ int chidb_column_position(list_t *names, char *col_name)
     return (i == list_size(names)) ? (-1) : (i);
 }
 
+/* given an index, return the position of a column among its columns
+ * (the indexed ones, followed by the included ones), which is the
+ * field of the index entries that holds it
+ *
+ * returns -1 if the column is not in the index
+ */
+int chidb_index_column_position(Index_t *index, char *col_name)
+{
+    StrList_t *names[2] = { index->columns, index->include };
+    int i = 0;
+
+    for(int l = 0; l < 2; l++)
+        for(StrList_t *name = names[l]; name != NULL; name = name->next, i++)
+            if(!strcmp(name->str, col_name))
+                return i;
+
+    return -1;
+}
+
 void chisql_statement_free(chisql_statement_t *sql)
 {
     switch (sql->type)
@@ -700,8 +811,18 @@ void chisql_statement_free(chisql_statement_t *sql)
         {
             Delete_free(sql->stmt.delete);
         } break;
+
+        case STMT_ANALYZE:
+        {
+            chisql_free(sql->stmt.analyze);
+        } break;
+
+        case STMT_BLOOM:
+        {
+            chisql_free(sql->stmt.bloom);
+        } break;
     }
 
-    free(sql->text);
-    free(sql);
+    chisql_free(sql->text);
+    chisql_free(sql);
 }
\ No newline at end of file
@@ -57,10 +57,63 @@
 
 uint32_t get4byte(const uint8_t *p);
 void put4byte(unsigned char *p, uint32_t v);
-int getVarint32(const uint8_t *p, uint32_t *v);
-int putVarint32(uint8_t *p, uint32_t v);
+uint64_t get8byte(const uint8_t *p);
+void put8byte(uint8_t *p, uint64_t v);
+int getVarint64(const uint8_t *p, uint64_t *v);
+int putVarint64(uint8_t *p, uint64_t v);
+int varintLen64(uint64_t v);
+
+/*
+** Read or write a varint of up to 32 bits (see getVarint64), returning
+** the number of bytes read or written. Record types and cell sizes
+** almost always take one or two bytes, so those are decoded inline.
+*/
+static inline int getVarint32(const uint8_t *p, uint32_t *v)
+{
+    uint64_t x;
+    int n;
+
+    if (!(p[0] & 0x80))
+    {
+        *v = p[0];
+        return 1;
+    }
+    if (!(p[1] & 0x80))
+    {
+        *v = ((uint32_t)(p[0] & 0x7F) << 7) | p[1];
+        return 2;
+    }
+
+    n = getVarint64(p, &x);
+    *v = (uint32_t) x;
+    return n;
+}
+
+static inline int putVarint32(uint8_t *p, uint32_t v)
+{
+    if (v < 0x80)
+    {
+        p[0] = (uint8_t) v;
+        return 1;
+    }
+    if (v < 0x4000)
+    {
+        p[0] = (uint8_t)(v >> 7) | 0x80;
+        p[1] = (uint8_t)(v & 0x7F);
+        return 2;
+    }
+
+    return putVarint64(p, v);
+}
+
+/* Number of bytes putVarint32 writes for v */
+static inline int varintLen32(uint32_t v)
+{
+    return v < 0x80 ? 1 : v < 0x4000 ? 2 : varintLen64(v);
+}
 
 int chidb_astrcat(char **dst, char *src);
+int chidb_real_str(char *s, size_t n, double v);
 
 typedef void (*fBTreeCellPrinter)(BTreeNode *, BTreeCell*);
 int chidb_Btree_print(BTree *bt, npage_t nroot, fBTreeCellPrinter printer, bool verbose);
@@ -77,6 +130,7 @@ int chidb_column_names(list_t s, char *table, list_t *names);
 int chidb_columns_total(list_t schemas, char *table);
 void print_schema_list(list_t schemas);
 int chidb_column_position(list_t *names, char *col_name);
+int chidb_index_column_position(Index_t *index, char *col_name);
 
 int chidb_get_tables(list_t tables, chisql_statement_t *sql_statement);
 int chidb_get_sra_tables(list_t tables, SRA_t *s);
@@ -20,10 +20,66 @@ char *typeToString(enum data_type type, char *buf)
     return buf;
 }
 
+/* Allocator of the calling thread (NULL for malloc) */
+static __thread chisql_alloc_t __alloc = NULL;
+static __thread void *__alloc_ctx = NULL;
+
+void chisql_set_allocator(chisql_alloc_t alloc, void *ctx)
+{
+    __alloc = alloc;
+    __alloc_ctx = ctx;
+}
+
+void chisql_get_allocator(chisql_alloc_t *alloc, void **ctx)
+{
+    *alloc = __alloc;
+    *ctx = __alloc_ctx;
+}
+
+void *chisql_malloc(size_t size)
+{
+    return __alloc ? __alloc(__alloc_ctx, size) : malloc(size);
+}
+
+void *chisql_calloc(size_t n, size_t size)
+{
+    void *p;
+
+    if (!__alloc)
+        return calloc(n, size);
+    if ((p = __alloc(__alloc_ctx, n * size)) != NULL)
+        memset(p, 0, n * size);
+    return p;
+}
+
+char *chisql_strdup(const char *s)
+{
+    return chisql_strndup(s, strlen(s));
+}
+
+char *chisql_strndup(const char *s, size_t n)
+{
+    size_t len = strnlen(s, n);
+    char *copy = chisql_malloc(len + 1);
+
+    if (copy)
+    {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+void chisql_free(void *p)
+{
+    if (!__alloc)
+        free(p);
+}
+
 StrList_t *StrList_makeWithNext(const char *str, StrList_t *next)
 {
-    StrList_t *list = (StrList_t *)calloc(1, sizeof(StrList_t));
-    list->str = strdup(str);
+    StrList_t *list = (StrList_t *)chisql_calloc(1, sizeof(StrList_t));
+    list->str = chisql_strdup(str);
     list->next = next;
     return list;
 }
@@ -47,7 +103,7 @@ void StrList_free(StrList_t *list)
     while (list)
     {
         StrList_t *next = list->next;
-        free(list);
+        chisql_free(list);
         list = next;
     }
 }
@@ -104,7 +160,7 @@ StrList_t *StrList_append(StrList_t *list1, StrList_t *list2)
 
 StrList_t *StrList_make(char *str)
 {
-    StrList_t *list = (StrList_t *)calloc(1, sizeof(StrList_t));
+    StrList_t *list = (StrList_t *)chisql_calloc(1, sizeof(StrList_t));
     list->str = str;
     return list;
 }
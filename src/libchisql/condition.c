@@ -66,7 +66,7 @@ void Condition_print(Condition_t *cond)
 
 Condition_t *Eq(Expression_t *expr1, Expression_t *expr2)
 {
-    Condition_t *new_cond = (Condition_t *)calloc(1, sizeof(Condition_t));
+    Condition_t *new_cond = (Condition_t *)chisql_calloc(1, sizeof(Condition_t));
     new_cond->t = RA_COND_EQ;
     new_cond->cond.comp.expr1 = expr1;
     new_cond->cond.comp.expr2 = expr2;
@@ -75,7 +75,7 @@ Condition_t *Eq(Expression_t *expr1, Expression_t *expr2)
 
 Condition_t *Lt(Expression_t *expr1, Expression_t *expr2)
 {
-    Condition_t *new_cond = (Condition_t *)calloc(1, sizeof(Condition_t));
+    Condition_t *new_cond = (Condition_t *)chisql_calloc(1, sizeof(Condition_t));
     new_cond->t = RA_COND_LT;
     new_cond->cond.comp.expr1 = expr1;
     new_cond->cond.comp.expr2 = expr2;
@@ -84,7 +84,7 @@ Condition_t *Lt(Expression_t *expr1, Expression_t *expr2)
 
 Condition_t *Gt(Expression_t *expr1, Expression_t *expr2)
 {
-    Condition_t *new_cond = (Condition_t *)calloc(1, sizeof(Condition_t));
+    Condition_t *new_cond = (Condition_t *)chisql_calloc(1, sizeof(Condition_t));
     new_cond->t = RA_COND_GT;
     new_cond->cond.comp.expr1 = expr1;
     new_cond->cond.comp.expr2 = expr2;
@@ -93,7 +93,7 @@ Condition_t *Gt(Expression_t *expr1, Expression_t *expr2)
 
 Condition_t *Leq(Expression_t *expr1, Expression_t *expr2)
 {
-    Condition_t *new_cond = (Condition_t *)calloc(1, sizeof(Condition_t));
+    Condition_t *new_cond = (Condition_t *)chisql_calloc(1, sizeof(Condition_t));
     new_cond->t = RA_COND_LEQ;
     new_cond->cond.comp.expr1 = expr1;
     new_cond->cond.comp.expr2 = expr2;
@@ -102,7 +102,7 @@ Condition_t *Leq(Expression_t *expr1, Expression_t *expr2)
 
 Condition_t *Geq(Expression_t *expr1, Expression_t *expr2)
 {
-    Condition_t *new_cond = (Condition_t *)calloc(1, sizeof(Condition_t));
+    Condition_t *new_cond = (Condition_t *)chisql_calloc(1, sizeof(Condition_t));
     new_cond->t = RA_COND_GEQ;
     new_cond->cond.comp.expr1 = (expr1);
     new_cond->cond.comp.expr2 = (expr2);
@@ -111,7 +111,7 @@ Condition_t *Geq(Expression_t *expr1, Expression_t *expr2)
 
 Condition_t *And(Condition_t *cond1, Condition_t *cond2)
 {
-    Condition_t *new_cond = (Condition_t *)calloc(1, sizeof(Condition_t));
+    Condition_t *new_cond = (Condition_t *)chisql_calloc(1, sizeof(Condition_t));
     new_cond->t = RA_COND_AND;
     new_cond->cond.binary.cond1 = cond1;
     new_cond->cond.binary.cond2 = cond2;
@@ -120,7 +120,7 @@ Condition_t *And(Condition_t *cond1, Condition_t *cond2)
 
 Condition_t *Or(Condition_t *cond1, Condition_t *cond2)
 {
-    Condition_t *new_cond = (Condition_t *)calloc(1, sizeof(Condition_t));
+    Condition_t *new_cond = (Condition_t *)chisql_calloc(1, sizeof(Condition_t));
     new_cond->t = RA_COND_OR;
     new_cond->cond.binary.cond1 = cond1;
     new_cond->cond.binary.cond2 = cond2;
@@ -129,7 +129,7 @@ Condition_t *Or(Condition_t *cond1, Condition_t *cond2)
 
 Condition_t *Not(Condition_t *cond)
 {
-    Condition_t *new_cond = (Condition_t *)calloc(1, sizeof(Condition_t));
+    Condition_t *new_cond = (Condition_t *)chisql_calloc(1, sizeof(Condition_t));
     new_cond->t = RA_COND_NOT;
     new_cond->cond.unary.cond = cond;
     return new_cond;
@@ -137,7 +137,7 @@ Condition_t *Not(Condition_t *cond)
 
 Condition_t *In(Expression_t *expr, Literal_t *values_list)
 {
-    Condition_t *new_cond = (Condition_t *)calloc(1, sizeof(Condition_t));
+    Condition_t *new_cond = (Condition_t *)chisql_calloc(1, sizeof(Condition_t));
     new_cond->t = RA_COND_IN;
     new_cond->cond.in.expr = expr;
     new_cond->cond.in.values_list = values_list;
@@ -153,8 +153,8 @@ void Condition_free(Condition_t *cond)
     case RA_COND_GEQ:
     case RA_COND_GT:
     case RA_COND_LT:
-        free(cond->cond.comp.expr1);
-        free(cond->cond.comp.expr2);
+        chisql_free(cond->cond.comp.expr1);
+        chisql_free(cond->cond.comp.expr2);
         break;
     case RA_COND_AND:
     case RA_COND_OR:
@@ -169,5 +169,5 @@ void Condition_free(Condition_t *cond)
         Expression_freeList(cond->cond.in.expr);
         break;
     }
-    free(cond);
+    chisql_free(cond);
 }
@@ -50,14 +50,14 @@ Table_t *Table_addKeyDecs(Table_t *table, KeyDec_t *decs)
 
 KeyDec_t *ForeignKeyDec(ForeignKeyRef_t fkr)
 {
-    KeyDec_t *kdec = (KeyDec_t *)calloc(1, sizeof(KeyDec_t));
+    KeyDec_t *kdec = (KeyDec_t *)chisql_calloc(1, sizeof(KeyDec_t));
     kdec->t = KEY_DEC_FOREIGN;
     kdec->dec.fkey = fkr;
     return kdec;
 }
 KeyDec_t *PrimaryKeyDec(StrList_t *col_names)
 {
-    KeyDec_t *kdec = (KeyDec_t *)calloc(1, sizeof(KeyDec_t));
+    KeyDec_t *kdec = (KeyDec_t *)chisql_calloc(1, sizeof(KeyDec_t));
     kdec->t = KEY_DEC_PRIMARY;
     kdec->dec.primary_keys = col_names;
     return kdec;
@@ -65,7 +65,7 @@ KeyDec_t *PrimaryKeyDec(StrList_t *col_names)
 
 Table_t *Table_make(char *name, Column_t *columns, KeyDec_t *decs)
 {
-    Table_t *new_table = (Table_t *)calloc(1, sizeof(Table_t));
+    Table_t *new_table = (Table_t *)chisql_calloc(1, sizeof(Table_t));
     new_table->name = name;
     new_table->columns = columns;
     Column_getOffsets(columns);
@@ -90,8 +90,8 @@ void Table_free(void *table_vptr)
 {
     Table_t *table = (Table_t *)table_vptr;
     Column_freeList(table->columns);
-    free(table->name);
-    free(table);
+    chisql_free(table->name);
+    chisql_free(table);
 }
 
 void TableReference_free(TableReference_t *tref)
@@ -101,11 +101,11 @@ void TableReference_free(TableReference_t *tref)
         fprintf(stderr, "Warning: TableReference_free called on null pointer\n");
         return;
     }
-    free(tref->table_name);
+    chisql_free(tref->table_name);
     /* alias is optional */
     if (tref->alias)
-        free(tref->alias);
-    free(tref);
+        chisql_free(tref->alias);
+    chisql_free(tref);
 }
 
 void Table_print(Table_t *table)
@@ -133,18 +133,20 @@ KeyDec_t *KeyDec_append(KeyDec_t *decs, KeyDec_t *dec)
 
 TableReference_t *TableReference_make(char *table_name, char *alias)
 {
-    TableReference_t *ref = (TableReference_t *)calloc(1, sizeof(TableReference_t));
+    TableReference_t *ref = (TableReference_t *)chisql_calloc(1, sizeof(TableReference_t));
     ref->table_name = table_name;
     ref->alias = alias;
     return ref;
 }
 
-Index_t *Index_make(char *name, char *table_name, char *column_name)
+Index_t *Index_make(char *name, char *table_name, StrList_t *columns, StrList_t *include)
 {
-    Index_t *idx = (Index_t *)calloc(1, sizeof(Index_t));
+    Index_t *idx = (Index_t *)chisql_calloc(1, sizeof(Index_t));
     idx->name = name;
     idx->table_name = table_name;
-    idx->column_name = column_name;
+    idx->column_name = columns->str;
+    idx->columns = columns;
+    idx->include = include;
     return idx;
 }
 
@@ -156,24 +158,35 @@ Index_t *Index_makeUnique(Index_t *idx)
 
 void Index_print(Index_t *idx)
 {
-    printf("Index '%s' on %s (%s)", idx->column_name,
-           idx->table_name,
-           idx->column_name);
+    printf("Index '%s' on %s ", idx->name, idx->table_name);
+    StrList_print(idx->columns);
+    if (idx->include)
+    {
+        printf(" include ");
+        StrList_print(idx->include);
+    }
     if (idx->unique) printf(", unique");
     puts("");
 }
 
 void Index_free(Index_t *idx)
 {
-    free(idx->name);
-    free(idx->column_name);
-    free(idx->table_name);
-    free(idx);
+    StrList_t *list;
+
+    chisql_free(idx->name);
+    for (list = idx->columns; list; list = list->next)
+        chisql_free(list->str);
+    for (list = idx->include; list; list = list->next)
+        chisql_free(list->str);
+    StrList_free(idx->columns);
+    StrList_free(idx->include);
+    chisql_free(idx->table_name);
+    chisql_free(idx);
 }
 
 Create_t *Create_fromTable(Table_t *table)
 {
-    Create_t *c = (Create_t *)calloc(1, sizeof(Create_t));
+    Create_t *c = (Create_t *)chisql_calloc(1, sizeof(Create_t));
     c->t = CREATE_TABLE;
     c->table = table;
     return c;
@@ -181,7 +194,7 @@ Create_t *Create_fromTable(Table_t *table)
 
 Create_t *Create_fromIndex(Index_t *idx)
 {
-    Create_t *c = (Create_t *)calloc(1, sizeof(Create_t));
+    Create_t *c = (Create_t *)chisql_calloc(1, sizeof(Create_t));
     c->t = CREATE_INDEX;
     c->index = idx;
     return c;
@@ -202,5 +215,5 @@ void Create_free(Create_t *cre)
         Table_free(cre->table);
     else
         Index_free(cre->index);
-    free(cre);
+    chisql_free(cre);
 }
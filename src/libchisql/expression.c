@@ -3,16 +3,16 @@
 
 Expression_t *Term(const char *str)
 {
-    Expression_t *new_expr = (Expression_t *)calloc(1, sizeof(Expression_t));
+    Expression_t *new_expr = (Expression_t *)chisql_calloc(1, sizeof(Expression_t));
     new_expr->t = EXPR_TERM;
     new_expr->expr.term.t = TERM_ID;
-    new_expr->expr.term.id = strdup(str);
+    new_expr->expr.term.id = chisql_strdup(str);
     return new_expr;
 }
 
 Expression_t *TermLiteral(Literal_t *val)
 {
-    Expression_t *new_expr = (Expression_t *)calloc(1, sizeof(Expression_t));
+    Expression_t *new_expr = (Expression_t *)chisql_calloc(1, sizeof(Expression_t));
     new_expr->t = EXPR_TERM;
     new_expr->expr.term.t = TERM_LITERAL;
     new_expr->expr.term.val = val;
@@ -21,7 +21,7 @@ Expression_t *TermLiteral(Literal_t *val)
 
 Expression_t *TermNull(void)
 {
-    Expression_t *new_expr = (Expression_t *)calloc(1, sizeof(Expression_t));
+    Expression_t *new_expr = (Expression_t *)chisql_calloc(1, sizeof(Expression_t));
     new_expr->t = EXPR_TERM;
     new_expr->expr.term.t = TERM_NULL;
     return new_expr;
@@ -29,7 +29,7 @@ Expression_t *TermNull(void)
 
 Expression_t *TermColumnReference(ColumnReference_t *ref)
 {
-    Expression_t *new_expr = (Expression_t *)calloc(1, sizeof(Expression_t));
+    Expression_t *new_expr = (Expression_t *)chisql_calloc(1, sizeof(Expression_t));
     new_expr->t = EXPR_TERM;
     new_expr->expr.term.t = TERM_COLREF;
     new_expr->expr.term.ref = ref;
@@ -38,7 +38,7 @@ Expression_t *TermColumnReference(ColumnReference_t *ref)
 
 Expression_t *TermFunction(int functype, Expression_t *expr)
 {
-    Expression_t *new_expr = (Expression_t *)calloc(1, sizeof(Expression_t));
+    Expression_t *new_expr = (Expression_t *)chisql_calloc(1, sizeof(Expression_t));
     new_expr->t = EXPR_TERM;
     new_expr->expr.term.t = TERM_FUNC;
     new_expr->expr.term.f.t = functype;
@@ -106,7 +106,7 @@ static void Term_free(ExprTerm term)
     switch (term.t)
     {
     case TERM_ID:
-        free(term.id);
+        chisql_free(term.id);
         break;
     case TERM_LITERAL:
         Literal_free(term.val);
@@ -115,8 +115,8 @@ static void Term_free(ExprTerm term)
         break;
     case TERM_COLREF:
         if (term.ref->tableName)
-            free(term.ref->tableName);
-        free(term.ref->columnName);
+            chisql_free(term.ref->tableName);
+        chisql_free(term.ref->columnName);
         break;
     case TERM_FUNC:
         switch (term.f.t)
@@ -146,7 +146,7 @@ static void Term_free(ExprTerm term)
 
 Expression_t *Binary(Expression_t *expr1, Expression_t *expr2, enum ExprType t)
 {
-    Expression_t *expr = (Expression_t *)calloc(1, sizeof(Expression_t));
+    Expression_t *expr = (Expression_t *)chisql_calloc(1, sizeof(Expression_t));
     expr->t = t;
     expr->expr.binary.expr1 = expr1;
     expr->expr.binary.expr2 = expr2;
@@ -180,7 +180,7 @@ Expression_t *Concat(Expression_t *expr1, Expression_t *expr2)
 
 Expression_t *Neg(Expression_t *expr)
 {
-    Expression_t *new_expr = (Expression_t *)calloc(1, sizeof(Expression_t));
+    Expression_t *new_expr = (Expression_t *)chisql_calloc(1, sizeof(Expression_t));
     new_expr->t = EXPR_NEG;
     new_expr->expr.unary.expr = expr;
     return new_expr;
@@ -282,7 +282,7 @@ void Expression_printList (Expression_t *expr)
 
 Expression_t *add_alias(Expression_t *expr, const char *alias)
 {
-    if (alias) expr->alias = strdup(alias);
+    if (alias) expr->alias = chisql_strdup(alias);
     return expr;
 }
 
@@ -319,8 +319,8 @@ void Expression_free(Expression_t *expr)
     default:
         printf("Can't delete unknown expression type '%d')", expr->t);
     }
-    if (expr->alias) free(expr->alias);
-    free(expr);
+    if (expr->alias) chisql_free(expr->alias);
+    chisql_free(expr);
 }
 
 void Expression_freeList(Expression_t *expr)
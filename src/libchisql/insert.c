@@ -3,8 +3,8 @@
 
 Insert_t *Insert_make(const char *table_name, StrList_t *opt_col_names, Literal_t *values)
 {
-    Insert_t *new_insert = (Insert_t *)calloc(1, sizeof(Insert_t));
-    new_insert->table_name = strdup(table_name);
+    Insert_t *new_insert = (Insert_t *)chisql_calloc(1, sizeof(Insert_t));
+    new_insert->table_name = chisql_strdup(table_name);
     new_insert->col_names = opt_col_names;
     new_insert->values = values;
     if (!values)
@@ -88,8 +88,8 @@ void Insert_free(Insert_t *insert)
         fprintf(stderr, "Warning: Insert_free called on null pointer\n");
         return;
     }
-    free(insert->table_name);
+    chisql_free(insert->table_name);
     StrList_free(insert->col_names);
     Literal_free(insert->values);
-    free(insert);
+    chisql_free(insert);
 }
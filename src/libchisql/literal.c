@@ -1,9 +1,10 @@
+#include <inttypes.h>
 #include <chisql/chisql.h>
 
 
-Literal_t *litInt(int i)
+Literal_t *litInt(int64_t i)
 {
-    Literal_t *lval = (Literal_t *)calloc(1, sizeof(Literal_t));
+    Literal_t *lval = (Literal_t *)chisql_calloc(1, sizeof(Literal_t));
     lval->t = TYPE_INT;
     lval->val.ival = i;
     return lval;
@@ -11,7 +12,7 @@ Literal_t *litInt(int i)
 
 Literal_t *litDouble(double d)
 {
-    Literal_t *lval = (Literal_t *)calloc(1, sizeof(Literal_t));
+    Literal_t *lval = (Literal_t *)chisql_calloc(1, sizeof(Literal_t));
     lval->t = TYPE_DOUBLE;
     lval->val.dval = d;
     return lval;
@@ -19,7 +20,7 @@ Literal_t *litDouble(double d)
 
 Literal_t *litChar(char c)
 {
-    Literal_t *lval = (Literal_t *)calloc(1, sizeof(Literal_t));
+    Literal_t *lval = (Literal_t *)chisql_calloc(1, sizeof(Literal_t));
     lval->t = TYPE_CHAR;
     lval->val.cval = c;
     return lval;
@@ -27,7 +28,7 @@ Literal_t *litChar(char c)
 
 Literal_t *litText(char *str)
 {
-    Literal_t *lval = (Literal_t *)calloc(1, sizeof(Literal_t));
+    Literal_t *lval = (Literal_t *)chisql_calloc(1, sizeof(Literal_t));
     lval->t = TYPE_TEXT;
     lval->val.strval = str;
     return lval;
@@ -40,7 +41,7 @@ void Literal_print(Literal_t *val)
     switch (val->t)
     {
     case TYPE_INT:
-        printf("%d", val->val.ival);
+        printf("%" PRId64, val->val.ival);
         break;
     case TYPE_DOUBLE:
         printf("%f", val->val.dval);
@@ -85,8 +86,8 @@ Literal_t *Literal_append(Literal_t *lit1, Literal_t *lit2)
 void Literal_free(Literal_t *lval)
 {
     if (lval->t == TYPE_TEXT)
-        free(lval->val.strval);
-    free(lval);
+        chisql_free(lval->val.strval);
+    chisql_free(lval);
 }
 
 void Literal_freeList(Literal_t *lval)
@@ -96,6 +97,6 @@ void Literal_freeList(Literal_t *lval)
     {
         temp = lval;
         lval = lval->next;
-        free(temp);
+        chisql_free(temp);
     }
 }
@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <chidb/chidb.h>
 #include <chisql/chisql.h>
 #include "sql-lexer.h"
@@ -18,11 +19,15 @@ int num_stmts = 0;
 
 chisql_statement_t *__stmt;
 
+/* The parser and lexer keep their state in globals, so connections
+ * used from different threads take turns parsing */
+static pthread_mutex_t __parser_lock = PTHREAD_MUTEX_INITIALIZER;
+
 %}
 
 %union {
 	double dval;
-	int ival;
+	int64_t ival;
 	char *strval;
 	Literal_t *lval;
 	Constraint_t *constr;
@@ -52,7 +57,8 @@ chisql_statement_t *__stmt;
 %token VALUES AUTO_INCREMENT ASC DESC UNIQUE IN ON
 %token COUNT SUM AVG MIN MAX INTERSECT EXCEPT DISTINCT
 %token CONCAT TRUE FALSE CASE WHEN DECLARE BIT GROUP
-%token INDEX EXPLAIN
+%token INDEX EXPLAIN LIMIT OFFSET ANALYZE INCLUDE BLOOM FILTER
+%token TOKEN_BEGIN COMMIT ROLLBACK TRANSACTION
 %token <strval> IDENTIFIER
 %token <strval> STRING_LITERAL
 %token <dval> DOUBLE_LITERAL
@@ -60,9 +66,10 @@ chisql_statement_t *__stmt;
 
 %type <ival> column_type bool_op comp_op select_combo
 %type <ival> function_name opt_distinct join opt_unique
+%type <ival> opt_limit opt_offset transaction
 %type <strval> column_name table_name opt_alias 
-%type <strval> index_name column_name_or_star
-%type <slist> column_names_list opt_column_names
+%type <strval> index_name column_name_or_star analyze create_bloom
+%type <slist> column_names_list opt_column_names opt_include
 %type <constr> opt_constraints constraints constraint
 %type <lval> literal_value values_list in_statement
 %type <fkeyref> references_stmt
@@ -100,6 +107,9 @@ sql_line
 	| select 		{ __stmt->stmt.select = $1; __stmt->type = STMT_SELECT; }
 	| insert_into 	{ __stmt->stmt.insert = $1; __stmt->type = STMT_INSERT; }
 	| delete_from 	{ __stmt->stmt.delete = $1; __stmt->type = STMT_DELETE; }
+	| analyze 		{ __stmt->stmt.analyze = $1; __stmt->type = STMT_ANALYZE; }
+	| create_bloom	{ __stmt->stmt.bloom = $1; __stmt->type = STMT_BLOOM; }
+	| transaction 	{ __stmt->type = $1; }
 	| /* empty */
 	;
 
@@ -109,13 +119,18 @@ create
 	;
 
 create_index
-        : CREATE opt_unique INDEX index_name ON table_name '(' column_name ')'
+        : CREATE opt_unique INDEX index_name ON table_name '(' column_names_list ')' opt_include
 		{ 
-			$$ = Index_make($4, $6, $8); 
+			$$ = Index_make($4, $6, $8, $10); 
 		  	if ($2 == UNIQUE) $$ = Index_makeUnique($$); 
 		}
 	;
 
+opt_include
+	: INCLUDE '(' column_names_list ')' { $$ = $3; }
+	| /* empty */ { $$ = NULL; }
+	;
+
 opt_unique
 	: UNIQUE { $$ = UNIQUE; }
 	| /* empty */ { $$ = 0; }
@@ -228,7 +243,7 @@ select_combo
 	;
 
 select_statement
-	: SELECT opt_distinct expression_list FROM table opt_where_condition opt_options
+	: SELECT opt_distinct expression_list FROM table opt_where_condition opt_options opt_limit opt_offset
 		{
 			if ($6 != NULL) 
 				$$ = SRAProject(SRASelect($5, $6), $3);
@@ -238,6 +253,8 @@ select_statement
 				$$ = SRA_applyOption($$, $7); 
 			if ($2 == DISTINCT)
 				$$ = SRA_makeDistinct($$);
+			if ($8 >= 0 || $9 > 0)
+				$$ = SRA_applyLimit($$, $8, $9);
 		}
 	| '(' select_statement ')' { $$ = $2; }
 	;
@@ -247,6 +264,16 @@ opt_distinct
 	| /* empty */ { $$ = 0; }
 	;
 
+opt_limit
+	: LIMIT INT_LITERAL { $$ = $2; }
+	| /* empty */ { $$ = -1; }
+	;
+
+opt_offset
+	: OFFSET INT_LITERAL { $$ = $2; }
+	| /* empty */ { $$ = 0; }
+	;
+
 opt_options
 	: order_by {$$ = $1; }
 	| group_by {$$ = $1; }
@@ -372,7 +399,7 @@ function_name
 	;
 
 column_name_or_star
-	: '*' { $$ = strdup("*"); }
+	: '*' { $$ = chisql_strdup("*"); }
 	| column_name
 	;
 
@@ -484,6 +511,26 @@ delete_from
 		}
 	;
 
+analyze
+	: ANALYZE            { $$ = NULL; }
+	| ANALYZE table_name { $$ = $2; }
+	;
+
+create_bloom
+	: CREATE BLOOM FILTER ON table_name { $$ = $5; }
+	;
+
+transaction
+	: TOKEN_BEGIN opt_transaction { $$ = STMT_BEGIN; }
+	| COMMIT opt_transaction      { $$ = STMT_COMMIT; }
+	| ROLLBACK opt_transaction    { $$ = STMT_ROLLBACK; }
+	;
+
+opt_transaction
+	: /* empty */
+	| TRANSACTION
+	;
+
 %%
 
 void yyerror(const char *s) {
@@ -506,6 +553,21 @@ int chisql_stmt_print(chisql_statement_t *stmt)
     case STMT_DELETE:
         Delete_print(stmt->stmt.delete);
         break;
+    case STMT_ANALYZE:
+        printf("Analyze(%s)\n", stmt->stmt.analyze? stmt->stmt.analyze : "*");
+        break;
+    case STMT_BLOOM:
+        printf("Bloom(%s)\n", stmt->stmt.bloom);
+        break;
+    case STMT_BEGIN:
+        printf("Begin\n");
+        break;
+    case STMT_COMMIT:
+        printf("Commit\n");
+        break;
+    case STMT_ROLLBACK:
+        printf("Rollback\n");
+        break;
     }
 
     return 0;
@@ -515,9 +577,9 @@ int chisql_stmt_print(chisql_statement_t *stmt)
 char *__sql_semicolon(const char *sql)
 {
   int len = strlen(sql);
-  char *t = strdup(sql);
+  char *t = chisql_malloc(len+2); /* room for the semicolon */
+  memcpy(t, sql, len+1);
   if (t[len-1]!=';') {
-    t = realloc(t,len+2);
     t[len]=';';
     t[len+1]=0;
   }
@@ -528,7 +590,8 @@ int chisql_parser(const char *sql, chisql_statement_t **stmt)
 {
   int rc;
   
-  __stmt = malloc(sizeof(chisql_statement_t));
+  pthread_mutex_lock(&__parser_lock);
+  __stmt = chisql_malloc(sizeof(chisql_statement_t));
   char *tsql = __sql_semicolon(sql);
     
   YY_BUFFER_STATE my_string_buffer = yy_scan_string (tsql);
@@ -538,10 +601,12 @@ int chisql_parser(const char *sql, chisql_statement_t **stmt)
   if (rc == 0) {
     __stmt->text = tsql; /* strdup(sql); */
     *stmt = __stmt;
+    pthread_mutex_unlock(&__parser_lock);
     return CHIDB_OK;
   } else {
     fprintf(stderr,"invalid sql: \"%s\"\n", tsql);
-    free(__stmt);
+    chisql_free(__stmt);
+    pthread_mutex_unlock(&__parser_lock);
     return CHIDB_EINVALIDSQL;
   }
 
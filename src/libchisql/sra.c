@@ -5,7 +5,7 @@ static SRA_t *SRABinary(SRA_t *sra1, SRA_t *sra2, enum SRAType t);
 
 SRA_t *SRATable(TableReference_t *ref)
 {
-    SRA_t *sra = (SRA_t *)calloc(1, sizeof(SRA_t));
+    SRA_t *sra = (SRA_t *)chisql_calloc(1, sizeof(SRA_t));
     sra->t = SRA_TABLE;
     sra->table.ref = ref;
     return sra;
@@ -13,10 +13,11 @@ SRA_t *SRATable(TableReference_t *ref)
 
 SRA_t *SRAProject(SRA_t *sra, Expression_t *expr)
 {
-    SRA_t *new_sra = (SRA_t *)calloc(1, sizeof(SRA_t));
+    SRA_t *new_sra = (SRA_t *)chisql_calloc(1, sizeof(SRA_t));
     new_sra->t = SRA_PROJECT;
     new_sra->project.sra = sra;
     new_sra->project.expr_list = expr;
+    new_sra->project.limit = -1;
     return new_sra;
 }
 
@@ -28,7 +29,7 @@ SRA_t *SRASelect(SRA_t *sra, Condition_t *cond)
     }
     else
     {
-        SRA_t *new_sra = (SRA_t *)calloc(1, sizeof(SRA_t));
+        SRA_t *new_sra = (SRA_t *)chisql_calloc(1, sizeof(SRA_t));
         new_sra->t = SRA_SELECT;
         new_sra->select.sra = sra;
         new_sra->select.cond = cond;
@@ -38,7 +39,7 @@ SRA_t *SRASelect(SRA_t *sra, Condition_t *cond)
 
 SRA_t *SRAJoin(SRA_t *sra1, SRA_t *sra2, JoinCondition_t *cond)
 {
-    SRA_t *new_sra = (SRA_t *)calloc(1, sizeof(SRA_t));
+    SRA_t *new_sra = (SRA_t *)chisql_calloc(1, sizeof(SRA_t));
     new_sra->t = SRA_JOIN;
     new_sra->join.sra1 = sra1;
     new_sra->join.sra2 = sra2;
@@ -68,7 +69,7 @@ SRA_t *SRAFullOuterJoin(SRA_t *sra1, SRA_t *sra2, JoinCondition_t *cond)
 
 static SRA_t *SRABinary(SRA_t *sra1, SRA_t *sra2, enum SRAType t)
 {
-    SRA_t *sra = (SRA_t *)calloc(1, sizeof(SRA_t));
+    SRA_t *sra = (SRA_t *)chisql_calloc(1, sizeof(SRA_t));
     sra->t = t;
     sra->binary.sra1 = sra1;
     sra->binary.sra2 = sra2;
@@ -122,7 +123,9 @@ void SRA_print(SRA_t *sra)
         SRA_print(sra->project.sra);
         if (sra->project.distinct ||
                 sra->project.group_by ||
-                sra->project.order_by)
+                sra->project.order_by ||
+                sra->project.limit >= 0 ||
+                sra->project.offset > 0)
         {
             printf(",\n");
             indent_print("Options: ");
@@ -141,6 +144,10 @@ void SRA_print(SRA_t *sra)
                 printf(sra->project.asc_desc == ORDER_BY_ASC ? " a" : " de");
                 printf("scending");
             }
+            if (sra->project.limit >= 0)
+                printf(" Limit %d", sra->project.limit);
+            if (sra->project.offset > 0)
+                printf(" Offset %d", sra->project.offset);
         }
         downInd();
         indent_print(")");
@@ -267,12 +274,12 @@ void ProjectOption_free(ProjectOption_t *opt)
         Expression_free(opt->group_by);
     if (opt->order_by)
         Expression_free(opt->order_by);
-    free(opt);
+    chisql_free(opt);
 }
 
 ProjectOption_t *OrderBy_make(Expression_t *expr, enum OrderBy asc_desc)
 {
-    ProjectOption_t *ob = (ProjectOption_t *)calloc(1, sizeof(ProjectOption_t));
+    ProjectOption_t *ob = (ProjectOption_t *)chisql_calloc(1, sizeof(ProjectOption_t));
     ob->asc_desc = asc_desc;
     ob->order_by = expr;
     return ob;
@@ -280,7 +287,7 @@ ProjectOption_t *OrderBy_make(Expression_t *expr, enum OrderBy asc_desc)
 
 ProjectOption_t *GroupBy_make(Expression_t *expr)
 {
-    ProjectOption_t *gb = (ProjectOption_t *)calloc(1, sizeof(ProjectOption_t));
+    ProjectOption_t *gb = (ProjectOption_t *)chisql_calloc(1, sizeof(ProjectOption_t));
     gb->group_by = expr;
     return gb;
 }
@@ -327,9 +334,23 @@ SRA_t *SRA_makeDistinct(SRA_t *sra)
     return sra;
 }
 
+SRA_t *SRA_applyLimit(SRA_t *sra, int limit, int offset)
+{
+    if (sra->t != SRA_PROJECT)
+    {
+        fprintf(stderr, "Error: limit only applies to Project\n");
+    }
+    else
+    {
+        sra->project.limit = limit;
+        sra->project.offset = offset;
+    }
+    return sra;
+}
+
 JoinCondition_t *On(Condition_t *cond)
 {
-    JoinCondition_t *jc = (JoinCondition_t *)calloc(1, sizeof(JoinCondition_t));
+    JoinCondition_t *jc = (JoinCondition_t *)chisql_calloc(1, sizeof(JoinCondition_t));
     jc->t = JOIN_COND_ON;
     jc->on = cond;
     return jc;
@@ -337,7 +358,7 @@ JoinCondition_t *On(Condition_t *cond)
 
 JoinCondition_t *Using(StrList_t *col_list)
 {
-    JoinCondition_t *jc = (JoinCondition_t *)calloc(1, sizeof(JoinCondition_t));
+    JoinCondition_t *jc = (JoinCondition_t *)chisql_calloc(1, sizeof(JoinCondition_t));
     jc->t = JOIN_COND_USING;
     jc->col_list = col_list;
     return jc;
@@ -409,7 +430,7 @@ void SRA_free(SRA_t *sra)
         SRA_free(sra->binary.sra2);
         break;
     }
-    free(sra);
+    chisql_free(sra);
 }
 
 static RA_t *desugar_table(SRA_t *sra)
@@ -1,5 +1,6 @@
 #include <unistd.h>
 #include <string.h>
+#include <inttypes.h>
 #include <chidb/dbm-file.h>
 #include "shell.h"
 #include "commands.h"
@@ -144,12 +145,23 @@ int chidb_shell_handle_sql(chidb_shell_ctx_t *ctx, const char *sql)
                     printf("ERROR: Column %i return an invalid type.\n", coltype);
                     break;
                 }
-                else if(coltype == SQL_INTEGER_1BYTE || coltype == SQL_INTEGER_2BYTE || coltype == SQL_INTEGER_4BYTE)
+                else if(coltype == SQL_INTEGER_1BYTE || coltype == SQL_INTEGER_2BYTE || coltype == SQL_INTEGER_4BYTE ||
+                        coltype == SQL_INTEGER_8BYTE)
                 {
                     if(ctx->mode == MODE_LIST)
-                        printf("%i", chidb_column_int(stmt,i));
+                        printf("%" PRId64, chidb_column_int64(stmt,i));
                     else if (ctx->mode == MODE_COLUMN)
-                        printf("%10i", chidb_column_int(stmt,i));
+                        printf("%10" PRId64, chidb_column_int64(stmt,i));
+                }
+                else if(coltype == SQL_REAL)
+                {
+                    char real[32];
+
+                    chidb_real_str(real, sizeof(real), chidb_column_double(stmt,i));
+                    if(ctx->mode == MODE_LIST)
+                        printf("%s", real);
+                    else if (ctx->mode == MODE_COLUMN)
+                        printf("%10s", real);
                 }
                 else if(coltype == SQL_NULL)
                 {
@@ -27,6 +27,7 @@ TCase* make_btree_5_tc(void);
 TCase* make_btree_6_tc(void);
 TCase* make_btree_7_tc(void);
 TCase* make_btree_8_tc(void);
+TCase* make_btree_9_tc(void);
 
 
 
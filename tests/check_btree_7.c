@@ -1,7 +1,10 @@
 #include <stdlib.h>
+#include <pthread.h>
 #include <check.h>
 #include "check_btree.h"
 
+#define NWRITERS (4)
+
 START_TEST (test_7_1)
 {
     chidb *db;
@@ -70,12 +73,90 @@ START_TEST (test_7_3)
 END_TEST
 
 
+struct writer
+{
+    char *fname;
+    int n;
+    int rc;
+};
+
+/* Inserts every NWRITERS-th value of the big file, in a connection of
+ * its own that shares the write lock with the other writers */
+static void *concurrent_writer(void *arg)
+{
+    struct writer *w = arg;
+    chidb *db;
+    uint8_t buf[192];
+
+    db = malloc(sizeof(chidb));
+    db->busy_timeout = 60000;
+    w->rc = chidb_Btree_openShared(w->fname, db, &db->bt);
+    if (w->rc != CHIDB_OK)
+        return NULL;
+
+    w->rc = chidb_Btree_beginSharedWrite(db->bt);
+    for(int i=w->n; i<bigfile_nvalues && w->rc == CHIDB_OK; i+=NWRITERS)
+    {
+        for(int j=0; j<48; j++)
+            put4byte(buf + (4*j), bigfile_ikeys[i]);
+        w->rc = chidb_Btree_insertInTable(db->bt, 1, bigfile_pkeys[i], buf,
+                                          ((bigfile_pkeys[i] % 3) + 1) * 64);
+    }
+    if (db->bt->shared_writer)
+    {
+        int rc = chidb_Btree_endSharedWrite(db->bt, w->rc != CHIDB_OK);
+        if (w->rc == CHIDB_OK)
+            w->rc = rc;
+    }
+
+    chidb_Btree_close(db->bt);
+    free(db);
+
+    return NULL;
+}
+
+
+START_TEST (test_7_4)
+{
+    chidb *db;
+    int rc;
+    pthread_t threads[NWRITERS];
+    struct writer writers[NWRITERS];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    db->busy_timeout = 60000;
+    rc = chidb_Btree_openShared(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<NWRITERS; i++)
+    {
+        writers[i].fname = fname;
+        writers[i].n = i;
+        ck_assert(pthread_create(&threads[i], NULL, concurrent_writer, &writers[i]) == 0);
+    }
+    for(int i=0; i<NWRITERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        ck_assert(writers[i].rc == CHIDB_OK);
+    }
+
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
 TCase* make_btree_7_tc(void)
 {
     TCase *tc = tcase_create ("Step 7: Insertion with splitting");
     tcase_add_test (tc, test_7_1);
     tcase_add_test (tc, test_7_2);
     tcase_add_test (tc, test_7_3);
+    tcase_add_test (tc, test_7_4);
 
     return tc;
 }
@@ -2,6 +2,35 @@
 #include <check.h>
 #include "check_btree.h"
 
+/* Feeds the bigfile index entries to chidb_Btree_loadIndex in key order */
+struct index_load_src
+{
+    int *order;
+    int next;
+};
+
+static int index_load_cmp(const void *a, const void *b)
+{
+    chidb_key_t ka = bigfile_ikeys[*(const int *) a];
+    chidb_key_t kb = bigfile_ikeys[*(const int *) b];
+
+    return (ka > kb) - (ka < kb);
+}
+
+static int index_load_next(void *arg, BTreeCell *btc)
+{
+    struct index_load_src *src = arg;
+
+    if (src->next == bigfile_nvalues)
+        return CHIDB_DONE;
+
+    btc->key = bigfile_ikeys[src->order[src->next]];
+    btc->fields.indexLeaf.keyPk = bigfile_pkeys[src->order[src->next]];
+    src->next++;
+
+    return CHIDB_OK;
+}
+
 START_TEST (test_8_1)
 {
     chidb *db;
@@ -85,12 +114,48 @@ START_TEST (test_8_3)
 END_TEST
 
 
+START_TEST (test_8_4)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    struct index_load_src src;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    src.order = malloc(bigfile_nvalues * sizeof(int));
+    for(int i=0; i<bigfile_nvalues; i++)
+        src.order[i] = i;
+    qsort(src.order, bigfile_nvalues, sizeof(int), index_load_cmp);
+    src.next = 0;
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_loadIndex(db->bt, npage, index_load_next, &src);
+    ck_assert(rc == CHIDB_OK);
+
+    test_index_bigfile(db, npage);
+
+    free(src.order);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
 TCase* make_btree_8_tc(void)
 {
     TCase *tc = tcase_create ("Step 8: Supporting index B-Trees");
     tcase_add_test (tc, test_8_1);
     tcase_add_test (tc, test_8_2);
     tcase_add_test (tc, test_8_3);
+    tcase_add_test (tc, test_8_4);
 
     return tc;
 }
@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/index.h"
+
+#define VARINDEX_NVALUES (5000)
+
+/* The key of the i-th entry of the test index: a text value that shares
+ * most of its bytes with its neighbours, followed by the primary key */
+static uint16_t varindex_key(int i, uint8_t *key)
+{
+    char text[32];
+    uint16_t size = 0;
+
+    sprintf(text, "product-code-%05d", i);
+    ck_assert(chidb_Index_keyAppendText(key, &size, text, strlen(text)) == CHIDB_OK);
+    ck_assert(chidb_Index_keyAppendPk(key, &size, (chidb_key_t) i * 3) == CHIDB_OK);
+
+    return size;
+}
+
+/* Visits the entries of a variable-length index in order, checking that
+ * the n-th one is the n-th key */
+static void varindex_walk(BTree *bt, npage_t npage, int *n)
+{
+    uint8_t key[VARINDEX_MAXKEY];
+    uint16_t size;
+    BTreeNode *btn;
+    BTreeCell btc;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    ck_assert(btn->type == PGTYPE_VARINDEX_INTERNAL || btn->type == PGTYPE_VARINDEX_LEAF);
+
+    for(ncell_t i = 0; i < btn->n_cells; i++)
+    {
+        ck_assert(chidb_Btree_getCell(btn, i, &btc) == CHIDB_OK);
+        if (btn->type == PGTYPE_VARINDEX_INTERNAL)
+            varindex_walk(bt, btc.fields.varIndex.child_page, n);
+
+        size = varindex_key(*n, key);
+        ck_assert_int_eq(btc.fields.varIndex.key_size, size);
+        ck_assert(!memcmp(btc.fields.varIndex.key, key, size));
+        ck_assert_int_eq(btc.fields.varIndex.keyPk, (chidb_key_t) *n * 3);
+        (*n)++;
+    }
+    if (btn->type == PGTYPE_VARINDEX_INTERNAL)
+        varindex_walk(bt, btn->right_page, n);
+
+    chidb_Btree_freeMemNode(bt, btn);
+}
+
+/* Finds an entry by searching each node on the way down */
+static bool varindex_find(BTree *bt, npage_t nroot, const uint8_t *key, uint16_t size)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    ncell_t ncell;
+    npage_t child;
+    bool found = false;
+
+    while (!found)
+    {
+        ck_assert(chidb_Btree_getNodeByPage(bt, nroot, &btn) == CHIDB_OK);
+        ck_assert(chidb_Btree_varIndexSearch(btn, key, size, false, &ncell, &btc) == CHIDB_OK);
+
+        if (ncell < btn->n_cells && btc.fields.varIndex.key_size == size &&
+            !memcmp(btc.fields.varIndex.key, key, size))
+            found = true;
+        else if (btn->type == PGTYPE_VARINDEX_LEAF)
+        {
+            chidb_Btree_freeMemNode(bt, btn);
+            break;
+        }
+
+        child = (ncell == btn->n_cells) ? btn->right_page : btc.fields.varIndex.child_page;
+        chidb_Btree_freeMemNode(bt, btn);
+        nroot = child;
+    }
+
+    return found;
+}
+
+static void test_varindex(BTree *bt, npage_t nroot)
+{
+    uint8_t key[VARINDEX_MAXKEY];
+    uint16_t size;
+    int n = 0;
+
+    varindex_walk(bt, nroot, &n);
+    ck_assert_int_eq(n, VARINDEX_NVALUES);
+
+    for(int i = 0; i < VARINDEX_NVALUES; i += 7)
+    {
+        size = varindex_key(i, key);
+        ck_assert(varindex_find(bt, nroot, key, size));
+        ck_assert(chidb_Btree_insertInVarIndex(bt, nroot, key, size) == CHIDB_EDUPLICATE);
+    }
+}
+
+static void varindex_insert(BTree *bt, npage_t nroot, int i)
+{
+    uint8_t key[VARINDEX_MAXKEY];
+    uint16_t size = varindex_key(i, key);
+
+    ck_assert(chidb_Btree_insertInVarIndex(bt, nroot, key, size) == CHIDB_OK);
+}
+
+/* Feeds the test entries to chidb_Btree_loadIndex in key order */
+static int varindex_load_next(void *arg, BTreeCell *btc)
+{
+    int *next = arg;
+
+    if (*next == VARINDEX_NVALUES)
+        return CHIDB_DONE;
+
+    btc->fields.varIndex.key_size = varindex_key(*next, btc->fields.varIndex.key);
+    btc->fields.varIndex.keyPk = (chidb_key_t) *next * 3;
+    btc->key = btc->fields.varIndex.keyPk;
+    (*next)++;
+
+    return CHIDB_OK;
+}
+
+static void test_9(int order)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_VARINDEX_LEAF);
+    if (order == 0)
+        for(int i=0; i<VARINDEX_NVALUES; i++)
+            varindex_insert(db->bt, npage, i);
+    else if (order == 1)
+        for(int i=VARINDEX_NVALUES-1; i>=0; i--)
+            varindex_insert(db->bt, npage, i);
+    else if (order == 2)
+    {
+        // each key goes between two keys that share most of its bytes
+        for(int i=0; i<VARINDEX_NVALUES; i+=2)
+            varindex_insert(db->bt, npage, i);
+        for(int i=1; i<VARINDEX_NVALUES; i+=2)
+            varindex_insert(db->bt, npage, i);
+    }
+    else
+    {
+        int next = 0;
+        rc = chidb_Btree_loadIndex(db->bt, npage, varindex_load_next, &next);
+        ck_assert(rc == CHIDB_OK);
+    }
+
+    test_varindex(db->bt, npage);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+
+START_TEST (test_9_1)
+{
+    test_9(0);
+}
+END_TEST
+
+
+START_TEST (test_9_2)
+{
+    test_9(1);
+}
+END_TEST
+
+
+START_TEST (test_9_3)
+{
+    test_9(2);
+}
+END_TEST
+
+
+START_TEST (test_9_4)
+{
+    test_9(3);
+}
+END_TEST
+
+
+START_TEST (test_9_5)
+{
+    uint8_t key1[VARINDEX_MAXKEY], key2[VARINDEX_MAXKEY];
+    uint16_t size1 = 0, size2 = 0;
+
+    // keys sort like the values they encode
+    chidb_Index_keyAppendInt(key1, &size1, -5);
+    chidb_Index_keyAppendInt(key2, &size2, 3);
+    ck_assert(chidb_Btree_keyCmp(key1, size1, key2, size2) < 0);
+
+    size1 = size2 = 0;
+    chidb_Index_keyAppendReal(key1, &size1, -2.5);
+    chidb_Index_keyAppendReal(key2, &size2, -1.0);
+    ck_assert(chidb_Btree_keyCmp(key1, size1, key2, size2) < 0);
+
+    size1 = size2 = 0;
+    chidb_Index_keyAppendText(key1, &size1, "ab", 2);
+    chidb_Index_keyAppendText(key2, &size2, "abc", 3);
+    ck_assert(chidb_Btree_keyCmp(key1, size1, key2, size2) < 0);
+
+    // a key is equal to the longer keys that start with it
+    size1 = size2 = 0;
+    chidb_Index_keyAppendText(key1, &size1, "ab", 2);
+    chidb_Index_keyAppendText(key2, &size2, "ab", 2);
+    chidb_Index_keyAppendPk(key2, &size2, 42);
+    ck_assert(chidb_Btree_keyCmp(key1, size1, key2, size2) == 0);
+
+    // NULL sorts first
+    size1 = size2 = 0;
+    chidb_Index_keyAppendNull(key1, &size1);
+    chidb_Index_keyAppendInt(key2, &size2, INT64_MIN);
+    ck_assert(chidb_Btree_keyCmp(key1, size1, key2, size2) < 0);
+}
+END_TEST
+
+
+START_TEST (test_9_6)
+{
+    uint8_t key[VARINDEX_MAXKEY];
+    uint16_t size = 0, pos = 0, len;
+    chidb_index_field_t field;
+    char text[] = { 'a', 0, 'b' };
+
+    // a key with a field of each type reads back the same values
+    chidb_Index_keyAppendInt(key, &size, -7);
+    chidb_Index_keyAppendReal(key, &size, -0.25);
+    chidb_Index_keyAppendText(key, &size, text, sizeof(text));
+    chidb_Index_keyAppendNull(key, &size);
+    chidb_Index_keyAppendReal(key, &size, 1e10);
+    chidb_Index_keyAppendPk(key, &size, 42);
+
+    ck_assert(chidb_Index_keyNextField(key, size, &pos, &field) == CHIDB_OK);
+    ck_assert(field.tag == INDEX_KEY_INTEGER && field.i == -7);
+    ck_assert(chidb_Index_keyNextField(key, size, &pos, &field) == CHIDB_OK);
+    ck_assert(field.tag == INDEX_KEY_REAL && field.r == -0.25);
+    ck_assert(chidb_Index_keyNextField(key, size, &pos, &field) == CHIDB_OK);
+    ck_assert(field.tag == INDEX_KEY_TEXT && field.len == sizeof(text) && !memcmp(field.text, text, sizeof(text)));
+    ck_assert(chidb_Index_keyNextField(key, size, &pos, &field) == CHIDB_OK);
+    ck_assert(field.tag == INDEX_KEY_NULL);
+    ck_assert(chidb_Index_keyNextField(key, size, &pos, &field) == CHIDB_OK);
+    ck_assert(field.tag == INDEX_KEY_REAL && field.r == 1e10);
+
+    // the primary key is not a field
+    ck_assert(chidb_Index_keyNextField(key, size, &pos, &field) == CHIDB_ENOTFOUND);
+    ck_assert_int_eq(pos, size - VARINDEX_PKEY_SIZE);
+
+    // the first fields of a key, and whether one of them is NULL
+    ck_assert(chidb_Index_keyPrefix(key, size, 2, &len) == CHIDB_OK);
+    ck_assert_int_eq(len, 18);
+    ck_assert(chidb_Index_keyPrefix(key, size, 4, &len) == CHIDB_EEMPTY);
+    ck_assert(chidb_Index_keyPrefix(key, size, 10, &len) == CHIDB_EEMPTY);
+    ck_assert_int_eq(len, size - VARINDEX_PKEY_SIZE);
+}
+END_TEST
+
+
+TCase* make_btree_9_tc(void)
+{
+    TCase *tc = tcase_create ("Step 9: Variable-length index B-Trees");
+    tcase_add_test (tc, test_9_1);
+    tcase_add_test (tc, test_9_2);
+    tcase_add_test (tc, test_9_3);
+    tcase_add_test (tc, test_9_4);
+    tcase_add_test (tc, test_9_5);
+    tcase_add_test (tc, test_9_6);
+
+    return tc;
+}
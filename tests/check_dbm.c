@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <check.h>
 #include <dirent.h>
+#include <inttypes.h>
 #include <chidb/chidb.h>
 #include "libchidb/dbm.h"
 #include "libchidb/dbm-file.h"
@@ -63,9 +64,13 @@ START_TEST (test_dbm)
         {
             switch(expected->type)
             {
-            case REG_INT32:
+            case REG_INTEGER:
                 ck_assert_msg(expected->value.i == actual->value.i,
-                        "Expected register %i to have value %i but it has value %i", nReg, expected->value.i, actual->value.i);
+                        "Expected register %i to have value %" PRId64 " but it has value %" PRId64, nReg, expected->value.i, actual->value.i);
+                break;
+            case REG_REAL:
+                ck_assert_msg(expected->value.r == actual->value.r,
+                        "Expected register %i to have value %g but it has value %g", nReg, expected->value.r, actual->value.r);
                 break;
             case REG_STRING:
                 ck_assert_msg(strcmp(expected->value.s, actual->value.s) == 0,
@@ -8,6 +8,8 @@ char *str_values[] = {"foo", "bar", "foobar", "", "scrumptrulescent", "cromulent
 int8_t int8_values[] = {0,1,32,-32,64,-64,127,-128};
 int16_t int16_values[] = {0,1,1000,-1000,20000,-20000,32767,-32768};
 int32_t int32_values[] = {0,1,100000,-100000,2000000,-2000000,2147483647,-2147483648};
+int64_t int64_values[] = {0,1,2147483648LL,-2147483649LL,5000000000LL,-5000000000LL,INT64_MAX,INT64_MIN};
+double double_values[] = {0.0,1.0,-1.5,0.125,3.141592653589793,-2.5e-10,1e300,-1e300};
 
 START_TEST (test_string)
 {
@@ -80,6 +82,40 @@ START_TEST (test_int32)
 END_TEST
 
 
+START_TEST (test_int64)
+{
+    for(int i=0; i<NVALUES; i++)
+    {
+        DBRecord *dbr;
+        int64_t val;
+        chidb_DBRecord_create(&dbr, "|i8|", int64_values[i]);
+        ck_assert(dbr->nfields == 1);
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr, 0), SQL_INTEGER_8BYTE);
+        chidb_DBRecord_getInt64(dbr, 0, &val);
+        ck_assert(int64_values[i] == val);
+        chidb_DBRecord_destroy(dbr);
+    }
+}
+END_TEST
+
+
+START_TEST (test_double)
+{
+    for(int i=0; i<NVALUES; i++)
+    {
+        DBRecord *dbr;
+        double val;
+        chidb_DBRecord_create(&dbr, "|r|", double_values[i]);
+        ck_assert(dbr->nfields == 1);
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr, 0), SQL_REAL);
+        chidb_DBRecord_getDouble(dbr, 0, &val);
+        ck_assert(double_values[i] == val);
+        chidb_DBRecord_destroy(dbr);
+    }
+}
+END_TEST
+
+
 START_TEST (test_null)
 {
     DBRecord *dbr;
@@ -177,6 +213,50 @@ START_TEST (test_packunpack)
 END_TEST
 
 
+START_TEST (test_packinto_arena)
+{
+    Arena arena;
+    DBRecordBuffer dbrb;
+    DBRecord *dbr1, *dbr2;
+    char long_str[3000];
+    char *s;
+    int32_t i32;
+    uint8_t *buf;
+
+    memset(long_str, 'x', sizeof(long_str) - 1);
+    long_str[sizeof(long_str) - 1] = '\0';
+
+    chidb_Arena_init(&arena);
+    for(int i=0; i<NVALUES; i++)
+    {
+        /* Records larger than the initial record buffer have to grow it */
+        ck_assert(chidb_DBRecord_create_empty_arena(&dbrb, 3, &arena) == CHIDB_OK);
+        chidb_DBRecord_appendString(&dbrb, str_values[i]);
+        chidb_DBRecord_appendInt32(&dbrb, int32_values[i]);
+        chidb_DBRecord_appendString(&dbrb, long_str);
+        chidb_DBRecord_finalize(&dbrb, &dbr1);
+
+        buf = chidb_Arena_alloc(&arena, dbr1->packed_len);
+        chidb_DBRecord_packInto(dbr1, buf);
+        chidb_DBRecord_unpack(&dbr2, buf);
+
+        chidb_DBRecord_getString(dbr2, 0, &s);
+        ck_assert_str_eq(str_values[i], s);
+        free(s);
+        chidb_DBRecord_getInt32(dbr2, 1, &i32);
+        ck_assert_int_eq(int32_values[i], i32);
+        chidb_DBRecord_getString(dbr2, 2, &s);
+        ck_assert_str_eq(long_str, s);
+        free(s);
+
+        chidb_DBRecord_destroy(dbr2);
+        chidb_Arena_reset(&arena);
+    }
+    chidb_Arena_free(&arena);
+}
+END_TEST
+
+
 Suite* make_dbrecord_suite (void)
 {
     Suite *s = suite_create ("DB Record");
@@ -186,6 +266,8 @@ Suite* make_dbrecord_suite (void)
     tcase_add_test (tc_single, test_int8);
     tcase_add_test (tc_single, test_int16);
     tcase_add_test (tc_single, test_int32);
+    tcase_add_test (tc_single, test_int64);
+    tcase_add_test (tc_single, test_double);
     tcase_add_test (tc_single, test_null);
     suite_add_tcase (s, tc_single);
 
@@ -195,6 +277,7 @@ Suite* make_dbrecord_suite (void)
 
     TCase *tc_packunpack = tcase_create ("Packing/unpacking a record");
     tcase_add_test (tc_packunpack, test_packunpack);
+    tcase_add_test (tc_packunpack, test_packinto_arena);
     suite_add_tcase (s, tc_packunpack);
 
     return s;
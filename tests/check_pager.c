@@ -1,4 +1,7 @@
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <check.h>
 #include "check_common.h"
 #include "libchidb/pager.h"
@@ -44,6 +47,52 @@ uint8_t values[] = {237, 255, 57, 47, 157, 159, 21, 16, 168, 96, 0, 179, 225, 15
                     244, 183, 125, 38, 90, 158, 9, 222, 50, 163, 39, 193, 141, 238, 67, 247, 112, 60, 185
                    };
 
+static int aux_freed;
+
+/* Fill the first MAXPAGES pages (allocating them if needed) and commit */
+static int commit_pages(Pager *pg, int delta)
+{
+    npage_t npage;
+    MemPage *page;
+
+    while(pg->n_pages < MAXPAGES)
+        chidb_Pager_allocatePage(pg, &npage);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] + j + delta;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    return chidb_Pager_commit(pg);
+}
+
+static void check_pages(Pager *pg, int delta)
+{
+    MemPage *page;
+
+    ck_assert_int_eq(pg->n_pages, MAXPAGES);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != (uint8_t) (values[k] + j + delta))
+            {
+                ck_abort_msg("Incorrect value read from page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+}
+
+static void free_aux(void *aux)
+{
+    aux_freed++;
+    free(aux);
+}
+
 START_TEST (test_open)
 {
     int rc;
@@ -146,6 +195,442 @@ START_TEST (test_readwrite)
 END_TEST
 
 
+START_TEST (test_wal)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    struct stat st;
+    char *walname;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    walname = strdup(pg->wal_name);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] + j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* Committed pages go to the log, not to the database file */
+    rc = chidb_Pager_commit(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(pg->wal_ncommitted, MAXPAGES);
+    stat(fname, &st);
+    ck_assert_int_eq(st.st_size, 0);
+    stat(walname, &st);
+    ck_assert_int_eq(st.st_size, PAGER_WAL_HEADER_SIZE + MAXPAGES * (PAGER_WAL_FRAME_HEADER_SIZE + PAGE_SIZE));
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != (uint8_t) (values[k] + j))
+            {
+                ck_abort_msg("Incorrect value read from the log");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* A checkpoint copies the pages back into the database file */
+    rc = chidb_Pager_checkpoint(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(pg->wal_nframes, 0);
+    stat(fname, &st);
+    ck_assert_int_eq(st.st_size, MAXPAGES * PAGE_SIZE);
+
+    rc = chidb_Pager_close(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(access(walname, F_OK) != 0);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert_int_eq(pg->n_pages, MAXPAGES);
+    chidb_Pager_readPage(pg, MAXPAGES, &page);
+    ck_assert_int_eq(page->data[pagepos[0]], (uint8_t) (values[0] + MAXPAGES));
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_close(pg);
+
+    free(walname);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_snapshot)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    PagerSnapshot *snapshot;
+    MemPage *page;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        page->data[pagepos[0]] = j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_commit(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Pager_openSnapshot(pg, &snapshot);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Overwrite every page and add a new one */
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        page->data[pagepos[0]] = j + 100;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_allocatePage(pg, &npage);
+    chidb_Pager_readPage(pg, npage, &page);
+    chidb_Pager_writePage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+    rc = chidb_Pager_commit(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    /* The snapshot pins the log */
+    rc = chidb_Pager_checkpoint(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->wal_nframes > 0);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readSnapshotPage(pg, snapshot, j, &page);
+        ck_assert_int_eq(page->data[pagepos[0]], j);
+        chidb_Pager_releaseMemPage(pg, page);
+
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert_int_eq(page->data[pagepos[0]], j + 100);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_readSnapshotPage(pg, snapshot, MAXPAGES + 1, &page);
+    ck_assert(rc == CHIDB_EPAGENO);
+
+    rc = chidb_Pager_closeSnapshot(pg, snapshot);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Pager_checkpoint(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(pg->wal_nframes, 0);
+
+    chidb_Pager_readPage(pg, 1, &page);
+    ck_assert_int_eq(page->data[pagepos[0]], 101);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_shared)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg, *pg2;
+    MemPage *page;
+    int a, b;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_openShared(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    rc = chidb_Pager_openShared(&pg2, fname);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg == pg2);
+
+    /* More pages than fit in the buffer pool */
+    rc = chidb_Pager_lockWrite(pg, &a, 0);
+    ck_assert(rc == CHIDB_OK);
+    for(int j=1; j<=PAGER_CACHE_SIZE + MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        page->data[pagepos[0]] = j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_commit(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Only the owner gets the write lock */
+    rc = chidb_Pager_lockWrite(pg, &b, 0);
+    ck_assert(rc == CHIDB_EBUSY);
+    rc = chidb_Pager_lockWrite(pg, &a, 0);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Uncommitted writes are only seen by the owner */
+    chidb_Pager_readPage(pg, 1, &page);
+    page->data[pagepos[0]] = 100;
+    chidb_Pager_writePage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_changeSchema(pg);
+
+    for(int pass=0; pass<2; pass++)
+        for(int j=1; j<=PAGER_CACHE_SIZE + MAXPAGES; j++)
+        {
+            rc = chidb_Pager_readCommittedPage(pg, j, &page);
+            ck_assert(rc == CHIDB_OK);
+            ck_assert_int_eq(page->data[pagepos[0]], j & 0xFF);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+    ck_assert(pg->cache_size <= PAGER_CACHE_SIZE);
+
+    chidb_Pager_readPage(pg, 1, &page);
+    ck_assert_int_eq(page->data[pagepos[0]], 100);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    /* Rolled back schema changes leave the cookie alone */
+    rc = chidb_Pager_rollback(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(chidb_Pager_getSchemaCookie(pg), 0);
+    chidb_Pager_unlockWrite(pg, &a);
+
+    rc = chidb_Pager_lockWrite(pg, &b, 0);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_readPage(pg, 1, &page);
+    page->data[pagepos[0]] = 100;
+    chidb_Pager_writePage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_changeSchema(pg);
+    rc = chidb_Pager_commit(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(chidb_Pager_getSchemaCookie(pg), 1);
+    chidb_Pager_unlockWrite(pg, &b);
+
+    rc = chidb_Pager_readCommittedPage(pg2, 1, &page);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(page->data[pagepos[0]], 100);
+    chidb_Pager_releaseMemPage(pg2, page);
+
+    /* The pager is only closed by the last connection */
+    rc = chidb_Pager_close(pg2);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Pager_readCommittedPage(pg, 2, &page);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_releaseMemPage(pg, page);
+    rc = chidb_Pager_close(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_aux)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    int *aux;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        page->data[pagepos[0]] = j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_commit(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Committed pages come from the buffer pool, which keeps their aux */
+    chidb_Pager_readPage(pg, 1, &page);
+    ck_assert(page->buf != NULL);
+    ck_assert(page->aux == NULL);
+    aux = malloc(sizeof(int));
+    *aux = 1;
+    rc = chidb_Pager_setAux(pg, page, aux, free_aux);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(page->aux == aux);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    chidb_Pager_readPage(pg, 1, &page);
+    ck_assert(page->aux == aux);
+
+    /* A written page loses its aux, and so do the following reads */
+    page->data[pagepos[0]] = 100;
+    chidb_Pager_writePage(pg, page);
+    ck_assert(page->aux == NULL);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    chidb_Pager_readPage(pg, 1, &page);
+    ck_assert(page->buf == NULL);
+    ck_assert(page->aux == NULL);
+    aux = malloc(sizeof(int));
+    *aux = 1;
+    aux_freed = 0;
+    chidb_Pager_setAux(pg, page, aux, free_aux);
+    ck_assert(page->aux == NULL);
+    ck_assert_int_eq(aux_freed, 1);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    rc = chidb_Pager_commit(pg);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_readPage(pg, 1, &page);
+    ck_assert_int_eq(page->data[pagepos[0]], 100);
+    ck_assert(page->aux == NULL);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    /* The aux of the old version is freed along with its buffer */
+    aux_freed = 0;
+    rc = chidb_Pager_close(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(aux_freed, 1);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_durable)
+{
+    int rc, status;
+    Pager *pg;
+    pid_t pid;
+
+    /* Commits must survive the process dying right after they return,
+     * both when every commit syncs the log and when the background
+     * writer syncs it for a group of commits */
+    for(uint32_t ncommits=1; ncommits<=4; ncommits*=2)
+    {
+        char *fname = create_tmp_file();
+
+        pid = fork();
+        if(pid == 0)
+        {
+            if(chidb_Pager_open(&pg, fname) != CHIDB_OK)
+                _exit(1);
+            chidb_Pager_setPageSize(pg, PAGE_SIZE);
+            chidb_Pager_setGroupCommit(pg, ncommits);
+            for(int i=0; i<(int) ncommits; i++)
+                if(commit_pages(pg, i) != CHIDB_OK)
+                    _exit(1);
+            _exit(0);
+        }
+        ck_assert(pid > 0);
+        waitpid(pid, &status, 0);
+        ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+        /* The pages are recovered from the log */
+        rc = chidb_Pager_open(&pg, fname);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE);
+        ck_assert_int_eq(pg->wal_ncommitted, ncommits * MAXPAGES);
+        check_pages(pg, ncommits - 1);
+        rc = chidb_Pager_close(pg);
+        ck_assert(rc == CHIDB_OK);
+
+        delete_tmp_file(fname);
+    }
+}
+END_TEST
+
+
+START_TEST (test_writer)
+{
+    int rc, i;
+    Pager *pg;
+    MemPage *page;
+    uint8_t data[PAGE_SIZE];
+    struct stat st;
+    char *walname;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    walname = strdup(pg->wal_name);
+
+    /* Once enough frames are committed, the writer is handed a
+     * checkpoint, and copies the pages while commits go on */
+    for(i=0; pg->wal_ckpt_frame == 0; i++)
+    {
+        rc = commit_pages(pg, i);
+        ck_assert(rc == CHIDB_OK);
+    }
+    ck_assert(pg->writer_started);
+    ck_assert(pg->wal_ncommitted >= PAGER_WAL_AUTOCHECKPOINT);
+    rc = commit_pages(pg, i);
+    ck_assert(rc == CHIDB_OK);
+    check_pages(pg, i);
+
+    rc = chidb_Pager_checkpoint(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(pg->wal_nframes, 0);
+    ck_assert(pg->ckpt == NULL);
+
+    /* The database file now holds the latest version of every page */
+    FILE *f = fopen(fname, "rb");
+    ck_assert(f != NULL);
+    fseek(f, (MAXPAGES - 1) * PAGE_SIZE, SEEK_SET);
+    ck_assert_int_eq(fread(data, 1, PAGE_SIZE, f), PAGE_SIZE);
+    fclose(f);
+    ck_assert_int_eq(data[pagepos[0]], (uint8_t) (values[0] + MAXPAGES + i));
+
+    /* Commits that have the writer sync the log wait for it, and the
+     * writer is stopped cleanly when the pager is closed */
+    chidb_Pager_setGroupCommit(pg, 3);
+    for(int j=0; j<4; j++)
+    {
+        rc = commit_pages(pg, i + j);
+        ck_assert(rc == CHIDB_OK);
+    }
+    ck_assert(pg->sync_done == pg->sync_requested);
+    ck_assert(pg->sync_done > 0);
+    rc = chidb_Pager_close(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(access(walname, F_OK) != 0);
+    stat(fname, &st);
+    ck_assert_int_eq(st.st_size, MAXPAGES * PAGE_SIZE);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    check_pages(pg, i + 3);
+    chidb_Pager_readPage(pg, 1, &page);
+    chidb_Pager_releaseMemPage(pg, page);
+    rc = chidb_Pager_close(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    free(walname);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
 Suite* make_pager_suite (void)
 {
     Suite *s = suite_create ("Pager");
@@ -162,6 +647,27 @@ Suite* make_pager_suite (void)
     tcase_add_test (tc_readwrite, test_readwrite);
     suite_add_tcase (s, tc_readwrite);
 
+    TCase *tc_wal = tcase_create ("Write-ahead log");
+    tcase_add_test (tc_wal, test_wal);
+    suite_add_tcase (s, tc_wal);
+
+    TCase *tc_snapshot = tcase_create ("Read snapshots");
+    tcase_add_test (tc_snapshot, test_snapshot);
+    suite_add_tcase (s, tc_snapshot);
+
+    TCase *tc_shared = tcase_create ("Shared pager");
+    tcase_add_test (tc_shared, test_shared);
+    suite_add_tcase (s, tc_shared);
+
+    TCase *tc_aux = tcase_create ("Decoded pages");
+    tcase_add_test (tc_aux, test_aux);
+    suite_add_tcase (s, tc_aux);
+
+    TCase *tc_writer = tcase_create ("Background writer");
+    tcase_add_test (tc_writer, test_durable);
+    tcase_add_test (tc_writer, test_writer);
+    suite_add_tcase (s, tc_writer);
+
     return s;
 }
 
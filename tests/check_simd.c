@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+
+/* The kernels are static, so they are tested by including their source */
+#include "libchidb/btree-simd.c"
+
+#define MAXKEYS (33)
+#define NARRAYS (200)
+
+typedef struct kernel
+{
+    const char *name;
+    chidb_Btree_simd_keyRank_t rank;
+    bool supported;
+} kernel_t;
+
+static uint64_t rand_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t next_rand(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static int cmp_keys(const void *a, const void *b)
+{
+    chidb_key_t ka = *(const chidb_key_t *) a, kb = *(const chidb_key_t *) b;
+
+    return (ka > kb) - (ka < kb);
+}
+
+/* Keys drawn from a small pool (so that arrays have duplicates) around
+ * 0, 2^63 and UINT64_MAX, or from the whole range */
+static chidb_key_t random_key(int pool)
+{
+    static const chidb_key_t bases[] = {0, BTREE_SIMD_SIGN - 4, UINT64_MAX - 8};
+    uint64_t r = next_rand();
+
+    if (pool == 3)
+        return r;
+    return bases[pool] + r % 9;
+}
+
+/* The position of the first key past key, counted the obvious way */
+static ncell_t reference_rank(const chidb_key_t *keys, ncell_t n, chidb_key_t key, bool after)
+{
+    ncell_t rank = 0;
+
+    for(ncell_t i = 0; i < n; i++)
+        if (keys[i] < key || (after && keys[i] == key))
+            rank++;
+
+    return rank;
+}
+
+static void check_kernel(kernel_t *k, const chidb_key_t *keys, ncell_t n, chidb_key_t key)
+{
+    for(int after = 0; after <= 1; after++)
+    {
+        ncell_t expected = reference_rank(keys, n, key, after);
+        ncell_t actual = k->rank(keys, n, key, after);
+
+        ck_assert_msg(actual == expected,
+                      "%s kernel: rank of %llu among %u keys (after=%d) is %u, expected %u",
+                      k->name, (unsigned long long) key, n, after, actual, expected);
+    }
+}
+
+START_TEST (test_kernels)
+{
+#ifdef BTREE_SIMD_X86
+    __builtin_cpu_init();
+#endif
+    kernel_t kernels[] = {
+        {"scalar", __chidb_Btree_simd_keyRankC, true},
+#ifdef BTREE_SIMD_X86
+        {"SSE4.2", __chidb_Btree_simd_keyRankSSE42, __builtin_cpu_supports("sse4.2")},
+        {"AVX2", __chidb_Btree_simd_keyRankAVX2, __builtin_cpu_supports("avx2")},
+#endif
+    };
+    int nkernels = sizeof(kernels) / sizeof(kernel_t);
+    chidb_key_t extremes[] = {0, 1, BTREE_SIMD_SIGN - 1, BTREE_SIMD_SIGN, BTREE_SIMD_SIGN + 1, UINT64_MAX};
+
+    for(int k = 0; k < nkernels; k++)
+    {
+        if (!kernels[k].supported)
+            continue;
+
+        for(ncell_t n = 0; n <= MAXKEYS; n++)
+            for(int a = 0; a < NARRAYS; a++)
+            {
+                /* Exactly n keys, so that reading past them is caught
+                 * by memory checkers */
+                chidb_key_t *keys = malloc((n > 0 ? n : 1) * sizeof(chidb_key_t));
+                int pool = a % 4;
+
+                for(ncell_t i = 0; i < n; i++)
+                    keys[i] = random_key(pool);
+                qsort(keys, n, sizeof(chidb_key_t), cmp_keys);
+
+                /* Every key in the array, its neighbours, and the extremes */
+                for(ncell_t i = 0; i < n; i++)
+                {
+                    check_kernel(&kernels[k], keys, n, keys[i]);
+                    check_kernel(&kernels[k], keys, n, keys[i] - 1);
+                    check_kernel(&kernels[k], keys, n, keys[i] + 1);
+                }
+                for(int i = 0; i < sizeof(extremes) / sizeof(chidb_key_t); i++)
+                    check_kernel(&kernels[k], keys, n, extremes[i]);
+                check_kernel(&kernels[k], keys, n, random_key(pool));
+
+                free(keys);
+            }
+    }
+}
+END_TEST
+
+
+START_TEST (test_dispatch)
+{
+    chidb_key_t keys[MAXKEYS];
+
+    for(ncell_t i = 0; i < MAXKEYS; i++)
+        keys[i] = BTREE_SIMD_SIGN + i / 2;
+
+    /* Whichever kernel is chosen */
+    ck_assert_int_eq(chidb_Btree_simd_keyRank(keys, MAXKEYS, BTREE_SIMD_SIGN + 3, false), 6);
+    ck_assert_int_eq(chidb_Btree_simd_keyRank(keys, MAXKEYS, BTREE_SIMD_SIGN + 3, true), 8);
+    ck_assert_int_eq(chidb_Btree_simd_keyRank(keys, MAXKEYS, UINT64_MAX, false), MAXKEYS);
+    ck_assert_int_eq(chidb_Btree_simd_keyRank(keys, MAXKEYS, 0, true), 0);
+}
+END_TEST
+
+
+Suite* make_simd_suite (void)
+{
+    Suite *s = suite_create ("B-Tree SIMD kernels");
+
+    TCase *tc_kernels = tcase_create ("Key rank kernels");
+    tcase_add_test (tc_kernels, test_kernels);
+    tcase_add_test (tc_kernels, test_dispatch);
+    suite_add_tcase (s, tc_kernels);
+
+    return s;
+}
+
+int main (void)
+{
+    SRunner *sr;
+    int number_failed;
+
+    sr = srunner_create (make_simd_suite ());
+
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
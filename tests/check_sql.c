@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <check.h>
+#include <chidb/chidb.h>
+#include "libchidb/dbm.h"
+#include "libchidb/dbm-parallel.h"
+#include "check_common.h"
+
+#define NROWS (3000)
+#define NSCANROWS (20000)
+#define NSCANTHREADS (4)
+
+/* Runs a statement that produces no rows */
+static void exec_sql(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+
+    ck_assert_msg(chidb_prepare(db, sql, &stmt) == CHIDB_OK, "Could not prepare %s", sql);
+    ck_assert_msg(chidb_step(stmt) == CHIDB_DONE, "Could not run %s", sql);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+/* Runs a statement producing a single integer */
+static int64_t query_int(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+    int64_t value;
+
+    ck_assert_msg(chidb_prepare(db, sql, &stmt) == CHIDB_OK, "Could not prepare %s", sql);
+    ck_assert_msg(chidb_step(stmt) == CHIDB_ROW, "No row produced by %s", sql);
+    value = chidb_column_int64(stmt, 0);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    return value;
+}
+
+/* Creates t(id, a, b) with an index on each of a and b (and one on both),
+ * and then inserts NROWS rows into it */
+static chidb *create_indexed_table(char *fname)
+{
+    char sql[128];
+    chidb *db;
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, a INTEGER, b TEXT);");
+    exec_sql(db, "CREATE INDEX ia ON t(a);");
+    exec_sql(db, "CREATE INDEX ib ON t(b);");
+    exec_sql(db, "CREATE INDEX iab ON t(a, b);");
+
+    exec_sql(db, "BEGIN;");
+    for(int i = 1; i <= NROWS; i++)
+    {
+        sprintf(sql, "INSERT INTO t VALUES(%d, %d, 'key%05d');", i, i % 7, 90 + i % 31);
+        exec_sql(db, sql);
+    }
+    exec_sql(db, "COMMIT;");
+
+    return db;
+}
+
+START_TEST (test_insert_index)
+{
+    char *fname = create_tmp_file();
+    chidb *db = create_indexed_table(fname);
+
+    /* Once ANALYZE has found them to be selective, the indexes are used
+     * to find the rows, so they have to hold the ones inserted after
+     * they were created */
+    exec_sql(db, "ANALYZE;");
+    ck_assert_int_eq(query_int(db, "SELECT COUNT(*) FROM t WHERE b = 'key00098';"), (NROWS - 8) / 31 + 1);
+    ck_assert_int_eq(query_int(db, "SELECT COUNT(*) FROM t WHERE a = 3;"), (NROWS - 3) / 7 + 1);
+    ck_assert_int_eq(query_int(db, "SELECT COUNT(*) FROM t WHERE b = 'key00000';"), 0);
+
+    exec_sql(db, "INSERT INTO t VALUES(5000, 3, 'key00000');");
+    ck_assert_int_eq(query_int(db, "SELECT id FROM t WHERE b = 'key00000';"), 5000);
+    ck_assert_int_eq(query_int(db, "SELECT COUNT(*) FROM t WHERE a = 3;"), (NROWS - 3) / 7 + 2);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Creates t(id, a, b), large enough for its B-Tree to have at least
+ * DBM_PARALLEL_MIN_SUBTREES subtrees in its first two levels */
+static chidb *create_scan_table(char *fname)
+{
+    char sql[128];
+    chidb *db;
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, a INTEGER, b TEXT);");
+
+    exec_sql(db, "BEGIN;");
+    for(int i = 1; i <= NSCANROWS; i++)
+    {
+        sprintf(sql, "INSERT INTO t VALUES(%d, %d, 'val%05d');", i, i % 13, (i * 7919) % NSCANROWS);
+        exec_sql(db, sql);
+    }
+    exec_sql(db, "COMMIT;");
+
+    return db;
+}
+
+/* Runs a query with the given number of scan threads, and returns its
+ * rows (in order) as a single string. nworkers is set to the number of
+ * workers seen scanning the table while rows were produced (which can
+ * only be seen for rows produced by the scan loop itself). */
+static char *query_rows(chidb *db, const char *sql, int nthreads, uint32_t *nrows, uint32_t *nworkers)
+{
+    chidb_stmt *stmt;
+    size_t len = 0, size = 4096;
+    char *rows = malloc(size);
+    int rc;
+
+    *rows = '\0';
+    *nrows = *nworkers = 0;
+    ck_assert(chidb_scan_threads(db, nthreads) == CHIDB_OK);
+    ck_assert_msg(chidb_prepare(db, sql, &stmt) == CHIDB_OK, "Could not prepare %s", sql);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        if(stmt->par != NULL && stmt->par->nworkers > *nworkers)
+            *nworkers = stmt->par->nworkers;
+        for(int i = 0; i < chidb_column_count(stmt); i++)
+        {
+            const char *text = NULL;
+            char num[32];
+
+            if(chidb_column_type(stmt, i) >= SQL_TEXT)
+                text = chidb_column_text(stmt, i);
+            else
+            {
+                sprintf(num, "%" PRId64, chidb_column_int64(stmt, i));
+                text = num;
+            }
+            while(len + strlen(text) + 2 > size)
+                rows = realloc(rows, size *= 2);
+            len += sprintf(rows + len, "%s%c", text, i + 1 < chidb_column_count(stmt) ? ' ' : '\n');
+        }
+        (*nrows)++;
+    }
+    ck_assert_msg(rc == CHIDB_DONE, "Error while running %s", sql);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    return rows;
+}
+
+START_TEST (test_parallel_scan)
+{
+    const char *queries[] = {
+        "SELECT id, b FROM t WHERE a = 5;",
+        "SELECT a, COUNT(*) FROM t GROUP BY a;",
+        "SELECT b, id FROM t WHERE a < 3 ORDER BY b;",
+    };
+    char *fname = create_tmp_file();
+    chidb *db;
+    char *rows, *expected;
+    uint32_t nrows, nexpected, nworkers;
+    int64_t last;
+
+    db = create_scan_table(fname);
+
+    /* The workers' rows come out exactly as a sequential scan's */
+    for(int q = 0; q < 3; q++)
+    {
+        expected = query_rows(db, queries[q], 1, &nexpected, &nworkers);
+        ck_assert_int_eq(nworkers, 0);
+        rows = query_rows(db, queries[q], NSCANTHREADS, &nrows, &nworkers);
+        ck_assert_int_eq(nrows, nexpected);
+        ck_assert_msg(strcmp(rows, expected) == 0, "%s produced different rows in parallel", queries[q]);
+
+        if(q == 0)
+        {
+            /* Filtered rows are produced in key order, while the
+             * workers scan the rest of the table */
+            ck_assert_int_eq(nworkers, NSCANTHREADS - 1);
+            ck_assert_int_eq(nrows, (NSCANROWS - 5) / 13 + 1);
+            last = 0;
+            for(char *row = rows; *row; row = strchr(row, '\n') + 1)
+            {
+                int64_t id = strtoll(row, NULL, 10);
+                ck_assert_msg(id > last && id % 13 == 5, "Row with key %" PRId64 " out of place", id);
+                last = id;
+            }
+        }
+        else if(q == 1)
+            ck_assert_int_eq(nrows, 13);
+        else
+        {
+            ck_assert_int_eq(nrows, NSCANROWS / 13 * 3 + 2);
+            for(char *row = rows, *next; *(next = strchr(row, '\n') + 1); row = next)
+                ck_assert_msg(strncmp(row, next, 8) <= 0, "Rows not sorted");
+        }
+
+        free(rows);
+        free(expected);
+    }
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+Suite* make_sql_suite (void)
+{
+    Suite *s = suite_create ("SQL");
+
+    TCase *tc_index = tcase_create ("Indexes");
+    tcase_add_test (tc_index, test_insert_index);
+    suite_add_tcase (s, tc_index);
+
+    TCase *tc_parallel = tcase_create ("Parallel scans");
+    tcase_add_test (tc_parallel, test_parallel_scan);
+    suite_add_tcase (s, tc_parallel);
+
+    return s;
+}
+
+int main (void)
+{
+    SRunner *sr;
+    int number_failed;
+
+    sr = srunner_create (make_sql_suite ());
+
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
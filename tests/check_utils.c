@@ -7,6 +7,9 @@
 uint16_t uint16_values[] = {0,1,128,255,256,32767,32768,65535};
 uint32_t uint32_values[] = {0,255,256,32767,32768,65535,65536,4294967295};
 uint32_t varint32_values[] = {0,255,256,32767,32768,65535,65536,268435455};
+int varint32_lengths[] = {1,2,2,3,3,3,3,4};
+uint64_t varint64_values[] = {0,127,128,16383,16384,4294967295ULL,72057594037927935ULL,18446744073709551615ULL};
+int varint64_lengths[] = {1,1,2,2,3,5,8,9};
 
 START_TEST (test_getput2byte)
 {
@@ -42,13 +45,14 @@ END_TEST
 
 START_TEST (test_varint32)
 {
-    uint8_t buf[4];
+    uint8_t buf[5];
 
     for(int i=0; i<NVALUES; i++)
     {
         uint32_t val;
-        putVarint32(buf, varint32_values[i]);
-        getVarint32(buf, &val);
+        ck_assert_int_eq(putVarint32(buf, varint32_values[i]), varint32_lengths[i]);
+        ck_assert_int_eq(varintLen32(varint32_values[i]), varint32_lengths[i]);
+        ck_assert_int_eq(getVarint32(buf, &val), varint32_lengths[i]);
 
         ck_assert_int_eq(val, varint32_values[i]);
     }
@@ -56,6 +60,40 @@ START_TEST (test_varint32)
 END_TEST
 
 
+START_TEST (test_varint64)
+{
+    uint8_t buf[9];
+
+    for(int i=0; i<NVALUES; i++)
+    {
+        uint64_t val;
+        ck_assert_int_eq(putVarint64(buf, varint64_values[i]), varint64_lengths[i]);
+        ck_assert_int_eq(varintLen64(varint64_values[i]), varint64_lengths[i]);
+        ck_assert_int_eq(getVarint64(buf, &val), varint64_lengths[i]);
+
+        ck_assert(val == varint64_values[i]);
+    }
+}
+END_TEST
+
+
+/* Varints padded to four bytes, as older files have them */
+START_TEST (test_varint32_padded)
+{
+    uint8_t buf[4] = {0x80, 0x80, 0x80, 0x05};
+    uint32_t val;
+
+    ck_assert_int_eq(getVarint32(buf, &val), 4);
+    ck_assert_int_eq(val, 5);
+
+    buf[2] = 0x81;
+    buf[3] = 0x0D;
+    ck_assert_int_eq(getVarint32(buf, &val), 4);
+    ck_assert_int_eq(val, 141);
+}
+END_TEST
+
+
 Suite* make_utils_suite (void)
 {
     Suite *s = suite_create ("Utils");
@@ -64,6 +102,8 @@ Suite* make_utils_suite (void)
     tcase_add_test (tc_integer, test_getput2byte);
     tcase_add_test (tc_integer, test_getput4byte);
     tcase_add_test (tc_integer, test_varint32);
+    tcase_add_test (tc_integer, test_varint64);
+    tcase_add_test (tc_integer, test_varint32_padded);
     suite_add_tcase (s, tc_integer);
 
     return s;